@@ -218,7 +218,7 @@ Only used if useRMSfilt == true.  Describes the function for RMS filtering.  Tra
         /* read data from files, do collapsing if data supports it, write
          * output */
 
-        populateDetVectorFromFile(detsFile, detections);
+        populateDetVectorFromFile(detsFileName, detections);
         populatePairsVectorFromFile(pairsFile, pairs);
         
         double dif = lsst::mops::timeElapsed(start);
@@ -0,0 +1,69 @@
+// -*- LSST-C++ -*-
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <getopt.h>
+
+#include "lsst/mops/common.h"
+#include "lsst/mops/DetectionStore.h"
+
+
+
+/*****************************************************************
+ * convert a text detections file (one detection per line, as read by
+ * MopsDetection::fromString) to a binary detection store, which
+ * findTracklets, collapseTracklets and linkTracklets read much faster.
+ *****************************************************************/
+int main(int argc, char* argv[])
+{
+    time_t start = time(NULL);
+    std::string USAGE("Usage: convertDetections -i <text dets file> -o <detection store> [-e <astrometric error, degrees>]");
+
+    std::string outFileName;
+    std::string inFileName;
+    double astromErr = 0.0;
+
+    static const struct option longOpts[] = {
+        { "inFile", required_argument, NULL, 'i' },
+        { "outFile", required_argument, NULL, 'o' },
+        { "astromErr", required_argument, NULL, 'e' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, no_argument, NULL, 0 }
+    };
+
+    int longIndex = -1;
+    const char *optString = "i:o:e:h";
+    int opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    while( opt != -1 ) {
+        switch( opt ) {
+        case 'i':
+            inFileName = optarg;
+            break;
+        case 'o':
+            outFileName = optarg;
+            break;
+        case 'e':
+            astromErr = atof(optarg);
+            break;
+        case 'h':
+            std::cout << USAGE << std::endl;
+            exit(0);
+        default:
+            break;
+        }
+        opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
+    }
+
+    if ((inFileName == "") || (outFileName == "")) {
+        std::cout << USAGE << std::endl;
+        exit(1);
+    }
+
+    lsst::mops::convertDetectionFileToStore(inFileName, outFileName, astromErr);
+
+    double dif = lsst::mops::timeElapsed(start);
+    std::cout << "Conversion took " << std::fixed << std::setprecision(10)
+              <<  dif  << " seconds." <<std::endl;
+    return 0;
+}
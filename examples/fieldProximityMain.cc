@@ -13,6 +13,8 @@
 
 #include "lsst/mops/daymops/fieldProximity/fieldProximity.h"
 #include "lsst/mops/daymops/fieldProximity/TrackForFieldProximity.h"
+#include "lsst/mops/ChunkedTextReader.h"
+#include "lsst/mops/Exceptions.h"
 
 #define uint unsigned int
 
@@ -51,34 +53,23 @@ void debugPrintFields(const std::vector<Field> &allFields)
 
 void populateFieldsVec(std::string fieldsFileName, std::vector<Field> &queryFields)
 {
-    std::string line;
-    std::ifstream fieldsFile;
-    fieldsFile.open(fieldsFileName.c_str());
-    if (!fieldsFile.is_open()) {
-         throw LSST_EXCEPT(FileException,
-                           "Failed to open fields file " 
-                           + fieldsFileName + " - does this file exist?\n");
-     }
-
-    std::getline(fieldsFile, line);
-    while (fieldsFile.fail() == false) {
+    // one field per line: fieldId MJD RA Dec radius
+    auto parseField = [](const char *pos, const char *end,
+                         unsigned long,
+                         std::vector<Field> &fields) {
          uint tmpFieldId;
          double tmpExpMjd;
          double tmpRa;
          double tmpDec;
          double tmpRadius;
-         std::istringstream ss(line);
-         ss.exceptions(std::ifstream::failbit | std::ifstream::badbit);    
-         ss >> tmpFieldId;
-         ss >> std::ws;
-         ss >> tmpExpMjd;
-         ss >> std::ws;
-         ss >> tmpRa;
-         ss >> std::ws;
-         ss >> tmpDec;
-         ss >> std::ws;
-         ss >> tmpRadius;
-         ss >> std::ws;
+         if (!(parseNextValue(pos, end, tmpFieldId) &&
+               parseNextValue(pos, end, tmpExpMjd) &&
+               parseNextValue(pos, end, tmpRa) &&
+               parseNextValue(pos, end, tmpDec) &&
+               parseNextValue(pos, end, tmpRadius))) {
+              throw LSST_EXCEPT(InputFileFormatErrorException,
+                                "Improperly-formatted fields file.\n");
+         }
 
          Field tmpField;
          tmpField.setFieldID(tmpFieldId);
@@ -87,10 +78,10 @@ void populateFieldsVec(std::string fieldsFileName, std::vector<Field> &queryFiel
          tmpField.setDec(tmpDec);
          tmpField.setRadius(tmpRadius);
 
-         queryFields.push_back(tmpField);
-         std::getline(fieldsFile, line);
-     }
-    
+         fields.push_back(tmpField);
+    };
+    ChunkedTextReader reader(fieldsFileName, "fields");
+    reader.parseLines(parseField, queryFields);
 }
 
 
@@ -125,39 +116,37 @@ void buildTrackVector(std::string tracksFileName,
      * allTracks vector.  This is needed because not all points in a
      * track are contiguous in the file, so we need to do lookups. */
     std::map<uint, uint> trackMap; 
-    std::string line;
-    std::ifstream tracksFile;
-    tracksFile.open(tracksFileName.c_str());
-     if (!tracksFile.is_open()) {
-         throw LSST_EXCEPT(FileException,
-                           "Failed to open tracks file " 
-                           + tracksFileName + " - does this file exist?\n");
-     }
 
-     std::getline(tracksFile, line);
-     while (tracksFile.fail() == false) {
-         std::istringstream ss(line);
-         ss.exceptions(std::ifstream::failbit | std::ifstream::badbit);    
+    // one point per line: trackId MJD RA Dec.  Read them all, then sort
+    // them into tracks.
+    typedef std::pair<uint, FieldProximityPoint> IdAndPoint;
+    auto parsePoint = [](const char *pos, const char *end,
+                         unsigned long,
+                         std::vector<IdAndPoint> &points) {
          unsigned int tmpId;
          double tmpMjd;
          double tmpRa;
          double tmpDec;
+         if (!(parseNextValue(pos, end, tmpId) &&
+               parseNextValue(pos, end, tmpMjd) &&
+               parseNextValue(pos, end, tmpRa) &&
+               parseNextValue(pos, end, tmpDec))) {
+              throw LSST_EXCEPT(InputFileFormatErrorException,
+                                "Improperly-formatted tracks file.\n");
+         }
          FieldProximityPoint tmpPoint;
-         ss >> tmpId;
-         ss >> std::ws;
-         ss >> tmpMjd;
-         ss >> std::ws;
-         ss >> tmpRa;
-         ss >> std::ws;
-         ss >> tmpDec;
-         ss >> std::ws;
          tmpPoint.setRA(tmpRa);
          tmpPoint.setDec(tmpDec);
          tmpPoint.setEpochMJD(tmpMjd);
-         
-         addPoint(tmpId, tmpPoint, allTracks, trackMap);
-         std::getline(tracksFile, line);
-     }
+         points.push_back(IdAndPoint(tmpId, tmpPoint));
+    };
+    std::vector<IdAndPoint> allPoints;
+    ChunkedTextReader reader(tracksFileName, "tracks");
+    reader.parseLines(parsePoint, allPoints);
+
+    for (uint i = 0; i < allPoints.size(); i++) {
+         addPoint(allPoints[i].first, allPoints[i].second, allTracks, trackMap);
+    }
 }
 
 void writeFieldMatches(
@@ -37,9 +37,12 @@ int main(int argc, char* argv[])
 
     double maxVelocity = 2.0;
     double minVelocity = 0.0;
+    unsigned int nThreads = 1;
+    bool dualTreeSearch = false;
+    bool unitVectorSearch = false;
 
     if(argc < 2){
-        std::cout << "Usage: findTracklets -i <input file> -o <output file> [-v <max velocity>] [-m <min velocity>]" << std::endl;
+        std::cout << "Usage: findTracklets -i <input file> -o <output file> [-v <max velocity>] [-m <min velocity>] [-j <threads>] [-d | -u]" << std::endl;
         exit(1);
     }
 
@@ -48,13 +51,16 @@ int main(int argc, char* argv[])
         { "outFile", required_argument, NULL, 'o' },
         { "maxVeloctiy", required_argument, NULL, 'v' },
         { "minVeloctiy", optional_argument, NULL, 'm' },
+        { "nThreads", required_argument, NULL, 'j' },
+        { "dualTreeSearch", no_argument, NULL, 'd' },
+        { "unitVectorSearch", no_argument, NULL, 'u' },
         { "help", no_argument, NULL, 'h' },
         { NULL, no_argument, NULL, 0 }
     };
 
 
     int longIndex = -1;
-    const char *optString = "i:o:v:m:h";
+    const char *optString = "i:o:v:m:j:duh";
     int opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
     while( opt != -1 ) {
         switch( opt ) {
@@ -70,8 +76,17 @@ int main(int argc, char* argv[])
         case 'm':
             minVelocity = atof(optarg);
             break;
+        case 'j':
+            nThreads = atoi(optarg);
+            break;
+        case 'd':
+            dualTreeSearch = true;
+            break;
+        case 'u':
+            unitVectorSearch = true;
+            break;
         case 'h':
-            std::cout << "Usage: findTracklets -i <input file> -o <output file> [-v <max velocity>] [-m <min velocity>]" << std::endl;
+            std::cout << "Usage: findTracklets -i <input file> -o <output file> [-v <max velocity>] [-m <min velocity>] [-j <threads>] [-d | -u]" << std::endl;
             exit(0);
         default:
             break;
@@ -79,9 +94,8 @@ int main(int argc, char* argv[])
         opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
     }
 
-    std::ifstream detsFile(inFileName.c_str());
-    
-    populateDetVectorFromFile(detsFile, myDets);
+    // takes a text detections file or a detection store.
+    populateDetVectorFromFile(inFileName, myDets);
 
     double dif = lsst::mops::timeElapsed(start);
     std::cout << "Reading input took " << std::fixed << std::setprecision(10) 
@@ -91,10 +105,14 @@ int main(int argc, char* argv[])
     lsst::mops::findTrackletsConfig config;
     config.maxV = maxVelocity;
     config.minV = minVelocity;
+    config.nThreads = nThreads;
+    config.dualTreeSearch = dualTreeSearch;
+    config.unitVectorSearch = unitVectorSearch;
     config.outputMethod = lsst::mops::trackletOutputMethod::IDS_FILE_WITH_CACHE;
     config.outputFile = outFileName;
-    // hold up to 1 GB before purging.
-    config.outputBufferSize = 1073741824;
+    // hand tracklets to the writer thread 2^24 at a time, about 200 MB
+    // of indices for pairs.
+    config.outputBufferSize = 1 << 24;
     
     // since we set up IDS_FILE_WITH_CACHE, output will be written automatically
     time_t linkingStart = time(NULL);
@@ -10,6 +10,7 @@
 #include <time.h>
 
 #include "lsst/mops/daymops/linkTracklets/linkTracklets.h"
+#include "lsst/mops/daymops/linkTracklets/skyTiles.h"
 #include "lsst/mops/fileUtils.h"
 
 
@@ -42,6 +43,9 @@ int main(int argc, char* argv[])
      
      int bufferSize = 1000;
 
+     lsst::mops::skyTilesConfig tilesConfig;
+     bool useSkyTiles = false;
+
      std::string helpString = 
 	  std::string("Usage: linkTracklets -d <detections file> -t <tracklets file> -o <output (tracks) file>") + std::string("\n") +
 	  std::string("  optional arguments: ") + std::string("\n") +
@@ -62,7 +66,19 @@ int main(int argc, char* argv[])
 	  std::string("     -b / --outputBufferSize (int) : number of tracks to buffer in memory before flushing output. Default = ")
 	  + boost::lexical_cast<std::string>(bufferSize) +  std::string("\n") +
 	  std::string("     -n / --leafNodeSize (int) : set max leaf node size for nodes in KDTree")
-	  +  std::string("\n");
+	  +  std::string("\n") +
+	  std::string("     -j / --nThreads (int) : number of threads to use for linking, default = ")
+	  + boost::lexical_cast<std::string>(searchConfig.nThreads) +  std::string("\n") +
+	  std::string("     -x / --raTiles (int) : if given, link the sky in tiles, this many in RA, default = ")
+	  + boost::lexical_cast<std::string>(tilesConfig.nRaTiles) +  std::string("\n") +
+	  std::string("     -y / --decTiles (int) : if given, link the sky in tiles, this many in Dec, default = ")
+	  + boost::lexical_cast<std::string>(tilesConfig.nDecTiles) +  std::string("\n") +
+	  std::string("     -p / --tileProcesses (int) : number of sky tiles to link at once, each in its own process (0: one per core), default = ")
+	  + boost::lexical_cast<std::string>(tilesConfig.nProcesses) +  std::string("\n") +
+	  std::string("     -S / --stateDir (string) : if given, link incrementally: the input is only the new night(s), and the earlier nights of the window are kept in this directory")
+	  +  std::string("\n") +
+	  std::string("     -W / --windowDays (float) : with -S, the length of the window in days, default = ")
+	  + boost::lexical_cast<std::string>(searchConfig.incrementalWindowDays) +  std::string("\n");
 
      static const struct option longOpts[] = {
 	  { "detectionsFile", required_argument, NULL, 'd' },
@@ -77,6 +93,12 @@ int main(int argc, char* argv[])
 	  { "minDetections", required_argument, NULL, 's'},
 	  { "outputBufferSize", required_argument, NULL, 'b'},
 	  { "leafNodeSize", required_argument, NULL, 'n'},
+	  { "nThreads", required_argument, NULL, 'j'},
+	  { "raTiles", required_argument, NULL, 'x'},
+	  { "decTiles", required_argument, NULL, 'y'},
+	  { "tileProcesses", required_argument, NULL, 'p'},
+	  { "stateDir", required_argument, NULL, 'S'},
+	  { "windowDays", required_argument, NULL, 'W'},
 	  { "help", no_argument, NULL, 'h' },
 	  { NULL, no_argument, NULL, 0 }
      };  
@@ -88,7 +110,7 @@ int main(int argc, char* argv[])
 
      
      int longIndex = -1;
-     const char *optString = "d:t:o:e:D:R:F:L:u:s:b:n:h";
+     const char *optString = "d:t:o:e:D:R:F:L:u:s:b:n:j:x:y:p:S:W:h";
      int opt = getopt_long( argc, argv, optString, longOpts, &longIndex );
      while( opt != -1 ) {
 	  switch( opt ) {
@@ -146,6 +168,48 @@ int main(int argc, char* argv[])
 	       std::cout << " Set leaf node size = " 
 			 << searchConfig.leafSize << std::endl;
 	       break;
+	  case 'j':
+	       if (atoi(optarg) < 1) {
+		    std::cerr << "Illegal number of threads. Exiting.\n";
+		    return -1;
+	       }
+	       searchConfig.nThreads = atoi(optarg);
+	       std::cout << " Set number of threads = " 
+			 << searchConfig.nThreads << std::endl;
+	       break;
+	  case 'x':
+	       if (atoi(optarg) < 1) {
+		    std::cerr << "Illegal number of RA tiles. Exiting.\n";
+		    return -1;
+	       }
+	       useSkyTiles = true;
+	       tilesConfig.nRaTiles = atoi(optarg);
+	       break;
+	  case 'y':
+	       if (atoi(optarg) < 1) {
+		    std::cerr << "Illegal number of Dec tiles. Exiting.\n";
+		    return -1;
+	       }
+	       useSkyTiles = true;
+	       tilesConfig.nDecTiles = atoi(optarg);
+	       break;
+	  case 'p':
+	       if (atoi(optarg) < 0) {
+		    std::cerr << "Illegal number of tile processes. Exiting.\n";
+		    return -1;
+	       }
+	       tilesConfig.nProcesses = atoi(optarg);
+	       break;
+	  case 'S':
+	       searchConfig.incrementalStateDir = optarg;
+	       break;
+	  case 'W':
+	       if (atof(optarg) <= 0) {
+		    std::cerr << "Illegal window length. Exiting.\n";
+		    return -1;
+	       }
+	       searchConfig.incrementalWindowDays = atof(optarg);
+	       break;
 	  case 'h':
 	       std::cout << helpString << std::endl;
 	       return 0;
@@ -163,9 +227,13 @@ int main(int argc, char* argv[])
 	  std::cerr << helpString << std::endl;
 	  return 1;
      }
+     if (useSkyTiles && (searchConfig.incrementalStateDir != "")) {
+	  std::cerr << "Can't link in sky tiles and incrementally at once. Exiting.\n";
+	  return 1;
+     }
 
      std::vector<lsst::mops::MopsDetection> allDets;
-     std::vector<lsst::mops::Tracklet> allTracklets;
+     lsst::mops::TrackletStore allTracklets;
      lsst::mops::TrackSet * resultTracks;
      searchConfig.outputMethod = lsst::mops::trackOutputMethod::IDS_FILE_WITH_CACHE;
      searchConfig.outputBufferSize = bufferSize;
@@ -178,7 +246,7 @@ int main(int argc, char* argv[])
      std::cout << "Calculating topocentric correction " << std::endl;
      calculateTopoCorr(allDets, searchConfig);
      std::cout << "Reading tracklets file " << std::endl;
-     populatePairsVectorFromFile(trackletsFileName, allTracklets);
+     populateTrackletStoreFromFile(trackletsFileName, allTracklets);
 
      dif = lsst::mops::timeElapsed(start);
      std::cout << "Reading input took " << std::fixed << std::setprecision(10) 
@@ -186,10 +254,23 @@ int main(int argc, char* argv[])
 
      
 
-     resultTracks = lsst::mops::linkTracklets(allDets, allTracklets, searchConfig);
-
-     
-     resultTracks->purgeToFile();
+     if (useSkyTiles) {
+	  std::cout << "Linking in " << tilesConfig.nRaTiles << " x " 
+		    << tilesConfig.nDecTiles << " sky tiles." << std::endl;
+	  lsst::mops::linkTrackletsInSkyTiles(allDets, allTracklets, 
+					      searchConfig, tilesConfig);
+     }
+     else if (searchConfig.incrementalStateDir != "") {
+	  std::cout << "Linking incrementally, keeping the window in " 
+		    << searchConfig.incrementalStateDir << std::endl;
+	  resultTracks = lsst::mops::linkTrackletsIncremental(allDets, allTracklets, 
+							       searchConfig);
+	  resultTracks->purgeToFile();
+     }
+     else {
+	  resultTracks = lsst::mops::linkTracklets(allDets, allTracklets, searchConfig);
+	  resultTracks->purgeToFile();
+     }
      std::cout << "Results successfully written to disk." << std::endl;
      
      std::cout << "Done. Exiting successfully." << std::endl;
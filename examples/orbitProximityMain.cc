@@ -5,6 +5,8 @@
  */
 
 #include "lsst/mops/daymops/orbitProximity/orbitProximity.h"
+#include "lsst/mops/ChunkedTextReader.h"
+#include "lsst/mops/Exceptions.h"
 
 
 //internal declaration, used only for this file
@@ -138,32 +140,46 @@ std::vector<lsst::mops::Orbit> populateOrbitVec(std::string dataFile)
 {
 
     std::vector<lsst::mops::Orbit> dataOrbits;
-    std::ifstream myFile(dataFile.c_str());
-    std::string line;
 
-    unsigned int lineIndex = 0;
-
-    //assuming file opens properly, iterate through all 
-    //lines of file and create orbit object for each
-    if(myFile.is_open()){
-
-        while(!myFile.eof()){
-            getline(myFile, line);
-
-            //create orbit object from file line
-            lsst::mops::Orbit myOrbit;
-            myOrbit.populateOrbitFromString(line, lineIndex);
-      
-            //myOrbit.print();
-
-            //add new Orbit to orbits vector
-            dataOrbits.push_back(myOrbit);
-
-            //used for orbit line indexing
-            lineIndex++;
+    // as Orbit::populateOrbitFromString: seven orbital elements and an
+    // optional orbitID; if there isn't one, use the line number.
+    auto parseOrbit = [](const char *pos, const char *end,
+                         unsigned long lineIndex,
+                         std::vector<lsst::mops::Orbit> &orbits) {
+        if (lsst::mops::onlyBlanksLeft(pos, end)) {
+            return;
+        }
+        double q, e, i, argPeri, node, timePeri, equinox;
+        double orbitID = lineIndex;
+        if (!(lsst::mops::parseNextValue(pos, end, q) &&
+              lsst::mops::parseNextValue(pos, end, e) &&
+              lsst::mops::parseNextValue(pos, end, i) &&
+              lsst::mops::parseNextValue(pos, end, argPeri) &&
+              lsst::mops::parseNextValue(pos, end, node) &&
+              lsst::mops::parseNextValue(pos, end, timePeri) &&
+              lsst::mops::parseNextValue(pos, end, equinox)) ||
+            (!lsst::mops::onlyBlanksLeft(pos, end) &&
+             !lsst::mops::parseNextValue(pos, end, orbitID))) {
+            throw LSST_EXCEPT(BadParameterException, 
+                              "Badly-formatted Orbit string\n");
         }
+        lsst::mops::Orbit myOrbit;
+        myOrbit.setPerihelion(q);
+        myOrbit.setEccentricity(e);
+        myOrbit.setInclination(i);
+        myOrbit.setPerihelionArg(argPeri);
+        myOrbit.setLongitude(node);
+        myOrbit.setPerihelionTime(timePeri);
+        myOrbit.setEquinox(equinox);
+        myOrbit.setOrbitID(orbitID);
+        orbits.push_back(myOrbit);
+    };
+
+    try {
+        lsst::mops::ChunkedTextReader reader(dataFile, "orbits");
+        reader.parseLines(parseOrbit, dataOrbits);
     }
-    else{
+    catch (lsst::mops::FileException &e) {
         std::cerr << "Unable to open input file " << dataFile 
                   << "." << std::endl;
         exit(1);
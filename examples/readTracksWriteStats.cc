@@ -12,9 +12,9 @@
 namespace lsst { namespace mops {
 
 
-void writeSet(std::ofstream *outFile, const std::set <unsigned int> &s)
+void writeSet(std::ofstream *outFile, const Track::IndexSet &s)
 {
-    std::set<unsigned int>::const_iterator outIter;
+    Track::IndexSet::const_iterator outIter;
     for (outIter = s.begin(); outIter != s.end(); outIter++) {
         *outFile << *outIter  << " ";
     }
@@ -0,0 +1,164 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * AsyncTrackWriter: writes tracks to an IDS file (one track per line,
+ * as space-delimited DIA IDs) from a background thread, dropping
+ * duplicates as it goes.  Used by TrackSet when it is created with
+ * asyncWrite set (see trackOutputMethod::IDS_FILE_ASYNC).
+ *
+ * New tracks are copied into a batch; full batches are handed to the
+ * writer thread through a lock-free single-producer, single-consumer
+ * queue and handed back (emptied) through another one once written.
+ * So in the steady state there are just two batches, one being filled
+ * while the other is formatted and written.  If the writer falls
+ * behind, the caller allocates more batches, up to a fixed number
+ * waiting to be written; only then does it wait for the writer, so
+ * the memory used doesn't depend on how fast the disk is.
+ *
+ * Duplicates are found with a hash table keyed on a 64-bit hash of the
+ * DIA ID set.  The IDs of every track written are kept in one flat
+ * array, and compared only when two hashes match.  That costs about
+ * 4 bytes per detection of output, versus a node (and a set
+ * comparison per level) of a std::set<Track> per track.
+ *
+ * Tracks are written in the order they were first inserted.  The file
+ * is complete only once close() returns (or the writer is destroyed).
+ */
+
+
+#ifndef LSST_ASYNC_TRACK_WRITER_H
+#define LSST_ASYNC_TRACK_WRITER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Track.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+/* the DIA IDs of a number of tracks, each stored as its number of
+ * IDs followed by the IDs. */
+class TrackBatch {
+public:
+    TrackBatch() { nTracks = 0; }
+
+    void add(const Track::IndexSet &diaIds);
+    void clear() { ids.clear(); nTracks = 0; }
+
+    std::vector<unsigned int> ids;
+    unsigned int nTracks;
+};
+
+
+
+/*
+ * a fixed-size ring of TrackBatch pointers for exactly one producer
+ * thread and one consumer thread.  Neither ever blocks: push() returns
+ * false if the ring is full and pop() returns NULL if it is empty.
+ */
+class TrackBatchQueue {
+public:
+    /* capacity is rounded up to a power of two. */
+    TrackBatchQueue(unsigned int capacity);
+
+    bool push(TrackBatch *batch);
+    TrackBatch *pop();
+
+private:
+    std::vector<TrackBatch *> slots;
+    size_t mask;
+    // head is only written by the consumer, tail by the producer.
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+
+
+class AsyncTrackWriter {
+public:
+    /* opens outFileName for appending and starts the writer thread.
+     * Tracks are handed to the writer batchSize at a time. */
+    AsyncTrackWriter(const std::string &outFileName,
+                     unsigned int batchSize=4096);
+
+    /* calls close(); errors are reported on std::cerr. */
+    ~AsyncTrackWriter();
+
+    /* queue the track for writing unless a track with the same DIA IDs
+     * was inserted before.  Returns true if the track was new. */
+    bool insert(const Track &newTrack);
+    bool insert(const Track::IndexSet &diaIds);
+
+    /* number of distinct tracks inserted so far. */
+    unsigned int size() const { return nUnique; }
+
+    /* hand any partly-filled batch to the writer thread.  Doesn't wait
+     * for it to be written. */
+    void flush();
+
+    /* flush, wait for everything to be written and stop the writer
+     * thread.  Throws FileException if any write failed.  Nothing may
+     * be inserted afterwards. */
+    void close();
+
+private:
+    static uint64_t hashIds(const Track::IndexSet &diaIds);
+
+    /* true if diaIds (with the given hash) is in the table; otherwise
+     * adds it and returns false. */
+    bool findOrAdd(const Track::IndexSet &diaIds, uint64_t hash);
+    void growTable();
+
+    /* give the current batch (if not empty) to the writer, waiting
+     * for room if need be, and get an empty one to fill. */
+    void sendBatch();
+    void writerLoop();
+    void writeBatch(const TrackBatch &batch, std::vector<char> &buffer);
+
+    // duplicate detection; only touched by the inserting thread.
+    struct Slot {
+        uint64_t hash;
+        // offset of the track in seenIds, or EMPTY_SLOT
+        uint64_t offset;
+    };
+    std::vector<Slot> table;
+    // number of IDs, then the IDs, for each distinct track
+    std::vector<unsigned int> seenIds;
+    unsigned int nUnique;
+
+    unsigned int batchSize;
+    TrackBatch *filling;
+    std::vector<TrackBatch *> allBatches;
+    TrackBatchQueue toWriter;
+    TrackBatchQueue fromWriter;
+
+    std::ofstream outFile;
+    std::thread writer;
+    std::atomic<bool> closing;
+    std::atomic<bool> writeFailed;
+    bool closed;
+    // the queues need no lock, but sleeping on them does.  batchSent
+    // is set (under wakeLock) after each push to toWriter, and
+    // cleared by the writer before it empties toWriter; the writer
+    // signals batchTaken after each pop.
+    std::mutex wakeLock;
+    bool batchSent;
+    std::condition_variable wakeWriter;
+    std::condition_variable batchTaken;
+};
+
+
+
+}} // close namespace lsst::mops
+
+#endif
@@ -24,6 +24,8 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <numeric>
+#include <thread>
 
 #include "common.h"  
 #include "Exceptions.h"
@@ -35,7 +37,7 @@ namespace lsst {
 namespace mops {
 
     
-    template <class T, class TreeNodeClass>
+    template <class T, class TreeNodeClass, unsigned int K = 0>
     class BaseKDTree {
     public:
 
@@ -44,14 +46,14 @@ namespace mops {
         BaseKDTree();
 
         /* copy constructor */
-        BaseKDTree(const BaseKDTree<T, TreeNodeClass> &source);
+        BaseKDTree(const BaseKDTree<T, TreeNodeClass, K> &source);
         
         void debugPrint() const;
         
         unsigned int size() const;
 
-        BaseKDTree<T, TreeNodeClass>& operator=(
-            const BaseKDTree<T, TreeNodeClass> &rhs);
+        BaseKDTree<T, TreeNodeClass, K>& operator=(
+            const BaseKDTree<T, TreeNodeClass, K> &rhs);
 
         ~BaseKDTree();
 
@@ -63,9 +65,10 @@ namespace mops {
          * populates the tree with given data.  See comments KDTree's second
          * constructor.
          */
-        void buildFromData(std::vector<PointAndValue <T> > pointsAndValues, 
-               unsigned int k, unsigned int maxLeafSize);
-        void copyTree(const BaseKDTree<T, TreeNodeClass> &source);
+        void buildFromData(const std::vector<PointAndValue<T, K> > &pointsAndValues, 
+                           unsigned int k, unsigned int maxLeafSize,
+                           unsigned int nThreads=1);
+        void copyTree(const BaseKDTree<T, TreeNodeClass, K> &source);
         void setUpEmptyTree();
         void clearPrivateData();
         bool hasData;
@@ -82,8 +85,8 @@ namespace mops {
 
 
 
-template <class T, class TreeNodeClass>
-void BaseKDTree<T, TreeNodeClass>::clearPrivateData()
+template <class T, class TreeNodeClass, unsigned int K>
+void BaseKDTree<T, TreeNodeClass, K>::clearPrivateData()
 {
     if (hasData == true) {
         myRoot->removeReference();
@@ -100,6 +103,7 @@ void BaseKDTree<T, TreeNodeClass>::clearPrivateData()
         myRoot = NULL;
     }
     myK = 0;
+    mySize = 0;
     myUBounds.clear();
     myLBounds.clear();
 }
@@ -108,8 +112,8 @@ void BaseKDTree<T, TreeNodeClass>::clearPrivateData()
 
 
 
-template <class T, class TreeNodeClass>
-BaseKDTree<T, TreeNodeClass>::~BaseKDTree()
+template <class T, class TreeNodeClass, unsigned int K>
+BaseKDTree<T, TreeNodeClass, K>::~BaseKDTree()
 {
     /*std::cerr << "DD: Entering ~KDTree " << std::endl;*/
     clearPrivateData();
@@ -120,12 +124,13 @@ BaseKDTree<T, TreeNodeClass>::~BaseKDTree()
 
 
 
-template <class T, class TreeNodeClass>
-void BaseKDTree<T, TreeNodeClass>::setUpEmptyTree() 
+template <class T, class TreeNodeClass, unsigned int K>
+void BaseKDTree<T, TreeNodeClass, K>::setUpEmptyTree() 
 {
     hasData = false;
     myRoot = NULL;
     myK = 0;    
+    mySize = 0;
     myUBounds.clear();
     myLBounds.clear();
 }
@@ -133,9 +138,9 @@ void BaseKDTree<T, TreeNodeClass>::setUpEmptyTree()
 
 
 
-template <class T, class TreeNodeClass>
-BaseKDTree<T, TreeNodeClass>::BaseKDTree(
-    const BaseKDTree<T, TreeNodeClass> &source) 
+template <class T, class TreeNodeClass, unsigned int K>
+BaseKDTree<T, TreeNodeClass, K>::BaseKDTree(
+    const BaseKDTree<T, TreeNodeClass, K> &source) 
 {
     setUpEmptyTree();
     /*std::cerr << "DD: entering copy constructor..." << std::endl;*/
@@ -145,14 +150,15 @@ BaseKDTree<T, TreeNodeClass>::BaseKDTree(
 
 
 
-template<class T, class TreeNodeClass>
-void BaseKDTree<T, TreeNodeClass>::copyTree(
-    const BaseKDTree<T, TreeNodeClass> &source) 
+template<class T, class TreeNodeClass, unsigned int K>
+void BaseKDTree<T, TreeNodeClass, K>::copyTree(
+    const BaseKDTree<T, TreeNodeClass, K> &source) 
 {
     // check for self-assignment
     if (this != &source) { 
         clearPrivateData();
         myK = source.myK;
+        mySize = source.mySize;
         if (source.hasData) {        
             myRoot = source.myRoot;
             myUBounds = source.myUBounds;
@@ -165,9 +171,9 @@ void BaseKDTree<T, TreeNodeClass>::copyTree(
 }
 
 
-template <class T, class TreeNodeClass>
-BaseKDTree<T, TreeNodeClass> &BaseKDTree<T, TreeNodeClass>::operator=(
-    const BaseKDTree<T, TreeNodeClass> &rhs)
+template <class T, class TreeNodeClass, unsigned int K>
+BaseKDTree<T, TreeNodeClass, K> &BaseKDTree<T, TreeNodeClass, K>::operator=(
+    const BaseKDTree<T, TreeNodeClass, K> &rhs)
 {
     /*std::cerr << "DD: Entering operator=..." << std::endl;;*/
     /* check for self-assignment */
@@ -182,8 +188,8 @@ BaseKDTree<T, TreeNodeClass> &BaseKDTree<T, TreeNodeClass>::operator=(
 
 
 
-template <class T, class TreeNodeClass>
-BaseKDTree<T, TreeNodeClass>::BaseKDTree()
+template <class T, class TreeNodeClass, unsigned int K>
+BaseKDTree<T, TreeNodeClass, K>::BaseKDTree()
 {
     setUpEmptyTree();
 }
@@ -192,8 +198,8 @@ BaseKDTree<T, TreeNodeClass>::BaseKDTree()
 
 
 
-template <class T, class TreeNodeClass>
-unsigned int BaseKDTree<T, TreeNodeClass>::size() const
+template <class T, class TreeNodeClass, unsigned int K>
+unsigned int BaseKDTree<T, TreeNodeClass, K>::size() const
 {
     return mySize;
 }
@@ -201,11 +207,11 @@ unsigned int BaseKDTree<T, TreeNodeClass>::size() const
 
 
 
-template <class T, class TreeNodeClass>
-void BaseKDTree<T, TreeNodeClass>::debugPrint() const
+template <class T, class TreeNodeClass, unsigned int K>
+void BaseKDTree<T, TreeNodeClass, K>::debugPrint() const
 {
   std::cout << "KDTree: dims " << myK << std::endl;
-  std::vector<double>::iterator myIter;
+  std::vector<double>::const_iterator myIter;
 
   std::cout << "UBounds: ";
   for (myIter = myUBounds.begin();
@@ -231,11 +237,12 @@ void BaseKDTree<T, TreeNodeClass>::debugPrint() const
 
 
 
-template <class T, class TreeNodeClass>
-void BaseKDTree<T, TreeNodeClass>::buildFromData(
-    std::vector<PointAndValue <T> > pointsAndValues,
+template <class T, class TreeNodeClass, unsigned int K>
+void BaseKDTree<T, TreeNodeClass, K>::buildFromData(
+    const std::vector<PointAndValue<T, K> > &pointsAndValues,
     unsigned int k, 
-    unsigned int maxLeafSize)
+    unsigned int maxLeafSize,
+    unsigned int nThreads)
 {
 
 
@@ -244,13 +251,7 @@ void BaseKDTree<T, TreeNodeClass>::buildFromData(
     if (pointsAndValues.size() > 0) 
     {
     
-        typename std::vector<PointAndValue<T>,std::allocator<PointAndValue<T> > >::iterator myIter;
-        
-        std::vector <std::vector<double> > pointsByDimension;
         std::vector <double> pointsUBounds, pointsLBounds;
-        double tmpMax, tmpMin;
-        std::vector <PointAndValue <T> > pointsAndValuesCopy;
-        std::vector <std::vector<double>*> allocatedDoubleVecs;
 
         /* sanity check */
         if (k < 1) {
@@ -261,60 +262,55 @@ void BaseKDTree<T, TreeNodeClass>::buildFromData(
             throw LSST_EXCEPT(BadParameterException, 
          "EE: KDTree: max leaf size must be strictly positive!\n");
         }
-        /* make sure all points from of pointsAndValues are of valid length */
-        for (myIter = pointsAndValues.begin(); 
-             myIter != pointsAndValues.end(); 
-             myIter++) {
-            unsigned int pointSize = myIter->getPoint().size();
-            if (pointSize < k) {
+
+        /* make sure all points from of pointsAndValues are of valid
+         * length, and find upper and lower bounds of points in each
+         * dimension */
+        pointsUBounds.assign(pointsAndValues[0].getPoint().begin(), 
+                             pointsAndValues[0].getPoint().end());
+        pointsLBounds = pointsUBounds;
+        for (unsigned int i = 0; i < pointsAndValues.size(); i++) {
+            const typename PointAndValue<T, K>::PointType &point = 
+                pointsAndValues[i].getPoint();
+            if (point.size() < k) {
                 throw LSST_EXCEPT(BadParameterException, 
                                   "Got point has size <  k");
             }
-        }
-
-        /* find upper and lower bounds of points in each dimension */
-  
-        for (unsigned int i = 0; i < myK; i++) {
-            std::vector<double> *tmpDoubleVec = new std::vector<double>;
-            pointsByDimension.push_back(*tmpDoubleVec);
-            allocatedDoubleVecs.push_back(tmpDoubleVec);
-        }
-
-        for (unsigned int i = 0; i < myK; i++) {
-
-            for (myIter = pointsAndValues.begin();
-                 myIter != pointsAndValues.end();
-                 myIter++) {
-                pointsByDimension[i].push_back(myIter->getPoint()[i]);
+            for (unsigned int axis = 0; axis < myK; axis++) {
+                pointsUBounds[axis] = std::max(pointsUBounds[axis], point[axis]);
+                pointsLBounds[axis] = std::min(pointsLBounds[axis], point[axis]);
             }
-
-            tmpMax = *(std::max_element(pointsByDimension[i].begin(),
-                                        pointsByDimension[i].end()));
-            tmpMin = *(std::min_element(pointsByDimension[i].begin(),
-                                        pointsByDimension[i].end()));
-            pointsUBounds.push_back(tmpMax);
-            pointsLBounds.push_back(tmpMin);
-        }
-
-        for (unsigned int i = 0; i < myK; i++){
-            delete allocatedDoubleVecs[i];
         }
+        pointsUBounds.resize(myK);
+        pointsLBounds.resize(myK);
 
         myUBounds = pointsUBounds;
         myLBounds = pointsLBounds;
   
-        /* make a copy of the pointsAndValues we were given; it will be
-           edited destructively.
-        */
-
-        pointsAndValuesCopy = pointsAndValues;
+        /* the nodes partition this permutation of the indices of
+         * pointsAndValues in place, rather than copying the points
+         * at each level. */
+        std::vector<unsigned int> order(pointsAndValues.size());
+        std::iota(order.begin(), order.end(), 0);
+        // and the nodes choose their splits in this, each in its own
+        // part, so it is only allocated once.
+        std::vector<typename TreeNodeClass::AxisValue> scratch(order.size());
+
+        if (nThreads == 0) {
+            nThreads = std::thread::hardware_concurrency();
+        }
+        if (nThreads < 1) {
+            nThreads = 1;
+        }
   
         /* create the root of the tree (and the rest of the tree
          * recursively), save it to private var. */
-        unsigned int idCounter = 0;
         myRoot = new TreeNodeClass(
-            pointsAndValuesCopy, k, maxLeafSize, 0,
-            pointsUBounds, pointsLBounds, idCounter);
+            pointsAndValues, order.data(), order.data() + order.size(),
+            scratch.data(), k, maxLeafSize, 0,
+            pointsUBounds, pointsLBounds, nThreads - 1);
+        unsigned int idCounter = 0;
+        myRoot->assignIds(idCounter);
         // don't set hasData until now, when the tree is actually built.
         mySize = idCounter;
         hasData = true;
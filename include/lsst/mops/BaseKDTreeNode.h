@@ -5,6 +5,11 @@
 #define BASE_LSST_KDTREE_NODE_H
 
 #include <iostream>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <utility>
 
 #include "lsst/mops/common.h"
 #include "lsst/mops/PointAndValue.h"
@@ -23,28 +28,45 @@
  *
  */
 
-static unsigned int lastId_NULL = 0;
-
 namespace lsst {
 namespace mops {
 
 
-    template <class T, class RecursiveT>
+    template <class T, class RecursiveT, unsigned int K = 0>
     class BaseKDTreeNode {
     public:
-        /* create and populate a KDTreeNode.  Caller is trusted that the
-         * Ubounds, LBounds provided correspond to the upper and lower
-         * bounds of data in each dimension from pointsAndValues.
+        /* a point's value along the axis being split, and its index. */
+        typedef std::pair<double, unsigned int> AxisValue;
+
+        /* create and populate a KDTreeNode holding the points of
+         * allPointsAndValues whose indices are first ... last - 1.
+         * Caller is trusted that the Ubounds, LBounds provided
+         * correspond to the upper and lower bounds of data in each
+         * dimension from those points.
+         *
+         * The indices are reordered in place as the node and its
+         * children partition them, so no points are copied until
+         * they reach a leaf; a leaf holds its points in their order
+         * in allPointsAndValues.  scratch must have room for
+         * last - first AxisValues; the node and its children use it
+         * (each child its own part) while choosing their splits.  Subtrees of at least
+         * MIN_PARALLEL_BUILD points are built on up to nSpareThreads
+         * extra threads.  Node IDs are not set; call assignIds on the
+         * root once it is built.
          *
          * automatically sets ref count to 1.
          */
         BaseKDTreeNode(
-            const std::vector<PointAndValue <T> > &pointsAndValues,
+            const std::vector<PointAndValue<T, K> > &allPointsAndValues,
+            unsigned int *first, unsigned int *last,
+            AxisValue *scratch,
             unsigned int k, unsigned int maxLeafSize,
             unsigned int myAxisToSplit,
             const std::vector<double> &Ubounds,
             const std::vector<double> &LBounds,
-            unsigned int &lastId=lastId_NULL);
+            unsigned int nSpareThreads=0);
+
+        static const unsigned int MIN_PARALLEL_BUILD = 1 << 14;
 
 
         /*
@@ -61,6 +83,13 @@ namespace mops {
 
         unsigned int getRefCount();
 
+        /*
+         * number this node and its children in pre-order, starting
+         * from lastId + 1; lastId is left at the last ID used.  Also
+         * for use by KDTree *ONLY*, once the tree is built.
+         */
+        void assignIds(unsigned int &lastId);
+
         void debugPrint(int depth) const;
 
         const unsigned int getId() const;
@@ -73,10 +102,10 @@ namespace mops {
          *
          * ASSUMES all points have size > axis
         */
-        double getMedianByAxis(std::vector<PointAndValue<T> > pointsAndValues,
+        double getMedianByAxis(std::vector<PointAndValue<T, K> > pointsAndValues,
                                unsigned int axis);
 
-        double maxByAxis(std::vector<PointAndValue<T> > pointsAndValues,
+        double maxByAxis(std::vector<PointAndValue<T, K> > pointsAndValues,
                          unsigned int axis);
 
 
@@ -91,31 +120,31 @@ namespace mops {
         unsigned int myK;
         std::vector <double> myUBounds;
         std::vector <double> myLBounds;
-        std::vector <PointAndValue <T> > myData;
+        std::vector <PointAndValue<T, K> > myData;
         unsigned int id;
     };
 
 
 
 
-template <class T, class RecursiveT>
-const std::vector<double> *BaseKDTreeNode<T, RecursiveT>::getUBounds()
+template <class T, class RecursiveT, unsigned int K>
+const std::vector<double> *BaseKDTreeNode<T, RecursiveT, K>::getUBounds()
     const
 {
     return &myUBounds;
 }
 
 
-template <class T, class RecursiveT>
-const std::vector<double> *BaseKDTreeNode<T, RecursiveT>::getLBounds()
+template <class T, class RecursiveT, unsigned int K>
+const std::vector<double> *BaseKDTreeNode<T, RecursiveT, K>::getLBounds()
     const
 {
     return &myLBounds;
 }
 
 
-template <class T, class RecursiveT>
-void BaseKDTreeNode<T, RecursiveT>::addReference()
+template <class T, class RecursiveT, unsigned int K>
+void BaseKDTreeNode<T, RecursiveT, K>::addReference()
 {
     myRefCount++;
 }
@@ -123,24 +152,24 @@ void BaseKDTreeNode<T, RecursiveT>::addReference()
 
 
 
-template <class T, class RecursiveT>
-void BaseKDTreeNode<T, RecursiveT>::removeReference()
+template <class T, class RecursiveT, unsigned int K>
+void BaseKDTreeNode<T, RecursiveT, K>::removeReference()
 {
     myRefCount--;
 }
 
 
 
-template <class T, class RecursiveT>
-const unsigned int BaseKDTreeNode<T, RecursiveT >::getId() const
+template <class T, class RecursiveT, unsigned int K>
+const unsigned int BaseKDTreeNode<T, RecursiveT, K>::getId() const
 {
     return id;
 }
 
 
 
-template <class T, class RecursiveT>
-unsigned int BaseKDTreeNode<T, RecursiveT>::getRefCount()
+template <class T, class RecursiveT, unsigned int K>
+unsigned int BaseKDTreeNode<T, RecursiveT, K>::getRefCount()
 {
     return myRefCount;
 }
@@ -149,35 +178,38 @@ unsigned int BaseKDTreeNode<T, RecursiveT>::getRefCount()
 
 
 
-template <class T, class RecursiveT>
-BaseKDTreeNode<T, RecursiveT>::BaseKDTreeNode(
-    const std::vector<PointAndValue <T> > &pointsAndValues,
+template <class T, class RecursiveT, unsigned int K>
+void BaseKDTreeNode<T, RecursiveT, K>::assignIds(unsigned int &lastId)
+{
+    lastId++;
+    id = lastId;
+    for (unsigned int i = 0; i < myChildren.size(); i++) {
+        myChildren[i].assignIds(lastId);
+    }
+}
+
+
+
+
+
+template <class T, class RecursiveT, unsigned int K>
+BaseKDTreeNode<T, RecursiveT, K>::BaseKDTreeNode(
+    const std::vector<PointAndValue<T, K> > &allPointsAndValues,
+    unsigned int *first, unsigned int *last,
+    AxisValue *scratch,
     unsigned int k,
     unsigned int maxLeafSize,
     unsigned int myAxisToSplit,
     const std::vector<double> & UBounds,
     const std::vector<double> & LBounds,
-    unsigned int &lastId)
+    unsigned int nSpareThreads)
 {
 
     myRefCount = 1;
     myK = k;
     myUBounds = UBounds;
     myLBounds = LBounds;
-    lastId++;
-    id = lastId;
-
-
-    std::vector<double> rightChildUBounds, rightChildLBounds,
-        leftChildUBounds, leftChildLBounds;
-    std::vector<PointAndValue <T> > leftPointsAndValues, rightPointsAndValues;
-    double tmpMedian;
-
-    typename std::vector<PointAndValue<T>,
-        std::allocator<PointAndValue<T> > >::iterator myIter;
-
-    PointAndValue<T> tmpPointAndValue;
-    unsigned int nextAxis;
+    id = 0;
 
     if (myAxisToSplit >= myK){
         throw LSST_EXCEPT(BadParameterException,
@@ -193,7 +225,7 @@ than dimensions of data\n");
 
     /*
        if myUBounds[i] == myLBounds[i] for i == 0,..k, but
-       pointsAndValues.size() > 1, then ALL POINTS ARE EQUAL.
+       there is more than one point, then ALL POINTS ARE EQUAL.
 
        this means that we need to be a leaf no matter what.
 
@@ -211,22 +243,55 @@ than dimensions of data\n");
         }
     }
 
-    // CTS
-    // if(pointsAndValues.size() == 0)
-    //    throw LSST_EXCEPT(ProgrammerErrorException, "zero length pointsAndValues in KDTree\n");
-
-    tmpMedian = getMedianByAxis(pointsAndValues, myAxisToSplit);
+    /* find the median along myAxisToSplit just as fastMedian would
+     * (the lower of the two middle values for an even number of
+     * points).  The values are copied out next to their indices
+     * (into our part of scratch), so the selection doesn't have to
+     * chase every point's vector.
+     * Then everything before the median is <= it and everything
+     * after >= it; move those equal to the median over to the left
+     * as well, finding the max as we go, and put the indices back
+     * in that order. */
+    unsigned int nPoints = last - first;
+    AxisValue *axisValues = scratch;
+    for (unsigned int i = 0; i < nPoints; i++) {
+        axisValues[i].first = allPointsAndValues[first[i]].getPoint()[myAxisToSplit];
+        axisValues[i].second = first[i];
+    }
+    unsigned int middleIndex = (nPoints % 2 == 0) ? (nPoints / 2) - 1 : nPoints / 2;
+    std::nth_element(axisValues, axisValues + middleIndex,
+                     axisValues + nPoints,
+                     [](const AxisValue &a, const AxisValue &b) {
+                         return a.first < b.first;
+                     });
+    double tmpMedian = axisValues[middleIndex].first;
     if(isnan(tmpMedian)) {
-      abort();
-      throw LSST_EXCEPT(ProgrammerErrorException, "getMedianByAxis returned NaN in BaseKDTreeNode\n");
+        throw LSST_EXCEPT(ProgrammerErrorException, "got a NaN median in BaseKDTreeNode\n");
+    }
+    double tmpMax = tmpMedian;
+    unsigned int nLeft = middleIndex + 1;
+    for (unsigned int i = middleIndex + 1; i < nPoints; i++) {
+        if (axisValues[i].first <= tmpMedian) {
+            std::swap(axisValues[i], axisValues[nLeft]);
+            nLeft++;
+        }
+        else if (axisValues[i].first > tmpMax) {
+            tmpMax = axisValues[i].first;
+        }
     }
+    for (unsigned int i = 0; i < nPoints; i++) {
+        first[i] = axisValues[i].second;
+    }
+    unsigned int *split = first + nLeft;
+    AxisValue *rightScratch = scratch + nLeft;
+
     /*
      * catch the special case John Dailey from WISE found: if the
      * median value is also the max value, we can't just give all
      * values <= the median to the left child; this would be *all*
      * the values and can lead to infinite recursion.
      */
-    if (tmpMedian == maxByAxis(pointsAndValues, myAxisToSplit)) {
+    if (tmpMedian == tmpMax) {
         forceLeaf = true;
         /* in the future, we may consider changing this behavior;
          * rather than force a leaf node at this location, use <
@@ -237,70 +302,85 @@ than dimensions of data\n");
 
 
     /* case 1: this is a leaf. */
-    if ((forceLeaf == true) || (pointsAndValues.size() <= maxLeafSize)) {
-        myData = pointsAndValues;
+    if ((forceLeaf == true) || (nPoints <= maxLeafSize)) {
+        std::sort(first, last);
+        myData.reserve(nPoints);
+        for (unsigned int *index = first; index != last; index++) {
+            myData.push_back(allPointsAndValues[*index]);
+        }
     }
     else {
-        /* case 2: not a leaf, so split data and into two chunks,
-         * recursively create children with them by partitioning the data
-         * along myAxisToSplit.  */
-
-
-        rightChildUBounds = UBounds;
+        /* case 2: not a leaf; the data is already partitioned along
+         * myAxisToSplit, so recursively create children with the two
+         * halves.  */
 
-        rightChildLBounds = LBounds;
+        std::vector<double> rightChildLBounds = LBounds;
         rightChildLBounds[myAxisToSplit] = tmpMedian;
 
-        leftChildUBounds = UBounds;
+        std::vector<double> leftChildUBounds = UBounds;
         leftChildUBounds[myAxisToSplit] = tmpMedian;
 
-        leftChildLBounds = LBounds;
-
-        //partition data for children
-        for (unsigned int i = 0; i < pointsAndValues.size(); i++) {
-
-            tmpPointAndValue = pointsAndValues[i];
-
-            if (tmpPointAndValue.getPoint()[myAxisToSplit] <= tmpMedian) {
-                leftPointsAndValues.push_back(tmpPointAndValue);
+        unsigned int nextAxis = (myAxisToSplit + 1) % (myK);
+
+        myChildren.reserve(2);
+        if ((nSpareThreads > 0) && (nPoints >= MIN_PARALLEL_BUILD)) {
+            // build the left child on another thread; the two halves
+            // of the index range don't overlap.
+            unsigned int leftSpareThreads = (nSpareThreads - 1) / 2;
+            unsigned int rightSpareThreads = nSpareThreads - 1 - leftSpareThreads;
+            std::unique_ptr<RecursiveT> leftChild;
+            std::exception_ptr leftError;
+            std::thread leftBuilder([&]() {
+                    try {
+                        leftChild.reset(
+                            new RecursiveT(allPointsAndValues, first, split, 
+                                           scratch, k, maxLeafSize, nextAxis,
+                                           leftChildUBounds, LBounds, 
+                                           leftSpareThreads));
+                    }
+                    catch (...) {
+                        leftError = std::current_exception();
+                    }
+                });
+            std::unique_ptr<RecursiveT> rightChild;
+            try {
+                rightChild.reset(
+                    new RecursiveT(allPointsAndValues, split, last, 
+                                   rightScratch, k, maxLeafSize, nextAxis,
+                                   UBounds, rightChildLBounds, 
+                                   rightSpareThreads));
             }
-            else {
-                rightPointsAndValues.push_back(tmpPointAndValue);
+            catch (...) {
+                leftBuilder.join();
+                throw;
             }
-
-            /* it would be really nice to delete
-             * pointsAndValues[i] at this point, but since it
-             * holds statically allocated data that's not really
-             * possible... this calls for a possible redesign
-             * (ugh)
-             */
+            leftBuilder.join();
+            if (leftError) {
+                std::rethrow_exception(leftError);
+            }
+            myChildren.push_back(std::move(*leftChild));
+            myChildren.push_back(std::move(*rightChild));
+        }
+        else {
+            myChildren.emplace_back(allPointsAndValues, first, split, 
+                                    scratch, k, maxLeafSize, nextAxis,
+                                    leftChildUBounds, LBounds, 0);
+            myChildren.emplace_back(allPointsAndValues, split, last, 
+                                    rightScratch, k, maxLeafSize, nextAxis,
+                                    UBounds, rightChildLBounds, 0);
         }
-
-        nextAxis = (myAxisToSplit + 1) % (myK);
-
-        RecursiveT leftChild(leftPointsAndValues, k, maxLeafSize,
-                             nextAxis,
-                             leftChildUBounds, leftChildLBounds, lastId);
-
-        myChildren.push_back(leftChild);
-
-        RecursiveT rightChild(rightPointsAndValues, k, maxLeafSize,
-                              nextAxis, rightChildUBounds,
-                              rightChildLBounds, lastId);
-
-        myChildren.push_back(rightChild);
     }
 }
 
 
 
 
-template <class T, class RecursiveT>
-void BaseKDTreeNode<T, RecursiveT>::debugPrint(int depth) const
+template <class T, class RecursiveT, unsigned int K>
+void BaseKDTreeNode<T, RecursiveT, K>::debugPrint(int depth) const
 {
     std::cout << "KDTREENODE: Depth "<< depth << std::endl;;
     std::cout << "\tmy dims is "<< myK << std::endl;
-    std::vector<double>::iterator myIter;
+    std::vector<double>::const_iterator myIter;
 
     std::cout << "UBounds: ";
     printDoubleVec(myUBounds);
@@ -311,11 +391,12 @@ void BaseKDTreeNode<T, RecursiveT>::debugPrint(int depth) const
     if (myChildren.size() == 0) {
 
         // we're a leaf node
-        typename std::vector<PointAndValue<T>,std::allocator<PointAndValue<T> > >::iterator dataIter;
+        typename std::vector<PointAndValue<T, K>,std::allocator<PointAndValue<T, K> > >::const_iterator dataIter;
         for (dataIter = myData.begin(); dataIter != myData.end(); dataIter++)
         {
             std::cout << "Data point: ";
-            printDoubleVec(dataIter->getPoint());
+            printDoubleVec(std::vector<double>(dataIter->getPoint().begin(),
+                                               dataIter->getPoint().end()));
         }
         std::cout << std::endl;
     }
@@ -328,9 +409,9 @@ void BaseKDTreeNode<T, RecursiveT>::debugPrint(int depth) const
 }
 
 
-template <class T, class RecursiveT>
-double BaseKDTreeNode<T, RecursiveT>::maxByAxis(
-    std::vector<PointAndValue<T> > pointsAndValues,
+template <class T, class RecursiveT, unsigned int K>
+double BaseKDTreeNode<T, RecursiveT, K>::maxByAxis(
+    std::vector<PointAndValue<T, K> > pointsAndValues,
     unsigned int axis)
 {
     double tmpMax = 0;
@@ -347,15 +428,15 @@ double BaseKDTreeNode<T, RecursiveT>::maxByAxis(
 
 
 
-template <class T, class RecursiveT>
-double BaseKDTreeNode<T, RecursiveT>::getMedianByAxis(
-    std::vector<PointAndValue<T> > pointsAndValues,
+template <class T, class RecursiveT, unsigned int K>
+double BaseKDTreeNode<T, RecursiveT, K>::getMedianByAxis(
+    std::vector<PointAndValue<T, K> > pointsAndValues,
     unsigned int axis)
 {
     double tmpMedian;
     std::vector<double> splitAxisPointData;
-    typename std::vector<PointAndValue<T>,
-        std::allocator<PointAndValue<T> > >::iterator myIter;
+    typename std::vector<PointAndValue<T, K>,
+        std::allocator<PointAndValue<T, K> > >::iterator myIter;
 
     for (myIter = pointsAndValues.begin();
          myIter != pointsAndValues.end();
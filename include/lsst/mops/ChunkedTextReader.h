@@ -0,0 +1,191 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * ChunkedTextReader: reads a line-oriented text file by mapping it into
+ * memory, cutting it at newlines into one chunk per thread, and parsing
+ * the chunks in parallel.  Each chunk's results are kept apart and
+ * appended to the output in file order, so the output is just what a
+ * line-by-line reader would have produced.
+ *
+ * The line parser is handed the bounds of one line (without its '\n')
+ * and the line's number in the file (counting from 0); it appends
+ * whatever it makes of the line to a vector.  parseNextValue pulls
+ * whitespace-separated numbers out of a line with std::from_chars,
+ * which (unlike an istringstream) doesn't allocate, lock or consult
+ * the locale.
+ *
+ * If any line parser throws, the exception from the earliest such line
+ * is passed on once all chunks are done, as though the file had been
+ * read in order.
+ */
+
+
+#ifndef LSST_CHUNKED_TEXT_READER_H
+#define LSST_CHUNKED_TEXT_READER_H
+
+#include <string.h>
+#include <charconv>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace lsst {
+namespace mops {
+
+
+/*
+ * skip any blanks at pos, then read a number into value and move pos
+ * past it.  Returns false (leaving value alone) if there is no number
+ * there, or it runs into something other than a blank.
+ */
+template <class T>
+bool parseNextValue(const char *&pos, const char *end, T &value)
+{
+    while ((pos < end) && ((*pos == ' ') || (*pos == '\t') || (*pos == '\r'))) {
+        pos++;
+    }
+    // from_chars doesn't take the leading '+' an istream would.
+    if ((pos < end) && (*pos == '+')) {
+        pos++;
+    }
+    T tmp;
+    std::from_chars_result result = std::from_chars(pos, end, tmp);
+    if ((result.ec != std::errc()) ||
+        ((result.ptr < end) && (*result.ptr != ' ') &&
+         (*result.ptr != '\t') && (*result.ptr != '\r'))) {
+        return false;
+    }
+    value = tmp;
+    pos = result.ptr;
+    return true;
+}
+
+/* true if there is nothing but blanks from pos to end. */
+bool onlyBlanksLeft(const char *pos, const char *end);
+
+
+
+class ChunkedTextReader {
+public:
+    /* maps fileName.  If it can't be opened, throws FileException
+     * saying that the fileKind file (e.g. "dets") couldn't be. */
+    ChunkedTextReader(const std::string &fileName,
+                      const std::string &fileKind);
+
+    ~ChunkedTextReader();
+
+    /*
+     * calls parseLine(lineBegin, lineEnd, lineNumber, results) for each
+     * line, using up to nThreads threads (0: one per core).  As with
+     * std::getline, a final '\n' does not start another line.
+     */
+    template <class T, class LineParser>
+    void parseLines(LineParser parseLine, std::vector<T> &results,
+                    unsigned int nThreads=0) const;
+
+private:
+    // no copying: we own the mapping.
+    ChunkedTextReader(const ChunkedTextReader &);
+    ChunkedTextReader & operator=(const ChunkedTextReader &);
+
+    /* cut the file into at most nChunks pieces, each ending just after
+     * a '\n' (or at the end of the file).  chunkStarts gets the start
+     * of each and the end of the file; chunkFirstLines the number of
+     * the first line of each. */
+    void splitIntoChunks(unsigned int nChunks,
+                         std::vector<const char *> &chunkStarts,
+                         std::vector<unsigned long> &chunkFirstLines) const;
+
+    void *mapped;
+    const char *data;
+    size_t dataSize;
+};
+
+
+
+
+template <class T, class LineParser>
+void ChunkedTextReader::parseLines(LineParser parseLine,
+                                   std::vector<T> &results,
+                                   unsigned int nThreads) const
+{
+    // below this, threads cost more than they save.
+    static const size_t MIN_CHUNK_BYTES = 1 << 20;
+    if (nThreads == 0) {
+        nThreads = std::thread::hardware_concurrency();
+    }
+    unsigned int nChunks = dataSize / MIN_CHUNK_BYTES;
+    if (nChunks > nThreads) {
+        nChunks = nThreads;
+    }
+    if (nChunks < 1) {
+        nChunks = 1;
+    }
+    std::vector<const char *> chunkStarts;
+    std::vector<unsigned long> chunkFirstLines;
+    splitIntoChunks(nChunks, chunkStarts, chunkFirstLines);
+    nChunks = chunkFirstLines.size();
+
+    std::vector<std::vector<T> > chunkResults(nChunks);
+    std::vector<std::exception_ptr> chunkErrors(nChunks);
+    auto parseChunk = [&](unsigned int c) {
+        try {
+            const char *lineStart = chunkStarts[c];
+            const char *chunkEnd = chunkStarts[c + 1];
+            unsigned long lineNumber = chunkFirstLines[c];
+            while (lineStart < chunkEnd) {
+                const char *lineEnd = (const char *)
+                    memchr(lineStart, '\n', chunkEnd - lineStart);
+                if (lineEnd == NULL) {
+                    lineEnd = chunkEnd;
+                }
+                parseLine(lineStart, lineEnd, lineNumber, chunkResults[c]);
+                lineNumber++;
+                lineStart = lineEnd + 1;
+            }
+        }
+        catch (...) {
+            chunkErrors[c] = std::current_exception();
+        }
+    };
+
+    if (nChunks == 1) {
+        parseChunk(0);
+    }
+    else {
+        std::vector<std::thread> threads;
+        for (unsigned int c = 1; c < nChunks; c++) {
+            threads.push_back(std::thread(parseChunk, c));
+        }
+        parseChunk(0);
+        for (unsigned int i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+    }
+
+    for (unsigned int c = 0; c < nChunks; c++) {
+        if (chunkErrors[c]) {
+            std::rethrow_exception(chunkErrors[c]);
+        }
+    }
+    size_t total = results.size();
+    for (unsigned int c = 0; c < nChunks; c++) {
+        total += chunkResults[c].size();
+    }
+    results.reserve(total);
+    for (unsigned int c = 0; c < nChunks; c++) {
+        for (size_t i = 0; i < chunkResults[c].size(); i++) {
+            results.push_back(std::move(chunkResults[c][i]));
+        }
+        std::vector<T>().swap(chunkResults[c]);
+    }
+}
+
+
+
+}} // close namespace lsst::mops
+
+#endif
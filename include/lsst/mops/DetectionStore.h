@@ -0,0 +1,120 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * DetectionStore: a binary, column-by-column file of detections which
+ * is read by mapping it into memory rather than parsing it.
+ *
+ * Reading a month of detections as text (populateDetVectorFromFile)
+ * costs a getline and an istringstream per detection, and takes longer
+ * than findTracklets itself.  Opening a store costs an mmap, no matter
+ * how many detections it holds; the columns are then available
+ * directly as arrays, and pages are read from disk as they are
+ * touched.
+ *
+ * File layout (all in the byte order of the machine which wrote it,
+ * which is checked on opening):
+ *
+ *   header: magic "MOPSDETS", version, byte-order mark, number of
+ *           detections, and the offset of each column in the file.
+ *   columns: MJD, RA, Dec, RaErr, DecErr, ID, imageID (obsHistId),
+ *            ssmId, mag, SNR, one after another, each one an array
+ *            of nDetections values starting on a 64-byte boundary.
+ *
+ * ssmId is a 32-bit int, ID and imageID 64-bit ints, the rest doubles.
+ *
+ * populateDetVectorFromFile recognizes stores, so the command-line
+ * tools take either kind of file.  convertDetections (see examples/)
+ * writes a store from a text detections file, with the RaErr and
+ * DecErr given to it.  When populateDetVectorFromFile reads a store,
+ * the stored errors are used unless it is given an astromErr > 0,
+ * which then replaces them (as it always does for text files, which
+ * have no errors of their own).
+ */
+
+
+#ifndef LSST_DETECTION_STORE_H
+#define LSST_DETECTION_STORE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "MopsDetection.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+class DetectionStore {
+public:
+    /* maps the store in fileName.  Throws FileException if it can't be
+     * opened or mapped, InputFileFormatErrorException if it isn't a
+     * store (or was written on a machine of the other byte order). */
+    DetectionStore(const std::string &fileName);
+
+    ~DetectionStore();
+
+    /* true iff fileName starts with a store's magic string. */
+    static bool isDetectionStore(const std::string &fileName);
+
+    unsigned int size() const { return nDetections; }
+
+    /* the columns themselves, each size() long.  They stay valid as
+     * long as the store does. */
+    const double *getMJDs() const { return (const double *) columns[MJD_COLUMN]; }
+    const double *getRAs() const { return (const double *) columns[RA_COLUMN]; }
+    const double *getDecs() const { return (const double *) columns[DEC_COLUMN]; }
+    const double *getRaErrs() const { return (const double *) columns[RA_ERR_COLUMN]; }
+    const double *getDecErrs() const { return (const double *) columns[DEC_ERR_COLUMN]; }
+    const int64_t *getIDs() const { return (const int64_t *) columns[ID_COLUMN]; }
+    const int64_t *getImageIDs() const { return (const int64_t *) columns[IMAGE_ID_COLUMN]; }
+    const int32_t *getSsmIds() const { return (const int32_t *) columns[SSM_ID_COLUMN]; }
+    const double *getMags() const { return (const double *) columns[MAG_COLUMN]; }
+    const double *getSNRs() const { return (const double *) columns[SNR_COLUMN]; }
+
+    MopsDetection getDetection(unsigned int i) const;
+
+    /* append every detection in the store to dets. */
+    void appendDetections(std::vector<MopsDetection> &dets) const;
+
+    enum Column { MJD_COLUMN = 0,
+                  RA_COLUMN,
+                  DEC_COLUMN,
+                  RA_ERR_COLUMN,
+                  DEC_ERR_COLUMN,
+                  ID_COLUMN,
+                  IMAGE_ID_COLUMN,
+                  SSM_ID_COLUMN,
+                  MAG_COLUMN,
+                  SNR_COLUMN,
+                  N_COLUMNS };
+
+private:
+    // no copying: we own the mapping.
+    DetectionStore(const DetectionStore &);
+    DetectionStore & operator=(const DetectionStore &);
+
+    void *mapped;
+    size_t mappedSize;
+    unsigned int nDetections;
+    const char *columns[N_COLUMNS];
+};
+
+
+
+/* write dets to a new store in fileName, replacing any file there. */
+void writeDetectionStore(const std::vector<MopsDetection> &dets,
+                         const std::string &fileName);
+
+/* read a text detections file (see MopsDetection::fromString) and write
+ * its detections to a store.  RaErr and DecErr are set to astromErr. */
+void convertDetectionFileToStore(const std::string &detsFileName,
+                                 const std::string &storeFileName,
+                                 double astromErr = 0.0);
+
+
+}} // close namespace lsst::mops
+
+#endif
@@ -0,0 +1,182 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * ImageIndex: numbers the distinct images (detection MJDs) of a set of
+ * detections 0, 1, ... in order of time, and groups them into nights,
+ * also numbered in order of time.
+ *
+ * Comparing and sorting doubles, and keeping maps keyed on them, is
+ * both slow and fragile; once this is done, the rest of the code can
+ * talk about images and nights with small dense integers instead.
+ * These are also stored in the detections themselves (see
+ * MopsDetection::getImageIndex, getNightIndex) by labelDetections.
+ *
+ * There is no notion of observatory or local time here: two images are
+ * on the same night iff there is no gap of more than half a day between
+ * them (NIGHT_GAP) among the image times.
+ */
+
+
+#ifndef LSST_IMAGE_INDEX_H
+#define LSST_IMAGE_INDEX_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "lsst/mops/MopsDetection.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+class ImageIndex {
+public:
+    ImageIndex();
+    ImageIndex(const std::vector<MopsDetection> &allDetections);
+
+    /* as above, but the images are those at allImageMjds (in any
+     * order; repeats are ignored), which must include the time of
+     * every detection.  So images and nights are numbered just as
+     * they would be for the detections of all those images, though
+     * we only have some of them (say, those of one part of the sky).
+     * Throws BadParameterException if a detection's time is missing. */
+    ImageIndex(const std::vector<MopsDetection> &allDetections,
+               const std::vector<double> &allImageMjds);
+
+    /* largest gap (in days) between two images of the same night. */
+    static const double NIGHT_GAP;
+
+    unsigned int getNumImages() const { return imageMjds.size(); }
+    unsigned int getNumNights() const { return nNights; }
+
+    /* i is an index into the detections we were built from. */
+    unsigned int getImageOfDetection(unsigned int i) const {
+        return detImages[i];
+    }
+    unsigned int getNightOfDetection(unsigned int i) const {
+        return imageNights[detImages[i]];
+    }
+
+    double getImageMJD(unsigned int image) const {
+        return imageMjds[image];
+    }
+    unsigned int getNightOfImage(unsigned int image) const {
+        return imageNights[image];
+    }
+
+    /* the images after image taken between minDt and maxDt days
+     * (inclusive) after it are firstImage, ..., endImage - 1; found by
+     * binary search, as the image times are sorted. */
+    void getLaterImagesInRange(unsigned int image, double minDt, double maxDt,
+                               unsigned int &firstImage,
+                               unsigned int &endImage) const;
+
+    /* set the image and night index of every detection.  allDetections
+     * must be the same detections, in the same order, as we were built
+     * from. */
+    void labelDetections(std::vector<MopsDetection> &allDetections) const;
+
+private:
+    friend class ImageGrouping;
+
+    /* given the sorted imageMjds, set detImages and number the nights. */
+    void indexDetections(const std::vector<MopsDetection> &allDetections);
+
+    std::vector<unsigned int> detImages;
+    std::vector<double> imageMjds;
+    std::vector<unsigned int> imageNights;
+    unsigned int nNights;
+};
+
+
+
+/*
+ * ImageGrouping groups a set of items (detections, tracklets, ...) by
+ * image without copying them.  The item indices are sorted by image
+ * with a counting sort, which is stable, so the items of each image
+ * keep their original order; those of image i are then
+ * itemsBegin(i) ... itemsEnd(i) - 1.  This costs 4 bytes per item plus
+ * 4 per image, however big the items are.
+ */
+class ImageGrouping {
+public:
+    ImageGrouping() { offsets.push_back(0); }
+
+    /* item i is in image itemImages[i], which must be < nImages. */
+    ImageGrouping(const std::vector<unsigned int> &itemImages,
+                  unsigned int nImages);
+
+    /* the detections imageIndex was built from, by image. */
+    explicit ImageGrouping(const ImageIndex &imageIndex);
+
+    unsigned int getNumImages() const { return offsets.size() - 1; }
+
+    const unsigned int *itemsBegin(unsigned int image) const {
+        return order.data() + offsets[image];
+    }
+    const unsigned int *itemsEnd(unsigned int image) const {
+        return order.data() + offsets[image + 1];
+    }
+    unsigned int getNumItems(unsigned int image) const {
+        return offsets[image + 1] - offsets[image];
+    }
+
+private:
+    void build(const std::vector<unsigned int> &itemImages,
+               unsigned int nImages);
+
+    std::vector<unsigned int> order;
+    // getNumImages() + 1 long.
+    std::vector<unsigned int> offsets;
+};
+
+
+
+/*
+ * DistinctIndexCounter counts the distinct values among a small set of
+ * image or night indices, using one bit per possible value.  clear()
+ * only zeroes the words which were touched, so a single counter can be
+ * reused for many small sets at almost no cost.
+ */
+class DistinctIndexCounter {
+public:
+    DistinctIndexCounter() { nDistinct = 0; }
+
+    /* make room for values in [0, nValues) up front; add() grows the
+     * counter as needed in any case.  Also clears the counter. */
+    void resize(unsigned int nValues);
+
+    /* returns true iff i had not been added since the last clear(). */
+    bool add(unsigned int i) {
+        unsigned int word = i >> 6;
+        uint64_t bit = ((uint64_t) 1) << (i & 63);
+        if (word >= words.size()) {
+            words.resize(word + 1, 0);
+        }
+        if (words[word] & bit) {
+            return false;
+        }
+        if (words[word] == 0) {
+            touchedWords.push_back(word);
+        }
+        words[word] |= bit;
+        nDistinct++;
+        return true;
+    }
+
+    unsigned int count() const { return nDistinct; }
+
+    void clear();
+
+private:
+    std::vector<uint64_t> words;
+    std::vector<unsigned int> touchedWords;
+    unsigned int nDistinct;
+};
+
+
+}} // close namespace lsst::mops
+
+#endif
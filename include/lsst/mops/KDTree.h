@@ -17,6 +17,10 @@
  * class which holds an K-dimensional vector of doubles (the spatial data, a
  * point) and some other data (the value)
  *
+ * KDTree<T, K> and PointAndValue<T, K> hold K-dimensional points inline (see
+ * PointAndValue.h); KDTree<T> takes points of any length, and searches use
+ * only the first k dimensions of them.
+ *
  * Since PointAndValue is a template class, KDTree also becomes a template
  * class. Template classes must keep all code in the header files.  This is a
  * really ugly and unfortunate mess.  To keep things readable, declarations will
@@ -31,6 +35,9 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <exception>
+#include <thread>
+#include <utility>
 
 #include "common.h"  
 #include "Exceptions.h"
@@ -43,8 +50,8 @@ namespace lsst {
 namespace mops {
 
     
-    template <class T>
-    class KDTree : public BaseKDTree<T, KDTreeNode<T> > {
+    template <class T, unsigned int K = 0>
+    class KDTree : public BaseKDTree<T, KDTreeNode<T, K>, K> {
     public:
 
 
@@ -63,9 +70,15 @@ namespace mops {
          *
          * maxLeafSize should be a positive integer.
          *
+         * large trees are built on up to nThreads threads (0: one per
+         * core); the tree is the same however many are used.  Building
+         * on more than one thread is only worth it for a tree built
+         * when nothing else is running.
+         *
          */
-        KDTree(std::vector<PointAndValue <T> > pointsAndValues, 
-               unsigned int k, unsigned int maxLeafSize);
+        KDTree(const std::vector<PointAndValue<T, K> > &pointsAndValues, 
+               unsigned int k, unsigned int maxLeafSize,
+               unsigned int nThreads=1);
 
 
         /* rangeSearch: given a point queryPt and a range queryRange, treat all
@@ -75,8 +88,8 @@ namespace mops {
          * 
          * if queryPt is not of the same dimensions as the tree, an exception will be thrown.
          */
-        std::vector<PointAndValue <T> > 
-        rangeSearch(std::vector<double> queryPt,
+        std::vector<PointAndValue<T, K> > 
+        rangeSearch(const std::vector<double> &queryPt,
                     double queryRange) const;
 
 
@@ -151,7 +164,7 @@ namespace mops {
          * More formal documentation is TBD.  Hopefully the examples are
          * sufficiently illustrative.
          */
-        std::vector<PointAndValue <T> > 
+        std::vector<PointAndValue<T, K> > 
             RADecRangeSearch(const std::vector<double> &RADecQueryPoint, 
                              double RADecQueryRange, 
 			     const std::vector<double> &otherDimsPoint,
@@ -191,22 +204,128 @@ namespace mops {
          * as k-dimensional and Euclidean.
          *
          */
-        std::vector<PointAndValue <T> > 
+        std::vector<PointAndValue<T, K> > 
         hyperRectangleSearch(const std::vector<double> &queryPt, 
                              const std::vector<double> &tolerances, 
                              const std::vector<GeometryType> 
                                     &spaceTypesByDimension) 
             const;
 
+        /*
+         * as rangeSearch, RADecRangeSearch and hyperRectangleSearch above,
+         * but rather than returning a vector of matches, call
+         * visit(match) with a const PointAndValue<T, K> & for each, in the
+         * order they would have been returned.  match is part of the tree,
+         * so is good for as long as the tree is.  visit is copied; give it
+         * anything it should change by reference, e.g. as a lambda's
+         * capture.  To copy the matches to an output iterator out, visit
+         * can be [&](const PointAndValue<T, K> &match) { *out++ = match; }
+         */
+        template <class Visitor>
+        void rangeSearch(const std::vector<double> &queryPt,
+                         double queryRange,
+                         Visitor visit) const;
+
+        template <class Visitor>
+        void RADecRangeSearch(const std::vector<double> &RADecQueryPoint, 
+                              double RADecQueryRange, 
+                              const std::vector<double> &otherDimsPoint,
+                              const std::vector<double> &otherDimsTolerances,
+                              const std::vector<GeometryType> 
+                                 &spaceTypesByDimension,
+                              Visitor visit) const; 
+
+        template <class Visitor>
+        void hyperRectangleSearch(const std::vector<double> &queryPt, 
+                                  const std::vector<double> &tolerances, 
+                                  const std::vector<GeometryType> 
+                                     &spaceTypesByDimensions,
+                                  Visitor visit) const;
+
+        /*
+         * RADecRangeSearchBatch: do a RADecRangeSearch around each of many
+         * points.  RADecQueryPoints holds the RA and Dec of query 0, then
+         * those of query 1, and so on; otherDimsPoints likewise holds the
+         * otherDimsPoint (k - 2 values) of each query in turn.  The range,
+         * other tolerances and space types are the same for every query.
+         *
+         * visit(q, match) is called for each match of query q, for queries
+         * 0, 1, ... in turn, just as calling RADecRangeSearch for each
+         * would.  Only one set of search parameters is allocated for all
+         * the queries.
+         *
+         * Large batches are shared among up to nThreads threads (0: one
+         * per core).  Each keeps its matches apart until all are done, so
+         * visit is only called from the calling thread, and in the same
+         * order however many threads are used.
+         */
+        template <class Visitor>
+        void RADecRangeSearchBatch(const std::vector<double> &RADecQueryPoints,
+                                   double RADecQueryRange,
+                                   const std::vector<double> &otherDimsPoints,
+                                   const std::vector<double> &otherDimsTolerances,
+                                   const std::vector<GeometryType> 
+                                      &spaceTypesByDimension,
+                                   Visitor visit,
+                                   unsigned int nThreads=1) const;
+
+        /*
+         * RADecPairSearch: find every pair of a point p of this tree and a
+         * point q of otherTree with minDistance <= d < maxDistance, where d
+         * is the great-circle distance (in degrees) between them.  The
+         * first two dimensions of both trees must be RA and Dec in [0,
+         * 360); any others are ignored.  The pair (p's value, q's value)
+         * is appended to results for each.
+         *
+         * This gives just what a RADecRangeSearch around each point of
+         * this tree would (less those nearer than minDistance), but walks
+         * the two trees together: a pair of nodes is dropped as soon as
+         * their bounding boxes are certainly too far apart (or too close
+         * together), and only pairs of leaves are compared point by
+         * point.  When the trees are dense, this visits far fewer nodes
+         * than searching for each point separately.  Results come out in
+         * an order set by the shapes of the trees.
+         */
+        void RADecPairSearch(const KDTree<T, K> &otherTree,
+                             double minDistance, double maxDistance,
+                             std::vector<std::pair<T, T> > &results) const;
+
         /* turns out we don't automatically inherit BaseKDTree's
          * constructors/destructors because it's not a direct
          * ancestor, due to template issues.  We'll have to copy-pase
          * the code, for now. . TBD: Does anyone know a better way to
          * avoid this ugliness?
          */
-        KDTree<T>() { this->setUpEmptyTree() ;}
-        ~KDTree<T>() { this->clearPrivateData(); }
-
+        KDTree() { this->setUpEmptyTree() ;}
+        ~KDTree() { this->clearPrivateData(); }
+
+    private:
+
+        /* checks the parameters of a RADecRangeSearch (but for the
+         * query point) and finds the RA and Dec dimensions. */
+        void checkRADecSearchParameters(double RADecQueryRange,
+                                        const std::vector<double> &otherDimsTolerances,
+                                        const std::vector<GeometryType> 
+                                           &spaceTypesByDimension,
+                                        unsigned int &RADimIndex,
+                                        unsigned int &DecDimIndex) const;
+
+        /* the search itself, once the parameters have been checked;
+         * realQueryPoint, realQueryTolerances and realQueryTypes are
+         * scratch space for the hyperRectangleSearch. */
+        template <class Visitor>
+        void RADecRangeSearchChecked(double RA, double Dec,
+                                     double RADecQueryRange,
+                                     const double *otherDimsPoint,
+                                     const std::vector<double> &otherDimsTolerances,
+                                     const std::vector<GeometryType> 
+                                        &spaceTypesByDimension,
+                                     unsigned int RADimIndex,
+                                     unsigned int DecDimIndex,
+                                     std::vector<double> &realQueryPoint,
+                                     std::vector<double> &realQueryTolerances,
+                                     std::vector<GeometryType> &realQueryTypes,
+                                     Visitor &visit) const;
 
     };
 
@@ -218,12 +337,13 @@ namespace mops {
 
 
 
-template <class T>
-KDTree<T>::KDTree(std::vector<PointAndValue <T> > pointsAndValues,
-                       unsigned int k, unsigned int maxLeafSize) 
+template <class T, unsigned int K>
+KDTree<T, K>::KDTree(const std::vector<PointAndValue<T, K> > &pointsAndValues,
+                  unsigned int k, unsigned int maxLeafSize,
+                  unsigned int nThreads) 
 {
     this->setUpEmptyTree();
-    this->buildFromData(pointsAndValues, k, maxLeafSize);
+    this->buildFromData(pointsAndValues, k, maxLeafSize, nThreads);
 }
 
 
@@ -236,18 +356,37 @@ KDTree<T>::KDTree(std::vector<PointAndValue <T> > pointsAndValues,
 
 
 
-template <class T>
-std::vector<PointAndValue <T> > 
-KDTree<T>::rangeSearch(std::vector<double> queryPt,
+template <class T, unsigned int K>
+std::vector<PointAndValue<T, K> > 
+KDTree<T, K>::rangeSearch(const std::vector<double> &queryPt,
 		       double queryRange) const
+{
+    std::vector<PointAndValue<T, K> > results;
+    rangeSearch(queryPt, queryRange, 
+                [&results](const PointAndValue<T, K> &match) {
+                    results.push_back(match);
+                });
+    return results;
+}
+
+
+
+template <class T, unsigned int K>
+template <class Visitor>
+void KDTree<T, K>::rangeSearch(const std::vector<double> &queryPt,
+                               double queryRange,
+                               Visitor visit) const
 {
     /* sanity check */
     if (queryPt.size() != this->myK)
     {
         throw LSST_EXCEPT(BadParameterException, "KDTree::rangeSearch:  got myK != queryPoint size");
     }
+    if (this->hasData != true) {
+        return;
+    }
     /* just punt to the KDTreeNode. */
-    return this->myRoot->rangeSearch(queryPt, queryRange);
+    this->myRoot->rangeSearch(queryPt, queryRange, visit);
 }
     
     
@@ -256,24 +395,173 @@ KDTree<T>::rangeSearch(std::vector<double> queryPt,
     
     
 
-template <class T>
-std::vector<PointAndValue <T> > 
-KDTree<T>::RADecRangeSearch(const std::vector<double> &RADecQueryPoint, 
+template <class T, unsigned int K>
+std::vector<PointAndValue<T, K> > 
+KDTree<T, K>::RADecRangeSearch(const std::vector<double> &RADecQueryPoint, 
                             double RADecQueryRange, 
 			    const std::vector<double> &otherDimsPoint,
                             const std::vector<double> &otherDimsTolerances,
                             const std::vector<GeometryType> &spaceTypesByDimension)  const
 {
-    /*
-     * this function is implemented by finding a series of rectangles which will
-     * enscribe the actual circle along the surface of the sphere. These
-     * rectangles are searched with hyperRectangleSearch (along with the
-     * additional parameters) and results are pruned.
-     */
+    std::vector<PointAndValue<T, K> > prunedResults;
+    RADecRangeSearch(RADecQueryPoint, RADecQueryRange, otherDimsPoint,
+                     otherDimsTolerances, spaceTypesByDimension,
+                     [&prunedResults](const PointAndValue<T, K> &match) {
+                         prunedResults.push_back(match);
+                     });
+    return prunedResults;
+}
+
 
+
+template <class T, unsigned int K>
+template <class Visitor>
+void KDTree<T, K>::RADecRangeSearch(const std::vector<double> &RADecQueryPoint, 
+                                    double RADecQueryRange, 
+                                    const std::vector<double> &otherDimsPoint,
+                                    const std::vector<double> &otherDimsTolerances,
+                                    const std::vector<GeometryType> &spaceTypesByDimension,
+                                    Visitor visit) const
+{
     // step 1: check input data.
     if ((RADecQueryPoint.size() != 2) || 
-        (otherDimsPoint.size() != this->myK - 2) || 
+        (otherDimsPoint.size() != this->myK - 2)) {
+        throw LSST_EXCEPT(BadParameterException, 
+    "KDTree::RADecRangeSearch called with illegal parameters.");
+    }
+    unsigned int RADimIndex, DecDimIndex;
+    checkRADecSearchParameters(RADecQueryRange, otherDimsTolerances,
+                               spaceTypesByDimension, RADimIndex, DecDimIndex);
+    if (this->hasData != true) {
+        return;
+    }
+    std::vector<double> realQueryPoint;
+    std::vector<double> realQueryTolerances;
+    std::vector<GeometryType> realQueryTypes;
+    RADecRangeSearchChecked(RADecQueryPoint[0], RADecQueryPoint[1],
+                            RADecQueryRange, otherDimsPoint.data(), 
+                            otherDimsTolerances, spaceTypesByDimension,
+                            RADimIndex, DecDimIndex,
+                            realQueryPoint, realQueryTolerances, realQueryTypes,
+                            visit);
+}
+
+
+
+template <class T, unsigned int K>
+template <class Visitor>
+void KDTree<T, K>::RADecRangeSearchBatch(const std::vector<double> &RADecQueryPoints,
+                                         double RADecQueryRange,
+                                         const std::vector<double> &otherDimsPoints,
+                                         const std::vector<double> &otherDimsTolerances,
+                                         const std::vector<GeometryType> &spaceTypesByDimension,
+                                         Visitor visit,
+                                         unsigned int nThreads) const
+{
+    // below this many queries per thread, threads cost more than they save.
+    static const unsigned int MIN_QUERIES_PER_THREAD = 256;
+
+    unsigned int RADimIndex, DecDimIndex;
+    checkRADecSearchParameters(RADecQueryRange, otherDimsTolerances,
+                               spaceTypesByDimension, RADimIndex, DecDimIndex);
+    unsigned int nOtherDims = this->myK - 2;
+    unsigned int nQueries = RADecQueryPoints.size() / 2;
+    if ((RADecQueryPoints.size() % 2 != 0) || 
+        (otherDimsPoints.size() != nQueries * nOtherDims)) {
+        throw LSST_EXCEPT(BadParameterException, 
+    "KDTree::RADecRangeSearchBatch: need 2 RA, Dec values and k - 2 other values for each query.");
+    }
+    if ((this->hasData != true) || (nQueries == 0)) {
+        return;
+    }
+
+    if (nThreads == 0) {
+        nThreads = std::thread::hardware_concurrency();
+    }
+    unsigned int nChunks = nQueries / MIN_QUERIES_PER_THREAD;
+    if (nChunks > nThreads) {
+        nChunks = nThreads;
+    }
+    if (nChunks < 1) {
+        nChunks = 1;
+    }
+
+    /* search queries firstQuery ... endQuery - 1, calling 
+     * visitQuery(q, match) for each match. */
+    auto searchQueries = [&](unsigned int firstQuery, unsigned int endQuery,
+                             auto &visitQuery) {
+        std::vector<double> realQueryPoint;
+        std::vector<double> realQueryTolerances;
+        std::vector<GeometryType> realQueryTypes;
+        for (unsigned int q = firstQuery; q < endQuery; q++) {
+            auto visitMatch = [&visitQuery, q](const PointAndValue<T, K> &match) {
+                visitQuery(q, match);
+            };
+            RADecRangeSearchChecked(RADecQueryPoints[2 * q], 
+                                    RADecQueryPoints[2 * q + 1],
+                                    RADecQueryRange, 
+                                    otherDimsPoints.data() + q * nOtherDims,
+                                    otherDimsTolerances, spaceTypesByDimension,
+                                    RADimIndex, DecDimIndex,
+                                    realQueryPoint, realQueryTolerances, 
+                                    realQueryTypes, visitMatch);
+        }
+    };
+
+    if (nChunks == 1) {
+        searchQueries(0, nQueries, visit);
+        return;
+    }
+
+    typedef std::pair<unsigned int, const PointAndValue<T, K> *> QueryMatch;
+    std::vector<std::vector<QueryMatch> > chunkMatches(nChunks);
+    std::vector<std::exception_ptr> chunkErrors(nChunks);
+    auto searchChunk = [&](unsigned int c) {
+        try {
+            std::vector<QueryMatch> &matches = chunkMatches[c];
+            auto keepMatch = [&matches](unsigned int q, 
+                                        const PointAndValue<T, K> &match) {
+                matches.push_back(QueryMatch(q, &match));
+            };
+            searchQueries((unsigned long) nQueries * c / nChunks,
+                          (unsigned long) nQueries * (c + 1) / nChunks,
+                          keepMatch);
+        }
+        catch (...) {
+            chunkErrors[c] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int c = 1; c < nChunks; c++) {
+        threads.push_back(std::thread(searchChunk, c));
+    }
+    searchChunk(0);
+    for (unsigned int i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    for (unsigned int c = 0; c < nChunks; c++) {
+        if (chunkErrors[c]) {
+            std::rethrow_exception(chunkErrors[c]);
+        }
+    }
+    for (unsigned int c = 0; c < nChunks; c++) {
+        for (unsigned int i = 0; i < chunkMatches[c].size(); i++) {
+            visit(chunkMatches[c][i].first, *(chunkMatches[c][i].second));
+        }
+        std::vector<QueryMatch>().swap(chunkMatches[c]);
+    }
+}
+
+
+
+template <class T, unsigned int K>
+void KDTree<T, K>::checkRADecSearchParameters(double RADecQueryRange,
+                                              const std::vector<double> &otherDimsTolerances,
+                                              const std::vector<GeometryType> &spaceTypesByDimension,
+                                              unsigned int &RADimIndex,
+                                              unsigned int &DecDimIndex) const
+{
+    if ((this->myK < 2) ||
         (otherDimsTolerances.size() != this->myK - 2) || 
         (spaceTypesByDimension.size() != this->myK) ||
         (RADecQueryRange <= 0.0))
@@ -281,22 +569,48 @@ KDTree<T>::RADecRangeSearch(const std::vector<double> &RADecQueryPoint,
         throw LSST_EXCEPT(BadParameterException, 
     "KDTree::RADecRangeSearch called with illegal parameters.");
     }
-    int RADimIndex = -1;
-    int DecDimIndex = -1;
+    int RADim = -1;
+    int DecDim = -1;
     for (unsigned int i = 0; i < spaceTypesByDimension.size(); i++) {
         if (spaceTypesByDimension.at(i) == RA_DEGREES) {
-            RADimIndex = i;
+            RADim = i;
         }
         else if (spaceTypesByDimension.at(i) == DEC_DEGREES) {
-            DecDimIndex = i;
+            DecDim = i;
         }
     }
-    if ((RADimIndex == -1) || (DecDimIndex == -1)) {
-        LSST_EXCEPT(BadParameterException,
+    if ((RADim == -1) || (DecDim == -1)) {
+        throw LSST_EXCEPT(BadParameterException,
                     "KDTree::RADecRangeSearch called with spaceTypesByDimension missing either RA, Dec, or both - this is illegal");        
     }
-    double RACenter =  convertToStandardDegrees(RADecQueryPoint.at(0));
-    double DecCenter = convertToStandardDegrees(RADecQueryPoint.at(1));
+    RADimIndex = RADim;
+    DecDimIndex = DecDim;
+}
+
+
+
+template <class T, unsigned int K>
+template <class Visitor>
+void KDTree<T, K>::RADecRangeSearchChecked(double RA, double Dec,
+                                           double RADecQueryRange,
+                                           const double *otherDimsPoint,
+                                           const std::vector<double> &otherDimsTolerances,
+                                           const std::vector<GeometryType> &spaceTypesByDimension,
+                                           unsigned int RADimIndex,
+                                           unsigned int DecDimIndex,
+                                           std::vector<double> &realQueryPoint,
+                                           std::vector<double> &realQueryTolerances,
+                                           std::vector<GeometryType> &realQueryTypes,
+                                           Visitor &visit) const
+{
+    /*
+     * this function is implemented by finding a series of rectangles which will
+     * enscribe the actual circle along the surface of the sphere. These
+     * rectangles are searched with hyperRectangleSearch (along with the
+     * additional parameters) and results are pruned.
+     */
+    double RACenter =  convertToStandardDegrees(RA);
+    double DecCenter = convertToStandardDegrees(Dec);
 
     /* now, find a set of rectangles which enscribe the RA Dec range.
      * there will be at most 2.
@@ -312,9 +626,6 @@ KDTree<T>::RADecRangeSearch(const std::vector<double> &RADecQueryPoint,
      * actually now have to do a brute force search over all the RA, Dec data! 
      */
 
-    std::vector<double> realQueryPoint;
-    std::vector<double> realQueryTolerances;
-    std::vector<GeometryType> realQueryTypes;
     //Constants
     const double northPole_Dec = 90;
     const double southPole_Dec = 270;
@@ -349,56 +660,70 @@ KDTree<T>::RADecRangeSearch(const std::vector<double> &RADecQueryPoint,
         DecHalfWidth = RADecQueryRange;
     }
     //build the real search params, pass them off to hyperRectangleSearch.
+    realQueryPoint.clear();
+    realQueryTolerances.clear();
+    realQueryTypes.clear();
     unsigned int otherParamsIndexCounter = 0;
     for (unsigned int i = 0; i < this->myK; i++) {
-        if (spaceTypesByDimension.at(i) == RA_DEGREES) {
+        if (spaceTypesByDimension[i] == RA_DEGREES) {
             realQueryPoint.push_back(RACenter);
             realQueryTolerances.push_back(RAHalfWidth);            
             realQueryTypes.push_back(CIRCULAR_DEGREES);
         }
-        else if (spaceTypesByDimension.at(i) == DEC_DEGREES) {
+        else if (spaceTypesByDimension[i] == DEC_DEGREES) {
             realQueryPoint.push_back(DecCenter);
             realQueryTolerances.push_back(DecHalfWidth);
             realQueryTypes.push_back(CIRCULAR_DEGREES);
         }
         else {
-            realQueryPoint.push_back(otherDimsPoint.at(otherParamsIndexCounter));
-            realQueryTolerances.push_back(otherDimsTolerances.at(otherParamsIndexCounter));
-            realQueryTypes.push_back(spaceTypesByDimension.at(i));
+            realQueryPoint.push_back(otherDimsPoint[otherParamsIndexCounter]);
+            realQueryTolerances.push_back(otherDimsTolerances[otherParamsIndexCounter]);
+            realQueryTypes.push_back(spaceTypesByDimension[i]);
             otherParamsIndexCounter++;
         }
     }
              
-    // now do a hyperRectangleSearch with this data. 
-    std::vector<PointAndValue <T> > searchResults;
-    searchResults = this->myRoot->hyperRectangleSearch(
-        realQueryPoint, realQueryTolerances, realQueryTypes);    
-
-    //prune results on angular distance around the center of the RA, Dec query.
-    std::vector<PointAndValue <T> > prunedResults;
-    for (unsigned int i = 0; i < searchResults.size(); i++) {
-        std::vector<double> point = searchResults.at(i).getPoint(); 
-        double resultRA = point.at(RADimIndex);
-        double resultDec = point.at(DecDimIndex);
-
-        if (angularDistanceRADec_deg(resultRA, resultDec, RACenter, DecCenter) 
+    // now do a hyperRectangleSearch with this data, pruning results on
+    // angular distance around the center of the RA, Dec query.
+    auto pruneMatch = [&](const PointAndValue<T, K> &match) {
+        const typename PointAndValue<T, K>::PointType &point = 
+            match.getPoint(); 
+        if (angularDistanceRADec_deg(point[RADimIndex], point[DecDimIndex], 
+                                     RACenter, DecCenter) 
             < RADecQueryRange) {
-            prunedResults.push_back(searchResults.at(i));
+            visit(match);
         }
-    }
-
-    return prunedResults;
+    };
+    this->myRoot->hyperRectangleSearch(
+        realQueryPoint, realQueryTolerances, realQueryTypes, pruneMatch);
 }
     
 
 
 
-template <class T>
-std::vector<PointAndValue <T> > 
-KDTree<T>::hyperRectangleSearch(const std::vector<double> &queryPt,
+template <class T, unsigned int K>
+std::vector<PointAndValue<T, K> > 
+KDTree<T, K>::hyperRectangleSearch(const std::vector<double> &queryPt,
 				const std::vector<double> &tolerances,
 				const std::vector<GeometryType> &spaceTypesByDimensions) const
 {
+    std::vector<PointAndValue<T, K> > toRet;
+    hyperRectangleSearch(queryPt, tolerances, spaceTypesByDimensions,
+                         [&toRet](const PointAndValue<T, K> &match) {
+                             toRet.push_back(match);
+                         });
+    return toRet;
+}
+
+
+
+template <class T, unsigned int K>
+template <class Visitor>
+void KDTree<T, K>::hyperRectangleSearch(const std::vector<double> &queryPt,
+                                        const std::vector<double> &tolerances,
+                                        const std::vector<GeometryType> &spaceTypesByDimensions,
+                                        Visitor visit) const
+{
     
   /* sanity check */
   if ((queryPt.size() != this->myK) || (tolerances.size() != this->myK) || 
@@ -408,9 +733,7 @@ KDTree<T>::hyperRectangleSearch(const std::vector<double> &queryPt,
   }
   if (this->hasData != true) {
       // if we are queried, but do not have any data, return nothing.
-      std::vector<PointAndValue <T> > toRet;
-      toRet.clear();
-      return toRet;
+      return;
     }
   else {
       for (unsigned int i = 0; i < this->myK; i++) {
@@ -426,13 +749,31 @@ KDTree<T>::hyperRectangleSearch(const std::vector<double> &queryPt,
       
       /* just punt to the KDTreeNode. */
       
-      return this->myRoot->hyperRectangleSearch(
-          queryPt, tolerances, spaceTypesByDimensions);
+      this->myRoot->hyperRectangleSearch(
+          queryPt, tolerances, spaceTypesByDimensions, visit);
   }
 }
 
 
 
+template <class T, unsigned int K>
+void KDTree<T, K>::RADecPairSearch(const KDTree<T, K> &otherTree,
+                                double minDistance, double maxDistance,
+                                std::vector<std::pair<T, T> > &results) const
+{
+    if ((this->hasData != true) || (otherTree.hasData != true)) {
+        return;
+    }
+    if ((this->myK < 2) || (otherTree.myK < 2)) {
+        throw LSST_EXCEPT(BadParameterException, 
+                          "KDTree::RADecPairSearch: trees must have RA and Dec dimensions.");
+    }
+    this->myRoot->RADecPairSearch(*(otherTree.myRoot), minDistance, maxDistance,
+                                  results);
+}
+
+
+
 }} // close namespace lsst::mops
 
 #endif
@@ -5,6 +5,7 @@
 #define LSST_KDTREE_NODE_H
 
 #include <iostream>
+#include <utility>
 
 #include "lsst/mops/PointAndValue.h"
 #include "lsst/mops/BaseKDTreeNode.h"
@@ -30,47 +31,66 @@
  * 
  */
 
-static unsigned int lastId2_NULL = 0;
-
 namespace lsst {
 namespace mops {
 
 
-    template <class T>
-    class KDTreeNode: public BaseKDTreeNode <T, KDTreeNode<T> > {
+    template <class T, unsigned int K = 0>
+    class KDTreeNode: public BaseKDTreeNode <T, KDTreeNode<T, K>, K> {
     public: 
 
-        /* create and populate a KDTreeNode.  Caller is trusted that the
-         * Ubounds, LBounds provided correspond to the upper and lower
-         * bounds of data in each dimension from pointsAndValues.
+        /* create and populate a KDTreeNode from the points of
+         * allPointsAndValues with indices first ... last - 1; see
+         * BaseKDTreeNode.
          *
          * automatically sets ref count to 1.
          */
-        KDTreeNode(const std::vector<PointAndValue <T> > &pointsAndValues, 
+        KDTreeNode(const std::vector<PointAndValue<T, K> > &allPointsAndValues, 
+                   unsigned int *first, unsigned int *last,
+                   typename BaseKDTreeNode<T, KDTreeNode<T, K>, K>::AxisValue *scratch,
                    unsigned int k, 
                    unsigned int maxLeafSize, 
                    unsigned int myAxisToSplit, 
                    const std::vector<double> &Ubounds,
                    const std::vector<double> &LBounds, 
-                   unsigned int &lastId=lastId2_NULL) 
+                   unsigned int nSpareThreads=0) 
             
-            : BaseKDTreeNode<T, KDTreeNode<T> >(pointsAndValues, 
+            : BaseKDTreeNode<T, KDTreeNode<T, K>, K>(allPointsAndValues, 
+                                                first, last, scratch,
                                                 k, maxLeafSize, 
                                                 myAxisToSplit, Ubounds,
-                                                LBounds, lastId) {}
+                                                LBounds, nSpareThreads) {}
         
 
 
-        std::vector<PointAndValue <T> > rangeSearch(
-            std::vector<double> queryPt, 
+        std::vector<PointAndValue<T, K> > rangeSearch(
+            const std::vector<double> &queryPt, 
             double queryRange) const; 
     
-        std::vector<PointAndValue <T> > 
+        std::vector<PointAndValue<T, K> > 
         hyperRectangleSearch(const std::vector<double> &queryPt, 
                              const std::vector<double> &tolerances, 
                              const std::vector<GeometryType> &spaceTypesByDimension) const;
 
-        
+        /* as above, but call visit(pointAndValue) for each match
+         * instead of returning them; matches come in the same order. */
+        template <class Visitor>
+        void rangeSearch(const std::vector<double> &queryPt, 
+                         double queryRange,
+                         Visitor &visit) const; 
+
+        template <class Visitor>
+        void hyperRectangleSearch(const std::vector<double> &queryPt, 
+                                  const std::vector<double> &tolerances, 
+                                  const std::vector<GeometryType> &spaceTypesByDimension,
+                                  Visitor &visit) const;
+
+        /* see KDTree::RADecPairSearch. */
+        void RADecPairSearch(const KDTreeNode<T, K> &other,
+                             double minDistance, double maxDistance,
+                             std::vector<std::pair<T, T> > &results) const;
+
+        bool isLeaf() const { return this->myChildren.size() == 0; }
 
     };
 
@@ -80,10 +100,26 @@ namespace mops {
 
 
 
-    template <class T>
-    std::vector<PointAndValue <T> > 
-    KDTreeNode<T>::rangeSearch(std::vector<double> queryPt,
+    template <class T, unsigned int K>
+    std::vector<PointAndValue<T, K> > 
+    KDTreeNode<T, K>::rangeSearch(const std::vector<double> &queryPt,
                                double queryRange) const
+    {
+        std::vector<PointAndValue<T, K> > myResults;
+        auto addResult = [&myResults](const PointAndValue<T, K> &result) {
+            myResults.push_back(result);
+        };
+        rangeSearch(queryPt, queryRange, addResult);
+        return myResults;
+    }
+
+
+
+    template <class T, unsigned int K>
+    template <class Visitor>
+    void KDTreeNode<T, K>::rangeSearch(const std::vector<double> &queryPt,
+                                       double queryRange,
+                                       Visitor &visit) const
     {
         /* if we are not within queryRange[i] of queryPt[i] on either edge,
            and in any direction, then we cannot possibly be within range of
@@ -93,12 +129,11 @@ namespace mops {
            actual search of the data if we are a leaf.
         */
 
-        std::vector<PointAndValue <T> > myResults;
         bool isInRange = true;
         std::vector<double> query(1);
         std::vector<double> uBound(1);
         std::vector<double> lBound(1);
-        typename std::vector<PointAndValue<T>,std::allocator<PointAndValue<T> > >::iterator dataIter;
+        typename std::vector<PointAndValue<T, K>,std::allocator<PointAndValue<T, K> > >::const_iterator dataIter;
 
         for (unsigned int i = 0; i < this->myK; i++)
         {
@@ -116,26 +151,21 @@ namespace mops {
                 /* this is a leaf node, search through the data */
                 for (dataIter = this->myData.begin(); dataIter != this->myData.end();
                      dataIter++) {
-                    if (euclideanDistance(queryPt, dataIter->getPoint(), this->myK) <= queryRange)
+                    std::vector<double> point(dataIter->getPoint().begin(),
+                                              dataIter->getPoint().end());
+                    if (euclideanDistance(queryPt, point, this->myK) <= queryRange)
                     {
-                        myResults.push_back(*dataIter);
+                        visit(*dataIter);
                     }
                 }
             }
             else {
                 /* not a leaf node, so just pass the buck */
-
-                std::vector<PointAndValue<T> > childResults;
                 for (unsigned int i = 0; i < 2; i++) {
-                    childResults = this->myChildren[i].rangeSearch(queryPt, queryRange);
-                    for (dataIter = childResults.begin(); dataIter != childResults.end();
-                         dataIter++) {
-                        myResults.push_back(*dataIter);
-                    }
+                    this->myChildren[i].rangeSearch(queryPt, queryRange, visit);
                 }
             }
         }
-        return myResults;
     }
 
 
@@ -143,15 +173,30 @@ namespace mops {
 
 
 
-template <class T>
-std::vector<PointAndValue <T> > 
-KDTreeNode<T>::hyperRectangleSearch(const std::vector<double> &queryPt,
+template <class T, unsigned int K>
+std::vector<PointAndValue<T, K> > 
+KDTreeNode<T, K>::hyperRectangleSearch(const std::vector<double> &queryPt,
 				    const std::vector<double> &tolerances,
 				    const std::vector<GeometryType> &spaceTypesByDimension) 
     const 
 {
-    std::vector<PointAndValue <T> > myResults;
+    std::vector<PointAndValue<T, K> > myResults;
+    auto addResult = [&myResults](const PointAndValue<T, K> &result) {
+        myResults.push_back(result);
+    };
+    hyperRectangleSearch(queryPt, tolerances, spaceTypesByDimension, addResult);
+    return myResults;
+}
+
 
+
+template <class T, unsigned int K>
+template <class Visitor>
+void KDTreeNode<T, K>::hyperRectangleSearch(const std::vector<double> &queryPt,
+                                            const std::vector<double> &tolerances,
+                                            const std::vector<GeometryType> &spaceTypesByDimension,
+                                            Visitor &visit) const 
+{
     /* 
      * just like for rangeSearch, we want to return nothing if queryPt is too
      * far from our representative space; otherwise, we want to either pass the
@@ -197,14 +242,9 @@ KDTreeNode<T>::hyperRectangleSearch(const std::vector<double> &queryPt,
         if (this->myChildren.size() != 0) {
             /* punt to the children */
             for (unsigned int i = 0; i < this->myChildren.size(); i++) {
-                std::vector<PointAndValue <T> > childResults;
-                childResults = this->myChildren[i].hyperRectangleSearch(queryPt, tolerances, 
-                                                                  spaceTypesByDimension);
-
-                for (unsigned int j = 0; j < childResults.size(); j++) {                    
-
-                    myResults.push_back(childResults[j]);
-                }                   
+                this->myChildren[i].hyperRectangleSearch(queryPt, tolerances, 
+                                                         spaceTypesByDimension,
+                                                         visit);
             }
 
         }
@@ -213,21 +253,20 @@ KDTreeNode<T>::hyperRectangleSearch(const std::vector<double> &queryPt,
             for (unsigned int i = 0; i < this->myData.size(); i++) {                
                 isInRange = true;
                 for (unsigned int j = 0; j < this->myK; j++) {
-                    std::vector<double> point = this->myData[i].getPoint();
+                    const typename PointAndValue<T, K>::PointType &point = 
+                        this->myData[i].getPoint();
                     if (distance1D(point[j], queryPt[j], spaceTypesByDimension[j]) > tolerances[j]) {
                         isInRange = false;
                     }
                 }
                 if (isInRange == true) {
-                    myResults.push_back(this->myData[i]);
+                    visit(this->myData[i]);
                 }
             }
             
         }
         
     }
-    
-    return myResults;
 }
 
  
@@ -236,6 +275,98 @@ KDTreeNode<T>::hyperRectangleSearch(const std::vector<double> &queryPt,
 
 
 
+template <class T, unsigned int K>
+void KDTreeNode<T, K>::RADecPairSearch(const KDTreeNode<T, K> &other,
+                                    double minDistance, double maxDistance,
+                                    std::vector<std::pair<T, T> > &results) const
+{
+    double minBoxDist, maxBoxDist;
+    angularDistanceBoundsRADecBoxes_deg(this->myLBounds[0], this->myUBounds[0],
+                                        this->myLBounds[1], this->myUBounds[1],
+                                        other.myLBounds[0], other.myUBounds[0],
+                                        other.myLBounds[1], other.myUBounds[1],
+                                        minBoxDist, maxBoxDist);
+    // the bounds are computed differently from the distances between
+    // points, so leave room for rounding before dropping anything.
+    if ((minBoxDist > maxDistance * (1. + 1e-9) + 1e-12) ||
+        (maxBoxDist < minDistance * (1. - 1e-9) - 1e-12)) {
+        return;
+    }
+
+    if (isLeaf() && other.isLeaf()) {
+        /* compare the leaves point by point.  Copy out the other
+         * leaf's points once, rather than once per pair, and skip the
+         * trig for pairs which are certainly too far apart. */
+        static thread_local std::vector<double> otherRAs;
+        static thread_local std::vector<double> otherDecs;
+        static thread_local std::vector<double> otherCosDecs;
+        otherRAs.resize(other.myData.size());
+        otherDecs.resize(other.myData.size());
+        otherCosDecs.resize(other.myData.size());
+        for (unsigned int j = 0; j < other.myData.size(); j++) {
+            const typename PointAndValue<T, K>::PointType &point = 
+                other.myData[j].getPoint();
+            otherRAs[j] = point[0];
+            otherDecs[j] = point[1];
+            otherCosDecs[j] = cos(point[1] * M_PI / 180.);
+        }
+        double sinHalfMaxDistance = sin(maxDistance * M_PI / 360.);
+        double sinSqHalfMaxDistance = sinHalfMaxDistance * sinHalfMaxDistance;
+        for (unsigned int i = 0; i < this->myData.size(); i++) {
+            const typename PointAndValue<T, K>::PointType &point = 
+                this->myData[i].getPoint();
+            double ra = point[0];
+            double dec = point[1];
+            for (unsigned int j = 0; j < other.myData.size(); j++) {
+                if ((circularShortestPathLen_Deg(dec, otherDecs[j]) > maxDistance) ||
+                    angularDistanceCertainlyAbove(ra, dec, otherRAs[j], otherDecs[j],
+                                                  otherCosDecs[j], 
+                                                  sinSqHalfMaxDistance)) {
+                    continue;
+                }
+                double d = angularDistanceRADec_deg(ra, dec, 
+                                                    otherRAs[j], otherDecs[j]);
+                if ((d < maxDistance) && (d >= minDistance)) {
+                    results.push_back(std::make_pair(this->myData[i].getValue(),
+                                                     other.myData[j].getValue()));
+                }
+            }
+        }
+        return;
+    }
+
+    /* split whichever node covers more of the sky (or the one which
+     * isn't a leaf). */
+    bool splitThis;
+    if (isLeaf()) {
+        splitThis = false;
+    }
+    else if (other.isLeaf()) {
+        splitThis = true;
+    }
+    else {
+        double thisSize = (this->myUBounds[0] - this->myLBounds[0]) + 
+            (this->myUBounds[1] - this->myLBounds[1]);
+        double otherSize = (other.myUBounds[0] - other.myLBounds[0]) + 
+            (other.myUBounds[1] - other.myLBounds[1]);
+        splitThis = (thisSize >= otherSize);
+    }
+    if (splitThis) {
+        for (unsigned int i = 0; i < this->myChildren.size(); i++) {
+            this->myChildren[i].RADecPairSearch(other, minDistance, maxDistance,
+                                                results);
+        }
+    }
+    else {
+        for (unsigned int i = 0; i < other.myChildren.size(); i++) {
+            RADecPairSearch(other.myChildren[i], minDistance, maxDistance,
+                            results);
+        }
+    }
+}
+
+
+
 }} // close namespace lsst::mops
 
 #endif
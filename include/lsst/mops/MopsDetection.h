@@ -42,6 +42,10 @@ public:
     long int getID() const ;
     long int getIndex() const ;
     long int getImageID() const;
+    // dense image and night numbers, or -1 if never set.  See
+    // ImageIndex.
+    long int getImageIndex() const;
+    long int getNightIndex() const;
     double getEpochMJD() const ;
     double getRA() const ;
     double getDec() const ;
@@ -55,6 +59,8 @@ public:
     void setID(long int newId);
     void setIndex(long int newId);
     void setImageID(long int);
+    void setImageIndex(long int);
+    void setNightIndex(long int);
     void setEpochMJD(double newMjd);
     void setRA(double newRa);
     void setDec(double newDec);
@@ -63,6 +69,8 @@ public:
     void setSsmId(int newSsmId);
     void setRaErr(double RaErr);
     void setDecErr(double DecErr);
+    // as worked out earlier by calculateTopoCorr (say, before saving).
+    void setRaTopoCorr(double newRaTopoCorr);
     void calculateTopoCorr();
 
     static void setObservatoryLocation(double obsLat, double obsLong);
@@ -82,6 +90,8 @@ private:
     double RaTopoCorr = 0.0;
     int ssmId;
     long int imageID;
+    long int imageIndex = -1;
+    long int nightIndex = -1;
     double mag;
     double snr;
 };
@@ -22,6 +22,7 @@
 #define LSST_POINT_AND_VALUE_H
 
 
+#include <array>
 #include <iostream>
 #include <vector>
 
@@ -29,14 +30,52 @@ namespace lsst {
 namespace mops {
 
 
-    template <class T>
+    /*
+     * PointAndValue<T, K> holds a K-dimensional point inline, in a
+     * std::array, so making, copying and reading one never touches
+     * the heap.  Use it (and KDTree<T, K>) where the number of
+     * dimensions is known at compile time.
+     *
+     * PointAndValue<T> (K = 0) holds a point of any length in a
+     * std::vector, as it always has.
+     */
+    template <class T, unsigned int K = 0>
     class PointAndValue {
 
     public:
-        void setPoint(std::vector <double> point) { myPoint = point; }
+        typedef std::array<double, K> PointType;
+
+        void setPoint(const PointType &point) { myPoint = point; }
+        void setValue(T value) { myValue = value; }
+    
+        const PointType &getPoint() const { return myPoint; }
+        T getValue() const { return myValue; }
+
+        void debugPrint() {
+            std::cout << " my Point: [";            
+            for (unsigned int i = 0; i < K; i++) {
+                std::cout << myPoint[i];
+            }
+            std::cout << "\n my Value: [" << myValue << std::endl;
+        }
+    
+    private:
+        T myValue;
+        PointType myPoint;
+    };
+
+
+
+    template <class T>
+    class PointAndValue<T, 0> {
+
+    public:
+        typedef std::vector<double> PointType;
+
+        void setPoint(const PointType &point) { myPoint = point; }
         void setValue(T value) { myValue = value; }
     
-        std::vector <double> getPoint() const { return myPoint; }
+        const PointType &getPoint() const { return myPoint; }
         T getValue() const { return myValue; }
 
         void debugPrint() {
@@ -49,7 +88,7 @@ namespace mops {
     
     private:
         T myValue;
-        std::vector <double> myPoint;
+        PointType myPoint;
     };
 
 }} // close namespace lsst::mops
@@ -0,0 +1,327 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * SkyIndex: a KDTree of points on the sky, kept as 3-D unit vectors
+ * (x, y, z) rather than as RA and Dec, for searches by great-circle
+ * distance.
+ *
+ * Two points d degrees apart on the sky are 2 sin(d/2) apart in
+ * space (the chord between them), and the chord grows with d, so
+ * "within d degrees" is the same as "within the chord of d" - a
+ * Euclidean ball, found by a box search of the tree followed by a
+ * comparison of squared lengths.  So RA wrapping around 360, searches
+ * near the poles and the widening of RA ranges with Dec (see
+ * KDTree::RADecRangeSearch) need no special handling, and no trig is
+ * done on the candidate points; only the query point and the radii
+ * are converted.
+ *
+ * Each point may also have NOther other coordinates (say, time), which
+ * are searched with a box of the given tolerances, as EUCLIDEAN
+ * dimensions of a hyperRectangleSearch are.
+ *
+ * Distances compare just as angularDistanceRADec_deg's do but for
+ * rounding, so a point within ~1e-12 degrees of a search radius may
+ * be found by one and not the other.
+ */
+
+
+#ifndef LSST_SKY_INDEX_H
+#define LSST_SKY_INDEX_H
+
+#include <vector>
+#include <cmath>
+
+#include "common.h"
+#include "Exceptions.h"
+#include "PointAndValue.h"
+#include "KDTree.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+template <class T, unsigned int NOther = 0>
+class SkyIndex {
+public:
+    /* the points of the tree: x, y, z, then the other coordinates. */
+    typedef PointAndValue<T, 3 + NOther> PointAndValueType;
+
+    /* an empty index, which finds nothing. */
+    SkyIndex() : myNumPoints(0) {}
+
+    /*
+     * index values.size() points.  RADecs holds the RA and Dec (in
+     * degrees) of point 0, then those of point 1, and so on;
+     * otherDims likewise holds the NOther other coordinates of each
+     * point in turn.  Searches report values[i] for point i.  The
+     * tree is built as KDTree builds its trees.
+     */
+    SkyIndex(const std::vector<double> &RADecs,
+             const std::vector<double> &otherDims,
+             const std::vector<T> &values,
+             unsigned int maxLeafSize,
+             unsigned int nThreads=1);
+
+    /* the number of points indexed. */
+    unsigned int size() const { return myNumPoints; }
+
+    /*
+     * call visit(match), with a const PointAndValueType &, for each
+     * point at least minRadius and less than maxRadius degrees from
+     * (RA, Dec), and within otherDimsTolerances[i] of otherDimsPoint[i]
+     * in each other dimension i.  Both vectors must have NOther
+     * elements.  As with RADecPairSearch, minRadius may be 0 to find
+     * everything within maxRadius.
+     */
+    template <class Visitor>
+    void radiusSearch(double RA, double Dec,
+                      double minRadius, double maxRadius,
+                      const std::vector<double> &otherDimsPoint,
+                      const std::vector<double> &otherDimsTolerances,
+                      Visitor visit) const;
+
+    /*
+     * radiusSearch around each of many points, with the same radii and
+     * tolerances for each; RADecQueryPoints and otherDimsPoints hold
+     * the points as the constructor's RADecs and otherDims do.
+     * visit(q, match) is called for each match of query q, for queries
+     * 0, 1, ... in turn.  The search parameters are only set up once
+     * for all the queries.
+     */
+    template <class Visitor>
+    void radiusSearchBatch(const std::vector<double> &RADecQueryPoints,
+                           double minRadius, double maxRadius,
+                           const std::vector<double> &otherDimsPoints,
+                           const std::vector<double> &otherDimsTolerances,
+                           Visitor visit) const;
+
+    /* the square of the chord between two points angle degrees apart
+     * on the unit sphere. */
+    static double chordSquared(double angle);
+
+private:
+
+    static std::vector<PointAndValueType> 
+    makePointsAndValues(const std::vector<double> &RADecs,
+                        const std::vector<double> &otherDims,
+                        const std::vector<T> &values);
+
+    /* checks the radii and tolerances of a search, and sets up the
+     * parameters of the tree search (but for the query point). */
+    void setUpSearch(double minRadius, double maxRadius,
+                     const std::vector<double> &otherDimsTolerances,
+                     double &minChordSq, double &maxChordSq,
+                     std::vector<double> &queryPt,
+                     std::vector<double> &tolerances,
+                     std::vector<GeometryType> &geometryTypes) const;
+
+    template <class Visitor>
+    void searchFrom(double RA, double Dec, const double *otherDimsPoint,
+                    double minChordSq, double maxChordSq,
+                    std::vector<double> &queryPt,
+                    const std::vector<double> &tolerances,
+                    const std::vector<GeometryType> &geometryTypes,
+                    Visitor &visit) const;
+
+    KDTree<T, 3 + NOther> myTree;
+    unsigned int myNumPoints;
+};
+
+
+
+
+
+
+
+
+
+template <class T, unsigned int NOther>
+SkyIndex<T, NOther>::SkyIndex(const std::vector<double> &RADecs,
+                              const std::vector<double> &otherDims,
+                              const std::vector<T> &values,
+                              unsigned int maxLeafSize,
+                              unsigned int nThreads)
+    : myTree(makePointsAndValues(RADecs, otherDims, values), 
+             3 + NOther, maxLeafSize, nThreads),
+      myNumPoints(values.size())
+{
+}
+
+
+
+template <class T, unsigned int NOther>
+std::vector<typename SkyIndex<T, NOther>::PointAndValueType> 
+SkyIndex<T, NOther>::makePointsAndValues(const std::vector<double> &RADecs,
+                                         const std::vector<double> &otherDims,
+                                         const std::vector<T> &values)
+{
+    if ((RADecs.size() != 2 * values.size()) ||
+        (otherDims.size() != NOther * values.size())) {
+        throw LSST_EXCEPT(BadParameterException,
+            "SkyIndex: need an RA, a Dec and NOther other coordinates for each value.");
+    }
+    std::vector<PointAndValueType> pointsAndValues(values.size());
+    for (unsigned int i = 0; i < values.size(); i++) {
+        typename PointAndValueType::PointType point;
+        toCartesian_deg(RADecs[2 * i], RADecs[2 * i + 1],
+                        point[0], point[1], point[2]);
+        for (unsigned int j = 0; j < NOther; j++) {
+            point[3 + j] = otherDims[NOther * i + j];
+        }
+        pointsAndValues[i].setPoint(point);
+        pointsAndValues[i].setValue(values[i]);
+    }
+    return pointsAndValues;
+}
+
+
+
+template <class T, unsigned int NOther>
+double SkyIndex<T, NOther>::chordSquared(double angle)
+{
+    if (angle <= 0) {
+        return 0;
+    }
+    if (angle >= 180) {
+        // the chord across the sphere.
+        return 4;
+    }
+    Constants c;
+    double halfChord = sin(c.deg_to_rad() * angle / 2.);
+    return 4 * halfChord * halfChord;
+}
+
+
+
+template <class T, unsigned int NOther>
+void SkyIndex<T, NOther>::setUpSearch(double minRadius, double maxRadius,
+                                      const std::vector<double> &otherDimsTolerances,
+                                      double &minChordSq, double &maxChordSq,
+                                      std::vector<double> &queryPt,
+                                      std::vector<double> &tolerances,
+                                      std::vector<GeometryType> &geometryTypes) const
+{
+    if ((otherDimsTolerances.size() != NOther) || (maxRadius <= 0.0) ||
+        (minRadius > maxRadius)) {
+        throw LSST_EXCEPT(BadParameterException,
+                          "SkyIndex search called with illegal parameters.");
+    }
+    minChordSq = chordSquared(minRadius);
+    maxChordSq = chordSquared(maxRadius);
+    double maxChord = sqrt(maxChordSq);
+    queryPt.resize(3 + NOther);
+    tolerances.resize(3 + NOther);
+    geometryTypes.assign(3 + NOther, EUCLIDEAN);
+    for (unsigned int i = 0; i < 3; i++) {
+        tolerances[i] = maxChord;
+    }
+    for (unsigned int i = 0; i < NOther; i++) {
+        tolerances[3 + i] = otherDimsTolerances[i];
+    }
+}
+
+
+
+template <class T, unsigned int NOther>
+template <class Visitor>
+void SkyIndex<T, NOther>::searchFrom(double RA, double Dec,
+                                     const double *otherDimsPoint,
+                                     double minChordSq, double maxChordSq,
+                                     std::vector<double> &queryPt,
+                                     const std::vector<double> &tolerances,
+                                     const std::vector<GeometryType> &geometryTypes,
+                                     Visitor &visit) const
+{
+    toCartesian_deg(RA, Dec, queryPt[0], queryPt[1], queryPt[2]);
+    for (unsigned int i = 0; i < NOther; i++) {
+        queryPt[3 + i] = otherDimsPoint[i];
+    }
+    double x = queryPt[0];
+    double y = queryPt[1];
+    double z = queryPt[2];
+    // the box around the ball of radius maxChord holds all the points
+    // we want; keep those in the ball (and outside the inner one).
+    myTree.hyperRectangleSearch(
+        queryPt, tolerances, geometryTypes,
+        [&](const PointAndValueType &match) {
+            const typename PointAndValueType::PointType &point = match.getPoint();
+            double dx = point[0] - x;
+            double dy = point[1] - y;
+            double dz = point[2] - z;
+            double chordSq = dx * dx + dy * dy + dz * dz;
+            if ((chordSq >= minChordSq) && (chordSq < maxChordSq)) {
+                visit(match);
+            }
+        });
+}
+
+
+
+template <class T, unsigned int NOther>
+template <class Visitor>
+void SkyIndex<T, NOther>::radiusSearch(double RA, double Dec,
+                                       double minRadius, double maxRadius,
+                                       const std::vector<double> &otherDimsPoint,
+                                       const std::vector<double> &otherDimsTolerances,
+                                       Visitor visit) const
+{
+    if (otherDimsPoint.size() != NOther) {
+        throw LSST_EXCEPT(BadParameterException,
+                          "SkyIndex search called with illegal parameters.");
+    }
+    double minChordSq, maxChordSq;
+    std::vector<double> queryPt;
+    std::vector<double> tolerances;
+    std::vector<GeometryType> geometryTypes;
+    setUpSearch(minRadius, maxRadius, otherDimsTolerances,
+                minChordSq, maxChordSq, queryPt, tolerances, geometryTypes);
+    if (size() == 0) {
+        return;
+    }
+    searchFrom(RA, Dec, otherDimsPoint.data(), minChordSq, maxChordSq,
+               queryPt, tolerances, geometryTypes, visit);
+}
+
+
+
+template <class T, unsigned int NOther>
+template <class Visitor>
+void SkyIndex<T, NOther>::radiusSearchBatch(const std::vector<double> &RADecQueryPoints,
+                                            double minRadius, double maxRadius,
+                                            const std::vector<double> &otherDimsPoints,
+                                            const std::vector<double> &otherDimsTolerances,
+                                            Visitor visit) const
+{
+    unsigned int nQueries = RADecQueryPoints.size() / 2;
+    if ((RADecQueryPoints.size() % 2 != 0) ||
+        (otherDimsPoints.size() != NOther * nQueries)) {
+        throw LSST_EXCEPT(BadParameterException,
+            "SkyIndex::radiusSearchBatch: need an RA, a Dec and NOther other values for each query.");
+    }
+    double minChordSq, maxChordSq;
+    std::vector<double> queryPt;
+    std::vector<double> tolerances;
+    std::vector<GeometryType> geometryTypes;
+    setUpSearch(minRadius, maxRadius, otherDimsTolerances,
+                minChordSq, maxChordSq, queryPt, tolerances, geometryTypes);
+    if (size() == 0) {
+        return;
+    }
+    for (unsigned int q = 0; q < nQueries; q++) {
+        auto visitMatch = [&visit, q](const PointAndValueType &match) {
+            visit(q, match);
+        };
+        searchFrom(RADecQueryPoints[2 * q], RADecQueryPoints[2 * q + 1],
+                   otherDimsPoints.data() + NOther * q,
+                   minChordSq, maxChordSq,
+                   queryPt, tolerances, geometryTypes, visitMatch);
+    }
+}
+
+
+
+}} // close namespace lsst::mops
+
+#endif
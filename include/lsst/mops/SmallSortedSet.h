@@ -0,0 +1,159 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * SmallSortedSet: a set of values kept as a sorted array, with room for
+ * the first N values inside the object itself.  Only once it grows past
+ * N does it move its contents to the heap.
+ *
+ * Meant for the many small sets of indices in a Track.  A std::set
+ * costs an allocation (and a cache miss to walk) per element; these
+ * cost nothing until they outgrow N, and iterate as plain pointers.
+ * Inserting is linear in the size of the set, which is fine for the
+ * couple dozen values we see in practice.
+ *
+ * Iteration order, == and < are those of a std::set holding the same
+ * values.
+ */
+
+
+#ifndef LSST_SMALL_SORTED_SET_H
+#define LSST_SMALL_SORTED_SET_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+
+namespace lsst {
+namespace mops {
+
+
+template <typename T, unsigned int N>
+class SmallSortedSet {
+public:
+    typedef T value_type;
+    typedef const T * const_iterator;
+    typedef const_iterator iterator;
+    typedef unsigned int size_type;
+
+    SmallSortedSet() {
+        mySize = 0;
+    }
+
+    SmallSortedSet(const SmallSortedSet &other) {
+        mySize = 0;
+        *this = other;
+    }
+
+    SmallSortedSet(SmallSortedSet &&other) {
+        mySize = 0;
+        *this = std::move(other);
+    }
+
+    SmallSortedSet & operator=(const SmallSortedSet &other) {
+        if (this != &other) {
+            if (other.mySize > N) {
+                spill = other.spill;
+            }
+            else {
+                std::copy(other.begin(), other.end(), inlineData);
+                spill.clear();
+            }
+            mySize = other.mySize;
+        }
+        return *this;
+    }
+
+    /* leaves other empty. */
+    SmallSortedSet & operator=(SmallSortedSet &&other) {
+        if (this != &other) {
+            if (other.mySize > N) {
+                spill = std::move(other.spill);
+            }
+            else {
+                std::copy(other.begin(), other.end(), inlineData);
+                spill.clear();
+            }
+            mySize = other.mySize;
+            other.spill.clear();
+            other.mySize = 0;
+        }
+        return *this;
+    }
+
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + mySize; }
+
+    size_type size() const { return mySize; }
+    bool empty() const { return mySize == 0; }
+
+    /* end() if v is not present. */
+    const_iterator find(const T &v) const {
+        const_iterator it = std::lower_bound(begin(), end(), v);
+        if ((it != end()) && !(v < *it)) {
+            return it;
+        }
+        return end();
+    }
+
+    size_type count(const T &v) const {
+        return (find(v) == end()) ? 0 : 1;
+    }
+
+    /* returns false (and does nothing) if v was already present. */
+    bool insert(const T &v) {
+        size_type pos = std::lower_bound(begin(), end(), v) - begin();
+        if ((pos < mySize) && !(v < data()[pos])) {
+            return false;
+        }
+        if (mySize < N) {
+            std::copy_backward(inlineData + pos, inlineData + mySize,
+                               inlineData + mySize + 1);
+            inlineData[pos] = v;
+        }
+        else {
+            if (mySize == N) {
+                spill.assign(inlineData, inlineData + N);
+            }
+            spill.insert(spill.begin() + pos, v);
+        }
+        mySize++;
+        return true;
+    }
+
+    void clear() {
+        spill.clear();
+        mySize = 0;
+    }
+
+    bool operator==(const SmallSortedSet &other) const {
+        return (mySize == other.mySize) &&
+            std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator!=(const SmallSortedSet &other) const {
+        return !(*this == other);
+    }
+
+    bool operator<(const SmallSortedSet &other) const {
+        return std::lexicographical_compare(begin(), end(),
+                                            other.begin(), other.end());
+    }
+
+private:
+    const T * data() const {
+        return (mySize > N) ? &spill[0] : inlineData;
+    }
+
+    size_type mySize;
+    // the values while there are at most N of them.
+    T inlineData[N];
+    // the values once there are more than N.
+    std::vector<T> spill;
+};
+
+
+}} // close namespace lsst::mops
+
+#endif
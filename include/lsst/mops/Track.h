@@ -13,6 +13,7 @@
 
 #include "MopsDetection.h"
 #include "Tracklet.h"
+#include "SmallSortedSet.h"
 
 
 namespace lsst { namespace mops {
@@ -49,6 +50,17 @@ namespace lsst { namespace mops {
 
 
 class Track {
+public:
+    /* the fit parameters and their covariances have at most 5 terms;
+       giving Eigen that bound keeps them off the heap. */
+    typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, 5, 1> FitVector;
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, 5, 5> FitMatrix;
+
+    /* sets of detection and tracklet indices (and diaIds).  A typical
+       track fits in the inline storage, so building one allocates
+       nothing. */
+    typedef SmallSortedSet<unsigned int, 12> IndexSet;
+
 private:
 
     void calculateBestFitRa(const std::vector<MopsDetection> &allDets,
@@ -58,9 +70,22 @@ private:
     void calculateBestFitDec(const std::vector<MopsDetection> &allDets,
                             const int forceOrder = -1,
                                     std::ostream *outFile = NULL);
+
+    void calculateBestFitRaFast(const std::vector<MopsDetection> &allDets,
+                                const int forceOrder = -1);
+
+    void calculateBestFitDecFast(const std::vector<MopsDetection> &allDets,
+                                 const int forceOrder = -1);
 public:
 
     Track();
+
+    /* copies and moves take everything, including the fit
+       parameters, covariances and chisq. */
+    Track(const Track &other) = default;
+    Track(Track &&other) = default;
+    Track & operator= (const Track &other) = default;
+    Track & operator= (Track &&other) = default;
     
     void addDetection(unsigned int detIndex, const std::vector<MopsDetection> & allDets);
 
@@ -76,12 +101,30 @@ public:
                      const Tracklet &t, 
                      const std::vector<MopsDetection> & allDets);
 
-    const std::set<unsigned int> getComponentDetectionIndices() const;
+    /* as above, for a tracklet with detection indices firstDetIndex
+       to lastDetIndex - 1 (e.g. one held in a TrackletStore). */
+    void addTracklet(unsigned int trackletIndex,
+                     const unsigned int *firstDetIndex,
+                     const unsigned int *lastDetIndex,
+                     const std::vector<MopsDetection> & allDets);
+
+    const IndexSet & getComponentDetectionIndices() const {
+        return componentDetectionIndices;
+    }
 
-    const std::set<unsigned int> getComponentDetectionDiaIds() const;
+    const IndexSet & getComponentDetectionDiaIds() const {
+        return componentDetectionDiaIds;
+    }
 
-    double getProbChisqRa() const { return probChisqRa; }
-    double getProbChisqDec() const { return probChisqDec; }
+    /* prob(chisq) of the last fit.  After calculateBestFitQuadraticFast
+       these are only worked out if asked for. */
+    double getProbChisqRa() const;
+    double getProbChisqDec() const;
+    double getChisqRa() const { return chisqRa; }
+    double getChisqDec() const { return chisqDec; }
+    /* the degrees of freedom used for prob(chisq): the number of
+       detections in the track at the time of the last fit. */
+    unsigned int getChisqDof() const { return chisqDof; }
     double getFitRange() const;
 
     /* until this function is called, initial position, velocity and
@@ -92,6 +135,20 @@ public:
                                    const int forceOrder = -1,
                                    std::ostream *outFile = NULL);
 
+    /* same model, order selection and back-off as
+       calculateBestFitQuadratic, but for the 3, 4 and 5 term models the
+       least-squares problem is solved through fixed-size normal
+       equations rather than an SVD of the full design matrix, and
+       nothing is allocated.  prob(chisq) is not calculated until
+       getProbChisqRa/Dec are called; compare getChisqRa/Dec against
+       precomputed limits instead (see ChisqThresholds).
+
+       The results match calculateBestFitQuadratic to within rounding
+       error.  Systems which are (nearly) singular are handed to
+       calculateBestFitQuadratic's SVD.
+    */
+    void calculateBestFitQuadraticFast(const std::vector<MopsDetection> &allDets,
+                                       const int forceOrder = -1);
     
     /* use best-fit quadratic to predict location at time mjd. will return WRONG VALUES
      if calculateBestFitQuadratic has not been called.*/
@@ -110,11 +167,9 @@ public:
       the tracklets which were used to build this track, if any. Currently this
       information is not used but could be useful for debugging or investigation.
     */
-    std::set<unsigned int> componentTrackletIndices;
+    IndexSet componentTrackletIndices;
     
 
-    Track & operator= (const Track &other);
-
     bool operator==(const Track &other) const {
         bool toRet = componentDetectionDiaIds == other.componentDetectionDiaIds;
         return toRet ;
@@ -137,16 +192,18 @@ public:
     }
 
 private:
-    std::set<unsigned int> componentDetectionIndices;
-    std::set<unsigned int> componentDetectionDiaIds;
-    Eigen::VectorXd raFunc;
-    Eigen::VectorXd decFunc;
-    Eigen::MatrixXd raCov;
-    Eigen::MatrixXd decCov;
+    IndexSet componentDetectionIndices;
+    IndexSet componentDetectionDiaIds;
+    FitVector raFunc;
+    FitVector decFunc;
+    FitMatrix raCov;
+    FitMatrix decCov;
     double chisqRa;
     double chisqDec;
-    double probChisqRa;
-    double probChisqDec;
+    // negative if not yet calculated
+    mutable double probChisqRa;
+    mutable double probChisqDec;
+    unsigned int chisqDof;
     double epoch;
     double meanTopoCorr;
 };
@@ -8,9 +8,11 @@
 
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <set>
 
 #include "Track.h"
+#include "AsyncTrackWriter.h"
 
 namespace lsst {
 namespace mops {
@@ -28,8 +30,15 @@ public:
      *
      * if useCache == False, open file with name outFileName for writing.
      * on destruction or call to purgeCacheToFile, write all contents to that outfile.
+     *
+     * if asyncWrite == True, useCache is ignored: tracks are not kept
+     * in componentTracks at all, but handed (if new) to an
+     * AsyncTrackWriter, which writes them to outFileName in the
+     * background, cacheSize at a time.  The file is complete once the
+     * TrackSet is destroyed.
      */
-    TrackSet(std::string outFileName, bool useCache=false, unsigned int cacheSize=0);
+    TrackSet(std::string outFileName, bool useCache=false, unsigned int cacheSize=0,
+             bool asyncWrite=false);
 
 
     /*
@@ -45,6 +54,9 @@ public:
      * if there is an outfile, write all contents to that outfile.
      * 
      * if cacheing is enabled, clear the local entries as well.
+     *
+     * if writing asynchronously, just hand any buffered tracks to the
+     * writer thread.
      */
     void purgeToFile();
 
@@ -53,6 +65,7 @@ public:
     std::set<Track> componentTracks;
 
     void insert(const Track &newTrack);
+    void insert(Track &&newTrack);
 
     unsigned int size() const;
     
@@ -66,12 +79,14 @@ public:
     bool operator!=(const TrackSet &other) const;
 
 private:
+    template <class TrackRef>
+    void insertTrack(TrackRef &&newTrack);
     void writeToFile();
     bool useCache;
     std::ofstream outFile;
     bool useOutFile;
     unsigned int cacheSize;
-    
+    std::unique_ptr<AsyncTrackWriter> asyncWriter;
 
 };
 
@@ -64,7 +64,13 @@ public:
     unsigned int getId() const { return myId; }
 
 
+    // copies are memberwise, just as operator= does; moves let
+    // tracklets built locally (e.g. by TrackletStore) be handed back
+    // without copying their sets.
+    Tracklet(const Tracklet &other) = default;
+    Tracklet(Tracklet &&other) = default;
     Tracklet & operator= (const Tracklet &other);
+    Tracklet & operator= (Tracklet &&other) = default;
 
     bool operator==(const Tracklet &other) const; 
 
@@ -0,0 +1,122 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * TrackletStore: many tracklets kept in a handful of flat arrays
+ * rather than as a vector of Tracklets.
+ *
+ * A Tracklet holds its detection indices in a std::set (a heap node
+ * per index) and its best-fit functions in two heap vectors; a run of
+ * findTracklets over a few weeks of data makes ~10^8 of them, so the
+ * overhead dwarfs the data.  Here tracklet i's detection indices are
+ * detIndices[offsets[i]] to detIndices[offsets[i+1]-1], in increasing
+ * order and without repeats, just as they would be in
+ * Tracklet::indices.  IDs and isCollapsed flags are kept per tracklet,
+ * and linkTracklets' parameters (the position and velocity at the
+ * first detection, and the time spanned) in fixed-width columns,
+ * which are only allocated once the first parameters are set.
+ *
+ * Tracklets can be moved to and from std::vector<Tracklet> (see the
+ * constructor, getTracklet and appendToVector), so the older
+ * interfaces all still work.
+ */
+
+
+#ifndef LSST_TRACKLET_STORE_H
+#define LSST_TRACKLET_STORE_H
+
+#include <vector>
+
+#include "lsst/mops/Tracklet.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+class TrackletStore {
+public:
+    TrackletStore();
+
+    /* copies the indices, IDs and isCollapsed flags of tracklets. */
+    explicit TrackletStore(const std::vector<Tracklet> &tracklets);
+
+    unsigned int size() const { return offsets.size() - 1; }
+    bool empty() const { return size() == 0; }
+
+    /* total number of detection indices, over all tracklets. */
+    unsigned long getNumAllIndices() const { return detIndices.size(); }
+
+    void clear();
+    void reserve(unsigned int nTracklets, unsigned long nIndices);
+
+    /* each returns the index of the new tracklet.  Detection indices
+     * need not be in order; repeats are dropped.  The new tracklet's
+     * ID is its index, and it is not collapsed. */
+    unsigned int addTracklet(const unsigned int *begin,
+                             const unsigned int *end);
+    /* as above, but keeps the ID and isCollapsed flag of t. */
+    unsigned int addTracklet(const Tracklet &t);
+    /* copies tracklet i of other (which must not be this store),
+     * with its ID, flag and parameters. */
+    unsigned int addTracklet(const TrackletStore &other, unsigned int i);
+
+    /* the detection indices of tracklet i, in increasing order. */
+    const unsigned int *indicesBegin(unsigned int i) const {
+        return detIndices.data() + offsets[i];
+    }
+    const unsigned int *indicesEnd(unsigned int i) const {
+        return detIndices.data() + offsets[i + 1];
+    }
+    unsigned int getNumIndices(unsigned int i) const {
+        return offsets[i + 1] - offsets[i];
+    }
+    bool contains(unsigned int i, unsigned int detIndex) const;
+
+    unsigned int getId(unsigned int i) const { return ids[i]; }
+    void setId(unsigned int i, unsigned int newId) { ids[i] = newId; }
+
+    bool isCollapsed(unsigned int i) const { return collapsed[i] != 0; }
+    void setCollapsed(unsigned int i, bool c) { collapsed[i] = c; }
+
+    /* true once setParameters has been called for any tracklet; the
+     * parameters of any others are 0 until they are set. */
+    bool hasParameters() const { return !ra0.empty(); }
+    void setParameters(unsigned int i, double newRa0, double newDec0,
+                       double newRaVelocity, double newDecVelocity,
+                       double newDeltaTime);
+    double getRa0(unsigned int i) const { return ra0[i]; }
+    double getDec0(unsigned int i) const { return dec0[i]; }
+    double getRaVelocity(unsigned int i) const { return raVelocity[i]; }
+    double getDecVelocity(unsigned int i) const { return decVelocity[i]; }
+    double getDeltaTime(unsigned int i) const { return deltaTime[i]; }
+
+    /* tracklet i as a Tracklet, with best-fit functions set from its
+     * parameters, if it has any. */
+    Tracklet getTracklet(unsigned int i) const;
+
+    /* append a Tracklet for each tracklet here to out. */
+    void appendToVector(std::vector<Tracklet> &out) const;
+
+private:
+    // size() + 1 long; offsets[0] is 0.
+    std::vector<unsigned long> offsets;
+    std::vector<unsigned int> detIndices;
+    std::vector<unsigned int> ids;
+    std::vector<unsigned char> collapsed;
+
+    // each either empty or size() long.
+    std::vector<double> ra0;
+    std::vector<double> dec0;
+    std::vector<double> raVelocity;
+    std::vector<double> decVelocity;
+    std::vector<double> deltaTime;
+
+    unsigned int finishTracklet(unsigned long firstIndex);
+};
+
+
+
+}} // close namespace lsst::mops
+
+#endif
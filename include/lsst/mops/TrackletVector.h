@@ -6,8 +6,11 @@
 #ifndef LSST_TRACKLETVECTOR_H
 #define LSST_TRACKLETVECTOR_H
 
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 
@@ -25,15 +28,25 @@ class TrackletVector {
 public:
 
     // create a normal TrackletVector, which is just a container class. no file behaviors.
-    TrackletVector() { useCache = false; cacheSize = 0; useOutFile = false;};
+    TrackletVector() { useCache = false; cacheSize = 0; useOutFile = false;
+        nWritten = 0; closed = false; nCached = 0; writing = false;
+        stopWriter = false; writeFailed = false; };
 
     /*
      * if useCache == True: create a TrackletVector which holds at most cacheSize 
      * elements, and if elements > that number are added, then write 
      * them to file with name outFileName.
      *
+     * Cached tracklets are kept as flat arrays of indices, not as
+     * Tracklets, and a full cache is written by a background thread
+     * while the next one fills; so at most about 2 * cacheSize
+     * tracklets are ever held, and the caller seldom waits on the disk.
+     *
      * if useCache == False, open file with name outFileName for writing.
      * on destruction or call to purgeCacheToFile, write all contents to that outfile.
+     *
+     * Either way, the file is appended to.  Throws FileException if it
+     * can't be opened.
      */
     TrackletVector(std::string outFileName, bool useCache=false, unsigned int cacheSize=0);
 
@@ -41,8 +54,9 @@ public:
      * does not allow copying of streams. */
 
     /*
-     * calls purgeToFile for you, in case there are still items in the
-     * cache that need to be written to disk.  Closes the outFile if in use.
+     * calls close() for you, in case there are still items in the
+     * cache that need to be written to disk.  Errors are reported on
+     * std::cerr.
      */
 
     ~TrackletVector();
@@ -50,14 +64,25 @@ public:
     /*
      * if there is no outfile, raise exception.
      *
-     * if there is an outfile, write all contents to that outfile.
-     * 
-     * if cacheing is enabled, clear the local entries as well.
+     * if there is an outfile, write all contents not yet written to
+     * that outfile.  If cacheing is enabled, the cache is handed to
+     * the writer thread and cleared; it may not be written yet when
+     * this returns.
      */
     void purgeToFile();
 
+    /* write everything out, wait for the writer thread and close the
+     * outfile.  Throws FileException if any write failed.  Nothing
+     * may be added afterwards. */
+    void close();
+
     void push_back(const Tracklet &newTracklet);
 
+    /* add a tracklet with the given detection indices, which must be
+     * in increasing order; with a cache, this saves making a
+     * Tracklet. */
+    void push_back(const unsigned int *firstIndex, const unsigned int *lastIndex);
+
     Tracklet at(unsigned int) const;
 
     unsigned int size() const;
@@ -93,12 +118,31 @@ public:
 
 private:
     void writeToFile();
+    void writerLoop();
+    void writeCachedIds(const std::vector<unsigned int> &ids);
+
     std::vector<Tracklet> componentTracklets;
     bool useCache;
     std::ofstream outFile;
     bool useOutFile;
     unsigned int cacheSize;
-    
+    // without a cache: componentTracklets before this are in the file.
+    unsigned int nWritten;
+    bool closed;
+
+    // with a cache: the tracklets not yet handed to the writer, each
+    // as its number of indices followed by the indices.
+    std::vector<unsigned int> cachedIds;
+    unsigned int nCached;
+    // the tracklets being written, in the same form.  Only touched by
+    // the writer thread while writing is set.
+    std::vector<unsigned int> writingIds;
+    std::thread writer;
+    std::mutex writerLock;
+    std::condition_variable writerStateChanged;
+    bool writing;
+    bool stopWriter;
+    bool writeFailed;
 
 };
 
@@ -0,0 +1,101 @@
+// -*- LSST-C++ -*-
+
+
+#ifndef LSST_WORK_STEALING_POOL_H
+#define LSST_WORK_STEALING_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/***************************************************************************
+ *
+ * WorkStealingPool is a small fixed-size pool of worker threads, each with its
+ * own double-ended task queue.  A worker pushes and pops tasks at the back of
+ * its own queue (so recently-spawned, cache-warm work runs first) and, when
+ * its queue is empty, steals from the front of some other worker's queue
+ * (where the oldest, and usually largest, tasks live).
+ *
+ * Tasks may submit more tasks; this is how linkTracklets hands out image
+ * pairs and then lets big pairs split themselves up further.
+ *
+ * The pool makes NO promise about the order in which tasks run.  Callers who
+ * need deterministic output must give each task its own place to put results
+ * and combine them afterwards in a fixed order.
+ *
+ ****************************************************************************/
+
+namespace lsst {
+namespace mops {
+
+
+class WorkStealingPool {
+public:
+    typedef std::function<void()> Task;
+
+    /* start nThreads worker threads.  nThreads == 0 is treated as 1. */
+    explicit WorkStealingPool(unsigned int nThreads);
+
+    /* waits for all outstanding tasks, then joins the workers. */
+    ~WorkStealingPool();
+
+    /* queue a task.  If called from one of this pool's workers, the task
+     * goes on that worker's own queue; otherwise tasks are dealt out
+     * round-robin. */
+    void submit(Task task);
+
+    /* block until every submitted task (including tasks submitted by
+     * other tasks) has finished.  If any task threw, the first
+     * exception is rethrown here. */
+    void wait();
+
+    unsigned int getNumThreads() const;
+
+    /* index in [0, getNumThreads()) of the calling worker thread, or
+     * getNumThreads() if the caller is not one of this pool's
+     * workers (e.g. the thread which created the pool). */
+    unsigned int getThreadIndex() const;
+
+private:
+    WorkStealingPool(const WorkStealingPool &);
+    WorkStealingPool & operator=(const WorkStealingPool &);
+
+    class WorkerQueue {
+    public:
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(unsigned int myIndex);
+
+    /* pop from the back of our own queue, else steal from the front of
+     * another's.  Returns false if every queue was empty. */
+    bool tryGetTask(unsigned int myIndex, Task &task);
+
+    std::vector<std::unique_ptr<WorkerQueue> > queues;
+    std::vector<std::thread> workers;
+
+    std::mutex stateLock;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+
+    // tasks submitted but not yet finished
+    unsigned long outstanding;
+    // tasks sitting in some queue, not yet picked up
+    unsigned long queued;
+    unsigned int nextQueue;
+    bool shuttingDown;
+    std::exception_ptr firstError;
+};
+
+
+
+}} // close namespace lsst::mops
+
+#endif
@@ -105,6 +105,35 @@ namespace mops {
      * these two points (on the unit sphere). All units in degrees. */
     double angularDistanceRADec_deg(double RA0, double Dec0, double RA1, double Dec1);
 
+    /* 
+     * a cheap test which returns true only if angularDistanceRADec_deg
+     * would return more than maxDist; false means "maybe not".  It
+     * uses no trig on the points, so is worth trying first when most
+     * points are far away.  cosDec1 must be cos(Dec1) and
+     * sinSqHalfMaxDist sin^2(maxDist/2), both in radians, so the
+     * caller can work them out once for many points.  All other units
+     * in degrees.
+     */
+    bool angularDistanceCertainlyAbove(double RA0, double Dec0, 
+                                       double RA1, double Dec1, 
+                                       double cosDec1, 
+                                       double sinSqHalfMaxDist);
+
+    /*
+     * bounds on the great-circle distance between any point of one
+     * RA, Dec box and any point of another.  Each box is given by its
+     * RA and Dec ranges as stored in a KDTree: RALo <= RAHi and DecLo <=
+     * DecHi, all in [0, 360), with Dec taken as standard degrees (so
+     * Dec -1 is 359).  minDist is never more, and maxDist never less,
+     * than angularDistanceRADec_deg for any such pair.  Units in
+     * degrees.
+     */
+    void angularDistanceBoundsRADecBoxes_deg(double RALo0, double RAHi0, 
+                                             double DecLo0, double DecHi0,
+                                             double RALo1, double RAHi1, 
+                                             double DecLo1, double DecHi1,
+                                             double &minDist, double &maxDist);
+
 
     /* 
      * arcToRA: given a lattitude in declination (degrees) and an arc length
@@ -24,6 +24,7 @@
 #include "lsst/mops/MopsDetection.h" 
 #include "lsst/mops/Exceptions.h"
 #include "lsst/mops/Tracklet.h"
+#include "lsst/mops/TrackletStore.h"
 
 namespace lsst {
     namespace mops {
@@ -43,6 +44,15 @@ namespace lsst {
             std::vector<Tracklet> &collapsedPairs,
             bool useMinimumRMS, bool useBestFit, 
             bool useRMSFilt, double maxRMS, bool beVerbose);
+
+        /* the same, for tracklets in TrackletStores. */
+        void doCollapsingPopulateOutputVector(
+            const std::vector<MopsDetection> * detections, 
+            TrackletStore &pairs,
+            std::vector<double> tolerances, 
+            TrackletStore &collapsedPairs,
+            bool useMinimumRMS, bool useBestFit, 
+            bool useRMSFilt, double maxRMS, bool beVerbose);
             
     void parameterize(const std::vector<MopsDetection> *trackletDets,
                       std::vector<double> &motionVector,
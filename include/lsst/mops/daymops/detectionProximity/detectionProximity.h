@@ -28,12 +28,18 @@ namespace lsst {
  * returns a vector of pairs of similar points; each pair has as its
  * first part an index into queryPoints and as its second part an
  * index into dataPoints.
+ *
+ * with useSkyIndex, the data points are kept in a SkyIndex (as unit
+ * vectors) rather than a KDTree of RA, Dec and time; the same pairs
+ * are found, but for rounding at distanceThreshold, though each query
+ * point's may come in a different order.
  */
 std::vector<std::pair <unsigned int, unsigned int> > 
 detectionProximity(const std::vector<MopsDetection>& queryPoints,
 		   const std::vector<MopsDetection>& dataPoints,
                    double distanceThreshold,
-		   double timeThreshold);
+		   double timeThreshold,
+                   bool useSkyIndex=false);
 
     }} // close lsst::mops
 
@@ -31,10 +31,18 @@ namespace lsst {
 */
 
 // queryFields may be modified - we will sort it by obs time.
+
+// with useSkyIndex, the track ephemerides are kept in a SkyIndex (as
+// unit vectors) and searched in a circle around each field, rather
+// than in a KDTree of time, RA and Dec searched in a box.  The circle
+// holds the box, so every track found with the KDTree is still found;
+// away from the equator (where the box's RA range covers less and
+// less of the sky) a few more may be.
 void fieldProximity(const std::vector<FieldProximityTrack> &allTracks,
                     std::vector<Field> &queryFields,
                     std::vector<std::pair<unsigned int, unsigned int>  > &results,
-                    double distThresh);
+                    double distThresh,
+                    bool useSkyIndex=false);
 
 // legacy interface - will be slower because we copy the output
 // vector, but needed to get unit tests compiling
@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "lsst/mops/TrackletVector.h"
+#include "lsst/mops/TrackletStore.h"
 #include "lsst/mops/MopsDetection.h"
 
 
@@ -44,6 +45,9 @@ public:
             outputMethod = trackletOutputMethod::RETURN_TRACKLETS;
             outputFile = "";
             outputBufferSize = 0;
+            nThreads = 1;
+            dualTreeSearch = false;
+            unitVectorSearch = false;
         }
 
     // units for these two are in days.
@@ -69,14 +73,44 @@ public:
     // tracklet per line, written as a series of space-delimited Detection IDs
     // which comprise the tracklet.  
 
-    // if IDS_FILE, write to outputBufferSize all at once, when finished.
+    // if IDS_FILE, write to outputFile as for IDS_FILE_WITH_CACHE, but
+    // in batches of 65536 results if outputBufferSize is 0.
 
     // if IDS_FILE_WITH_CACHE, Write to a file named by outputFile, buffering
-    // outputBufferSize results between writes.
+    // outputBufferSize results between writes.  Writing is done by a
+    // background thread while the next outputBufferSize results are
+    // found, so memory use is set by outputBufferSize rather than the
+    // number of tracklets found.
+
+    // in both cases the file is appended to.
 
     trackletOutputMethod outputMethod;
     std::string outputFile;
     unsigned int outputBufferSize;
+
+    /* nThreads: number of threads searching for tracklets.  Each
+     * image's detections are searched for separately, and the
+     * tracklets found for each image are added to the output in image
+     * order, so the output does not depend on nThreads. */
+    unsigned int nThreads;
+
+    /* dualTreeSearch: rather than searching each image's tree for
+     * each detection of an earlier image, walk the trees of the two
+     * images together, dropping pairs of tree nodes which are
+     * certainly too far apart (or too close together) for any
+     * tracklet.  Finds the same tracklets, much faster in dense
+     * fields, but orders each pair of images' tracklets by detection
+     * index rather than as the per-detection searches would. */
+    bool dualTreeSearch;
+
+    /* unitVectorSearch: keep each image's detections in a SkyIndex, as
+     * unit vectors, rather than in a KDTree of RA, Dec, and find each
+     * detection's partners with chord lengths rather than by
+     * great-circle distance.  Finds the same tracklets (but for ones
+     * right at the velocity limits, where rounding differs), but may
+     * order each detection's tracklets differently.  Can't be used with
+     * dualTreeSearch. */
+    bool unitVectorSearch;
 };
         
 
@@ -95,6 +129,13 @@ std::vector<Tracklet> *
 findTracklets(const std::vector<MopsDetection> &allDetections, 
 	      findTrackletsConfig config);
 
+/* the same, but tracklets are added to results, which takes a
+ * fraction of the memory for large runs.  With file output, results
+ * is left alone. */
+void findTracklets(const std::vector<MopsDetection> &allDetections, 
+                   findTrackletsConfig config,
+                   TrackletStore &results);
+
     }} // close lsst::mops
 
 #endif
@@ -0,0 +1,168 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * FlatTrackletTree is a pointer-free copy of a TrackletTree, meant for
+ * the inner loops of linkTracklets.
+ *
+ * A TrackletTree is a tree of TrackletTreeNodes, each of which holds its
+ * bounds in two heap-allocated std::vectors and its children in a third, so
+ * walking the tree and reading bounds means chasing a pointer or two per
+ * access.  Here every node lives in one contiguous array, in depth-first
+ * order:
+ *
+ * - a non-leaf node's left child is always the very next node (index + 1);
+ *   only the index of its right child is stored.
+ * - bounds are kept per axis (structure-of-arrays): getLBounds(POINT_RA)[i]
+ *   is the lower RA bound of node i, and so on for the 4 axes, so the bounds
+ *   of neighbouring nodes share cache lines.
+ * - tracklet IDs are all kept in one array, ordered so that every node's
+ *   tracklets (leaf or not) form a contiguous range of it.
+ *
+ * The flat tree is built from a TrackletTree and has exactly the same nodes,
+ * bounds and leaves (and node IDs), so linking on either gives the same
+ * tracks.
+ */
+
+
+#ifndef FLAT_TRACKLET_TREE_H
+#define FLAT_TRACKLET_TREE_H
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "lsst/mops/daymops/linkTracklets/TrackletTree.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+    class FlatTrackletTree {
+    public:
+
+        /*
+         * NodeRef is a lightweight handle on one node of a
+         * FlatTrackletTree; it is just the tree and an index and is
+         * meant to be passed around by value.  It offers the same
+         * calls as linkTracklets' handle for TrackletTreeNodes so the
+         * linking code can run on either.
+         */
+        class NodeRef {
+        public:
+            NodeRef() { tree = NULL; index = 0; }
+            NodeRef(const FlatTrackletTree * t, unsigned int i) {
+                tree = t; index = i;
+            }
+
+            bool isLeaf() const {
+                return tree->rightChild[index] == 0;
+            }
+            // nodes have either no children or two.
+            bool hasLeftChild() const { return !isLeaf(); }
+            bool hasRightChild() const { return !isLeaf(); }
+            NodeRef getLeftChild() const {
+                return NodeRef(tree, index + 1);
+            }
+            NodeRef getRightChild() const {
+                return NodeRef(tree, tree->rightChild[index]);
+            }
+
+            double getLBound(unsigned int axis) const {
+                return tree->lBounds[axis][index];
+            }
+            double getUBound(unsigned int axis) const {
+                return tree->uBounds[axis][index];
+            }
+
+            // number of tracklets held by this node and its children.
+            unsigned int getNumTracklets() const {
+                return tree->trackletCount[index];
+            }
+            // ID of the k-th of those tracklets, k < getNumTracklets().
+            unsigned int getTrackletId(unsigned int k) const {
+                return tree->trackletIds[tree->firstTracklet[index] + k];
+            }
+
+            unsigned int getId() const { return tree->nodeIds[index]; }
+            unsigned int getIndex() const { return index; }
+            const FlatTrackletTree * getTree() const { return tree; }
+
+            unsigned int getNumVisits() const {
+                return tree->visits[index].load(std::memory_order_relaxed);
+            }
+            void addVisit() const {
+                tree->visits[index].fetch_add(1, std::memory_order_relaxed);
+            }
+
+        private:
+            const FlatTrackletTree * tree;
+            unsigned int index;
+        };
+
+
+        FlatTrackletTree();
+
+        /* copy the layout of source, which must hold data. */
+        explicit FlatTrackletTree(const TrackletTree &source);
+
+        FlatTrackletTree(FlatTrackletTree &&other);
+
+        /* write the tree to outFile (in this machine's byte order),
+         * less firstTrackletId on every tracklet ID, so that it can be
+         * read back with the IDs starting elsewhere.  See
+         * LinkingState.h. */
+        void write(std::ostream &outFile, unsigned int firstTrackletId) const;
+
+        /* replace this tree with one written by write, adding
+         * firstTrackletId to every tracklet ID.  Throws
+         * InputFileFormatErrorException if inFile runs out, or if the
+         * sizes, child indices or tracklet ranges read don't make
+         * sense.  The tracklet IDs themselves are the caller's to
+         * check; see getTrackletIds. */
+        void read(std::istream &inFile, unsigned int firstTrackletId);
+
+        NodeRef getRootNode() const { return NodeRef(this, 0); }
+
+        // number of nodes
+        unsigned int size() const { return nodeIds.size(); }
+
+        // IDs of all tracklets in the tree, in no particular order.
+        const std::vector<unsigned int> & getTrackletIds() const {
+            return trackletIds;
+        }
+
+        /* raw per-axis bounds arrays, indexed by node index; handy for
+         * code which wants to look at many nodes at once. */
+        const double * getLBounds(unsigned int axis) const {
+            return &(lBounds[axis][0]);
+        }
+        const double * getUBounds(unsigned int axis) const {
+            return &(uBounds[axis][0]);
+        }
+
+    private:
+        FlatTrackletTree(const FlatTrackletTree &);
+        FlatTrackletTree & operator=(const FlatTrackletTree &);
+
+        void addNode(TrackletTreeNode * node);
+
+        // all indexed by node index.  rightChild is 0 for leaves
+        // (no node's right child can be the root).
+        std::vector<unsigned int> rightChild;
+        std::vector<unsigned int> firstTracklet;
+        std::vector<unsigned int> trackletCount;
+        std::vector<unsigned int> nodeIds;
+        std::vector<double> lBounds[4];
+        std::vector<double> uBounds[4];
+        std::unique_ptr<std::atomic<unsigned int>[]> visits;
+
+        std::vector<unsigned int> trackletIds;
+    };
+
+
+}} // close namespace lsst::mops
+
+#endif
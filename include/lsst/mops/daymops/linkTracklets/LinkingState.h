@@ -0,0 +1,125 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * LinkingState: what incremental linkTracklets (see
+ * linkTrackletsIncremental) keeps on disk from one run to the next.
+ * For each image in the window it keeps the detections, the
+ * tracklets which start in that image with their parameters, and the
+ * FlatTrackletTree of those tracklets.  A run then only has to fit and
+ * build trees for the new images.
+ *
+ * The state is a directory holding a file for each image, plus an
+ * index file ("images") listing the images in order of time and the
+ * settings they were made with.  An image's file is written once, when
+ * the image is added, and deleted once the image leaves the window;
+ * only the index is rewritten every run.  To keep the image files
+ * valid as earlier images are dropped:
+ * - a tracklet names each detection by its image (counting from the
+ *   tracklet's first image) and its place within that image;
+ * - a tree names its tracklets by their place within the image.
+ * The files are written in the byte order of the machine.
+ *
+ * In memory, detections are kept image by image, as are tracklets
+ * (grouped by first image), so image i's tracklets are
+ * images[i].firstTracklet, ... and their IDs in its tree are those
+ * indices.
+ */
+
+
+#ifndef LSST_LINKING_STATE_H
+#define LSST_LINKING_STATE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lsst/mops/MopsDetection.h"
+#include "lsst/mops/TrackletStore.h"
+#include "lsst/mops/daymops/linkTracklets/FlatTrackletTree.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+class LinkingState {
+public:
+
+    class Image {
+    public:
+        Image() : mjd(0), firstDetection(0), numDetections(0),
+                  firstTracklet(0), numTracklets(0), isNew(false) {}
+        double mjd;
+        unsigned int firstDetection;
+        unsigned int numDetections;
+        unsigned int firstTracklet;
+        unsigned int numTracklets;
+        // NULL if no tracklets start here, or the tree has been
+        // handed on.
+        std::unique_ptr<FlatTrackletTree> tree;
+        // true if added since the state was read.
+        bool isNew;
+    };
+
+    /* an empty state, with the given settings.  Detections' RAs are
+     * as recentered on (skyCenterRa, skyCenterDec); trees are built
+     * with positionalError and leafSize. */
+    LinkingState(double skyCenterRa, double skyCenterDec,
+                 double positionalError, unsigned int leafSize);
+
+    /* true if dirName holds a state. */
+    static bool exists(const std::string &dirName);
+
+    /*
+     * read the state in dirName, leaving out images before
+     * windowStart (and the tracklets which start in them).  Throws
+     * BadParameterException if the state was made with other
+     * settings than ours, FileException or
+     * InputFileFormatErrorException if it can't be read.
+     */
+    void read(const std::string &dirName, double windowStart);
+
+    /*
+     * add newDetections (which must all be later than any image we
+     * have) and newTracklets, whose indices are into newDetections.
+     * The new tracklets' parameters are not set.  Returns the index
+     * of the first new tracklet.
+     */
+    unsigned int addImages(const std::vector<MopsDetection> &newDetections,
+                           const TrackletStore &newTracklets);
+
+    /* write the files of the new images (which must still have their
+     * trees) to dirName, making it if need be. */
+    void writeNewImages(const std::string &dirName) const;
+
+    /* write the index to dirName, and delete the files of the images
+     * read left out. */
+    void writeIndex(const std::string &dirName) const;
+
+    std::vector<Image> images;
+    std::vector<MopsDetection> detections;
+    TrackletStore tracklets;
+
+private:
+    static std::string getImageFileName(double mjd);
+    void readImage(const std::string &dirName, const std::string &fileName,
+                   std::vector<unsigned int> &trackletSizes,
+                   std::vector<unsigned int> &trackletRefs,
+                   std::vector<unsigned char> &trackletFlags,
+                   std::vector<double> &trackletParameters);
+    void writeImage(const std::string &dirName, unsigned int image) const;
+    unsigned int getImageOfDetection(unsigned int detIndex) const;
+
+    double skyCenterRa;
+    double skyCenterDec;
+    double positionalError;
+    unsigned int leafSize;
+    std::vector<std::string> droppedFileNames;
+};
+
+
+
+}} // close namespace lsst::mops
+
+#endif
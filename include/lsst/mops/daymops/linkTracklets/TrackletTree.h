@@ -33,6 +33,7 @@
 
 #include "lsst/mops/MopsDetection.h"
 #include "lsst/mops/TrackletVector.h"
+#include "lsst/mops/TrackletStore.h"
 
 
 
@@ -74,6 +75,20 @@ namespace mops {
                      double positionalErrorDec,
                      unsigned int maxLeafSize);
 
+        /*
+         * as above, but the tree holds the tracklets of allTracklets
+         * whose indices are firstIndex to lastIndex - 1 (e.g. one
+         * image's range of an ImageGrouping); their parameters (see
+         * TrackletStore) must be set.  Values in the tree are the
+         * tracklets' IDs.
+         */
+        TrackletTree(const TrackletStore &allTracklets,
+                     const unsigned int *firstIndex,
+                     const unsigned int *lastIndex,
+                     double positionalErrorRa, 
+                     double positionalErrorDec,
+                     unsigned int maxLeafSize);
+
         
         /* 
          * populates the tree with given data.  Same as constructor
@@ -86,6 +101,14 @@ namespace mops {
                            double positionalErrorDec,
                            unsigned int maxLeafSize,
                            const std::vector<double> &perAxisWidths);
+
+        void buildFromData(const TrackletStore &allTracklets,
+                           const unsigned int *firstIndex,
+                           const unsigned int *lastIndex,
+                           double positionalErrorRa, 
+                           double positionalErrorDec,
+                           unsigned int maxLeafSize,
+                           const std::vector<double> &perAxisWidths);
         
         TrackletTreeNode * getRootNode() const { return myRoot; };
 
@@ -100,6 +123,15 @@ namespace mops {
         TrackletTree() { this->setUpEmptyTree() ;}
         ~TrackletTree() { this->clearPrivateData(); }
 
+    private:
+        /* points are (RA_0, Dec_0, RAv, Decv, delta time), values
+         * tracklet IDs. */
+        void buildFromParameterizedTracklets(
+            const std::vector<PointAndValue <unsigned int> > &parameterizedTracklets,
+            double positionalErrorRa, 
+            double positionalErrorDec,
+            unsigned int maxLeafSize,
+            const std::vector<double> &perAxisWidths);
 
     };
 
@@ -4,6 +4,7 @@
 #ifndef TRACKLET_TREE_NODE_H
 #define TRACKLET_TREE_NODE_H
 
+#include <atomic>
 #include <iostream>
 
 #include "lsst/mops/BaseKDTreeNode.h"
@@ -54,9 +55,33 @@ namespace mops {
             unsigned int &lastId,
             bool useMedian=false,
             bool splitWidest=true);
-        
+
+        /* as above, but the node holds the tracklets of allTracklets
+         * with indices first ... last - 1, which must be in
+         * increasing order.  The children partition the indices in
+         * place, keeping them in order, and the tracklets are only
+         * copied into the leaves. */
+        TrackletTreeNode(
+            const std::vector<PointAndValue <unsigned int> > &allTracklets, 
+            unsigned int *first,
+            unsigned int *last,
+            double positionalErrorRa, 
+            double positionalErrorDec,
+            unsigned int maxLeafSize, 
+            unsigned int myAxisToSplit, 
+            const std::vector<double> &widths,
+            unsigned int &lastId,
+            bool useMedian,
+            bool splitWidest);
+
+        // needed since std::atomic (numVisits) is not copyable.
+        TrackletTreeNode(const TrackletTreeNode &other);
+        TrackletTreeNode & operator=(const TrackletTreeNode &other);
     
         const unsigned int getNumVisits() const;
+        // number of tracklets held by this node and its children.
+        unsigned int getNumTracklets() const;
+        // safe to call from several linking threads at once.
         void addVisit();
 
         // return true iff this node OR ITS CHILDREN holds the tracklet t
@@ -74,6 +99,18 @@ namespace mops {
 
     protected:
 
+        void build(const std::vector<PointAndValue <unsigned int> > &allTracklets, 
+                   unsigned int *first,
+                   unsigned int *last,
+                   double positionalErrorRa, 
+                   double positionalErrorDec,
+                   unsigned int maxLeafSize, 
+                   unsigned int myAxisToSplit, 
+                   const std::vector<double> &widths,
+                   unsigned int &lastId,
+                   bool useMedian,
+                   bool splitWidest);
+
         /* after the "real" constructor is called at the root, and the
          * BaseKDTree constructor sets up the children, this function
          * is used to do a post-traversal of the children and update
@@ -83,7 +120,8 @@ namespace mops {
                                         double positionalErrorDec);
 
     private:
-        unsigned int numVisits;
+        std::atomic<unsigned int> numVisits;
+        unsigned int numTracklets;
     };
 
 
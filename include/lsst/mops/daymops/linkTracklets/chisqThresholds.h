@@ -0,0 +1,47 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * linkTracklets keeps a track only if prob(chisq) of its fit is above
+ * trackMinProbChisq, in both RA and Dec.  prob(chisq) falls as chisq
+ * rises, so that is the same as asking that chisq be below the value
+ * at which prob(chisq) equals trackMinProbChisq.  That value depends
+ * only on the degrees of freedom, so we work it out once per DOF up
+ * front rather than evaluating the chi-square CDF for every candidate
+ * track.
+ */
+
+
+#ifndef LSST_CHISQ_THRESHOLDS_H
+#define LSST_CHISQ_THRESHOLDS_H
+
+#include <vector>
+
+
+namespace lsst {
+namespace mops {
+
+
+    class ChisqThresholds {
+    public:
+        /* limits are precomputed for DOF up to maxDof; anything larger
+         * falls back to the CDF. */
+        ChisqThresholds(double minProbChisq, unsigned int maxDof=256);
+
+        /* true iff gsl_cdf_chisq_Q(chisq, dof) > minProbChisq, up
+         * to rounding error in the precomputed limit. */
+        bool accepts(double chisq, unsigned int dof) const;
+
+        /* the largest acceptable chisq for dof. */
+        double getMaxChisq(unsigned int dof) const;
+
+    private:
+        double minProbChisq;
+        // indexed by DOF
+        std::vector<double> maxChisq;
+    };
+
+
+}} // close namespace lsst::mops
+
+#endif
@@ -0,0 +1,117 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * Cheap pre-check for pairs of endpoint tracklets in linkTracklets.
+ *
+ * Every pair of endpoint tracklets used to be turned into a Track,
+ * fit with a quadratic, and only then tested by
+ * endpointTrackletsAreCompatible, which throws out most of them for too
+ * large an RA or Dec acceleration or too little time between first and
+ * last detection.
+ *
+ * The quadratic fit is a weighted least-squares fit, so its
+ * acceleration depends on the detections only through the sums of
+ * w t^k (k = 0..4) and w t^k y (k = 0..2), where w = 1/err^2.  We work
+ * those out once per tracklet (TrackletMoments); for a pair, the
+ * moments of the two tracklets are shifted to a common time and
+ * position and added, and the acceleration falls out of a 3x3 solve.
+ *
+ * The answer agrees with the full fit up to rounding error.  We only
+ * reject a pair if it fails by a margin much larger than that, so the
+ * pre-check never throws out a pair the full check would have kept;
+ * pairs which are close to a limit are left for the full check.
+ */
+
+
+#ifndef LSST_ENDPOINT_PRECHECK_H
+#define LSST_ENDPOINT_PRECHECK_H
+
+#include <vector>
+
+#include "lsst/mops/MopsDetection.h"
+#include "lsst/mops/Tracklet.h"
+#include "lsst/mops/TrackletStore.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+    /*
+     * weighted moments of a tracklet's detections in RA and in Dec.
+     * Times are relative to refTime (the mean detection time) and
+     * positions to refRa, refDec (those of the first detection).
+     */
+    class TrackletMoments {
+    public:
+        TrackletMoments();
+
+        TrackletMoments(const std::vector<MopsDetection> &allDetections,
+                        const Tracklet &tracklet);
+
+        /* for the detections with indices firstDetIndex to
+         * lastDetIndex - 1. */
+        TrackletMoments(const std::vector<MopsDetection> &allDetections,
+                        const unsigned int *firstDetIndex,
+                        const unsigned int *lastDetIndex);
+
+        double firstTime;
+        double lastTime;
+        double refTime;
+        double refRa;
+        double refDec;
+        // raT[k] is the sum of w (t - refTime)^k, raTY[k] of
+        // w (t - refTime)^k (RA - refRa), with w = 1/RaErr^2.
+        double raT[5];
+        double raTY[3];
+        double decT[5];
+        double decTY[3];
+    };
+
+
+
+    /* moments[i] will be those of allTracklets[i]. */
+    void calculateTrackletMoments(
+        const std::vector<MopsDetection> &allDetections,
+        const std::vector<Tracklet> &allTracklets,
+        std::vector<TrackletMoments> &moments);
+
+    void calculateTrackletMoments(
+        const std::vector<MopsDetection> &allDetections,
+        const TrackletStore &allTracklets,
+        std::vector<TrackletMoments> &moments);
+
+
+
+    /*
+     * the RA and Dec accelerations (2x the quadratic coefficients, as
+     * in Track::getBestFitQuadratic) of the quadratic fit to the
+     * detections of both tracklets.  Returns false, leaving raAcc and
+     * decAcc alone, if the fit is too badly conditioned to trust.
+     *
+     * Only good for tracklets with no detections in common.
+     */
+    bool pairAccelerations(const TrackletMoments &first,
+                           const TrackletMoments &second,
+                           double &raAcc, double &decAcc);
+
+
+
+    /*
+     * true only if endpointTrackletsAreCompatible would certainly say
+     * first and second are incompatible: the acceleration is over
+     * maxRaAcc or maxDecAcc by a clear margin, or the detections span
+     * less than minTimeSeparation days.  first must start before
+     * second.
+     */
+    bool endpointPairCertainlyIncompatible(const TrackletMoments &first,
+                                           const TrackletMoments &second,
+                                           double maxRaAcc,
+                                           double maxDecAcc,
+                                           double minTimeSeparation);
+
+
+}} // close namespace lsst::mops
+
+#endif
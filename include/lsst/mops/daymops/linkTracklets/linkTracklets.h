@@ -8,6 +8,7 @@
 
 #include "lsst/mops/MopsDetection.h"
 #include "lsst/mops/Tracklet.h"
+#include "lsst/mops/TrackletStore.h"
 #include "lsst/mops/Track.h"
 #include "lsst/mops/TrackSet.h"
 
@@ -16,7 +17,8 @@ namespace lsst {
 
 enum class trackOutputMethod { RETURN_TRACKS = 0,
                                IDS_FILE,
-                               IDS_FILE_WITH_CACHE};
+                               IDS_FILE_WITH_CACHE,
+                               IDS_FILE_ASYNC};
 
 
 /* use settings in this class to declare the verbosity of
@@ -127,6 +129,19 @@ public:
             skyCenterRa = 340.;
             skyCenterDec = -15.;
 
+            // run serially unless asked otherwise.
+            nThreads = 1;
+            taskSplitThreshold = 1e5;
+            useFlatTrackletTrees = false;
+            compatibilityCacheSize = 0;
+            useFastTrackFit = false;
+            useEndpointPrecheck = true;
+            // if empty, the images are those of the detections.
+            allImageMjds.clear();
+            // if empty, linkTrackletsIncremental can't be used.
+            incrementalStateDir = "";
+            incrementalWindowDays = 15.;
+
         }
 
     /* acceleration terms are in degrees/(day^2)
@@ -209,7 +224,8 @@ public:
      * minUniqueNights: 
      *
      * Tracks are not reported unless they contain detections from at
-     * least this many distinct nights.
+     * least this many distinct nights.  Images are on the same night
+     * unless separated by a gap of over half a day (see ImageIndex).
      */
     double minUniqueNights;
     
@@ -239,6 +255,14 @@ public:
 
     // if IDS_FILE_WITH_CACHE, Write to a file named by outputFile,
     // buffering outputBufferSize results between writes.
+
+    // if IDS_FILE_ASYNC, write the same file from a background thread,
+    // handing it outputBufferSize results at a time (a default batch
+    // size if 0).  Linking never waits on the disk, and duplicates are
+    // found by hashing rather than kept in a std::set; see
+    // AsyncTrackWriter.h.  Tracks are written in the order found, not
+    // sorted, and the file is complete once the returned TrackSet is
+    // deleted.
     trackOutputMethod outputMethod;
     std::string outputFile;
     unsigned int outputBufferSize;
@@ -260,6 +284,98 @@ public:
     double skyCenterRa;
     double skyCenterDec;
 
+    /* nThreads: number of worker threads used for linking.  Each
+     * (first endpoint image, second endpoint image) pair is an
+     * independent search; pairs are handed out to a work-stealing
+     * pool and each pair collects its tracks in its own TrackSet.
+     * Those are merged into the output in image-pair order, so the
+     * tracks found (and, for file output, the order they are
+     * written) do not depend on nThreads.
+     */
+    unsigned int nThreads;
+
+    /* taskSplitThreshold: only used if nThreads > 1.  A few dense
+     * image pairs can hold most of the work, leaving one thread busy
+     * and the rest idle.  So while searching a pair, whenever we
+     * split an endpoint node we estimate the work left below it
+     * (first endpoint tracklets * second endpoint tracklets * support
+     * nodes).  If that is at least taskSplitThreshold, one of the two
+     * child searches is queued as a separate task which other threads
+     * may steal.  Lower values spread work better but cost more
+     * overhead per task.
+     */
+    double taskSplitThreshold;
+
+    /* useFlatTrackletTrees: if true, each image's TrackletTree is
+     * copied into a FlatTrackletTree (one contiguous array of nodes,
+     * bounds stored per axis) before linking, and the pointer-based
+     * trees are freed.  Linking then walks the flat trees.  Results
+     * are identical either way; see FlatTrackletTree.h.
+     */
+    bool useFlatTrackletTrees;
+
+    /* compatibilityCacheSize: as the search descends the endpoint
+     * trees, the same support nodes are tested against the same
+     * endpoint nodes over and over.  The acceleration range allowed by
+     * each such pair of nodes is remembered in a least-recently-used
+     * cache holding at most this many pairs (per thread; an entry is
+     * about 100 bytes).  0 turns the cache off.  Results don't depend
+     * on it.  The hit rate is printed if myVerbosity.printVisitCounts
+     * is set.
+     *
+     * Off by default: the math being saved is only a few dozen flops
+     * per pair (and is vectorized), and in our tests a lookup cost
+     * more than that even at hit rates over 75%.  It may pay off
+     * where memory is fast relative to the CPU.
+     */
+    unsigned int compatibilityCacheSize;
+
+    /* useFastTrackFit: if true, candidate tracks are fit with
+     * Track::calculateBestFitQuadraticFast (fixed-size normal
+     * equations, no allocation) instead of calculateBestFitQuadratic
+     * (an SVD), and the trackMinProbChisq cut is made by comparing
+     * chisq against limits worked out once per degree of freedom (see
+     * ChisqThresholds) instead of calling the chi-square CDF per
+     * track.  The fits agree to within rounding error, so only tracks
+     * right at the edge of a cut could come out differently.
+     */
+    bool useFastTrackFit;
+
+    /* useEndpointPrecheck: if true, each pair of endpoint tracklets is
+     * first checked for acceleration and time separation with a
+     * closed-form fit worked out from per-tracklet sums (see
+     * endpointPrecheck.h), and only pairs which survive are made into
+     * Tracks and fit.  The pre-check only rejects pairs the full check
+     * would reject too, so results don't depend on it.  The number of
+     * pairs it removes is printed if myVerbosity.printVisitCounts is
+     * set.
+     */
+    bool useEndpointPrecheck;
+
+    /* allImageMjds: if not empty, the times of all the images in the
+     * survey window, which must include the time of every detection.
+     * Nights are then found from these rather than from the
+     * detections' own times (see ImageIndex).  Only needed when
+     * linking some of the detections of a window - say, those of one
+     * sky tile (see skyTiles.h) - as two images of a night may seem
+     * to be on different nights if none of the images between them
+     * have detections.
+     */
+    std::vector<double> allImageMjds;
+
+    /* incrementalStateDir: the directory in which
+     * linkTrackletsIncremental keeps the detections, tracklets and
+     * trees of the window from one run to the next (see
+     * LinkingState.h).  It is made if it doesn't exist.
+     */
+    std::string incrementalStateDir;
+
+    /* incrementalWindowDays: linkTrackletsIncremental drops images
+     * more than this many days before the latest new image, and finds
+     * no tracks which start before then.
+     */
+    double incrementalWindowDays;
+
 };
 
 
@@ -275,6 +391,35 @@ TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
                         std::vector<Tracklet> &queryTracklets,
                         const linkTrackletsConfig &searchConfig);
 
+/* the same, for tracklets in a TrackletStore, which is much smaller
+   for large runs.  Each tracklet's parameters are set, and its ID
+   set to its index; the tracks' component tracklet indices are
+   indices into queryTracklets. */
+TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
+                        TrackletStore &queryTracklets,
+                        const linkTrackletsConfig &searchConfig);
+
+/*
+ * link a night (or any run of images) at a time.  newDetections and
+ * newTracklets are the new images' detections and tracklets, all later
+ * than those of earlier runs; the detections, tracklets and tracklet
+ * trees of the window (the last incrementalWindowDays days) are kept
+ * in searchConfig.incrementalStateDir.  Only tracks which end in a new
+ * image are searched for, so each track is found once, in the run of
+ * its last image; only the new tracklets are fit and put in trees.
+ *
+ * newDetections are recentered and newTracklets are left as they are.
+ * The tracks' detection and tracklet indices are into the window's
+ * detections and tracklets (not newDetections), which aren't passed
+ * back, so use their detection IDs (as IDS_FILE output does).  The sky
+ * center, detectionLocationErrorThresh and leafSize must be the same
+ * from run to run.  allImageMjds, if not empty, must hold the times of
+ * all the images of the window.
+ */
+TrackSet* linkTrackletsIncremental(std::vector<MopsDetection> &newDetections,
+                                   TrackletStore &newTracklets,
+                                   const linkTrackletsConfig &searchConfig);
+
 
 
 
@@ -1,63 +1,72 @@
-// jmyers: took this from http://datahack.se/?p=103
-// when done with testing replace it with somebody's real implementation!
+// -*- LSST-C++ -*-
+
+/*
+ * LRUCache: a fixed-capacity map which, when full, throws out the least
+ * recently used entry to make room for a new one.
+ *
+ * Every operation is O(1) and nothing is allocated once the cache has
+ * filled up:
+ *
+ * - entries live in a vector, and an evicted entry's slot is reused by
+ *   the entry which replaces it.
+ * - recency is a doubly-linked list threaded through the entries by
+ *   index.
+ * - keys are found through an open-addressing (linear probing) hash
+ *   table of entry indices, kept at most half full.  Removal shifts
+ *   later entries of the probe run back rather than leaving
+ *   tombstones, so lookups stay short however long the cache is used.
+ *
+ * Also counts hits and misses of find(), for reporting.
+ *
+ * NOT thread-safe; give each thread its own cache.
+ */
 
 #ifndef _LRUCACHE_HPP_
 #define _LRUCACHE_HPP_
 
-#include <list>
-#include <map>
+#include <cstddef>
+#include <functional>
+#include <vector>
 
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Hash = std::hash<Key> >
 class LRUCache
 {
 public:
-     /* Shortcuts */
-
-     typedef std::list< std::pair< Key, Value> > List;
-     typedef typename List::iterator ListIter;
-     typedef typename List::const_iterator ListIterConst;
-     typedef std::map< Key, ListIter > Index;
-     typedef typename Index::iterator IndexIter;
-     
-     /* Constructor */
-     
+
+     /* a cache of size 0 stores nothing; every find() misses. */
      LRUCache(size_t size)  {
 	  m_size = size;
+	  m_count = 0;
+	  m_hits = 0;
+	  m_misses = 0;
+	  m_head = NONE;
+	  m_tail = NONE;
+	  m_free = NONE;
+	  _resizeTable();
      }
 
      ~LRUCache() {
      }
 
-     /* Iterators */
-
-     ListIterConst begin() const {
-	  return m_list.begin();
-     }
-
-     ListIterConst rbegin() const {
-	  return m_list.rbegin();
-     }
-
-     ListIterConst end() const {
-	  return m_list.end();
-     }
-
-     ListIterConst rend() const {
-	  return m_list.rend();
-     }
-
      /* Capacity */
 
      bool empty() const {
-	  return m_list.empty();
+	  return m_count == 0;
      }
 
      size_t size() const {
-	  return m_list.size();
+	  return m_count;
      }
 
+     /* shrinking below the current size drops the oldest entries. */
      void set_max_size(size_t size) {
 	  m_size = size;
+	  while (m_count > m_size) {
+	       _evict();
+	  }
+	  if (2 * m_size > m_table.size()) {
+	       _resizeTable();
+	  }
      }
 
      size_t max_size() const {
@@ -67,69 +76,212 @@ public:
      /* Modifiers */
 
      void insert(const Key& k, const Value& v) {
-	  IndexIter _i = m_index.find(k);
+	  if (m_size == 0) {
+	       return;
+	  }
+	  size_t h = m_hash(k);
+	  size_t bucket = _findBucket(k, h);
 
 	  // update current item
-	  if (_i != m_index.end()) {
-	       (*_i->second).second = v;
-	       _touch(_i);
+	  if (m_table[bucket] != NONE) {
+	       m_entries[m_table[bucket]].value = v;
+	       _touch(m_table[bucket]);
 	       return;
 	  }
 
-	  // insert new item
-	  m_index.insert(
-	       std::make_pair(
-		    k,
-		    m_list.insert(
-			 m_list.begin(),
-			 std::make_pair(k, v)
-			 )
-		    )
-	       );
+	  // make room if needed.  Evicting may move things around in
+	  // the table, so look for our bucket again.
+	  if (m_count >= m_size) {
+	       _evict();
+	       bucket = _findBucket(k, h);
+	  }
 
-	  // truncate if the list is too big
-	  if (m_size && m_list.size() > m_size) {
-	       ListIter _l = m_list.end();
-	       --_l;
-	       remove(_l->first);
+	  size_t slot;
+	  if (m_free != NONE) {
+	       slot = m_free;
+	       m_free = m_entries[slot].next;
+	       m_entries[slot].key = k;
+	       m_entries[slot].value = v;
+	  }
+	  else {
+	       slot = m_entries.size();
+	       m_entries.push_back(Entry(k, v));
 	  }
+	  m_entries[slot].hash = h;
+	  _linkAtHead(slot);
+	  m_table[bucket] = slot;
+	  m_count++;
      }
 
      void remove(const Key& k) {
-	  IndexIter _i = m_index.find(k);
-	  if (_i != m_index.end()) {
-	       m_list.erase(_i->second);
-	       m_index.erase(_i);
+	  size_t bucket = _findBucket(k, m_hash(k));
+	  if (m_table[bucket] != NONE) {
+	       _removeBucket(bucket);
 	  }
      }
 
      void clear() {
-	  m_index.clear();
-	  m_list.clear();
+	  m_entries.clear();
+	  for (size_t i = 0; i < m_table.size(); i++) {
+	       m_table[i] = NONE;
+	  }
+	  m_count = 0;
+	  m_head = NONE;
+	  m_tail = NONE;
+	  m_free = NONE;
      }
 
      /* Operations */
 
      bool find(const Key& k, Value& v, bool touch = true) {
-	  IndexIter _i = m_index.find(k);
-	  if (_i != m_index.end()) {
-	       v = (*_i->second).second;
-	       if (touch) _touch(_i);
+	  size_t slot = m_table[_findBucket(k, m_hash(k))];
+	  if (slot != NONE) {
+	       v = m_entries[slot].value;
+	       if (touch) _touch(slot);
+	       m_hits++;
 	       return true;
 	  }
+	  m_misses++;
 	  return false;
      }
 
+     /* Statistics */
+
+     unsigned long hits() const {
+	  return m_hits;
+     }
+
+     unsigned long misses() const {
+	  return m_misses;
+     }
+
 protected:
+     static const size_t NONE = (size_t) -1;
+
+     class Entry {
+     public:
+	  Entry(const Key& k, const Value& v) : key(k), value(v) {
+	  }
+	  Key key;
+	  Value value;
+	  size_t hash;
+	  // neighbours in recency order (prev is more recent), or, for
+	  // free slots, next is the next free slot.
+	  size_t prev;
+	  size_t next;
+     };
+
      size_t m_size;
-     List m_list;
-     Index m_index;
+     size_t m_count;
+     Hash m_hash;
+     std::vector<Entry> m_entries;
+     // indices into m_entries, or NONE for empty buckets.  The size is
+     // a power of two.
+     std::vector<size_t> m_table;
+     // most and least recently used entries
+     size_t m_head;
+     size_t m_tail;
+     // first free slot in m_entries
+     size_t m_free;
+     unsigned long m_hits;
+     unsigned long m_misses;
+
+     // the bucket holding k, or the empty bucket where it would go.
+     size_t _findBucket(const Key& k, size_t h) const {
+	  size_t mask = m_table.size() - 1;
+	  size_t i = h & mask;
+	  while ((m_table[i] != NONE) &&
+		 !((m_entries[m_table[i]].hash == h) &&
+		   (m_entries[m_table[i]].key == k))) {
+	       i = (i + 1) & mask;
+	  }
+	  return i;
+     }
+
+     void _removeBucket(size_t bucket) {
+	  size_t slot = m_table[bucket];
+	  _unlink(slot);
+	  m_entries[slot].next = m_free;
+	  m_free = slot;
+	  m_count--;
+
+	  // close the gap: move back any later entry of this probe run
+	  // which would no longer be found past the empty bucket.
+	  size_t mask = m_table.size() - 1;
+	  size_t hole = bucket;
+	  size_t i = bucket;
+	  while (true) {
+	       i = (i + 1) & mask;
+	       if (m_table[i] == NONE) {
+		    break;
+	       }
+	       size_t home = m_entries[m_table[i]].hash & mask;
+	       // can the entry at i stay put, i.e. is its home
+	       // cyclically in (hole, i]?
+	       bool stays = (hole <= i) ?
+		    ((hole < home) && (home <= i)) :
+		    ((hole < home) || (home <= i));
+	       if (!stays) {
+		    m_table[hole] = m_table[i];
+		    hole = i;
+	       }
+	  }
+	  m_table[hole] = NONE;
+     }
+
+     // size the table for m_size entries at most half full, and
+     // refill it.
+     void _resizeTable() {
+	  size_t tableSize = 1;
+	  while (tableSize < 2 * m_size) {
+	       tableSize *= 2;
+	  }
+	  m_table.assign(tableSize, NONE);
+	  size_t mask = tableSize - 1;
+	  for (size_t slot = m_head; slot != NONE;
+	       slot = m_entries[slot].next) {
+	       size_t i = m_entries[slot].hash & mask;
+	       while (m_table[i] != NONE) {
+		    i = (i + 1) & mask;
+	       }
+	       m_table[i] = slot;
+	  }
+     }
+
+     void _unlink(size_t slot) {
+	  Entry &e = m_entries[slot];
+	  if (e.prev != NONE) m_entries[e.prev].next = e.next;
+	  else m_head = e.next;
+	  if (e.next != NONE) m_entries[e.next].prev = e.prev;
+	  else m_tail = e.prev;
+     }
+
+     void _linkAtHead(size_t slot) {
+	  Entry &e = m_entries[slot];
+	  e.prev = NONE;
+	  e.next = m_head;
+	  if (m_head != NONE) m_entries[m_head].prev = slot;
+	  m_head = slot;
+	  if (m_tail == NONE) m_tail = slot;
+     }
 
      // move item to head
-     void _touch(IndexIter& _i) {
-	  m_list.splice(m_list.begin(), m_list, _i->second);
-	  _i->second = m_list.begin();
+     void _touch(size_t slot) {
+	  if (slot != m_head) {
+	       _unlink(slot);
+	       _linkAtHead(slot);
+	  }
+     }
+
+     // drop the least recently used item
+     void _evict() {
+	  if (m_tail != NONE) {
+	       remove(m_entries[m_tail].key);
+	  }
      }
 };
 
+template<typename Key, typename Value, typename Hash>
+const size_t LRUCache<Key, Value, Hash>::NONE;
+
 #endif
@@ -0,0 +1,190 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * skyTiles: linking a survey window one piece of the sky at a time.
+ *
+ * linkTracklets holds all the tracklets of the window in memory at
+ * once, and recenters the whole sky on one point.  Here the sky is cut
+ * into a grid of nRaTiles x nDecTiles tiles, and each tile is linked on
+ * its own (in its own process, or on its own machine) with only the
+ * tracklets which lie wholly within the tile or its halo: a margin
+ * around it wide enough that a track which starts in the tile stays
+ * inside the halo for the whole window.  Each tile's detections are
+ * recentered on the tile's center.
+ *
+ * The halo is as wide as the distance an object could go in the window
+ * (from the first detection to the last) moving at the speed of the
+ * fastest tracklet (or maxVelocity) and accelerating at maxRAAccel or
+ * maxDecAccel, plus trackAdditionThreshold and haloPadding.  As in
+ * linkTracklets itself, all of this is in degrees of RA and Dec, not of
+ * arc.  A track faster than that could be lost.
+ *
+ * Each tile keeps only the tracks whose first detection is in the tile
+ * itself (rather than its halo), so tracks which the halo cuts short
+ * aren't reported and no track should be found twice.  Still,
+ * mergeTrackFiles keeps only the first copy of any set of detection
+ * IDs, so tile outputs can be merged whatever they hold.
+ *
+ * linkTrackletsInSkyTiles does it all on one machine, forking a process
+ * per tile.  To spread tiles over machines, give each worker the same
+ * input, have it call linkSkyTile for its tiles, and merge the tile
+ * files with mergeTrackFiles.
+ */
+
+
+#ifndef LSST_SKY_TILES_H
+#define LSST_SKY_TILES_H
+
+#include <string>
+#include <vector>
+
+#include "lsst/mops/MopsDetection.h"
+#include "lsst/mops/TrackletStore.h"
+#include "lsst/mops/daymops/linkTracklets/linkTracklets.h"
+
+
+namespace lsst {
+namespace mops {
+
+
+class skyTilesConfig {
+public:
+    skyTilesConfig()
+        {
+            nRaTiles = 4;
+            nDecTiles = 2;
+            haloPadding = .1;
+            maxVelocity = 0;
+            nProcesses = 0;
+            keepTileFiles = false;
+        }
+
+    /* the sky is cut into nRaTiles equal ranges of RA and nDecTiles
+     * equal ranges of Dec. */
+    unsigned int nRaTiles;
+    unsigned int nDecTiles;
+
+    /* extra width (in degrees) added to each halo. */
+    double haloPadding;
+
+    /* if > 0, the halo is worked out for objects moving this fast (in
+     * degrees per day, in RA or Dec) rather than as fast as the
+     * fastest tracklet.  A few fast tracklets (often false ones) can
+     * make the halos, and so the tiles, much bigger than they need to
+     * be for most objects; faster tracks may then be lost. */
+    double maxVelocity;
+
+    /* number of tiles linked at once by linkTrackletsInSkyTiles (0:
+     * one per core).  Each tile also uses linkTrackletsConfig::nThreads
+     * threads. */
+    unsigned int nProcesses;
+
+    /* if false, the tile files are deleted once merged. */
+    bool keepTileFiles;
+};
+
+
+
+/*
+ * the grid of tiles, and the halo around each.  Tile i covers RA in
+ * [getRaMin(i), getRaMin(i) + getRaWidth()) and Dec in
+ * [getDecMin(i), getDecMin(i) + getDecWidth()), but for the last row
+ * of tiles, which also has Dec 90.
+ */
+class SkyTiling {
+public:
+    SkyTiling(unsigned int nRaTiles, unsigned int nDecTiles,
+              double raHalo, double decHalo);
+
+    unsigned int getNumTiles() const { return nRaTiles * nDecTiles; }
+    double getRaWidth() const { return 360. / nRaTiles; }
+    double getDecWidth() const { return 180. / nDecTiles; }
+    double getRaHalo() const { return raHalo; }
+    double getDecHalo() const { return decHalo; }
+
+    double getRaMin(unsigned int tile) const;
+    double getDecMin(unsigned int tile) const;
+    double getCenterRa(unsigned int tile) const;
+    double getCenterDec(unsigned int tile) const;
+
+    /* the one tile holding (RA, Dec); any RA is allowed. */
+    unsigned int getTileOfPoint(double RA, double Dec) const;
+
+    /* true if (RA, Dec) is in the tile or its halo. */
+    bool isInTileOrHalo(unsigned int tile, double RA, double Dec) const;
+
+private:
+    unsigned int nRaTiles;
+    unsigned int nDecTiles;
+    double raHalo;
+    double decHalo;
+};
+
+
+
+/* work out the RA and Dec halo widths for these tracklets, as
+ * described above. */
+void getSkyTileHalos(const std::vector<MopsDetection> &allDetections,
+                     const TrackletStore &queryTracklets,
+                     const linkTrackletsConfig &searchConfig,
+                     const skyTilesConfig &tilesConfig,
+                     double &raHalo, double &decHalo);
+
+/*
+ * the tracklets of one tile (those whose detections all lie within
+ * the tile or its halo) and their detections.  tileTracklets' indices
+ * are into tileDetections; tileDetections are in the order of
+ * allDetections.  startsInTile[i] is true if tileDetections[i] is in
+ * the tile itself.
+ */
+void getSkyTileInput(const std::vector<MopsDetection> &allDetections,
+                     const TrackletStore &queryTracklets,
+                     const SkyTiling &tiling,
+                     unsigned int tile,
+                     std::vector<MopsDetection> &tileDetections,
+                     TrackletStore &tileTracklets,
+                     std::vector<bool> &startsInTile);
+
+/*
+ * link one tile and write the tracks which start in it to
+ * outFileName (replacing it), as linkTracklets' IDS_FILE output is
+ * written.  searchConfig's skyCenterRa, skyCenterDec and output
+ * settings are ignored; if its allImageMjds is empty, the times of all
+ * of allDetections are used.  Returns the number of tracks written.
+ */
+unsigned int linkSkyTile(const std::vector<MopsDetection> &allDetections,
+                         const TrackletStore &queryTracklets,
+                         const linkTrackletsConfig &searchConfig,
+                         const SkyTiling &tiling,
+                         unsigned int tile,
+                         const std::string &outFileName);
+
+/*
+ * write each line of the inFileNames (each a list of detection IDs, as
+ * written by linkTracklets) to outFileName, but for any whose set of
+ * IDs has already been written.  Returns the number of tracks written.
+ */
+unsigned int mergeTrackFiles(const std::vector<std::string> &inFileNames,
+                             const std::string &outFileName);
+
+/*
+ * link queryTracklets one tile at a time, in tilesConfig.nProcesses
+ * child processes, writing all the tracks found to
+ * searchConfig.outputFile (whatever searchConfig.outputMethod).  Tile i
+ * writes its tracks to outputFile + ".tile<i>" first.  Returns the
+ * number of tracks written; throws if any tile fails.
+ *
+ * Children are made with fork(), so this should not be called while
+ * other threads are running.
+ */
+unsigned int linkTrackletsInSkyTiles(const std::vector<MopsDetection> &allDetections,
+                                     const TrackletStore &queryTracklets,
+                                     const linkTrackletsConfig &searchConfig,
+                                     const skyTilesConfig &tilesConfig);
+
+
+
+}} // close namespace lsst::mops
+
+#endif
@@ -0,0 +1,158 @@
+// -*- LSST-C++ -*-
+
+
+/*
+ * Batched version of linkTracklets' support node compatibility test.
+ *
+ * For each step of the linkTracklets recursion, every support node is
+ * checked against the same pair of endpoint nodes: the acceleration
+ * bounds are tightened by (first endpoint, support node) and then by
+ * (support node, second endpoint), and the support node survives if the
+ * bounds are still non-empty.  That is a couple dozen min/max operations
+ * per node with no branches that depend on other nodes, so here we do
+ * it for a whole batch of support nodes at once, four at a time with
+ * AVX2 when the CPU has it.
+ *
+ * The math (including the order of floating-point operations) is exactly
+ * that of updateAccBoundsReturnValidity in linkTracklets.cc, so the
+ * surviving nodes and their tightened bounds are bit-for-bit those the
+ * one-node-at-a-time test gives.
+ *
+ * Each of the two pair tests only ever lowers the max and raises the
+ * min, by amounts which depend on the two nodes and not on the starting
+ * bounds.  So we first work out the window each pair allows on its own
+ * (starting from +/- infinity) and then intersect the starting bounds
+ * with both windows; this gives the same answer, and the windows can
+ * be remembered and reused (see linkTracklets' compatibility cache).
+ */
+
+
+#ifndef LSST_SUPPORT_COMPATIBILITY_H
+#define LSST_SUPPORT_COMPATIBILITY_H
+
+#include <vector>
+
+
+namespace lsst {
+namespace mops {
+
+
+    /*
+     * the bounds (in RA, Dec, RAv, Decv order, as in TrackletTree) and
+     * image time of one endpoint node.
+     */
+    class EndpointBounds {
+    public:
+        double lBounds[4];
+        double uBounds[4];
+        double mjd;
+    };
+
+
+
+    /*
+     * the range of RA and Dec accelerations allowed by a pair of nodes.
+     * If minRa > maxRa or minDec > maxDec, no acceleration is allowed.
+     */
+    class AccWindow {
+    public:
+        double minRa;
+        double maxRa;
+        double minDec;
+        double maxDec;
+
+        /* narrow the given bounds to this window, the same way
+         * updateAccBoundsReturnValidity does.  Returns false if they
+         * end up empty. */
+        bool applyTo(double &accMinRa, double &accMaxRa,
+                     double &accMinDec, double &accMaxDec) const {
+            if (maxRa < accMaxRa) {
+                accMaxRa = maxRa;
+            }
+            if (maxDec < accMaxDec) {
+                accMaxDec = maxDec;
+            }
+            if (minRa > accMinRa) {
+                accMinRa = minRa;
+            }
+            if (minDec > accMinDec) {
+                accMinDec = minDec;
+            }
+            return !((accMinRa > accMaxRa) || (accMinDec > accMaxDec));
+        }
+    };
+
+
+
+    /*
+     * the window allowed by node A and the later node B, dt days
+     * apart, with bounds in RA, Dec, RAv, Decv order.
+     */
+    AccWindow pairAccWindow(const double aLBounds[4], 
+                            const double aUBounds[4],
+                            const double bLBounds[4], 
+                            const double bUBounds[4],
+                            double dt);
+
+
+
+    /*
+     * a batch of support nodes, stored per axis so the kernel can load
+     * four nodes' worth of any one bound at once.  Fill it with add(),
+     * run findCompatibleSupport(), then read survivors (and the
+     * tightened acceleration bounds of the survivors) by position.
+     *
+     * Meant to be kept around and reused: clear() keeps the capacity.
+     */
+    class SupportBatch {
+    public:
+        void clear();
+
+        void add(const double lBounds[4], const double uBounds[4],
+                 double mjd);
+
+        unsigned int size() const { return mjd.size(); }
+
+        // inputs
+        std::vector<double> lBounds[4];
+        std::vector<double> uBounds[4];
+        std::vector<double> mjd;
+
+        // outputs.  The acceleration bounds are only meaningful where
+        // survivors is nonzero.  firstWindows and secondWindows are
+        // the windows of (first endpoint, support node) and (support
+        // node, second endpoint) alone.
+        std::vector<AccWindow> firstWindows;
+        std::vector<AccWindow> secondWindows;
+        std::vector<unsigned char> survivors;
+        std::vector<double> accMinRa;
+        std::vector<double> accMaxRa;
+        std::vector<double> accMinDec;
+        std::vector<double> accMaxDec;
+    };
+
+
+
+    /*
+     * test every support node in batch for compatibility with the
+     * endpoints, starting from the given acceleration bounds, and fill
+     * in batch's outputs.  Returns the number of survivors.
+     *
+     * if allowSimd is false the scalar code is used even if the CPU
+     * supports AVX2; this is for testing.
+     */
+    unsigned int findCompatibleSupport(const EndpointBounds &firstEndpoint,
+                                       const EndpointBounds &secondEndpoint,
+                                       double accMinRa, double accMaxRa,
+                                       double accMinDec, double accMaxDec,
+                                       SupportBatch &batch,
+                                       bool allowSimd=true);
+
+
+    /* true if findCompatibleSupport will use the AVX2 kernel. */
+    bool haveSimdSupportKernel();
+
+
+}} // close namespace lsst::mops
+
+#endif
@@ -24,6 +24,7 @@
 #include "Exceptions.h"
 #include "KDTree.h"
 #include "Tracklet.h"
+#include "TrackletStore.h"
 
 
 namespace lsst {
@@ -36,8 +37,11 @@ namespace mops {
 
 bool isSane(unsigned int detsSize, const std::vector<Tracklet> *pairs);
 
+bool isSane(unsigned int detsSize, const TrackletStore *pairs);
+
 
 void writeTrackletsToOutFile(const std::vector<Tracklet> * tracklets, std::ofstream &outFile);
+void writeTrackletsToOutFile(const TrackletStore * tracklets, std::ofstream &outFile);
 
 
 void populateDetVectorFromFile(std::ifstream &detsFile, std::vector <MopsDetection> &myDets, const double &astromErr = 0.0);
@@ -45,12 +49,20 @@ void populateDetVectorFromFile(std::ifstream &detsFile, std::vector <MopsDetecti
 void populatePairsVectorFromFile(std::ifstream &pairsFile,
 				 std::vector <Tracklet> &pairsVector);
 
-/* these overloaded versions are mainly for SWIG, since Python file objects != fstreams */
+/* these overloaded versions are mainly for SWIG, since Python file objects != fstreams.
+ * populateDetVectorFromFile also reads binary detection stores (see DetectionStore.h),
+ * keeping their stored errors if astromErr is 0. */
 void writeTrackletsToOutFile(const std::vector<Tracklet> * tracklets, std::string outFileName);
+void writeTrackletsToOutFile(const TrackletStore * tracklets, std::string outFileName);
     void populateDetVectorFromFile(std::string detsFileName, std::vector <MopsDetection> &myDets, const double &astromErr = 0.0);
 void populatePairsVectorFromFile(std::string pairsFileName,
 				 std::vector <Tracklet> &pairsVector);
 
+/* reads the same files as populatePairsVectorFromFile, adding the
+ * tracklets to pairs. */
+void populateTrackletStoreFromFile(std::string pairsFileName,
+                                   TrackletStore &pairs);
+
 // look up the process PID and print its mem use info from /proc/<pid>
 void printMemUse();
 
@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "Tracklet.h"
+#include "TrackletStore.h"
 
 
 namespace lsst {
@@ -26,6 +27,12 @@ namespace mops {
             std::vector<Tracklet> &outVector,
             bool shortCircuit=true,
             bool sortBeforeIntersect=false);
+
+        void removeSubsetsPopulateOutputVector(
+            const TrackletStore *tracksVector, 
+            TrackletStore &outVector,
+            bool shortCircuit=true,
+            bool sortBeforeIntersect=false);
         
     };
     
@@ -34,6 +41,9 @@ namespace mops {
     void putLongestPerDetInOutputVector(const std::vector<Tracklet> *pairsVector, 
                                         std::vector<Tracklet> &outputVector);
 
+    void putLongestPerDetInOutputVector(const TrackletStore *pairsVector, 
+                                        TrackletStore &outputVector);
+
 }} // close namespace lsst::mops
 
 
@@ -3,6 +3,7 @@
 
 #include "lsst/mops/MopsDetection.h"
 #include "lsst/mops/Tracklet.h"
+#include "lsst/mops/TrackletStore.h"
 #include "lsst/mops/Track.h"
 #include "lsst/mops/daymops/findTracklets/findTracklets.h"
 #include "lsst/mops/daymops/linkTracklets/linkTracklets.h"
@@ -14,6 +15,12 @@ using namespace lsst::mops;
 
 PYBIND11_MAKE_OPAQUE(std::vector<Tracklet>);
 
+// Track keeps its indices in IndexSets; hand Python the same sets it
+// has always had.
+static std::set<unsigned int> indexSetToSet(const Track::IndexSet &s) {
+    return std::set<unsigned int>(s.begin(), s.end());
+}
+
 PYBIND11_PLUGIN(_daymopsLib) {
     py::module m("_daymopsLib", "mops_daymops C++ wrapper module");
 
@@ -33,6 +40,10 @@ PYBIND11_PLUGIN(_daymopsLib) {
                 &MopsDetection::setIndex)
         .def_property("ImageID", &MopsDetection::getImageID,
                 &MopsDetection::setImageID)
+        .def_property("imageIndex", &MopsDetection::getImageIndex,
+                &MopsDetection::setImageIndex)
+        .def_property("nightIndex", &MopsDetection::getNightIndex,
+                &MopsDetection::setNightIndex)
         .def_property("EpochMJD", &MopsDetection::getEpochMJD,
                 &MopsDetection::setEpochMJD)
         .def_property("RA", &MopsDetection::getRA,
@@ -57,10 +68,19 @@ PYBIND11_PLUGIN(_daymopsLib) {
         .def_readwrite("maxV", &findTrackletsConfig::maxV)
         .def_readwrite("minV", &findTrackletsConfig::minV)
         .def_readwrite("outputFile", &findTrackletsConfig::outputFile)
-        .def_readwrite("outputBufferSize", &findTrackletsConfig::outputBufferSize);
+        .def_readwrite("outputBufferSize", &findTrackletsConfig::outputBufferSize)
+        .def_readwrite("nThreads", &findTrackletsConfig::nThreads)
+        .def_readwrite("dualTreeSearch", &findTrackletsConfig::dualTreeSearch)
+        .def_readwrite("unitVectorSearch", &findTrackletsConfig::unitVectorSearch);
 
     // findTracklets
-    m.def("findTracklets", &findTracklets);
+    m.def("findTracklets", 
+          (std::vector<Tracklet> * (*)(const std::vector<MopsDetection> &, 
+                                       findTrackletsConfig)) &findTracklets);
+    m.def("findTracklets", 
+          (void (*)(const std::vector<MopsDetection> &, findTrackletsConfig,
+                    TrackletStore &)) &findTracklets,
+          py::arg("allDetections"), py::arg("config"), py::arg("results"));
 
     py::class_<Tracklet>(m, "Tracklet")
         .def(py::init<>())
@@ -78,6 +98,19 @@ PYBIND11_PLUGIN(_daymopsLib) {
                 })
         .def_readwrite("isCollapsed", &Tracklet::isCollapsed);
 
+    py::class_<TrackletStore>(m, "TrackletStore")
+        .def(py::init<>())
+        .def(py::init<const std::vector<Tracklet> &>())
+        .def("__len__", &TrackletStore::size)
+        .def("size", &TrackletStore::size)
+        .def("addTracklet", 
+             (unsigned int (TrackletStore::*)(const Tracklet &)) &TrackletStore::addTracklet)
+        .def("getTracklet", &TrackletStore::getTracklet)
+        .def("appendToVector", &TrackletStore::appendToVector)
+        .def("getNumIndices", &TrackletStore::getNumIndices)
+        .def("getId", &TrackletStore::getId)
+        .def("isCollapsed", &TrackletStore::isCollapsed);
+
     // linkTracklets
     py::class_<linkTrackletsConfig>(m, "linkTrackletsConfig")
         .def(py::init<>())
@@ -117,6 +150,24 @@ PYBIND11_PLUGIN(_daymopsLib) {
                 &linkTrackletsConfig::trackMinProbChisq)
         .def_readwrite("skyCenterRa",
                 &linkTrackletsConfig::skyCenterRa)
+        .def_readwrite("nThreads",
+                &linkTrackletsConfig::nThreads)
+        .def_readwrite("taskSplitThreshold",
+                &linkTrackletsConfig::taskSplitThreshold)
+        .def_readwrite("useFlatTrackletTrees",
+                &linkTrackletsConfig::useFlatTrackletTrees)
+        .def_readwrite("compatibilityCacheSize",
+                &linkTrackletsConfig::compatibilityCacheSize)
+        .def_readwrite("useFastTrackFit",
+                &linkTrackletsConfig::useFastTrackFit)
+        .def_readwrite("useEndpointPrecheck",
+                &linkTrackletsConfig::useEndpointPrecheck)
+        .def_readwrite("allImageMjds",
+                &linkTrackletsConfig::allImageMjds)
+        .def_readwrite("incrementalStateDir",
+                &linkTrackletsConfig::incrementalStateDir)
+        .def_readwrite("incrementalWindowDays",
+                &linkTrackletsConfig::incrementalWindowDays)
         .def_readwrite("myVerbosity",
                 &linkTrackletsConfig::myVerbosity);
 
@@ -127,8 +178,16 @@ PYBIND11_PLUGIN(_daymopsLib) {
         .def_readwrite("printTimesByCategory", &linkTrackletsVerbositySettings::printStatus)
         .def_readwrite("printBoundsInfo", &linkTrackletsVerbositySettings::printStatus);
 
-    m.def("linkTracklets", &linkTracklets,
+    m.def("linkTracklets", 
+            (TrackSet * (*)(std::vector<MopsDetection> &, std::vector<Tracklet> &,
+                            const linkTrackletsConfig &)) &linkTracklets,
+            py::arg("allDetections"), py::arg("queryTracklets"), py::arg("searchConfig"));
+    m.def("linkTracklets", 
+            (TrackSet * (*)(std::vector<MopsDetection> &, TrackletStore &,
+                            const linkTrackletsConfig &)) &linkTracklets,
             py::arg("allDetections"), py::arg("queryTracklets"), py::arg("searchConfig"));
+    m.def("linkTrackletsIncremental", &linkTrackletsIncremental,
+            py::arg("newDetections"), py::arg("newTracklets"), py::arg("searchConfig"));
 
     m.def("modifyWithAcceleration", &modifyWithAcceleration,
         py::arg("position"), py::arg("velocity"), py::arg("acceleration"), py::arg("time"));
@@ -141,7 +200,18 @@ PYBIND11_PLUGIN(_daymopsLib) {
             py::arg("allDetections"), py::arg("searchConfig"));
 
     // collapseTracklets
-    m.def("doCollapsingPopulateOutputVector",  &doCollapsingPopulateOutputVector,
+    m.def("doCollapsingPopulateOutputVector",  
+            (void (*)(const std::vector<MopsDetection> *, std::vector<Tracklet> &,
+                      std::vector<double>, std::vector<Tracklet> &,
+                      bool, bool, bool, double, bool)) &doCollapsingPopulateOutputVector,
+            py::arg("detections"), py::arg("tracklets"), py::arg("tolerances"),
+            py::arg("collapsedPairs"), py::arg("useMinimumRMS"),
+            py::arg("useBestFit"), py::arg("useRMSFilt"), py::arg("maxRMS"),
+            py::arg("beVerbose"));
+    m.def("doCollapsingPopulateOutputVector",  
+            (void (*)(const std::vector<MopsDetection> *, TrackletStore &,
+                      std::vector<double>, TrackletStore &,
+                      bool, bool, bool, double, bool)) &doCollapsingPopulateOutputVector,
             py::arg("detections"), py::arg("tracklets"), py::arg("tolerances"),
             py::arg("collapsedPairs"), py::arg("useMinimumRMS"),
             py::arg("useBestFit"), py::arg("useRMSFilt"), py::arg("maxRMS"),
@@ -182,11 +252,14 @@ PYBIND11_PLUGIN(_daymopsLib) {
             });
 
     py::class_<Track>(m , "Track")
-        .def("detectionIndices", &Track::getComponentDetectionIndices)
-        .def("diaIds", &Track::getComponentDetectionDiaIds)
-        .def("trackletIndices", &Track::getComponentDetectionDiaIds)
+        .def("detectionIndices", [](Track &t) {
+                return indexSetToSet(t.getComponentDetectionIndices());
+                })
+        .def("diaIds", [](Track &t) {
+                return indexSetToSet(t.getComponentDetectionDiaIds());
+                })
         .def("trackletIndices", [](Track &t) {
-                return py::cast((&t)->componentTrackletIndices);
+                return indexSetToSet(t.componentTrackletIndices);
                 });
 
     // This is a copy of TrackletSet for Tracks.
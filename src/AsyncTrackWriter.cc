@@ -0,0 +1,330 @@
+// -*- LSST-C++ -*-
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+
+#include "lsst/mops/Exceptions.h"
+#include "lsst/mops/AsyncTrackWriter.h"
+
+#define uint unsigned int
+
+namespace lsst {
+namespace mops {
+
+
+static const uint64_t EMPTY_SLOT = ~((uint64_t) 0);
+
+// room for this many batches on the way to (and back from) the writer;
+// with the queue to the writer full, the inserting thread waits.
+static const uint BATCH_QUEUE_CAPACITY = 64;
+
+
+
+void TrackBatch::add(const Track::IndexSet &diaIds)
+{
+    ids.push_back(diaIds.size());
+    ids.insert(ids.end(), diaIds.begin(), diaIds.end());
+    nTracks++;
+}
+
+
+
+
+TrackBatchQueue::TrackBatchQueue(uint capacity) : head(0), tail(0)
+{
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    slots.resize(size, NULL);
+    mask = size - 1;
+}
+
+
+
+bool TrackBatchQueue::push(TrackBatch *batch)
+{
+    size_t myTail = tail.load(std::memory_order_relaxed);
+    if (myTail - head.load(std::memory_order_acquire) == slots.size()) {
+        return false;
+    }
+    slots[myTail & mask] = batch;
+    tail.store(myTail + 1, std::memory_order_release);
+    return true;
+}
+
+
+
+TrackBatch *TrackBatchQueue::pop()
+{
+    size_t myHead = head.load(std::memory_order_relaxed);
+    if (myHead == tail.load(std::memory_order_acquire)) {
+        return NULL;
+    }
+    TrackBatch *batch = slots[myHead & mask];
+    head.store(myHead + 1, std::memory_order_release);
+    return batch;
+}
+
+
+
+
+AsyncTrackWriter::AsyncTrackWriter(const std::string &outFileName,
+                                   uint batchSize)
+    : toWriter(BATCH_QUEUE_CAPACITY), fromWriter(BATCH_QUEUE_CAPACITY),
+      closing(false), writeFailed(false)
+{
+    nUnique = 0;
+    closed = false;
+    batchSent = false;
+    this->batchSize = (batchSize > 0) ? batchSize : 1;
+    table.resize(1024);
+    for (uint i = 0; i < table.size(); i++) {
+        table[i].offset = EMPTY_SLOT;
+    }
+
+    outFile.open(outFileName.c_str(), std::ios_base::out | std::ios_base::app);
+    if (!outFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "AsyncTrackWriter: could not open " + outFileName
+                          + " for writing.\n");
+    }
+    filling = new TrackBatch;
+    allBatches.push_back(filling);
+    writer = std::thread(&AsyncTrackWriter::writerLoop, this);
+}
+
+
+
+AsyncTrackWriter::~AsyncTrackWriter()
+{
+    try {
+        close();
+    }
+    catch (std::exception &e) {
+        std::cerr << "AsyncTrackWriter: " << e.what() << std::endl;
+    }
+    for (uint i = 0; i < allBatches.size(); i++) {
+        delete allBatches[i];
+    }
+}
+
+
+
+/* any decent 64-bit mix will do; this is the finalizer from
+ * splitmix64. */
+static inline uint64_t mix64(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+
+uint64_t AsyncTrackWriter::hashIds(const Track::IndexSet &diaIds)
+{
+    uint64_t h = mix64(0x9e3779b97f4a7c15ULL + diaIds.size());
+    Track::IndexSet::const_iterator idIter;
+    for (idIter = diaIds.begin(); idIter != diaIds.end(); idIter++) {
+        h = mix64(h + 0x9e3779b97f4a7c15ULL + *idIter);
+    }
+    return h;
+}
+
+
+
+bool AsyncTrackWriter::findOrAdd(const Track::IndexSet &diaIds, uint64_t hash)
+{
+    size_t mask = table.size() - 1;
+    size_t i = hash & mask;
+    while (table[i].offset != EMPTY_SLOT) {
+        if (table[i].hash == hash) {
+            const unsigned int *seen = &seenIds[table[i].offset];
+            if ((seen[0] == diaIds.size()) &&
+                std::equal(diaIds.begin(), diaIds.end(), seen + 1)) {
+                return true;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+
+    table[i].hash = hash;
+    table[i].offset = seenIds.size();
+    seenIds.push_back(diaIds.size());
+    seenIds.insert(seenIds.end(), diaIds.begin(), diaIds.end());
+    nUnique++;
+    // keep the table at most half full.
+    if (2 * (size_t) nUnique >= table.size()) {
+        growTable();
+    }
+    return false;
+}
+
+
+
+void AsyncTrackWriter::growTable()
+{
+    std::vector<Slot> oldTable;
+    oldTable.swap(table);
+    table.resize(2 * oldTable.size());
+    for (uint i = 0; i < table.size(); i++) {
+        table[i].offset = EMPTY_SLOT;
+    }
+    size_t mask = table.size() - 1;
+    for (uint i = 0; i < oldTable.size(); i++) {
+        if (oldTable[i].offset != EMPTY_SLOT) {
+            size_t j = oldTable[i].hash & mask;
+            while (table[j].offset != EMPTY_SLOT) {
+                j = (j + 1) & mask;
+            }
+            table[j] = oldTable[i];
+        }
+    }
+}
+
+
+
+bool AsyncTrackWriter::insert(const Track &newTrack)
+{
+    return insert(newTrack.getComponentDetectionDiaIds());
+}
+
+
+
+bool AsyncTrackWriter::insert(const Track::IndexSet &diaIds)
+{
+    if (closed) {
+        throw LSST_EXCEPT(ProgrammerErrorException,
+                          "AsyncTrackWriter: insert called after close.\n");
+    }
+    if (findOrAdd(diaIds, hashIds(diaIds))) {
+        return false;
+    }
+    filling->add(diaIds);
+    if (filling->nTracks >= batchSize) {
+        sendBatch();
+    }
+    return true;
+}
+
+
+
+void AsyncTrackWriter::sendBatch()
+{
+    if (filling->nTracks == 0) {
+        return;
+    }
+    {
+        // the writer pops without the lock but signals batchTaken
+        // with it, so a pop can't slip in between a failed push and
+        // the wait.
+        std::unique_lock<std::mutex> lock(wakeLock);
+        batchTaken.wait(lock, [this] { return toWriter.push(filling); });
+        batchSent = true;
+    }
+    wakeWriter.notify_one();
+    filling = fromWriter.pop();
+    if (filling == NULL) {
+        filling = new TrackBatch;
+        allBatches.push_back(filling);
+    }
+}
+
+
+
+void AsyncTrackWriter::flush()
+{
+    if (!closed) {
+        sendBatch();
+    }
+}
+
+
+
+void AsyncTrackWriter::close()
+{
+    if (closed) {
+        return;
+    }
+    closed = true;
+    sendBatch();
+    {
+        std::lock_guard<std::mutex> lock(wakeLock);
+        closing.store(true, std::memory_order_release);
+    }
+    wakeWriter.notify_one();
+    writer.join();
+    outFile.close();
+    if (writeFailed.load() || outFile.fail()) {
+        throw LSST_EXCEPT(FileException,
+                          "AsyncTrackWriter: failed writing tracks to file.\n");
+    }
+}
+
+
+
+void AsyncTrackWriter::writerLoop()
+{
+    std::vector<char> buffer;
+    while (true) {
+        bool done;
+        {
+            std::unique_lock<std::mutex> lock(wakeLock);
+            wakeWriter.wait(lock, [this] { 
+                    return batchSent || closing.load(std::memory_order_acquire); });
+            // once closing is set, nothing more is pushed, so emptying
+            // the queue after this means we are done.
+            done = closing.load(std::memory_order_acquire);
+            batchSent = false;
+        }
+        TrackBatch *batch;
+        while ((batch = toWriter.pop()) != NULL) {
+            {
+                std::lock_guard<std::mutex> lock(wakeLock);
+                batchTaken.notify_one();
+            }
+            writeBatch(*batch, buffer);
+            batch->clear();
+            // if there is no room, the batch just isn't reused.
+            fromWriter.push(batch);
+        }
+        if (done) {
+            break;
+        }
+    }
+}
+
+
+
+/* formats the batch exactly as TrackSet::writeToFile would and writes
+ * it with one call. */
+void AsyncTrackWriter::writeBatch(const TrackBatch &batch,
+                                  std::vector<char> &buffer)
+{
+    // an ID and its blank take at most 11 characters, and a line's
+    // newline one more.
+    buffer.resize(12 * batch.ids.size() + 1);
+    char *out = buffer.data();
+    char *bufferEnd = buffer.data() + buffer.size();
+    uint pos = 0;
+    while (pos < batch.ids.size()) {
+        uint nIds = batch.ids[pos];
+        pos++;
+        for (uint i = 0; i < nIds; i++) {
+            out = std::to_chars(out, bufferEnd, batch.ids[pos + i]).ptr;
+            *out++ = ' ';
+        }
+        *out++ = '\n';
+        pos += nIds;
+    }
+    outFile.write(buffer.data(), out - buffer.data());
+    outFile.flush();
+    if (!outFile) {
+        writeFailed.store(true);
+    }
+}
+
+
+
+}} // close namespace lsst::mops
@@ -0,0 +1,109 @@
+// -*- LSST-C++ -*-
+#include <algorithm>
+// for open, fstat and mmap
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lsst/mops/Exceptions.h"
+#include "lsst/mops/ChunkedTextReader.h"
+
+#define uint unsigned int
+
+namespace lsst {
+namespace mops {
+
+
+bool onlyBlanksLeft(const char *pos, const char *end)
+{
+    while (pos < end) {
+        if ((*pos != ' ') && (*pos != '\t') && (*pos != '\r')) {
+            return false;
+        }
+        pos++;
+    }
+    return true;
+}
+
+
+
+
+ChunkedTextReader::ChunkedTextReader(const std::string &fileName,
+                                     const std::string &fileKind)
+{
+    mapped = NULL;
+    data = NULL;
+    dataSize = 0;
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open " + fileKind + " file " + fileName
+                          + " - does this file exist?\n");
+    }
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0) {
+        ::close(fd);
+        throw LSST_EXCEPT(FileException,
+                          "Failed to stat " + fileKind + " file " + fileName + "\n");
+    }
+    // an empty file can't be mapped, but has no lines either.
+    if (fileInfo.st_size > 0) {
+        dataSize = fileInfo.st_size;
+        mapped = mmap(NULL, dataSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw LSST_EXCEPT(FileException,
+                              "Failed to map " + fileKind + " file " + fileName + "\n");
+        }
+        // we read it front to back, once.
+        madvise(mapped, dataSize, MADV_SEQUENTIAL);
+        data = (const char *) mapped;
+    }
+    ::close(fd);
+}
+
+
+
+ChunkedTextReader::~ChunkedTextReader()
+{
+    if (mapped != NULL) {
+        munmap(mapped, dataSize);
+    }
+}
+
+
+
+void ChunkedTextReader::splitIntoChunks(uint nChunks,
+                                        std::vector<const char *> &chunkStarts,
+                                        std::vector<unsigned long> &chunkFirstLines) const
+{
+    const char *end = data + dataSize;
+    chunkStarts.clear();
+    chunkFirstLines.clear();
+    chunkStarts.push_back(data);
+    chunkFirstLines.push_back(0);
+    for (uint c = 1; c < nChunks; c++) {
+        // move the even split point on to the start of the next line.
+        const char *start = data + (dataSize / nChunks) * c;
+        if (start <= chunkStarts.back()) {
+            continue;
+        }
+        const char *newline = (const char *) memchr(start - 1, '\n', end - start + 1);
+        if ((newline == NULL) || (newline + 1 >= end)) {
+            break;
+        }
+        start = newline + 1;
+        if (start <= chunkStarts.back()) {
+            continue;
+        }
+        chunkFirstLines.push_back(chunkFirstLines.back() +
+                                  std::count(chunkStarts.back(), start, '\n'));
+        chunkStarts.push_back(start);
+    }
+    chunkStarts.push_back(end);
+}
+
+
+
+}} // close namespace lsst::mops
@@ -0,0 +1,250 @@
+// -*- LSST-C++ -*-
+#include <string.h>
+// for open, fstat and mmap
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "lsst/mops/Exceptions.h"
+#include "lsst/mops/fileUtils.h"
+#include "lsst/mops/DetectionStore.h"
+
+#define uint unsigned int
+
+namespace lsst {
+namespace mops {
+
+
+static const char STORE_MAGIC[8] = {'M', 'O', 'P', 'S', 'D', 'E', 'T', 'S'};
+static const uint32_t STORE_VERSION = 1;
+// reads back as something else if the byte order differs.
+static const uint32_t STORE_BYTE_ORDER = 0x01020304;
+static const uint64_t COLUMN_ALIGNMENT = 64;
+
+struct DetectionStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t nDetections;
+    uint64_t columnOffsets[DetectionStore::N_COLUMNS];
+};
+
+static const uint64_t COLUMN_WIDTHS[DetectionStore::N_COLUMNS] = {
+    sizeof(double), sizeof(double), sizeof(double), sizeof(double),
+    sizeof(double), sizeof(int64_t), sizeof(int64_t), sizeof(int32_t),
+    sizeof(double), sizeof(double) };
+
+
+
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+}
+
+
+
+
+DetectionStore::DetectionStore(const std::string &fileName)
+{
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open detection store " + fileName
+                          + " - does this file exist?\n");
+    }
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0) {
+        ::close(fd);
+        throw LSST_EXCEPT(FileException,
+                          "Failed to stat detection store " + fileName + "\n");
+    }
+    mappedSize = fileInfo.st_size;
+    if (mappedSize < sizeof(DetectionStoreHeader)) {
+        ::close(fd);
+        throw LSST_EXCEPT(InputFileFormatErrorException,
+                          fileName + " is too short to be a detection store.\n");
+    }
+    mapped = mmap(NULL, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping holds its own reference to the file.
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to map detection store " + fileName + "\n");
+    }
+
+    const DetectionStoreHeader *header = (const DetectionStoreHeader *) mapped;
+    std::string problem;
+    if (memcmp(header->magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0) {
+        problem = " is not a detection store.\n";
+    }
+    else if (header->byteOrder != STORE_BYTE_ORDER) {
+        problem = " was written on a machine of different byte order.\n";
+    }
+    else if (header->version != STORE_VERSION) {
+        problem = " is a detection store of an unknown version.\n";
+    }
+    else if (header->nDetections > 0xffffffffULL) {
+        problem = " holds too many detections.\n";
+    }
+    else {
+        for (uint c = 0; c < N_COLUMNS; c++) {
+            uint64_t offset = header->columnOffsets[c];
+            if ((offset % COLUMN_ALIGNMENT != 0) ||
+                (offset > mappedSize) ||
+                (header->nDetections * COLUMN_WIDTHS[c] > mappedSize - offset)) {
+                problem = " is truncated or corrupt.\n";
+                break;
+            }
+            columns[c] = (const char *) mapped + offset;
+        }
+    }
+    if (problem != "") {
+        munmap(mapped, mappedSize);
+        throw LSST_EXCEPT(InputFileFormatErrorException, fileName + problem);
+    }
+    nDetections = header->nDetections;
+}
+
+
+
+DetectionStore::~DetectionStore()
+{
+    munmap(mapped, mappedSize);
+}
+
+
+
+bool DetectionStore::isDetectionStore(const std::string &fileName)
+{
+    std::ifstream inFile(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+    char magic[sizeof(STORE_MAGIC)];
+    if (!inFile.read(magic, sizeof(magic))) {
+        return false;
+    }
+    return memcmp(magic, STORE_MAGIC, sizeof(STORE_MAGIC)) == 0;
+}
+
+
+
+MopsDetection DetectionStore::getDetection(uint i) const
+{
+    return MopsDetection(getIDs()[i], getMJDs()[i], getRAs()[i], getDecs()[i],
+                         getRaErrs()[i], getDecErrs()[i], getSsmIds()[i],
+                         getImageIDs()[i], getSNRs()[i], getMags()[i]);
+}
+
+
+
+void DetectionStore::appendDetections(std::vector<MopsDetection> &dets) const
+{
+    dets.reserve(dets.size() + nDetections);
+    for (uint i = 0; i < nDetections; i++) {
+        dets.push_back(getDetection(i));
+    }
+}
+
+
+
+
+/* write nBytes of values, preceded by zeroes out to offset. */
+static void writeColumn(std::ofstream &outFile, uint64_t &written,
+                        uint64_t offset, const void *values, uint64_t nBytes)
+{
+    static const char zeroes[COLUMN_ALIGNMENT] = {0};
+    outFile.write(zeroes, offset - written);
+    outFile.write((const char *) values, nBytes);
+    written = offset + nBytes;
+}
+
+
+
+void writeDetectionStore(const std::vector<MopsDetection> &dets,
+                         const std::string &fileName)
+{
+    uint64_t n = dets.size();
+    DetectionStoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header.version = STORE_VERSION;
+    header.byteOrder = STORE_BYTE_ORDER;
+    header.nDetections = n;
+    uint64_t offset = alignUp(sizeof(header));
+    for (uint c = 0; c < DetectionStore::N_COLUMNS; c++) {
+        header.columnOffsets[c] = offset;
+        offset = alignUp(offset + n * COLUMN_WIDTHS[c]);
+    }
+
+    std::ofstream outFile(fileName.c_str(),
+                          std::ios_base::out | std::ios_base::binary |
+                          std::ios_base::trunc);
+    if (!outFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open output file " + fileName
+                          + " - do you have permission?\n");
+    }
+    outFile.write((const char *) &header, sizeof(header));
+    uint64_t written = sizeof(header);
+
+    // gather and write one column at a time.
+    std::vector<double> doubles(n);
+    std::vector<int64_t> longs(n);
+    std::vector<int32_t> ints(n);
+    for (uint c = 0; c < DetectionStore::N_COLUMNS; c++) {
+        const void *values;
+        for (uint i = 0; i < n; i++) {
+            const MopsDetection &det = dets[i];
+            switch (c) {
+            case DetectionStore::MJD_COLUMN: doubles[i] = det.getEpochMJD(); break;
+            case DetectionStore::RA_COLUMN: doubles[i] = det.getRA(); break;
+            case DetectionStore::DEC_COLUMN: doubles[i] = det.getDec(); break;
+            case DetectionStore::RA_ERR_COLUMN: doubles[i] = det.getRaErr(); break;
+            case DetectionStore::DEC_ERR_COLUMN: doubles[i] = det.getDecErr(); break;
+            case DetectionStore::ID_COLUMN: longs[i] = det.getID(); break;
+            case DetectionStore::IMAGE_ID_COLUMN: longs[i] = det.getImageID(); break;
+            case DetectionStore::SSM_ID_COLUMN: ints[i] = det.getSsmId(); break;
+            case DetectionStore::MAG_COLUMN: doubles[i] = det.getMag(); break;
+            case DetectionStore::SNR_COLUMN: doubles[i] = det.getSNR(); break;
+            }
+        }
+        if (COLUMN_WIDTHS[c] == sizeof(int32_t)) {
+            values = ints.data();
+        }
+        else if ((c == DetectionStore::ID_COLUMN) ||
+                 (c == DetectionStore::IMAGE_ID_COLUMN)) {
+            values = longs.data();
+        }
+        else {
+            values = doubles.data();
+        }
+        writeColumn(outFile, written, header.columnOffsets[c], values,
+                    n * COLUMN_WIDTHS[c]);
+    }
+    outFile.close();
+    if (outFile.fail()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed writing detection store " + fileName + "\n");
+    }
+}
+
+
+
+void convertDetectionFileToStore(const std::string &detsFileName,
+                                 const std::string &storeFileName,
+                                 double astromErr)
+{
+    std::ifstream detsFile(detsFileName.c_str());
+    if (!detsFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open dets file " + detsFileName
+                          + " - does this file exist?\n");
+    }
+    std::vector<MopsDetection> dets;
+    populateDetVectorFromFile(detsFile, dets, astromErr);
+    writeDetectionStore(dets, storeFileName);
+}
+
+
+}} // close namespace lsst::mops
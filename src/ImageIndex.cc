@@ -0,0 +1,168 @@
+// -*- LSST-C++ -*-
+#include <algorithm>
+
+#include "lsst/mops/Exceptions.h"
+#include "lsst/mops/ImageIndex.h"
+
+#define uint unsigned int
+
+namespace lsst {
+namespace mops {
+
+
+const double ImageIndex::NIGHT_GAP = .5;
+
+
+ImageIndex::ImageIndex()
+{
+    nNights = 0;
+}
+
+
+
+ImageIndex::ImageIndex(const std::vector<MopsDetection> &allDetections)
+{
+    imageMjds.resize(allDetections.size());
+    for (uint i = 0; i < allDetections.size(); i++) {
+        imageMjds[i] = allDetections[i].getEpochMJD();
+    }
+    std::sort(imageMjds.begin(), imageMjds.end());
+    imageMjds.erase(std::unique(imageMjds.begin(), imageMjds.end()),
+                    imageMjds.end());
+    indexDetections(allDetections);
+}
+
+
+
+ImageIndex::ImageIndex(const std::vector<MopsDetection> &allDetections,
+                       const std::vector<double> &allImageMjds)
+{
+    imageMjds = allImageMjds;
+    std::sort(imageMjds.begin(), imageMjds.end());
+    imageMjds.erase(std::unique(imageMjds.begin(), imageMjds.end()),
+                    imageMjds.end());
+    indexDetections(allDetections);
+    for (uint i = 0; i < allDetections.size(); i++) {
+        if ((detImages[i] == imageMjds.size()) ||
+            (imageMjds[detImages[i]] != allDetections[i].getEpochMJD())) {
+            throw LSST_EXCEPT(BadParameterException,
+                "ImageIndex: got a detection whose time is not among the image times.");
+        }
+    }
+}
+
+
+
+void ImageIndex::indexDetections(const std::vector<MopsDetection> &allDetections)
+{
+    detImages.resize(allDetections.size());
+    for (uint i = 0; i < allDetections.size(); i++) {
+        detImages[i] = std::lower_bound(imageMjds.begin(), imageMjds.end(),
+                                        allDetections[i].getEpochMJD())
+            - imageMjds.begin();
+    }
+
+    // a new night starts wherever there is a big enough gap between
+    // successive images.
+    nNights = 0;
+    imageNights.resize(imageMjds.size());
+    for (uint i = 0; i < imageMjds.size(); i++) {
+        if ((i == 0) || (imageMjds[i] - imageMjds[i - 1] > NIGHT_GAP)) {
+            nNights++;
+        }
+        imageNights[i] = nNights - 1;
+    }
+}
+
+
+
+void ImageIndex::getLaterImagesInRange(uint image, double minDt, double maxDt,
+                                       uint &firstImage, uint &endImage) const
+{
+    // compare differences, rather than against imageMjd + minDt, so
+    // that we agree exactly with callers testing each image in turn.
+    double imageMjd = imageMjds[image];
+    std::vector<double>::const_iterator first =
+        std::lower_bound(imageMjds.begin() + image + 1, imageMjds.end(), minDt,
+                         [imageMjd](double mjd, double dt) {
+                             return mjd - imageMjd < dt; });
+    std::vector<double>::const_iterator end =
+        std::upper_bound(first, imageMjds.end(), maxDt,
+                         [imageMjd](double dt, double mjd) {
+                             return dt < mjd - imageMjd; });
+    firstImage = first - imageMjds.begin();
+    endImage = end - imageMjds.begin();
+}
+
+
+
+void ImageIndex::labelDetections(std::vector<MopsDetection> &allDetections) const
+{
+    for (uint i = 0; i < allDetections.size(); i++) {
+        allDetections[i].setImageIndex(getImageOfDetection(i));
+        allDetections[i].setNightIndex(getNightOfDetection(i));
+    }
+}
+
+
+
+
+ImageGrouping::ImageGrouping(const std::vector<uint> &itemImages, uint nImages)
+{
+    build(itemImages, nImages);
+}
+
+
+
+ImageGrouping::ImageGrouping(const ImageIndex &imageIndex)
+{
+    build(imageIndex.detImages, imageIndex.getNumImages());
+}
+
+
+
+void ImageGrouping::build(const std::vector<uint> &itemImages, uint nImages)
+{
+    // count the items of each image, turn the counts into offsets,
+    // then drop each item into the next free place for its image.
+    offsets.assign(nImages + 1, 0);
+    for (uint i = 0; i < itemImages.size(); i++) {
+        if (itemImages[i] >= nImages) {
+            throw LSST_EXCEPT(BadParameterException,
+                              "ImageGrouping: got an item in an image past the last.");
+        }
+        offsets[itemImages[i] + 1]++;
+    }
+    for (uint image = 0; image < nImages; image++) {
+        offsets[image + 1] += offsets[image];
+    }
+    std::vector<uint> nextPlace(offsets.begin(), offsets.end() - 1);
+    order.resize(itemImages.size());
+    for (uint i = 0; i < itemImages.size(); i++) {
+        order[nextPlace[itemImages[i]]++] = i;
+    }
+}
+
+
+
+
+void DistinctIndexCounter::resize(uint nValues)
+{
+    words.assign((nValues + 63) / 64, 0);
+    touchedWords.clear();
+    nDistinct = 0;
+}
+
+
+
+void DistinctIndexCounter::clear()
+{
+    for (uint i = 0; i < touchedWords.size(); i++) {
+        words[touchedWords[i]] = 0;
+    }
+    touchedWords.clear();
+    nDistinct = 0;
+}
+
+
+}} // close namespace lsst::mops
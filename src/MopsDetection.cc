@@ -65,6 +65,16 @@ void MopsDetection::setImageID(long int newiid)
     imageID = newiid;
 }
 
+void MopsDetection::setImageIndex(long int newIndex) 
+{
+    imageIndex = newIndex;
+}
+
+void MopsDetection::setNightIndex(long int newIndex) 
+{
+    nightIndex = newIndex;
+}
+
 void MopsDetection::setMag(double newMag) 
 {
     mag = newMag;
@@ -106,6 +116,11 @@ void MopsDetection::setDecErr(double newDecErr)
 {
     DecErr = newDecErr;
 }
+
+void MopsDetection::setRaTopoCorr(double newRaTopoCorr)
+{
+    RaTopoCorr = newRaTopoCorr;
+}
  
 void MopsDetection::setObservatoryLocation(double lat, double longitude)
 {
@@ -130,6 +145,16 @@ long int MopsDetection::getImageID() const
     return imageID;
 }
 
+long int MopsDetection::getImageIndex() const
+{
+    return imageIndex;
+}
+
+long int MopsDetection::getNightIndex() const
+{
+    return nightIndex;
+}
+
 double MopsDetection::getMag() const
 {
     return mag;
@@ -235,7 +260,7 @@ void missing_palCs2c( float a, float b, float v[3] ) {
     cosb = cos(b);
     v[0] = cos(a)*cosb;
     v[1] = sin(a)*cosb;
-    v[3] = sin(b);
+    v[2] = sin(b);
 
 }
 
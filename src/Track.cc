@@ -11,6 +11,11 @@ namespace lsst { namespace mops {
 Track::Track()
 {
     epoch = 0;
+    chisqRa = 0;
+    chisqDec = 0;
+    probChisqRa = 0;
+    probChisqDec = 0;
+    chisqDof = 0;
 }
 
 
@@ -28,6 +33,22 @@ void Track::addTracklet(unsigned int trackletIndex,
      }
 
 }
+
+
+
+void Track::addTracklet(unsigned int trackletIndex,
+			const unsigned int *firstDetIndex,
+			const unsigned int *lastDetIndex,
+			const std::vector<MopsDetection> & allDets)
+{
+     componentTrackletIndices.insert(trackletIndex);
+     for (const unsigned int *detIndex = firstDetIndex;
+	  detIndex != lastDetIndex;
+	  detIndex++) {
+	  componentDetectionIndices.insert(*detIndex);
+	  componentDetectionDiaIds.insert(allDets.at(*detIndex).getID());
+     }
+}
 	  
 
 
@@ -40,28 +61,6 @@ void Track::addDetection(unsigned int detIndex, const std::vector<MopsDetection>
     componentDetectionDiaIds.insert(allDets.at(detIndex).getID());
 }
 	  
-const std::set<unsigned int> Track::getComponentDetectionIndices() const
-{
-    const std::set<unsigned int>copy(componentDetectionIndices);
-    return copy;
-}
-
-const std::set<unsigned int> Track::getComponentDetectionDiaIds() const
-{
-    const std::set<unsigned int>copy(componentDetectionDiaIds);
-    return copy;
-}
-
-
-Track & Track::operator= (const Track &other) {
-    componentTrackletIndices = other.componentTrackletIndices;
-    componentDetectionIndices = other.componentDetectionIndices;
-    componentDetectionDiaIds = other.componentDetectionDiaIds;
-    epoch = other.epoch;
-    raFunc = other.raFunc;
-    decFunc = other.decFunc;
-    return *this;
-}
 
 
 
@@ -74,7 +73,7 @@ int Track::getObjectId(const std::vector<MopsDetection> &allDets)
      }
      // no object should have ssmId -1; it's -1 for noise >=0 for real ssmIds.
      int toRet = -2;
-     std::set<unsigned int>::const_iterator detInd;
+     IndexSet::const_iterator detInd;
      for (detInd = componentDetectionIndices.begin();
 	  detInd != componentDetectionIndices.end(); detInd++) {
 	  int curId = allDets.at(*detInd).getSsmId();
@@ -142,7 +141,7 @@ void Track::calculateBestFitQuadratic(const std::vector<MopsDetection> &allDets,
     Eigen::VectorXd raE(trackLen);
 
     int i = 0;
-    for (std::set<unsigned int>::const_iterator detIndIt = componentDetectionIndices.begin();
+    for (IndexSet::const_iterator detIndIt = componentDetectionIndices.begin();
          detIndIt != componentDetectionIndices.end(); detIndIt++, i++) {
         const MopsDetection* curDet = &allDets.at(*detIndIt);
 	double t = curDet->getEpochMJD();
@@ -199,6 +198,7 @@ void Track::calculateBestFitQuadratic(const std::vector<MopsDetection> &allDets,
 // Calculate the prob(chisq), which will be the quality measure of the fit
 
     probChisqRa = gsl_cdf_chisq_Q(chisqRa, trackLen);
+    chisqDof = trackLen;
 
 // Calculate the covariance matrices of the least squares solutions for ra and dec - based on Numerical
 // Recipes eqn 15.4.20
@@ -294,7 +294,7 @@ void Track::calculateBestFitQuadratic(const std::vector<MopsDetection> &allDets,
 
 
     int i = 0;
-    for (std::set<unsigned int>::const_iterator detIndIt = componentDetectionIndices.begin();
+    for (IndexSet::const_iterator detIndIt = componentDetectionIndices.begin();
          detIndIt != componentDetectionIndices.end(); detIndIt++, i++) {
         const MopsDetection* curDet = &allDets.at(*detIndIt);
 	double t = curDet->getEpochMJD();
@@ -340,6 +340,7 @@ void Track::calculateBestFitQuadratic(const std::vector<MopsDetection> &allDets,
 // Calculate the prob(chisq), which will be the quality measure of the fit
 
     probChisqDec = gsl_cdf_chisq_Q(chisqDec, trackLen);
+    chisqDof = trackLen;
 
 // Calculate the covariance matrices of the least squares solutions for ra and dec - based on Numerical
 // Recipes eqn 15.4.20
@@ -402,6 +403,255 @@ void Track::calculateBestFitQuadratic(const std::vector<MopsDetection> &allDets,
 
 
 
+namespace {
+
+/*
+ * the fixed-size fits behind calculateBestFitQuadraticFast.  The rows of
+ * the design matrix are those built in calculateBestFitRa and
+ * calculateBestFitDec (time demeaned; an Ra model of 4 or 5 terms ends
+ * with the demeaned topocentric correction; every row weighted by
+ * 1/error), but rather than store them we make one pass over the
+ * detections to sum up the normal equations and another to sum the
+ * squared residuals.
+ */
+
+// normal equations worse than this (after scaling) go to the SVD.
+const double MIN_NORMAL_EQUATIONS_RCOND = 1e-13;
+
+template <int N>
+void fillFitRow(double t, int polyLen, bool topoTerm, double topoCorr,
+                Eigen::Matrix<double, N, 1> &row)
+{
+    row(0) = 1.0;
+    row(1) = t;
+    for (int i = 2; i < polyLen; i++) {
+        row(i) = row(i-1) * t;
+    }
+    if (topoTerm) {
+        row(N-1) = topoCorr;
+    }
+}
+
+
+
+/*
+ * fit the RA (if fitRa) or Dec of the given detections with an N term
+ * model.  Sets epoch and, for RA models with a topocentric term,
+ * meanTopoCorr; meanWeight is the mean of 1/error.
+ *
+ * The columns are scaled to unit diagonal before the Cholesky
+ * decomposition; our columns (1, t, t^2, ...) differ in size by orders
+ * of magnitude and this keeps the condition number down.  Returns false,
+ * leaving everything untouched, if the system is too close to singular
+ * to trust.
+ */
+template <int N>
+bool fitFixedSize(const std::vector<MopsDetection> &allDets,
+                  const Track::IndexSet &detIndices,
+                  bool fitRa, 
+                  double &epoch, double &meanTopoCorr,
+                  Track::FitVector &func, Track::FitMatrix &cov,
+                  double &chisq, double &meanWeight)
+{
+    typedef Eigen::Matrix<double, N, 1> Vec;
+    typedef Eigen::Matrix<double, N, N> Mat;
+
+    bool topoTerm = fitRa && (N >= 4);
+    int polyLen = topoTerm ? N - 1 : N;
+    double nDets = detIndices.size();
+    if (nDets == 0) {
+        return false;
+    }
+    Track::IndexSet::const_iterator detIndIt;
+
+    double sumT = 0;
+    double sumTopoCorr = 0;
+    double sumWeight = 0;
+    for (detIndIt = detIndices.begin(); detIndIt != detIndices.end(); detIndIt++) {
+        const MopsDetection &curDet = allDets.at(*detIndIt);
+        sumT += curDet.getEpochMJD();
+        if (topoTerm) {
+            sumTopoCorr += curDet.getRaTopoCorr();
+        }
+        sumWeight += 1.0 / (fitRa ? curDet.getRaErr() : curDet.getDecErr());
+    }
+    double myEpoch = sumT / nDets;
+    double myMeanTopoCorr = sumTopoCorr / nDets;
+
+    Mat ata = Mat::Zero();
+    Vec atb = Vec::Zero();
+    Vec row;
+    for (detIndIt = detIndices.begin(); detIndIt != detIndices.end(); detIndIt++) {
+        const MopsDetection &curDet = allDets.at(*detIndIt);
+        double weight = 1.0 / (fitRa ? curDet.getRaErr() : curDet.getDecErr());
+        fillFitRow<N>(curDet.getEpochMJD() - myEpoch, polyLen, topoTerm,
+                      topoTerm ? curDet.getRaTopoCorr() - myMeanTopoCorr : 0,
+                      row);
+        row *= weight;
+        ata += row * row.transpose();
+        atb += row * ((fitRa ? curDet.getRA() : curDet.getDec()) * weight);
+    }
+
+    Vec scale;
+    for (int i = 0; i < N; i++) {
+        if (!(ata(i,i) > 0)) {
+            return false;
+        }
+        scale(i) = 1.0 / sqrt(ata(i,i));
+    }
+    Mat scaled = scale.asDiagonal() * ata * scale.asDiagonal();
+    Eigen::LLT<Mat> llt(scaled);
+    if ((llt.info() != Eigen::Success) || 
+        !(llt.rcond() > MIN_NORMAL_EQUATIONS_RCOND)) {
+        return false;
+    }
+    Vec x = scale.asDiagonal() * llt.solve(scale.asDiagonal() * atb);
+    Mat scaledInverse = llt.solve(Mat::Identity());
+
+    double sumSq = 0;
+    for (detIndIt = detIndices.begin(); detIndIt != detIndices.end(); detIndIt++) {
+        const MopsDetection &curDet = allDets.at(*detIndIt);
+        double weight = 1.0 / (fitRa ? curDet.getRaErr() : curDet.getDecErr());
+        fillFitRow<N>(curDet.getEpochMJD() - myEpoch, polyLen, topoTerm,
+                      topoTerm ? curDet.getRaTopoCorr() - myMeanTopoCorr : 0,
+                      row);
+        row *= weight;
+        double resid = (fitRa ? curDet.getRA() : curDet.getDec()) * weight 
+            - row.dot(x);
+        sumSq += resid * resid;
+    }
+
+    epoch = myEpoch;
+    if (topoTerm) {
+        meanTopoCorr = myMeanTopoCorr;
+    }
+    func = x;
+    cov = scale.asDiagonal() * scaledInverse * scale.asDiagonal();
+    chisq = sumSq;
+    meanWeight = sumWeight / nDets;
+    return true;
+}
+
+} // anonymous namespace
+
+
+
+void Track::calculateBestFitQuadraticFast(const std::vector<MopsDetection> &allDets, 
+                                          const int forceOrder)
+{
+    // the order here is important, just as in calculateBestFitQuadratic.
+    calculateBestFitDecFast(allDets, forceOrder);
+    calculateBestFitRaFast(allDets, forceOrder);
+}
+
+
+
+void Track::calculateBestFitRaFast(const std::vector<MopsDetection> &allDets, 
+                                   const int forceOrder)
+{
+    float covRatioMax = 100.0;
+
+    int trackLen = componentDetectionIndices.size();
+
+    int raFuncLen;
+    if (forceOrder>0) {
+        raFuncLen = forceOrder;
+    }
+    else if (trackLen >= 6) {
+        raFuncLen = 5;
+    } 
+    else {
+        raFuncLen = 3;
+    }
+
+    bool fitOK = false;
+    double meanWeight;
+    if (raFuncLen == 5) {
+        fitOK = fitFixedSize<5>(allDets, componentDetectionIndices, true,
+                                epoch, meanTopoCorr, raFunc, raCov, 
+                                chisqRa, meanWeight);
+    }
+    else if (raFuncLen == 4) {
+        fitOK = fitFixedSize<4>(allDets, componentDetectionIndices, true,
+                                epoch, meanTopoCorr, raFunc, raCov, 
+                                chisqRa, meanWeight);
+    }
+    else if (raFuncLen == 3) {
+        fitOK = fitFixedSize<3>(allDets, componentDetectionIndices, true,
+                                epoch, meanTopoCorr, raFunc, raCov, 
+                                chisqRa, meanWeight);
+    }
+    if (!fitOK) {
+        calculateBestFitRa(allDets, raFuncLen);
+        return;
+    }
+    probChisqRa = -1;
+    chisqDof = trackLen;
+
+    // back off to a lower order if the fit isn't justified; see
+    // calculateBestFitRa.
+    double raUnc, decUnc;
+    predictLocationUncertaintyAtTime(epoch, raUnc, decUnc, true, false);
+    double ratioRa = raUnc*meanWeight/sqrt(chisqRa/trackLen);
+    if ((ratioRa>covRatioMax) && (raFuncLen>3)) {
+        calculateBestFitRaFast(allDets, raFuncLen-1);
+    }
+}
+
+
+
+void Track::calculateBestFitDecFast(const std::vector<MopsDetection> &allDets, 
+                                    const int forceOrder)
+{
+    float covRatioMax = 100.0;
+
+    int trackLen = componentDetectionIndices.size();
+
+    int decFuncLen;
+    if (forceOrder>0) {
+        decFuncLen = forceOrder;
+    }
+    else if (trackLen >= 6) {
+        decFuncLen = 4;
+    } 
+    else {
+        decFuncLen = 3;
+    }
+
+    bool fitOK = false;
+    double meanWeight;
+    if (decFuncLen == 5) {
+        fitOK = fitFixedSize<5>(allDets, componentDetectionIndices, false,
+                                epoch, meanTopoCorr, decFunc, decCov, 
+                                chisqDec, meanWeight);
+    }
+    else if (decFuncLen == 4) {
+        fitOK = fitFixedSize<4>(allDets, componentDetectionIndices, false,
+                                epoch, meanTopoCorr, decFunc, decCov, 
+                                chisqDec, meanWeight);
+    }
+    else if (decFuncLen == 3) {
+        fitOK = fitFixedSize<3>(allDets, componentDetectionIndices, false,
+                                epoch, meanTopoCorr, decFunc, decCov, 
+                                chisqDec, meanWeight);
+    }
+    if (!fitOK) {
+        calculateBestFitDec(allDets, decFuncLen);
+        return;
+    }
+    probChisqDec = -1;
+    chisqDof = trackLen;
+
+    double raUnc, decUnc;
+    predictLocationUncertaintyAtTime(epoch, raUnc, decUnc, false, true);
+    double ratioDec = decUnc*meanWeight/sqrt(chisqDec/trackLen);
+    if ((ratioDec>covRatioMax) && (decFuncLen>3)) {
+        calculateBestFitDecFast(allDets, decFuncLen-1);
+    }
+}
+
+
+
 void Track::predictLocationAtTime(const double mjd, double &ra, double &dec) const
 {
 /* 
@@ -451,9 +701,9 @@ void Track::predictLocationUncertaintyAtTime(const double mjd, double &raUnc, do
 {
 
     double t = mjd - epoch;
-    Eigen::VectorXd gVecRa;
-    Eigen::VectorXd gVecDec;
-    Eigen::MatrixXd tmp;
+    FitVector gVecRa;
+    FitVector gVecDec;
+    Eigen::Matrix<double, 1, 1> tmp;
 
     if (calcRa) {
 	 if (raFunc.size() == 5) {
@@ -526,6 +776,22 @@ void Track::getBestFitQuadratic(double &epoch, double &ra0, double &raV, double
 
 }
 
+double Track::getProbChisqRa() const 
+{
+    if (probChisqRa < 0) {
+        probChisqRa = gsl_cdf_chisq_Q(chisqRa, chisqDof);
+    }
+    return probChisqRa;
+}
+
+double Track::getProbChisqDec() const 
+{
+    if (probChisqDec < 0) {
+        probChisqDec = gsl_cdf_chisq_Q(chisqDec, chisqDof);
+    }
+    return probChisqDec;
+}
+
 double Track::getFitRange() const {
      if (raFunc.size() == 5) {
 	  return raFunc(4);
@@ -5,6 +5,7 @@
 
 #include <iomanip>
 #include <iostream>
+#include <utility>
 
 #include "lsst/mops/Exceptions.h"
 #include "lsst/mops/TrackSet.h"
@@ -16,8 +17,22 @@ namespace mops {
 
 
 
-TrackSet::TrackSet(std::string outFileName, bool useCache, unsigned int cacheSize) 
+TrackSet::TrackSet(std::string outFileName, bool useCache, unsigned int cacheSize,
+                   bool asyncWrite) 
 {
+    if (asyncWrite) {
+        this->useCache = false;
+        this->cacheSize = 0;
+        useOutFile = false;
+        if (cacheSize > 0) {
+            asyncWriter.reset(new AsyncTrackWriter(outFileName, cacheSize));
+        }
+        else {
+            asyncWriter.reset(new AsyncTrackWriter(outFileName));
+        }
+        return;
+    }
+
     if (useCache) {
         this->useCache = true;
         this->cacheSize = cacheSize;
@@ -34,6 +49,10 @@ TrackSet::TrackSet(std::string outFileName, bool useCache, unsigned int cacheSiz
 
 void TrackSet::purgeToFile() 
 {
+    if (asyncWriter) {
+        asyncWriter->flush();
+        return;
+    }
     std::cout << "TrackSet: purgeToFile called.\n";
     if (useOutFile) {
         if (componentTracks.size() != 0) {
@@ -58,6 +77,8 @@ void TrackSet::purgeToFile()
 
 TrackSet::~TrackSet() 
 {
+    // closes the file once everything is written.
+    asyncWriter.reset();
     if (useOutFile) {
         purgeToFile();
         outFile.close();
@@ -75,8 +96,8 @@ void TrackSet::debugPrint()
          curTrack != componentTracks.end();
          curTrack++) {
         std::cout << "Track " << count << ": \n   Dias are: ";
-        std::set<unsigned int> diaIds = curTrack->getComponentDetectionDiaIds();
-        std::set<unsigned int>::const_iterator detIter;
+        const Track::IndexSet &diaIds = curTrack->getComponentDetectionDiaIds();
+        Track::IndexSet::const_iterator detIter;
         for (detIter = diaIds.begin();
              detIter != diaIds.end();
              detIter++) {
@@ -95,8 +116,8 @@ void TrackSet::writeToFile()
     for (curTrack = componentTracks.begin(); 
          curTrack != componentTracks.end();
          curTrack++) {
-        std::set<unsigned int>::const_iterator detIter;
-        std::set<unsigned int> diaIds = curTrack->getComponentDetectionDiaIds();
+        Track::IndexSet::const_iterator detIter;
+        const Track::IndexSet &diaIds = curTrack->getComponentDetectionDiaIds();
         for (detIter = diaIds.begin();
              detIter != diaIds.end();
              detIter++) {
@@ -125,8 +146,15 @@ void TrackSet::writeToFile()
 
 
 
-void TrackSet::insert(const Track &newTrack) {
-    componentTracks.insert(newTrack);
+/* both insert()s: newTrack is copied or moved into
+ * componentTracks, as TrackRef allows. */
+template <class TrackRef>
+void TrackSet::insertTrack(TrackRef &&newTrack) {
+    if (asyncWriter) {
+        asyncWriter->insert(newTrack);
+        return;
+    }
+    componentTracks.insert(std::forward<TrackRef>(newTrack));
     if (useCache && (componentTracks.size() >= cacheSize)) {
         std::cout << "TrackSet: componentTracks has reached size " << componentTracks.size()
                   << "; purging to file to clear out tracks.\n";
@@ -135,8 +163,21 @@ void TrackSet::insert(const Track &newTrack) {
 }
 
 
+void TrackSet::insert(const Track &newTrack) {
+    insertTrack(newTrack);
+}
+
+
+void TrackSet::insert(Track &&newTrack) {
+    insertTrack(std::move(newTrack));
+}
+
+
 
 unsigned int TrackSet::size() const {
+    if (asyncWriter) {
+        return asyncWriter->size();
+    }
     return componentTracks.size();
 }
 
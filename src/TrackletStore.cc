@@ -0,0 +1,185 @@
+// -*- LSST-C++ -*-
+#include <algorithm>
+
+#include "lsst/mops/TrackletStore.h"
+
+#define uint unsigned int
+
+namespace lsst {
+namespace mops {
+
+
+TrackletStore::TrackletStore()
+{
+    offsets.push_back(0);
+}
+
+
+
+TrackletStore::TrackletStore(const std::vector<Tracklet> &tracklets)
+{
+    offsets.push_back(0);
+    unsigned long nIndices = 0;
+    for (uint i = 0; i < tracklets.size(); i++) {
+        nIndices += tracklets[i].indices.size();
+    }
+    reserve(tracklets.size(), nIndices);
+    for (uint i = 0; i < tracklets.size(); i++) {
+        addTracklet(tracklets[i]);
+    }
+}
+
+
+
+void TrackletStore::clear()
+{
+    offsets.resize(1);
+    detIndices.clear();
+    ids.clear();
+    collapsed.clear();
+    ra0.clear();
+    dec0.clear();
+    raVelocity.clear();
+    decVelocity.clear();
+    deltaTime.clear();
+}
+
+
+
+void TrackletStore::reserve(uint nTracklets, unsigned long nIndices)
+{
+    offsets.reserve(nTracklets + 1);
+    detIndices.reserve(nIndices);
+    ids.reserve(nTracklets);
+    collapsed.reserve(nTracklets);
+}
+
+
+
+/* the indices from firstIndex on are those of a new tracklet; put
+ * them in order and add the tracklet's other columns. */
+uint TrackletStore::finishTracklet(unsigned long firstIndex)
+{
+    std::vector<uint>::iterator first = detIndices.begin() + firstIndex;
+    // findTracklets and the file readers almost always give them
+    // in order already.
+    if (!std::is_sorted(first, detIndices.end())) {
+        std::sort(first, detIndices.end());
+    }
+    detIndices.erase(std::unique(first, detIndices.end()), detIndices.end());
+
+    uint newIndex = size();
+    offsets.push_back(detIndices.size());
+    ids.push_back(newIndex);
+    collapsed.push_back(false);
+    if (hasParameters()) {
+        ra0.push_back(0);
+        dec0.push_back(0);
+        raVelocity.push_back(0);
+        decVelocity.push_back(0);
+        deltaTime.push_back(0);
+    }
+    return newIndex;
+}
+
+
+
+uint TrackletStore::addTracklet(const uint *begin, const uint *end)
+{
+    unsigned long firstIndex = detIndices.size();
+    detIndices.insert(detIndices.end(), begin, end);
+    return finishTracklet(firstIndex);
+}
+
+
+
+uint TrackletStore::addTracklet(const Tracklet &t)
+{
+    unsigned long firstIndex = detIndices.size();
+    detIndices.insert(detIndices.end(), t.indices.begin(), t.indices.end());
+    uint newIndex = finishTracklet(firstIndex);
+    ids[newIndex] = t.getId();
+    collapsed[newIndex] = t.isCollapsed;
+    return newIndex;
+}
+
+
+
+uint TrackletStore::addTracklet(const TrackletStore &other, uint i)
+{
+    unsigned long firstIndex = detIndices.size();
+    detIndices.insert(detIndices.end(), other.indicesBegin(i), other.indicesEnd(i));
+    uint newIndex = finishTracklet(firstIndex);
+    ids[newIndex] = other.ids[i];
+    collapsed[newIndex] = other.collapsed[i];
+    if (other.hasParameters()) {
+        setParameters(newIndex, other.ra0[i], other.dec0[i],
+                      other.raVelocity[i], other.decVelocity[i],
+                      other.deltaTime[i]);
+    }
+    return newIndex;
+}
+
+
+
+bool TrackletStore::contains(uint i, uint detIndex) const
+{
+    return std::binary_search(indicesBegin(i), indicesEnd(i), detIndex);
+}
+
+
+
+void TrackletStore::setParameters(uint i, double newRa0, double newDec0,
+                                  double newRaVelocity, double newDecVelocity,
+                                  double newDeltaTime)
+{
+    if (!hasParameters()) {
+        ra0.resize(size(), 0);
+        dec0.resize(size(), 0);
+        raVelocity.resize(size(), 0);
+        decVelocity.resize(size(), 0);
+        deltaTime.resize(size(), 0);
+    }
+    ra0[i] = newRa0;
+    dec0[i] = newDec0;
+    raVelocity[i] = newRaVelocity;
+    decVelocity[i] = newDecVelocity;
+    deltaTime[i] = newDeltaTime;
+}
+
+
+
+Tracklet TrackletStore::getTracklet(uint i) const
+{
+    Tracklet t;
+    for (const uint *index = indicesBegin(i); index != indicesEnd(i); index++) {
+        t.indices.insert(t.indices.end(), *index);
+    }
+    t.setId(ids[i]);
+    t.isCollapsed = collapsed[i];
+    if (hasParameters()) {
+        std::vector<double> raP0Vel(2);
+        raP0Vel[0] = ra0[i];
+        raP0Vel[1] = raVelocity[i];
+        std::vector<double> decP0Vel(2);
+        decP0Vel[0] = dec0[i];
+        decP0Vel[1] = decVelocity[i];
+        t.setBestFitFunctionRa(raP0Vel);
+        t.setBestFitFunctionDec(decP0Vel);
+    }
+    return t;
+}
+
+
+
+void TrackletStore::appendToVector(std::vector<Tracklet> &out) const
+{
+    out.reserve(out.size() + size());
+    for (uint i = 0; i < size(); i++) {
+        out.push_back(getTracklet(i));
+    }
+}
+
+
+
+}} // close namespace lsst::mops
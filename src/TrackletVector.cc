@@ -3,7 +3,9 @@
    4/08/10
 */
 
+#include <charconv>
 #include <ios>
+#include <iostream>
 #include <set>
 
 #include "lsst/mops/Exceptions.h"
@@ -27,10 +29,23 @@ TrackletVector::TrackletVector(std::string outFileName, bool useCache, unsigned
         this->useCache = false;
         this->cacheSize = 0;        
     }
+    nWritten = 0;
+    closed = false;
+    nCached = 0;
+    writing = false;
+    stopWriter = false;
+    writeFailed = false;
 
     useOutFile = true;
     outFile.open(outFileName.c_str(), std::ios_base::out | std::ios_base::app);
+    if (!outFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open output file " + outFileName + " - do you have permission?\n");
+    }
 
+    if (this->useCache) {
+        writer = std::thread(&TrackletVector::writerLoop, this);
+    }
 }
 
 
@@ -39,18 +54,60 @@ TrackletVector::TrackletVector(std::string outFileName, bool useCache, unsigned
 
 void TrackletVector::purgeToFile() 
 {
-    if (useOutFile) {
-        if (componentTracklets.size() != 0) {
-            writeToFile();
-        }        
-    }
-    else {
+    if (!useOutFile) {
         throw LSST_EXCEPT(BadParameterException,
                           "TrackletVector: Cannot purge to file in a trackletVector created without a file.");
     }
+    if (closed) {
+        throw LSST_EXCEPT(BadParameterException,
+                          "TrackletVector: Cannot purge to file after close.");
+    }
+
+    if (!useCache) {
+        if (nWritten < componentTracklets.size()) {
+            writeToFile();
+        }
+        return;
+    }
+
+    if (nCached == 0) {
+        return;
+    }
+    /* wait for the writer to finish the last lot, then swap buffers:
+     * it gets our tracklets and we get its (emptied) buffer. */
+    std::unique_lock<std::mutex> guard(writerLock);
+    writerStateChanged.wait(guard, [this] { return !writing; });
+    writingIds.swap(cachedIds);
+    cachedIds.clear();
+    nCached = 0;
+    writing = true;
+    guard.unlock();
+    writerStateChanged.notify_all();
+}
+
+
 
+
+
+void TrackletVector::close()
+{
+    if ((!useOutFile) || (closed)) {
+        return;
+    }
+    purgeToFile();
+    closed = true;
     if (useCache) {
-        componentTracklets.clear();
+        {
+            std::lock_guard<std::mutex> guard(writerLock);
+            stopWriter = true;
+        }
+        writerStateChanged.notify_all();
+        writer.join();
+    }
+    outFile.close();
+    if (writeFailed || outFile.fail()) {
+        throw LSST_EXCEPT(FileException,
+                          "TrackletVector: failed to write tracklets to output file.\n");
     }
 }
 
@@ -61,9 +118,11 @@ void TrackletVector::purgeToFile()
 
 TrackletVector::~TrackletVector() 
 {
-    if (useOutFile) {
-        purgeToFile();
-        outFile.close();
+    try {
+        close();
+    }
+    catch (std::exception &e) {
+        std::cerr << "TrackletVector: " << e.what() << std::endl;
     }
 }
 
@@ -73,22 +132,111 @@ TrackletVector::~TrackletVector()
 
 void TrackletVector::writeToFile()
 {
-    // TBD: eventually, get rid of fileUtils entirely and put its code here.
-    writeTrackletsToOutFile(&componentTracklets, outFile);
+    std::set<unsigned int>::const_iterator indicesIter;
+    for (unsigned int i = nWritten; i < componentTracklets.size(); i++) {
+        const Tracklet &t = componentTracklets[i];
+        for (indicesIter = t.indices.begin(); indicesIter != t.indices.end();
+             indicesIter++) {
+            outFile << *indicesIter << " ";
+        }
+        outFile << "\n";
+    }
+    outFile.flush();
+    nWritten = componentTracklets.size();
 }
 
 
 
 
 
-void TrackletVector::push_back(const Tracklet &newTracklet) {
+/* runs in the writer thread: write each lot of tracklets handed over
+ * by purgeToFile, until told to stop (after writing any last lot). */
+void TrackletVector::writerLoop()
+{
+    std::unique_lock<std::mutex> guard(writerLock);
+    while (true) {
+        writerStateChanged.wait(guard, [this] { return writing || stopWriter; });
+        if (writing) {
+            guard.unlock();
+            writeCachedIds(writingIds);
+            writingIds.clear();
+            guard.lock();
+            writing = false;
+            writerStateChanged.notify_all();
+        }
+        else {
+            return;
+        }
+    }
+}
+
+
+
+/* same format as writeToFile: each index followed by a space, a
+ * newline after each tracklet. */
+void TrackletVector::writeCachedIds(const std::vector<unsigned int> &ids)
+{
+    static const unsigned int FLUSH_SIZE = 1 << 20;
+    std::vector<char> buffer(FLUSH_SIZE + 256);
+    char *pos = buffer.data();
+    char *flushAt = buffer.data() + FLUSH_SIZE;
+    unsigned long i = 0;
+    while (i < ids.size()) {
+        unsigned int nIndices = ids[i];
+        i++;
+        for (unsigned int j = 0; j < nIndices; j++, i++) {
+            pos = std::to_chars(pos, pos + 16, ids[i]).ptr;
+            *pos++ = ' ';
+            if (pos >= flushAt) {
+                outFile.write(buffer.data(), pos - buffer.data());
+                pos = buffer.data();
+            }
+        }
+        *pos++ = '\n';
+    }
+    outFile.write(buffer.data(), pos - buffer.data());
+    outFile.flush();
+    if (outFile.fail()) {
+        writeFailed = true;
+    }
+}
+
+
 
 
-    if ((useOutFile) && (useCache) && (componentTracklets.size() >= cacheSize)) {
+
+void TrackletVector::push_back(const Tracklet &newTracklet) {
+
+    if (!useCache) {
+        componentTracklets.push_back(newTracklet);
+        return;
+    }
+    cachedIds.push_back(newTracklet.indices.size());
+    cachedIds.insert(cachedIds.end(), newTracklet.indices.begin(), 
+                     newTracklet.indices.end());
+    nCached++;
+    if (nCached >= cacheSize) {
         purgeToFile();
     }
+}
+
 
-    componentTracklets.push_back(newTracklet);
+
+void TrackletVector::push_back(const unsigned int *firstIndex, 
+                               const unsigned int *lastIndex) {
+
+    if (!useCache) {
+        Tracklet newTracklet;
+        newTracklet.indices.insert(firstIndex, lastIndex);
+        componentTracklets.push_back(newTracklet);
+        return;
+    }
+    cachedIds.push_back(lastIndex - firstIndex);
+    cachedIds.insert(cachedIds.end(), firstIndex, lastIndex);
+    nCached++;
+    if (nCached >= cacheSize) {
+        purgeToFile();
+    }
 }
 
 
@@ -0,0 +1,178 @@
+// -*- LSST-C++ -*-
+
+#include "lsst/mops/WorkStealingPool.h"
+
+namespace lsst {
+namespace mops {
+
+
+// which pool (if any) the current thread works for, and its index there.
+static thread_local const WorkStealingPool * currentPool = NULL;
+static thread_local unsigned int currentIndex = 0;
+
+
+
+WorkStealingPool::WorkStealingPool(unsigned int nThreads)
+{
+    if (nThreads == 0) {
+        nThreads = 1;
+    }
+    outstanding = 0;
+    queued = 0;
+    nextQueue = 0;
+    shuttingDown = false;
+
+    for (unsigned int i = 0; i < nThreads; i++) {
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+    for (unsigned int i = 0; i < nThreads; i++) {
+        workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+}
+
+
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::unique_lock<std::mutex> guard(stateLock);
+        allDone.wait(guard, [this] { return outstanding == 0; });
+        shuttingDown = true;
+    }
+    workAvailable.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+
+
+void WorkStealingPool::submit(Task task)
+{
+    unsigned int target;
+    {
+        // hold stateLock across the push so that a worker can never
+        // pick the task up before it has been counted.
+        std::lock_guard<std::mutex> guard(stateLock);
+        if (currentPool == this) {
+            target = currentIndex;
+        }
+        else {
+            target = nextQueue;
+            nextQueue = (nextQueue + 1) % queues.size();
+        }
+        {
+            std::lock_guard<std::mutex> qGuard(queues[target]->lock);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        outstanding++;
+        queued++;
+    }
+    workAvailable.notify_one();
+}
+
+
+
+void WorkStealingPool::wait()
+{
+    std::unique_lock<std::mutex> guard(stateLock);
+    allDone.wait(guard, [this] { return outstanding == 0; });
+    if (firstError) {
+        std::exception_ptr toThrow = firstError;
+        firstError = std::exception_ptr();
+        std::rethrow_exception(toThrow);
+    }
+}
+
+
+
+unsigned int WorkStealingPool::getNumThreads() const
+{
+    return workers.size();
+}
+
+
+
+unsigned int WorkStealingPool::getThreadIndex() const
+{
+    if (currentPool == this) {
+        return currentIndex;
+    }
+    return workers.size();
+}
+
+
+
+bool WorkStealingPool::tryGetTask(unsigned int myIndex, Task &task)
+{
+    {
+        WorkerQueue &mine = *queues[myIndex];
+        std::lock_guard<std::mutex> guard(mine.lock);
+        if (!mine.tasks.empty()) {
+            task = std::move(mine.tasks.back());
+            mine.tasks.pop_back();
+            return true;
+        }
+    }
+    for (unsigned int offset = 1; offset < queues.size(); offset++) {
+        WorkerQueue &victim = *queues[(myIndex + offset) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+void WorkStealingPool::workerLoop(unsigned int myIndex)
+{
+    currentPool = this;
+    currentIndex = myIndex;
+
+    while (true) {
+        Task task;
+        if (tryGetTask(myIndex, task)) {
+            {
+                std::lock_guard<std::mutex> guard(stateLock);
+                queued--;
+            }
+
+            std::exception_ptr err;
+            try {
+                task();
+            }
+            catch (...) {
+                err = std::current_exception();
+            }
+
+            bool finishedAll = false;
+            {
+                std::lock_guard<std::mutex> guard(stateLock);
+                if (err && !firstError) {
+                    firstError = err;
+                }
+                outstanding--;
+                finishedAll = (outstanding == 0);
+            }
+            if (finishedAll) {
+                allDone.notify_all();
+            }
+        }
+        else {
+            std::unique_lock<std::mutex> guard(stateLock);
+            workAvailable.wait(guard, [this] {
+                    return (queued > 0) || shuttingDown; });
+            if (shuttingDown && (queued == 0)) {
+                return;
+            }
+        }
+    }
+}
+
+
+
+}} // close namespace lsst::mops
@@ -22,9 +22,10 @@ namespace lsst {
 
     // declare some helper functions - these don't need to be exposed.
 
+    template <class Tracklets>
     void populateTrackletsForTreeVector(const std::vector<MopsDetection> *detections,
-                                        const std::vector<Tracklet> *tracklets,
-                                        std::vector<PointAndValue <unsigned int> >
+                                        const Tracklets *tracklets,
+                                        std::vector<PointAndValue <unsigned int, 4> >
                                         &trackletsForTree);
 
 
@@ -197,6 +198,92 @@ namespace lsst {
 
 
 
+
+
+    /* doCollapsing works on pairs in either a vector of Tracklets or a
+     * TrackletStore; these give it what it needs from each. */
+    static unsigned int numTracklets(const std::vector<Tracklet> &pairs) 
+    {
+        return pairs.size();
+    }
+
+    static unsigned int numTracklets(const TrackletStore &pairs) 
+    {
+        return pairs.size();
+    }
+
+    static std::set<unsigned int>::const_iterator 
+    indicesBegin(const std::vector<Tracklet> &pairs, unsigned int i)
+    {
+        return pairs[i].indices.begin();
+    }
+
+    static std::set<unsigned int>::const_iterator 
+    indicesEnd(const std::vector<Tracklet> &pairs, unsigned int i)
+    {
+        return pairs[i].indices.end();
+    }
+
+    static const unsigned int * indicesBegin(const TrackletStore &pairs, 
+                                             unsigned int i)
+    {
+        return pairs.indicesBegin(i);
+    }
+
+    static const unsigned int * indicesEnd(const TrackletStore &pairs, 
+                                           unsigned int i)
+    {
+        return pairs.indicesEnd(i);
+    }
+
+    static bool pairIsCollapsed(const std::vector<Tracklet> &pairs, unsigned int i)
+    {
+        return pairs[i].isCollapsed;
+    }
+
+    static bool pairIsCollapsed(const TrackletStore &pairs, unsigned int i)
+    {
+        return pairs.isCollapsed(i);
+    }
+
+    static const Tracklet & pairAsTracklet(const std::vector<Tracklet> &pairs, 
+                                           unsigned int i)
+    {
+        return pairs[i];
+    }
+
+    static Tracklet pairAsTracklet(const TrackletStore &pairs, unsigned int i)
+    {
+        return pairs.getTracklet(i);
+    }
+
+    /* as collapse(pairs[i], t). */
+    static void collapsePair(std::vector<Tracklet> &pairs, unsigned int i, 
+                             Tracklet &t)
+    {
+        collapse(pairs[i], t);
+    }
+
+    static void collapsePair(TrackletStore &pairs, unsigned int i, Tracklet &t)
+    {
+        pairs.setCollapsed(i, true);
+        t.isCollapsed = true;
+        t.indices.insert(pairs.indicesBegin(i), pairs.indicesEnd(i));
+    }
+
+    static void addToOutput(std::vector<Tracklet> &collapsedPairs, 
+                            const Tracklet &t)
+    {
+        collapsedPairs.push_back(t);
+    }
+
+    static void addToOutput(TrackletStore &collapsedPairs, const Tracklet &t)
+    {
+        collapsedPairs.addTracklet(t);
+    }
+
+
+
   
     /*
      * given vector detections and pairs, a vector of vectors of indices into
@@ -204,21 +291,22 @@ namespace lsst {
      * element of "pairs" describes a tracklet, a collection of detections)
      * put the resulting tracklets into collapsedPairs.
      */
-    void doCollapsingPopulateOutputVector(
+    template <class Tracklets>
+    void doCollapsing(
         const std::vector<MopsDetection> * detections, 
-        std::vector<Tracklet> &pairs,
+        Tracklets &pairs,
         std::vector<double> tolerances, 
-        std::vector<Tracklet> &collapsedPairs,       
+        Tracklets &collapsedPairs,       
         bool useMinimumRMS, bool useBestFit, 
         bool useRMSFilt,
         double maxRMS, bool beVerbose) {
 
         /* each t in trackletsForTree maps tracklet physical parameters (RA0,
          * Dec0, angle, vel.) to an index into pairs. */
-        std::vector<PointAndValue <unsigned int> >
+        std::vector<PointAndValue <unsigned int, 4> >
             trackletsForTree;
-        std::vector<PointAndValue<unsigned int> >::iterator trackletIter;
-        std::vector<PointAndValue<unsigned int> >::iterator similarTrackletIter;
+        std::vector<PointAndValue<unsigned int, 4> >::iterator trackletIter;
+        std::vector<unsigned int>::iterator similarTrackletIter;
 
         std::vector<GeometryType> geometryTypes(4);
         /* RA0, Dec0, and angle are all degree measures along [0,360).
@@ -237,31 +325,41 @@ namespace lsst {
             
             std::cout << "Building KDTree of all tracklets.." << std::endl;
         }
-        KDTree<unsigned int> searchTree(trackletsForTree, 4, MAX_LEAF_SIZE);       
+        KDTree<unsigned int, 4> searchTree(trackletsForTree, 4, MAX_LEAF_SIZE);       
         if (beVerbose) {
             std::cout << "done." << std::endl;
             std::cout << "Doing many, many tree queries and collapses..." << std::endl;
         }
         unsigned int trackletCount = 0;
+        std::vector<double> queryPoint(4);
+        // the values of the tracklets like the current one.
+        std::vector<unsigned int> similarTracklets;
+        auto addSimilarTracklet = [&similarTracklets](
+            const PointAndValue<unsigned int, 4> &match) {
+            similarTracklets.push_back(match.getValue());
+        };
         for (trackletIter = trackletsForTree.begin(); 
              trackletIter != trackletsForTree.end();
              trackletIter++) {
             trackletCount++;
             /* don't collapse a given tracklet twice */
-            if (pairs[trackletIter->getValue()].isCollapsed == false) {
+            if (pairIsCollapsed(pairs, trackletIter->getValue()) == false) {
                 
                 /* create a new tracklet which will be output. it is marked as
                    collapsed already, and so will be the current tracklet from
                    pairs.  This way we won't bother trying to collapse this tracklet again - 
                    if we don't get it now, it won't happen later, either. */
                 Tracklet newTracklet;
-                collapse(pairs[trackletIter->getValue()], newTracklet);
+                collapsePair(pairs, trackletIter->getValue(), newTracklet);
 
                 /* find all similar tracklets */
-                std::vector<PointAndValue<unsigned int> > queryResults = 
-                    searchTree.hyperRectangleSearch((*trackletIter).getPoint(), 
-                                                    tolerances, 
-                                                    geometryTypes);
+                std::copy(trackletIter->getPoint().begin(), 
+                          trackletIter->getPoint().end(), queryPoint.begin());
+                similarTracklets.clear();
+                searchTree.hyperRectangleSearch(queryPoint, 
+                                                tolerances, 
+                                                geometryTypes,
+                                                addSimilarTracklet);
                 
 
 
@@ -276,15 +374,15 @@ namespace lsst {
                         bool foundOne = false;
                         double bestMatchRMS = 1337;
                         unsigned int bestMatchID = 1337;
-                        for (similarTrackletIter = queryResults.begin();
-                             similarTrackletIter != queryResults.end();
+                        for (similarTrackletIter = similarTracklets.begin();
+                             similarTrackletIter != similarTracklets.end();
                              similarTrackletIter++) {
                             /* try combining the current tracklet with each
                                similar tracklet and getting an RMS value. */
-                            unsigned int similarTrackletID = similarTrackletIter->getValue();			    
-			    if ((pairs[similarTrackletID].isCollapsed == false) && 
-                                (trackletsAreCompatible(detections, pairs[similarTrackletID], newTracklet))) {
-                                Tracklet tmp = unionTracklets(newTracklet, pairs[similarTrackletID]);
+                            unsigned int similarTrackletID = *similarTrackletIter;			    
+			    if ((pairIsCollapsed(pairs, similarTrackletID) == false) && 
+                                (trackletsAreCompatible(detections, pairAsTracklet(pairs, similarTrackletID), newTracklet))) {
+                                Tracklet tmp = unionTracklets(newTracklet, pairAsTracklet(pairs, similarTrackletID));
                                 double tmpRMS = rmsForTracklet(tmp, detections);
                                if ((useRMSFilt == false) || 
                                     (tmpRMS <= maxRMS)) {
@@ -297,7 +395,7 @@ namespace lsst {
                             }
                         }
                         if (foundOne == true) {
-                            collapse(pairs[bestMatchID], newTracklet);
+                            collapsePair(pairs, bestMatchID, newTracklet);
                         }
                         else {
                             /* found no allowable matches*/
@@ -330,19 +428,18 @@ namespace lsst {
                         leastSquaresSolveForRADecLinear(&trackletDets, currentRAFunc, 
                                                                     currentDecFunc, t0);
 
-                        for (similarTrackletIter = queryResults.begin();
-                             similarTrackletIter != queryResults.end();
+                        for (similarTrackletIter = similarTracklets.begin();
+                             similarTrackletIter != similarTracklets.end();
                              similarTrackletIter++) {
                             /* find the similar tracklet closest to the current line. */
-                            unsigned int similarTrackletID = similarTrackletIter->getValue();
-                            const Tracklet* similarTracklet = &pairs[similarTrackletID];
+                            unsigned int similarTrackletID = *similarTrackletIter;
                             std::map<unsigned int, double> detIDToSqDist;
-                            if ((pairs[similarTrackletID].isCollapsed == false) && 
-                                (trackletsAreCompatible(detections, *similarTracklet, newTracklet))) {
+                            if ((pairIsCollapsed(pairs, similarTrackletID) == false) && 
+                                (trackletsAreCompatible(detections, pairAsTracklet(pairs, similarTrackletID), newTracklet))) {
                                 double netSqDist = 0;
                                 unsigned int newDets = 1;
-                                for (std::set<unsigned int>::const_iterator sIter=similarTracklet->indices.begin();
-                                     sIter != similarTracklet->indices.end(); sIter++) {
+                                for (auto sIter = indicesBegin(pairs, similarTrackletID);
+                                     sIter != indicesEnd(pairs, similarTrackletID); sIter++) {
                                     if (newTracklet.indices.find(*sIter) == newTracklet.indices.end()) {
                                         // this detection is not already in our current tracklet
                                         newDets++;
@@ -369,13 +466,13 @@ namespace lsst {
                         }
                         if (foundOne == true) {
                             // if newTracklet + best match has higher RMS than filter allows, we're done!
-                            Tracklet tmp = unionTracklets(newTracklet, pairs[bestMatchID]);
+                            Tracklet tmp = unionTracklets(newTracklet, pairAsTracklet(pairs, bestMatchID));
                             double tmpRMS = rmsForTracklet(tmp, detections);
                             if ((useRMSFilt == true) && (tmpRMS >  maxRMS)) {
                                 done = true;
                             }
                             else { /* we got a result, and it was legal */
-                                collapse(pairs[bestMatchID], newTracklet);
+                                collapsePair(pairs, bestMatchID, newTracklet);
                             }
                         }
                         else {
@@ -386,15 +483,15 @@ namespace lsst {
                 }
                 else {
                     /* be greedy - try tracklets without much discriminiation */
-                    for (similarTrackletIter = queryResults.begin();
-                         similarTrackletIter != queryResults.end();
+                    for (similarTrackletIter = similarTracklets.begin();
+                         similarTrackletIter != similarTracklets.end();
                          similarTrackletIter++) {
                         /* if tracklet is similar, has not already been collapsed,
                            not == query tracklet, and compatible with this tracklet
                            so far, then go ahead and collapse them together
                            greedily. */
-                        Tracklet similarTracklet = pairs[similarTrackletIter->getValue()];
-                        if ((similarTrackletIter->getValue() != trackletIter->getValue()) 
+                        Tracklet similarTracklet = pairAsTracklet(pairs, *similarTrackletIter);
+                        if ((*similarTrackletIter != trackletIter->getValue()) 
                             &&
                             (similarTracklet.isCollapsed == false)
                             && 
@@ -404,34 +501,60 @@ namespace lsst {
                                 /* check that this is a 'good enough' fit to use. */
                                 Tracklet tmp = newTracklet;
                                 /* subtly abuse the 'collapse' function as a union operation */
-                                collapse(pairs[similarTrackletIter->getValue()], newTracklet);
+                                collapsePair(pairs, *similarTrackletIter, newTracklet);
                                 if (rmsForTracklet(tmp, detections) > maxRMS) {
                                     collapseIsLegal = false;
                                 }
                             }
                             if (collapseIsLegal) {
-                                collapse(pairs[similarTrackletIter->getValue()], newTracklet);
+                                collapsePair(pairs, *similarTrackletIter, newTracklet);
                             }
                         }
                     }                        
                 }
 
                 /* this tracklet is valid output. */
-                collapsedPairs.push_back(newTracklet);
+                addToOutput(collapsedPairs, newTracklet);
             } /* end 'if (pairs[trackletIter->getValue().isCollapsed == false) */
         
         } /* end 'for (trackletIter in trackletsForTree... ) */
 
         /* temporary sanity check */
 
-        for (std::vector<Tracklet>::iterator tIter = pairs.begin();
-             tIter != pairs.end();
-             tIter++) {
-            if (tIter->isCollapsed == false) {
+        for (unsigned int i = 0; i < numTracklets(pairs); i++) {
+            if (pairIsCollapsed(pairs, i) == false) {
                 std::cerr << "got a tracklet which was not collapsed!" << std::endl;
             }
         }
     }
+
+
+
+    void doCollapsingPopulateOutputVector(
+        const std::vector<MopsDetection> * detections, 
+        std::vector<Tracklet> &pairs,
+        std::vector<double> tolerances, 
+        std::vector<Tracklet> &collapsedPairs,       
+        bool useMinimumRMS, bool useBestFit, 
+        bool useRMSFilt,
+        double maxRMS, bool beVerbose) {
+        doCollapsing(detections, pairs, tolerances, collapsedPairs,
+                     useMinimumRMS, useBestFit, useRMSFilt, maxRMS, beVerbose);
+    }
+
+
+
+    void doCollapsingPopulateOutputVector(
+        const std::vector<MopsDetection> * detections, 
+        TrackletStore &pairs,
+        std::vector<double> tolerances, 
+        TrackletStore &collapsedPairs,       
+        bool useMinimumRMS, bool useBestFit, 
+        bool useRMSFilt,
+        double maxRMS, bool beVerbose) {
+        doCollapsing(detections, pairs, tolerances, collapsedPairs,
+                     useMinimumRMS, useBestFit, useRMSFilt, maxRMS, beVerbose);
+    }
     
 
 
@@ -511,23 +634,22 @@ namespace lsst {
 
 
 
+    template <class Tracklets>
     void populateTrackletsForTreeVector(const std::vector<MopsDetection> *detections,
-                                                           const std::vector<Tracklet> * tracklets,
-                                                           std::vector<PointAndValue <unsigned int> >
+                                                           const Tracklets * tracklets,
+                                                           std::vector<PointAndValue <unsigned int, 4> >
                                                            &trackletsForTree) {
         
         double midPointTime = getMidPointTime(detections);
-        std::vector<Tracklet>::const_iterator trackletIter;
-        std::set<unsigned int>::iterator indicesIter;
 
-        unsigned int i = 0;
-        for (trackletIter = (*tracklets).begin(); trackletIter != (*tracklets).end(); trackletIter++) {
-            PointAndValue <unsigned int> curTracklet;
+        for (unsigned int i = 0; i < numTracklets(*tracklets); i++) {
+            PointAndValue <unsigned int, 4> curTracklet;
+            PointAndValue <unsigned int, 4>::PointType trackletPoint;
             std::vector<double> motionVector(4); /* will hold RA0, Dec0, angle, velocity */
             std::vector<MopsDetection> trackletDets;
 
-            for (indicesIter = trackletIter->indices.begin(); 
-                 indicesIter != trackletIter->indices.end();
+            for (auto indicesIter = indicesBegin(*tracklets, i); 
+                 indicesIter != indicesEnd(*tracklets, i);
                  indicesIter++) {
                 trackletDets.push_back((*detections)[*indicesIter]);
             }
@@ -536,12 +658,13 @@ namespace lsst {
             /* for the KDTree, use parameterized representation as the
                spatial 'point' and make sure we get a reference to the
                current index into pairs as the associated value */
-            curTracklet.setPoint(motionVector);
+            std::copy(motionVector.begin(), motionVector.end(), 
+                      trackletPoint.begin());
+            curTracklet.setPoint(trackletPoint);
             /*each PointAndValue for the tree has Value which is index into
              * tracklets vector of corresponding tracklet*/
             curTracklet.setValue(i);
             trackletsForTree.push_back(curTracklet);
-            i++;
         }
     }
 
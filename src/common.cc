@@ -237,6 +237,124 @@ double angularDistanceRADec_deg(double RA0, double Dec0, double RA1, double Dec1
     
 }
 
+/*
+ * the distance d from angularDistanceRADec_deg satisfies
+ *
+ *   sin^2(d/2) = sin^2(dDec/2) + cos(Dec0) cos(Dec1) sin^2(dRA/2)
+ *
+ * cos(Dec0) >= cos(Dec1) - |dDec| since cos has slope at most 1, and
+ * sin(x) >= x - x^3/6 for x >= 0, so we can bound the right side from
+ * below without any trig.  For the small distances we care about the
+ * bound is very nearly exact.  We only claim d > maxDist if the bound
+ * clears it by a margin far larger than any rounding error.
+ */
+bool angularDistanceCertainlyAbove(double RA0, double Dec0, 
+                                   double RA1, double Dec1, 
+                                   double cosDec1, 
+                                   double sinSqHalfMaxDist)
+{
+    Constants c;
+    double decDist = c.deg_to_rad()*circularShortestPathLen_Deg(Dec0, Dec1);
+    double minCosDec0 = cosDec1 - decDist;
+    if ((cosDec1 <= 0) || (minCosDec0 <= 0)) {
+        // points past the poles; don't guess.
+        return false;
+    }
+    double halfDec = decDist / 2.;
+    double halfRA = c.deg_to_rad()*circularShortestPathLen_Deg(RA0, RA1) / 2.;
+    double minSinHalfDec = halfDec - halfDec*halfDec*halfDec/6.;
+    double minSinHalfRA = halfRA - halfRA*halfRA*halfRA/6.;
+    double minSinSqHalfDist = minSinHalfDec*minSinHalfDec + 
+        minCosDec0*cosDec1*minSinHalfRA*minSinHalfRA;
+    return minSinSqHalfDist > sinSqHalfMaxDist * (1. + 1e-9);
+}
+
+
+
+/* 
+ * least and greatest circular distance (in [0, 180]) of x - y from 0,
+ * where x - y ranges over [lo, hi], an interval no more than 720
+ * degrees long.
+ */
+static void circularDistanceRange_Deg(double lo, double hi, 
+                                      double &minDist, double &maxDist)
+{
+    double atLo = circularShortestPathLen_Deg(lo, 0);
+    double atHi = circularShortestPathLen_Deg(hi, 0);
+    // the distance is 0 at each multiple of 360 and 180 halfway
+    // between, and monotonic in between.
+    if (floor(lo / 360.) != floor(hi / 360.) || (fmod(lo, 360.) == 0)) {
+        minDist = 0;
+    }
+    else {
+        minDist = minOfTwo(atLo, atHi);
+    }
+    if (floor((lo - 180.) / 360.) != floor((hi - 180.) / 360.)) {
+        maxDist = 180.;
+    }
+    else {
+        maxDist = maxOfTwo(atLo, atHi);
+    }
+}
+
+
+
+/* least and greatest cos(Dec) for Dec (in standard degrees) in [lo,
+ * hi]; as no real Dec is more than 90 degrees from 0, neither is
+ * negative. */
+static void cosDecRange(double lo, double hi, 
+                        double &minCos, double &maxCos)
+{
+    Constants c;
+    double cosLo = cos(c.deg_to_rad()*lo);
+    double cosHi = cos(c.deg_to_rad()*hi);
+    minCos = (lo <= 180. && hi >= 180.) ? 0 : maxOfTwo(0, minOfTwo(cosLo, cosHi));
+    maxCos = (lo == 0) ? 1. : maxOfTwo(0, maxOfTwo(cosLo, cosHi));
+}
+
+
+
+/*
+ * as for angularDistanceCertainlyAbove, 
+ *
+ *   sin^2(d/2) = sin^2(dDec/2) + cos(Dec0) cos(Dec1) sin^2(dRA/2)
+ *
+ * and with dRA, dDec in [0, 180] and the cosines non-negative, every
+ * term grows with the quantity in it.  So putting in the least (or
+ * greatest) possible value of each bounds d from below (or above).
+ * The differences in RA and in Dec are both circular; as Dec is
+ * never more than 90 from 0, the circular difference in (standard)
+ * Dec is just the difference in real Dec.
+ */
+void angularDistanceBoundsRADecBoxes_deg(double RALo0, double RAHi0, 
+                                         double DecLo0, double DecHi0,
+                                         double RALo1, double RAHi1, 
+                                         double DecLo1, double DecHi1,
+                                         double &minDist, double &maxDist)
+{
+    Constants c;
+    double minRADist, maxRADist, minDecDist, maxDecDist;
+    circularDistanceRange_Deg(RALo0 - RAHi1, RAHi0 - RALo1, minRADist, maxRADist);
+    circularDistanceRange_Deg(DecLo0 - DecHi1, DecHi0 - DecLo1, minDecDist, maxDecDist);
+    double minCos0, maxCos0, minCos1, maxCos1;
+    cosDecRange(DecLo0, DecHi0, minCos0, maxCos0);
+    cosDecRange(DecLo1, DecHi1, minCos1, maxCos1);
+
+    double sinHalfDec = sin(c.deg_to_rad()*minDecDist/2.);
+    double sinHalfRA = sin(c.deg_to_rad()*minRADist/2.);
+    double sinSqHalfDist = sinHalfDec*sinHalfDec + 
+        minCos0*minCos1*sinHalfRA*sinHalfRA;
+    minDist = c.rad_to_deg()*2*asin(sqrt(minOfTwo(sinSqHalfDist, 1.)));
+
+    sinHalfDec = sin(c.deg_to_rad()*maxDecDist/2.);
+    sinHalfRA = sin(c.deg_to_rad()*maxRADist/2.);
+    sinSqHalfDist = sinHalfDec*sinHalfDec + 
+        maxCos0*maxCos1*sinHalfRA*sinHalfRA;
+    maxDist = c.rad_to_deg()*2*asin(sqrt(minOfTwo(sinSqHalfDist, 1.)));
+}
+
+
+
 /* 
  * arcToRA: given a lattitude in declination (degrees) and an arc length
  * in degrees, return the number of degrees in RA which corresponding to
@@ -5,6 +5,7 @@
  */
 
 #include "lsst/mops/daymops/detectionProximity/detectionProximity.h"
+#include "lsst/mops/SkyIndex.h"
 
 
 namespace lsst {
@@ -12,26 +13,39 @@ namespace lsst {
 
 // prototypes not to be seen outside this file
 
-KDTree<unsigned int> buildKDTree(const std::vector<MopsDetection>);
+KDTree<unsigned int, 3> buildKDTree(const std::vector<MopsDetection>);
 
 std::vector<std::pair <unsigned int, unsigned int> > getProximity(const std::vector<MopsDetection>& queryPoints,
-								  const KDTree<unsigned int>& searchTree,
+								  const KDTree<unsigned int, 3>& searchTree,
 								  double maxDist,
 								  double maxTime);
 
+std::vector<std::pair <unsigned int, unsigned int> > getSkyIndexProximity(
+    const std::vector<MopsDetection>& queryPoints,
+    const std::vector<MopsDetection>& dataPoints,
+    double maxDist,
+    double maxTime);
+
 
 std::vector<std::pair <unsigned int, unsigned int> > detectionProximity(
     const std::vector<MopsDetection>& queryPoints,
     const std::vector<MopsDetection>& dataPoints,
     double distanceThreshold,
-    double timeThreshold)
+    double timeThreshold,
+    bool useSkyIndex)
 {
     std::vector<std::pair <unsigned int, unsigned int> > results;
     
-    if(queryPoints.size() > 0 && dataPoints.size() > 0){
+    if(queryPoints.size() > 0 && dataPoints.size() > 0 && useSkyIndex){
+        
+        //search unit vectors of the data points
+        results = getSkyIndexProximity(queryPoints, dataPoints, 
+                                       distanceThreshold, timeThreshold);
+    }
+    else if(queryPoints.size() > 0 && dataPoints.size() > 0){
         
         //build KDTrees from detection vectors
-        KDTree<unsigned int> dataTree(buildKDTree(dataPoints));
+        KDTree<unsigned int, 3> dataTree(buildKDTree(dataPoints));
         
         //get results
         results = getProximity(queryPoints, dataTree, distanceThreshold,
@@ -46,21 +60,21 @@ std::vector<std::pair <unsigned int, unsigned int> > detectionProximity(
 /**********************************************************************
  * Populate a KDTree 'tree' from the Detections in vector 'points'
  ***********************************************************************/
-KDTree<unsigned int> buildKDTree(const std::vector<MopsDetection> points)
+KDTree<unsigned int, 3> buildKDTree(const std::vector<MopsDetection> points)
 {
 
-  std::vector<PointAndValue<unsigned int> > vecPV;
+  std::vector<PointAndValue<unsigned int, 3> > vecPV;
   if(points.size() > 0){
 
 
     for(unsigned int i=0; i < points.size(); i++){
     
-	PointAndValue<unsigned int> tempPV;
-	std::vector<double> pairRADec;
+	PointAndValue<unsigned int, 3> tempPV;
+	PointAndValue<unsigned int, 3>::PointType pairRADec;
 	
-	pairRADec.push_back(convertToStandardDegrees(points.at(i).getRA()));                    
-	pairRADec.push_back(convertToStandardDegrees(points.at(i).getDec()));
-        pairRADec.push_back(points.at(i).getEpochMJD());
+	pairRADec[0] = convertToStandardDegrees(points.at(i).getRA());
+	pairRADec[1] = convertToStandardDegrees(points.at(i).getDec());
+        pairRADec[2] = points.at(i).getEpochMJD();
 	
 	tempPV.setPoint(pairRADec);
 	tempPV.setValue(i);
@@ -68,7 +82,8 @@ KDTree<unsigned int> buildKDTree(const std::vector<MopsDetection> points)
     }
     
   }
-  KDTree<unsigned int> newTree(vecPV, 3, 100);
+  // built before any searching, so use every core.
+  KDTree<unsigned int, 3> newTree(vecPV, 3, 100, 0);
   return newTree;
 }
     
@@ -78,7 +93,7 @@ KDTree<unsigned int> buildKDTree(const std::vector<MopsDetection> points)
  *
  */
 std::vector<std::pair <unsigned int, unsigned int> > getProximity(const std::vector<MopsDetection>& queryPoints,
-								  const KDTree<unsigned int>& searchTree,
+								  const KDTree<unsigned int, 3>& searchTree,
 								  double maxDist,
 								  double maxTime)
 {
@@ -89,33 +104,71 @@ std::vector<std::pair <unsigned int, unsigned int> > getProximity(const std::vec
   myGeos.push_back(DEC_DEGREES); //Dec
   myGeos.push_back(EUCLIDEAN); //time
 
-  
-  for(unsigned int i=0; i<queryPoints.size(); i++){
 
-      std::vector<double> RADecQueryPt;
-      std::vector<double> otherDimsPt;
-      std::vector<double> otherDimsTolerances;
-      std::vector<PointAndValue<unsigned int> > queryResults;
-
-      RADecQueryPt.push_back(convertToStandardDegrees(queryPoints.at(i).getRA()));
-      RADecQueryPt.push_back(convertToStandardDegrees(queryPoints.at(i).getDec()));
-    
-      otherDimsPt.push_back(queryPoints.at(i).getEpochMJD());
-      
-      otherDimsTolerances.push_back(maxTime);
-      
-      queryResults = searchTree.RADecRangeSearch(RADecQueryPt, maxDist, 
-                                                 otherDimsPt, otherDimsTolerances, 
-                                                 myGeos);
-      
-      for(unsigned int j=0; j<queryResults.size(); j++){
-          pairs.push_back(std::make_pair(i, queryResults.at(j).getValue()));
-      }
+  // RA, Dec and time of each query point in turn.
+  std::vector<double> RADecQueryPts(2 * queryPoints.size());
+  std::vector<double> otherDimsPts(queryPoints.size());
+  std::vector<double> otherDimsTolerances(1, maxTime);
+  for(unsigned int i=0; i<queryPoints.size(); i++){
+      RADecQueryPts[2 * i] = convertToStandardDegrees(queryPoints.at(i).getRA());
+      RADecQueryPts[2 * i + 1] = convertToStandardDegrees(queryPoints.at(i).getDec());
+      otherDimsPts[i] = queryPoints.at(i).getEpochMJD();
   }
+
+  searchTree.RADecRangeSearchBatch(RADecQueryPts, maxDist, 
+                                   otherDimsPts, otherDimsTolerances, 
+                                   myGeos,
+                                   [&pairs](unsigned int i, 
+                                            const PointAndValue<unsigned int, 3> &match) {
+                                       pairs.push_back(std::make_pair(i, match.getValue()));
+                                   },
+                                   0);
   
   
   return pairs;
 }
 
 
+
+/*
+ * as getProximity, but searching a SkyIndex of dataPoints.
+ */
+std::vector<std::pair <unsigned int, unsigned int> > getSkyIndexProximity(
+    const std::vector<MopsDetection>& queryPoints,
+    const std::vector<MopsDetection>& dataPoints,
+    double maxDist,
+    double maxTime)
+{
+  std::vector<std::pair <unsigned int, unsigned int> > pairs;
+
+  // RA, Dec and time of each point in turn.
+  std::vector<double> RADecs(2 * dataPoints.size());
+  std::vector<double> MJDs(dataPoints.size());
+  std::vector<unsigned int> indices(dataPoints.size());
+  for(unsigned int i=0; i < dataPoints.size(); i++){
+      RADecs[2 * i] = dataPoints[i].getRA();
+      RADecs[2 * i + 1] = dataPoints[i].getDec();
+      MJDs[i] = dataPoints[i].getEpochMJD();
+      indices[i] = i;
+  }
+  // built before any searching, so use every core.
+  SkyIndex<unsigned int, 1> dataIndex(RADecs, MJDs, indices, 100, 0);
+
+  RADecs.resize(2 * queryPoints.size());
+  MJDs.resize(queryPoints.size());
+  for(unsigned int i=0; i < queryPoints.size(); i++){
+      RADecs[2 * i] = queryPoints[i].getRA();
+      RADecs[2 * i + 1] = queryPoints[i].getDec();
+      MJDs[i] = queryPoints[i].getEpochMJD();
+  }
+  std::vector<double> timeTolerance(1, maxTime);
+  dataIndex.radiusSearchBatch(RADecs, 0, maxDist, MJDs, timeTolerance,
+                              [&pairs](unsigned int i, 
+                                       const PointAndValue<unsigned int, 4> &match) {
+                                  pairs.push_back(std::make_pair(i, match.getValue()));
+                              });
+  return pairs;
+}
+
+
     }} // close lsst::mops
@@ -13,6 +13,7 @@
 #include <time.h>
 
 #include "lsst/mops/KDTree.h"
+#include "lsst/mops/SkyIndex.h"
 #include "lsst/mops/common.h"
 #include "lsst/mops/daymops/fieldProximity/fieldProximity.h"
 
@@ -173,6 +174,30 @@ bool isInsideImage(const Field &img, const FieldProximityTrack &t)
 
 
 
+/* of the tracks trackIndices, add those which pass through img to
+ * resultsVec, as (field ID, track ID). */
+void addTracksInsideImage(std::vector<std::pair<uint, uint> > &resultsVec,
+                          const Field &img, 
+                          const std::set<uint> &trackIndices,
+                          const std::vector<FieldProximityTrack> &allTracks)
+{
+    std::set<uint>::const_iterator resultIter;
+    for (resultIter = trackIndices.begin(); 
+         resultIter != trackIndices.end(); 
+         resultIter++) {
+
+        const FieldProximityTrack* matchingTrack = 
+            &(allTracks.at(*resultIter));
+        if (isInsideImage(img, *matchingTrack)) {
+            resultsVec.push_back(std::make_pair(img.getFieldID(),
+                                                matchingTrack->getID()));
+
+        }
+    }
+}
+
+
+
 void getProximity(std::vector<std::pair<uint, uint> > &resultsVec,  
                   KDTree<uint> &myTree,
                   const std::vector<Field> &queryPoints,
@@ -216,21 +241,40 @@ void getProximity(std::vector<std::pair<uint, uint> > &resultsVec,
         for (uint j = 0; j < queryResults.size(); j++) {
             queryResultsSet.insert(queryResults[j].getValue());
         }
-        std::set<uint>::const_iterator resultIter;
-        for (resultIter = queryResultsSet.begin(); 
-             resultIter != queryResultsSet.end(); 
-             resultIter++) {
+        addTracksInsideImage(resultsVec, queryPoints[i], queryResultsSet, 
+                             allTracks);
+    }
+
+}
 
-            const FieldProximityTrack* matchingTrack = 
-                &(allTracks.at(*resultIter));
-            if (isInsideImage(queryPoints[i], *matchingTrack)) {
-                resultsVec.push_back(std::make_pair(queryPoints[i].getFieldID(),
-                                                    matchingTrack->getID()));
 
-            }
-        }
-    }
 
+/* as getProximity, but searching a SkyIndex of the ephemerides (with
+ * their times) around the center of each image.  getProximity looks
+ * in a box reaching the image's radius from its center in RA and Dec;
+ * the circle through the corners of that box holds it (bar the
+ * curvature of the sky, which is slight over an image). */
+void getSkyIndexProximity(std::vector<std::pair<uint, uint> > &resultsVec,  
+                          const SkyIndex<uint, 1> &ephemIndex,
+                          const std::vector<Field> &queryPoints,
+                          const std::vector<FieldProximityTrack> &allTracks)
+{
+    // any ephemeris within 1 day of the image.
+    std::vector<double> timeTolerance(1, 1.);
+    std::vector<double> queryTime(1);
+    std::set<uint> queryResultsSet;
+    for (uint i = 0; i < queryPoints.size(); i++) {
+        queryTime[0] = queryPoints[i].getEpochMJD();
+        queryResultsSet.clear();
+        ephemIndex.radiusSearch(queryPoints[i].getRA(), queryPoints[i].getDec(),
+                                0, M_SQRT2 * queryPoints[i].getRadius(),
+                                queryTime, timeTolerance,
+                                [&queryResultsSet](const PointAndValue<uint, 4> &match) {
+                                    queryResultsSet.insert(match.getValue());
+                                });
+        addTracksInsideImage(resultsVec, queryPoints[i], queryResultsSet, 
+                             allTracks);
+    }
 }
 
 
@@ -245,7 +289,8 @@ bool compByTime(const Field &f1, const Field &f2)
 void fieldProximity(const std::vector<FieldProximityTrack> &allTracks,
                     std::vector<Field> &queryFields,
                     std::vector<std::pair<unsigned int, unsigned int>  > &results,
-                    double distThresh)
+                    double distThresh,
+                    bool useSkyIndex)
 {
 
     if(queryFields.size() > 0 && allTracks.size() > 0){
@@ -258,15 +303,40 @@ void fieldProximity(const std::vector<FieldProximityTrack> &allTracks,
         std::cout << "Massaging data for tree construction at " 
                   << ctime(&currentTime) << "\n";
         buildPavsForEphem(allTracks, allEphem);
-        // build a tree of (time, ra, dec) -> track index 
-        time(&currentTime);
-        std::cout << "Building tree at " 
-                  << ctime(&currentTime) << "\n";
-        KDTree<uint> myTree(allEphem, 3, LEAF_NODE_SIZE);        
-        time(&currentTime);
-        std::cout << "Searching tree at " 
-                  << ctime(&currentTime) << "\n";
-        getProximity(results, myTree, queryFields, allTracks);
+        if (useSkyIndex) {
+            // index (ra, dec), time -> track index 
+            std::vector<double> RADecs(2 * allEphem.size());
+            std::vector<double> times(allEphem.size());
+            std::vector<uint> trackIndices(allEphem.size());
+            for (uint i = 0; i < allEphem.size(); i++) {
+                times[i] = allEphem[i].getPoint()[0];
+                RADecs[2 * i] = allEphem[i].getPoint()[1];
+                RADecs[2 * i + 1] = allEphem[i].getPoint()[2];
+                trackIndices[i] = allEphem[i].getValue();
+            }
+            std::vector<PointAndValue<uint> >().swap(allEphem);
+            time(&currentTime);
+            std::cout << "Building sky index at " 
+                      << ctime(&currentTime) << "\n";
+            // nothing else is running yet, so use every core.
+            SkyIndex<uint, 1> ephemIndex(RADecs, times, trackIndices,
+                                         LEAF_NODE_SIZE, 0);
+            time(&currentTime);
+            std::cout << "Searching sky index at " 
+                      << ctime(&currentTime) << "\n";
+            getSkyIndexProximity(results, ephemIndex, queryFields, allTracks);
+        }
+        else {
+            // build a tree of (time, ra, dec) -> track index 
+            time(&currentTime);
+            std::cout << "Building tree at " 
+                      << ctime(&currentTime) << "\n";
+            KDTree<uint> myTree(allEphem, 3, LEAF_NODE_SIZE, 0);
+            time(&currentTime);
+            std::cout << "Searching tree at " 
+                      << ctime(&currentTime) << "\n";
+            getProximity(results, myTree, queryFields, allTracks);
+        }
         time(&currentTime);
         std::cout << "Finished searching at " 
                   << ctime(&currentTime) << "\n";
@@ -5,6 +5,7 @@
  * 
  */
 
+#include <algorithm>
 #include <istream>
 #include <sstream>
 // these C style headers used by printMemUse()
@@ -13,6 +14,8 @@
 
 
 #include "lsst/mops/fileUtils.h"
+#include "lsst/mops/DetectionStore.h"
+#include "lsst/mops/ChunkedTextReader.h"
 
 
 namespace lsst {
@@ -39,6 +42,19 @@ bool isSane(unsigned int detsSize, const std::vector<Tracklet> *pairs) {
 
 
 
+bool isSane(unsigned int detsSize, const TrackletStore *pairs) {
+    for (unsigned int i = 0; i < pairs->size(); i++) {
+        // indices are in increasing order, so only the last can be too big.
+        if ((pairs->getNumIndices(i) > 0) && 
+            (*(pairs->indicesEnd(i) - 1) >= detsSize)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
 
 
 
@@ -60,6 +76,21 @@ void writeTrackletsToOutFile(const std::vector<Tracklet> * tracklets, std::ofstr
 
 
 
+void writeTrackletsToOutFile(const TrackletStore * tracklets, std::ofstream &outFile){
+     for (unsigned int i = 0; i < tracklets->size(); i++) {
+	  for (const unsigned int *index = tracklets->indicesBegin(i);
+	       index != tracklets->indicesEnd(i);
+	       index++) {
+	       outFile << *index;
+	       outFile << " ";
+	  }
+	  outFile << '\n';
+     }
+     outFile.flush();
+}
+
+
+
 
 
 
@@ -131,31 +162,132 @@ void writeTrackletsToOutFile(const std::vector<Tracklet> * tracklets, std::strin
      }
      writeTrackletsToOutFile(tracklets, outFile);
 }
+
+
+
+void writeTrackletsToOutFile(const TrackletStore * tracklets, std::string outFileName)
+{
+     std::ofstream outFile;
+     outFile.open(outFileName.c_str());
+     if (!outFile.is_open()) {
+	  throw LSST_EXCEPT(FileException,
+			    "Failed to open output file " + outFileName + " - do you have permission?\n");
+     }
+     writeTrackletsToOutFile(tracklets, outFile);
+}
     
         void populateDetVectorFromFile(std::string detsFileName, std::vector <MopsDetection> &myDets, const double &astromErr)
 {
-     std::ifstream detsFile;
-     detsFile.open(detsFileName.c_str());
-     if (!detsFile.is_open()) {
-	  throw LSST_EXCEPT(FileException,
-			    "Failed to open dets file " + detsFileName + " - does this file exist?\n");
+     if (DetectionStore::isDetectionStore(detsFileName)) {
+          // the stored errors are kept unless the caller gives some.
+          DetectionStore store(detsFileName);
+          unsigned int firstNew = myDets.size();
+          store.appendDetections(myDets);
+          if (astromErr > 0) {
+               for (unsigned int i = firstNew; i < myDets.size(); i++) {
+                    myDets[i].setRaErr(astromErr);
+                    myDets[i].setDecErr(astromErr);
+               }
+          }
+          return;
      }
-     populateDetVectorFromFile(detsFile, myDets, astromErr);
-        
+     // as MopsDetection::fromString, but without the istringstream.
+     auto parseDetection = [astromErr](const char *pos, const char *end,
+                                       unsigned long,
+                                       std::vector<MopsDetection> &dets) {
+          long int id, imageId;
+          int ssmId;
+          double ra, dec, mjd, mag, snr;
+          if (!(parseNextValue(pos, end, id) &&
+                parseNextValue(pos, end, imageId) &&
+                parseNextValue(pos, end, ssmId) &&
+                parseNextValue(pos, end, ra) &&
+                parseNextValue(pos, end, dec) &&
+                parseNextValue(pos, end, mjd) &&
+                parseNextValue(pos, end, mag) &&
+                parseNextValue(pos, end, snr))) {
+               throw LSST_EXCEPT(BadParameterException, 
+                                 "Badly-formatted DiaSource string. Note that MITI is no longer supported\n");
+          }
+          dets.push_back(MopsDetection(id, mjd, ra, dec, astromErr, astromErr,
+                                       ssmId, imageId, snr, mag));
+     };
+     ChunkedTextReader reader(detsFileName, "dets");
+     reader.parseLines(parseDetection, myDets);
 }
     
 void populatePairsVectorFromFile(std::string pairsFileName,
                                  std::vector <Tracklet> &pairsVector)
 
 {
-     std::ifstream pairsFile;
-     pairsFile.open(pairsFileName.c_str());
-     if (!pairsFile.is_open()) {
-	  throw LSST_EXCEPT(FileException,
-			    "Failed to open pairs file " + pairsFileName + " - does this file exist?\n");
+     auto parsePair = [](const char *pos, const char *end,
+                         unsigned long,
+                         std::vector<Tracklet> &pairs) {
+          // indices are almost always in order already, so collect
+          // them first and insert with a hint.
+          static thread_local std::vector<unsigned int> indices;
+          indices.clear();
+          do {
+               int tmpInt;
+               if (!parseNextValue(pos, end, tmpInt)) {
+                    throw LSST_EXCEPT(InputFileFormatErrorException, "Improperly-formatted pairs file.\n");
+               }
+               indices.push_back(tmpInt);
+          } while (!onlyBlanksLeft(pos, end));
+          std::sort(indices.begin(), indices.end());
+          pairs.push_back(Tracklet());
+          Tracklet &tmpPair = pairs.back();
+          tmpPair.isCollapsed = false;
+          for (unsigned int i = 0; i < indices.size(); i++) {
+               tmpPair.indices.insert(tmpPair.indices.end(), indices[i]);
+          }
+          if (tmpPair.indices.size() < 2) {
+               throw LSST_EXCEPT(InputFileFormatErrorException, "EE: CollapseTracklets: pairs in pairs file must be length >= 2!\n");
+          }
+     };
+     ChunkedTextReader reader(pairsFileName, "pairs");
+     reader.parseLines(parsePair, pairsVector);
+}
+
+
+
+
+void populateTrackletStoreFromFile(std::string pairsFileName,
+                                   TrackletStore &pairs)
+{
+     // each line becomes its number of indices followed by the
+     // indices, in order.
+     auto parsePair = [](const char *pos, const char *end,
+                         unsigned long,
+                         std::vector<unsigned int> &counted) {
+          unsigned long countIndex = counted.size();
+          counted.push_back(0);
+          do {
+               int tmpInt;
+               if (!parseNextValue(pos, end, tmpInt)) {
+                    throw LSST_EXCEPT(InputFileFormatErrorException, "Improperly-formatted pairs file.\n");
+               }
+               counted.push_back(tmpInt);
+          } while (!onlyBlanksLeft(pos, end));
+          std::vector<unsigned int>::iterator first = counted.begin() + countIndex + 1;
+          std::sort(first, counted.end());
+          counted.erase(std::unique(first, counted.end()), counted.end());
+          counted[countIndex] = counted.size() - countIndex - 1;
+          if (counted[countIndex] < 2) {
+               throw LSST_EXCEPT(InputFileFormatErrorException, "EE: CollapseTracklets: pairs in pairs file must be length >= 2!\n");
+          }
+     };
+     std::vector<unsigned int> counted;
+     ChunkedTextReader reader(pairsFileName, "pairs");
+     reader.parseLines(parsePair, counted);
+
+     unsigned long pos = 0;
+     while (pos < counted.size()) {
+          unsigned int nIndices = counted[pos];
+          const unsigned int *first = counted.data() + pos + 1;
+          pairs.addTracklet(first, first + nIndices);
+          pos += nIndices + 1;
      }
-     populatePairsVectorFromFile(pairsFile, pairsVector);
-        
 }
 
 
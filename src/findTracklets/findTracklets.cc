@@ -11,10 +11,14 @@
 #include <string>
 #include <sstream>
 #include <math.h>
+#include <iterator>
 
 #include "lsst/mops/common.h"
 #include "lsst/mops/KDTree.h"
+#include "lsst/mops/SkyIndex.h"
 #include "lsst/mops/MopsDetection.h"
+#include "lsst/mops/ImageIndex.h"
+#include "lsst/mops/WorkStealingPool.h"
 #include "lsst/mops/daymops/findTracklets/findTracklets.h"
 
 #define LEAF_NODE_SIZE 16
@@ -28,31 +32,35 @@ namespace mops {
     Prototypes - these don't need to be seen by files which include findTracklets.h
 ***/
 
-/*****************************************************************
- * Populate 2D vector of detections.
- * Each outer vector contains Detections of equal MJD.
- *****************************************************************/
-void groupByImageTime(const std::vector<MopsDetection>&,
-		      std::map<double, std::vector<MopsDetection> >&);
-
-
 /******************************************************************
- * Take 2D vector of detections and create a map linking
- * each MJD vector to its MJD double value.
+ * Take the detections grouped by image and create a KDTree for the
+ * detections of each image.
  ******************************************************************/
-void generatePerImageTrees(const std::map<double, std::vector<MopsDetection> > &detectionSets, 
-                           std::map<double, KDTree<long int> > &myTreeMap);
+void generatePerImageTrees(const std::vector<MopsDetection> &myDets,
+                           const ImageGrouping &detsByImage, 
+                           std::vector<KDTree<long int, 2> > &myTrees);
+
+/* the same, with a SkyIndex for each image. */
+void generatePerImageSkyIndexes(const std::vector<MopsDetection> &myDets,
+                                const ImageGrouping &detsByImage, 
+                                std::vector<SkyIndex<long int> > &mySkyIndexes);
 
 
 /******************************************************************
- * Given a mapping of MJDs to KDTrees of PointAndValue pairs 
+ * Given a KDTree of PointAndValue pairs for each image (or, with
+ * config.unitVectorSearch, a SkyIndex for each image), 
  * index by file line number index, generate tracklets for each 
- * query point within a distance determined by maxVelocity.
+ * detection of each image within a distance determined by maxVelocity.
+ * Tracklets come out ordered by first image, then second image.
  ******************************************************************/
 
-void getTracklets(std::vector<Tracklet> &results,
-		  const std::map<double, KDTree<long int> > &myTreeMap,
-		  const std::vector<MopsDetection> &queryPoints,
+template <class TrackletContainer>
+void getTracklets(TrackletContainer &results,
+		  const std::vector<KDTree<long int, 2> > &myTrees,
+                  const std::vector<SkyIndex<long int> > &mySkyIndexes,
+                  const ImageIndex &imageIndex,
+                  const std::vector<MopsDetection> &myDets,
+                  const ImageGrouping &detsByImage,
 		  findTrackletsConfig config);
 
 
@@ -62,211 +70,395 @@ void getTracklets(std::vector<Tracklet> &results,
 /*****************************************************************
  *The main function of this file.
  *****************************************************************/
-std::vector<Tracklet> * findTracklets(const std::vector<MopsDetection> &myDets,
-                               findTrackletsConfig config)
+template <class TrackletContainer>
+void findTrackletsPopulateContainer(const std::vector<MopsDetection> &myDets,
+                                    findTrackletsConfig config,
+                                    TrackletContainer &results)
 {
-    //detection vectors, each vector of unique MJD
-    std::map<double,  std::vector<MopsDetection> > detectionSets; 
-
-    //vector of RA and dec pairs for later searching
-    std::vector<double> queryPoints; 
-
-    //link MJD to KDTree of unique MJD detections
-    std::map<double, KDTree<long int> > myTreeMap; 
+    //number the images (unique MJDs)
+    ImageIndex imageIndex(myDets);
 
-    groupByImageTime(myDets, 
-                     detectionSets);
-    
-    generatePerImageTrees(detectionSets, myTreeMap);
+    //indices of the detections of each image; images are numbered
+    //in order of time.
+    ImageGrouping detsByImage(imageIndex);
 
-    //get results
-    std::vector<Tracklet> * resultsVec;
+    //KDTree (or SkyIndex) of the detections of each image
+    std::vector<KDTree<long int, 2> > myTrees; 
+    std::vector<SkyIndex<long int> > mySkyIndexes; 
 
-    resultsVec = new std::vector<Tracklet>;
-    /*
-    if (config.outputMethod == RETURN_TRACKLETS) {
-        resultsVec = new TrackletVector();
+    if (config.unitVectorSearch) {
+        if (config.dualTreeSearch) {
+            throw LSST_EXCEPT(BadParameterException, 
+                "findTracklets: dualTreeSearch and unitVectorSearch can't be used together.");
+        }
+        generatePerImageSkyIndexes(myDets, detsByImage, mySkyIndexes);
     }
-    else if (config.outputMethod == IDS_FILE) {
-        resultsVec = new TrackletVector(config.outputFile, false, 0);
+    else {
+        generatePerImageTrees(myDets, detsByImage, myTrees);
     }
-    else if (config.outputMethod == IDS_FILE_WITH_CACHE) {
-        resultsVec = new TrackletVector(config.outputFile, true, config.outputBufferSize);
+
+    getTracklets(results, myTrees, mySkyIndexes, imageIndex,
+                 myDets, detsByImage, config);
+}
+
+
+
+// tracklets per batch written for IDS_FILE output, if
+// outputBufferSize is 0.
+static const unsigned int IDS_FILE_BATCH_SIZE = 1 << 16;
+
+
+
+/*****************************************************************
+ * if config asks for file output, find the tracklets and write them
+ * to config.outputFile, and return true.  If it asks for them to be
+ * returned, do nothing and return false.
+ *****************************************************************/
+static bool findTrackletsToFile(const std::vector<MopsDetection> &myDets,
+                                findTrackletsConfig config)
+{
+    if (config.outputMethod == trackletOutputMethod::RETURN_TRACKLETS) {
+        return false;
     }
-    else {
+    else if ((config.outputMethod != trackletOutputMethod::IDS_FILE) &&
+             (config.outputMethod != trackletOutputMethod::IDS_FILE_WITH_CACHE)) {
         throw LSST_EXCEPT(BadParameterException, 
                           "findTracklets: got unknown or unimplemented output method.");
     }
-    */
+    // both write through the cache, so that only a batch of results
+    // is ever held; IDS_FILE just picks its own batch size if it isn't
+    // given one.
+    unsigned int batchSize = config.outputBufferSize;
+    if ((config.outputMethod == trackletOutputMethod::IDS_FILE) && 
+        (batchSize == 0)) {
+        batchSize = IDS_FILE_BATCH_SIZE;
+    }
+    TrackletVector resultsVec(config.outputFile, true, batchSize);
+    findTrackletsPopulateContainer(myDets, config, resultsVec);
+    resultsVec.close();
+    return true;
+}
 
-    getTracklets(*resultsVec, myTreeMap, 
-                 myDets, config);
 
-    /*
-    if ((config.outputMethod == IDS_FILE) || 
-        (config.outputMethod == IDS_FILE_WITH_CACHE)) {
 
-        resultsVec->purgeToFile();
-        delete resultsVec;
-        resultsVec = NULL;
+std::vector<Tracklet> * findTracklets(const std::vector<MopsDetection> &myDets,
+                               findTrackletsConfig config)
+{
+    if (findTrackletsToFile(myDets, config)) {
+        return NULL;
     }
-    */
-    
+    std::vector<Tracklet> * resultsVec = new std::vector<Tracklet>;
+    findTrackletsPopulateContainer(myDets, config, *resultsVec);
     return resultsVec;
 }
 
 
 
-/*****************************************************************
- * Populate 2D vector of detections.
- * Each outer vector contains Detections of equal MJD.
- *****************************************************************/
-void groupByImageTime(const std::vector<MopsDetection> &myDets, 
-		      std::map<double, std::vector<MopsDetection> > &detectionSets)
+void findTracklets(const std::vector<MopsDetection> &myDets,
+                   findTrackletsConfig config,
+                   TrackletStore &results)
 {
-    // maps by default sort on their first parameter.
-    // build a map from detection time to all dets at that time. we'll have a nice sorted
-    // set of vectors.
-
-    for (unsigned int i = 0; i < myDets.size(); i++) {
-        detectionSets[myDets.at(i).getEpochMJD()].push_back(myDets.at(i));
+    if (findTrackletsToFile(myDets, config)) {
+        return;
     }
-    
+    findTrackletsPopulateContainer(myDets, config, results);
 }
 
 
 
-
 /******************************************************************
- * Take 2D vector of detections and create a map linking
- * each per-MJD Detection vector to its MJD double value.
+ * Take the detections grouped by image and create a KDTree for the
+ * detections of each image; myTrees[i] is the tree for image i.
  ******************************************************************/
-void generatePerImageTrees(const std::map<double, std::vector<MopsDetection> > &detectionSets, 
-                           std::map<double, KDTree<long int> > &myTreeMap)
+void generatePerImageTrees(const std::vector<MopsDetection> &myDets,
+                           const ImageGrouping &detsByImage, 
+                           std::vector<KDTree<long int, 2> > &myTrees)
 {
 
-    // for each vector representing a single EpochMJD, created
-    // a KDTree containing mapping detection RA, Decs -> detection IDs
+    // for each image, create a KDTree containing mapping detection
+    // RA, Decs -> detection IDs
 
-    std::map<double, std::vector<MopsDetection> >::const_iterator imageIter;
+    myTrees.clear();
+    myTrees.reserve(detsByImage.getNumImages());
 
-    for(imageIter = detectionSets.begin(); imageIter != detectionSets.end(); imageIter++) {
+    for(unsigned int image = 0; image < detsByImage.getNumImages(); image++) {
 
-        const std::vector<MopsDetection> *thisDetVec = &(imageIter->second);
-        double thisEpoch = imageIter->first;
-        std::vector<PointAndValue<long int> > vecPV;
+        std::vector<PointAndValue<long int, 2> > vecPV;
+        vecPV.reserve(detsByImage.getNumItems(image));
         
-        for(unsigned int j=0; j < thisDetVec->size(); j++) {
+        for (const unsigned int *det = detsByImage.itemsBegin(image);
+             det != detsByImage.itemsEnd(image); det++) {
 
-            PointAndValue<long int> tempPV;
-            std::vector<double> pairRADec;
+            const MopsDetection &thisDet = myDets[*det];
+            PointAndValue<long int, 2> tempPV;
+            PointAndValue<long int, 2>::PointType pairRADec;
             
-            pairRADec.push_back(convertToStandardDegrees(thisDetVec->at(j).getRA()));                    
-            pairRADec.push_back(convertToStandardDegrees(thisDetVec->at(j).getDec()));
+            pairRADec[0] = convertToStandardDegrees(thisDet.getRA());
+            pairRADec[1] = convertToStandardDegrees(thisDet.getDec());
             
             tempPV.setPoint(pairRADec);
-            tempPV.setValue(thisDetVec->at(j).getIndex());
+            tempPV.setValue(thisDet.getIndex());
             vecPV.push_back(tempPV);
         }
         
-        KDTree<long int> tempKDTree(vecPV, 2, LEAF_NODE_SIZE);
-        myTreeMap.insert(std::make_pair(thisEpoch, tempKDTree) );
+        myTrees.push_back(KDTree<long int, 2>(vecPV, 2, LEAF_NODE_SIZE));
+    }
+}
+
+
+
+void generatePerImageSkyIndexes(const std::vector<MopsDetection> &myDets,
+                                const ImageGrouping &detsByImage, 
+                                std::vector<SkyIndex<long int> > &mySkyIndexes)
+{
+    static const std::vector<double> noOtherDims;
+
+    mySkyIndexes.clear();
+    mySkyIndexes.reserve(detsByImage.getNumImages());
+
+    std::vector<double> RADecs;
+    std::vector<long int> indices;
+    for(unsigned int image = 0; image < detsByImage.getNumImages(); image++) {
+        RADecs.clear();
+        indices.clear();
+        for (const unsigned int *det = detsByImage.itemsBegin(image);
+             det != detsByImage.itemsEnd(image); det++) {
+            const MopsDetection &thisDet = myDets[*det];
+            RADecs.push_back(thisDet.getRA());
+            RADecs.push_back(thisDet.getDec());
+            indices.push_back(thisDet.getIndex());
+        }
+        mySkyIndexes.push_back(SkyIndex<long int>(RADecs, noOtherDims, indices,
+                                                  LEAF_NODE_SIZE));
     }
 }
 
 
 
 /******************************************************************
- * Given a mapping of MJDs to KDTrees of PointAndValue pairs 
+ * Given a KDTree of PointAndValue pairs for each image, 
  * index by file line number index, generate tracklets for each 
  * query point within a distance determined by maxVelocity.
  ******************************************************************/
-void getTracklets(std::vector<Tracklet> &results,
-		  const std::map<double, KDTree<long int> > &myTreeMap,
-		  const std::vector<MopsDetection> &queryPoints,
-		  findTrackletsConfig config)
+static void addPair(std::vector<Tracklet> &results, uint first, uint second)
+{
+    Tracklet newTracklet;
+    newTracklet.indices.insert(first);
+    newTracklet.indices.insert(second);
+    results.push_back(newTracklet);
+}
+
+
+
+static void addPair(TrackletStore &results, uint first, uint second)
+{
+    uint indices[2] = {first, second};
+    results.addTracklet(indices, indices + 2);
+}
+
+
+
+static void addPair(TrackletVector &results, uint first, uint second)
+{
+    uint indices[2] = {std::min(first, second), std::max(first, second)};
+    results.push_back(indices, indices + 2);
+}
+
+
+
+/* append the tracklets of more to results, just as though they had
+ * been found straight into results, and empty more. */
+static void appendTracklets(std::vector<Tracklet> &results,
+                            TrackletStore &more)
+{
+    results.reserve(results.size() + more.size());
+    for (uint i = 0; i < more.size(); i++) {
+        Tracklet newTracklet;
+        newTracklet.indices.insert(more.indicesBegin(i), more.indicesEnd(i));
+        results.push_back(newTracklet);
+    }
+    more = TrackletStore();
+}
+
+
+
+static void appendTracklets(TrackletStore &results, TrackletStore &more)
+{
+    results.reserve(results.size() + more.size(),
+                    results.getNumAllIndices() + more.getNumAllIndices());
+    for (uint i = 0; i < more.size(); i++) {
+        results.addTracklet(more.indicesBegin(i), more.indicesEnd(i));
+    }
+    more = TrackletStore();
+}
+
+
+
+static void appendTracklets(TrackletVector &results, TrackletStore &more)
+{
+    for (uint i = 0; i < more.size(); i++) {
+        results.push_back(more.indicesBegin(i), more.indicesEnd(i));
+    }
+    more = TrackletStore();
+}
+
+
+
+/******************************************************************
+ * Find the tracklets starting with a detection of queryImage: every
+ * detection of queryImage is searched for in the tree of each later
+ * image taken within [minDt, maxDt] of it, which we find by binary
+ * search on the (sorted) image times.  With config.dualTreeSearch,
+ * the tree of queryImage is searched against each of those trees
+ * instead; with config.unitVectorSearch, the images' SkyIndexes are
+ * searched rather than their trees.  Only reads the trees, so several
+ * images may be searched at once.
+ ******************************************************************/
+template <class TrackletContainer>
+void getTrackletsForImage(TrackletContainer &results,
+                          unsigned int queryImage,
+                          const std::vector<KDTree<long int, 2> > &myTrees,
+                          const std::vector<SkyIndex<long int> > &mySkyIndexes,
+                          const ImageIndex &imageIndex,
+                          const std::vector<MopsDetection> &myDets,
+                          const ImageGrouping &detsByImage,
+                          const findTrackletsConfig &config)
 {
-  time_t start = time(NULL);
     // vectors of RADecRangeSearch parameters we search exclusively in RA, Dec;
     // the "otherDims" parameters sent to KDTree range search are empty.
-    std::vector<double> otherDimsTolerances;
-    std::vector<double> otherDimsPt;
-    otherDimsTolerances.resize(0);
-    otherDimsPt.resize(0);
-    std::vector<GeometryType> myGeos;
+    static const std::vector<double> otherDimsTolerances;
+    static const std::vector<double> otherDimsPt;
     // we search RA, Dec only.
-    myGeos.push_back(RA_DEGREES);
-    myGeos.push_back(DEC_DEGREES);
+    static const std::vector<GeometryType> myGeos = { RA_DEGREES, DEC_DEGREES };
+
+    // reused for every image.
+    static thread_local std::vector<double> queryPoints;
+
+    const unsigned int *queryDets = detsByImage.itemsBegin(queryImage);
+    unsigned int nQueryDets = detsByImage.getNumItems(queryImage);
+    unsigned int firstImage, endImage;
+    imageIndex.getLaterImagesInRange(queryImage, config.minDt, config.maxDt,
+                                     firstImage, endImage);
+    if ((firstImage == endImage) || (nQueryDets == 0)) {
+        return;
+    }
 
+    if (config.dualTreeSearch) {
+        static thread_local std::vector<std::pair<long int, long int> > pairs;
+        double queryMJD = imageIndex.getImageMJD(queryImage);
+        for (unsigned int image = firstImage; image < endImage; image++) {
+            double dt = imageIndex.getImageMJD(image) - queryMJD;
+            pairs.clear();
+            myTrees[queryImage].RADecPairSearch(myTrees[image], 
+                                                dt * config.minV, dt * config.maxV,
+                                                pairs);
+            // the order the trees give is arbitrary; use a fixed one.
+            std::sort(pairs.begin(), pairs.end());
+            for (unsigned int i = 0; i < pairs.size(); i++) {
+                addPair(results, pairs[i].first, pairs[i].second);
+            }
+        }
+        return;
+    }
 
-    // iterate through list of collected Detections, as read from input
-    // file, and search over them
-    for(unsigned int i=0; i<queryPoints.size(); i++){
-        
-        const MopsDetection * curQuery = &(queryPoints.at(i));
-        double queryRA = convertToStandardDegrees(curQuery->getRA());
-        double queryDec = convertToStandardDegrees(curQuery->getDec());
-        double queryMJD = curQuery->getEpochMJD();
-
-        // iterate through each KDTree of detections, where each KDTree
-        // represents a unique MJD
-        std::map<double, KDTree<long int> >::const_iterator iter;
-        for(iter = myTreeMap.begin(); iter != myTreeMap.end(); iter++) {
-
-            double curMJD = iter->first;     //map key
-            const KDTree<long int> *curTree = &(iter->second); //value associated with key
-
-            //only consider this tree if it contains detections
-            //that occurred after the current one
-            if ((curMJD > queryMJD) && 
-                (curMJD - queryMJD >= config.minDt) && 
-                (curMJD - queryMJD <= config.maxDt)) {
- 
-                double maxVelocity = config.maxV;
-                double minVelocity = config.minV;
-	  
-                double maxDistance = (curMJD - queryMJD) * maxVelocity;
-                double minDistance = (curMJD - queryMJD) * minVelocity;
-                std::vector<double> queryPt;
-                queryPt.push_back(queryRA);
-                queryPt.push_back(queryDec);
-	
-                std::vector<PointAndValue<long int> > queryResults;
-
-                // do a rectangular search around this point. note that we 
-                // use the haversine great-circle distance in the tree, so we are
-                // sure that we get any object within maxDistance (and a few others)
-                queryResults = curTree->RADecRangeSearch(queryPt, maxDistance,
-                                                         otherDimsPt, otherDimsTolerances,
-                                                         myGeos);
-                
-                // filter the results, getting the items which are actually within
-                // the circle we are searching, not the rectangle enclosing it.
-                std::vector<long int> closeEnoughResults;
-                    
-                for (unsigned int ii = 0; ii < queryResults.size(); ii++) {
-                    PointAndValue<long int> * curResult = &(queryResults.at(ii));
-                    double resultRa = curResult->getPoint().at(0);
-                    double resultDec = curResult->getPoint().at(1);
-                    double properDistance =  angularDistanceRADec_deg(queryRA, 
-                                                                      queryDec, 
-                                                                      resultRa,
-                                                                      resultDec);
-                    if ((properDistance <= maxDistance) && (properDistance >= minDistance)) {
-                        closeEnoughResults.push_back(curResult->getValue());
-                    }
-                }
-                
-                for (unsigned int ii = 0; ii < closeEnoughResults.size(); ii++) {
-                    // collect results for each query point's results for each MJD
-                    Tracklet newTracklet;
-                    newTracklet.indices.insert(curQuery->getIndex());
-                    newTracklet.indices.insert(closeEnoughResults.at(ii));
-                    results.push_back(newTracklet);
-                }
-                
-                queryResults.clear();
-                queryPt.clear();
+    queryPoints.resize(2 * nQueryDets);
+    for (unsigned int i = 0; i < nQueryDets; i++) {
+        queryPoints[2 * i] = convertToStandardDegrees(myDets[queryDets[i]].getRA());
+        queryPoints[2 * i + 1] = convertToStandardDegrees(myDets[queryDets[i]].getDec());
+    }
+    double queryMJD = imageIndex.getImageMJD(queryImage);
+
+    if (config.unitVectorSearch) {
+        for (unsigned int image = firstImage; image < endImage; image++) {
+            double dt = imageIndex.getImageMJD(image) - queryMJD;
+            mySkyIndexes[image].radiusSearchBatch(
+                queryPoints, dt * config.minV, dt * config.maxV,
+                otherDimsPt, otherDimsTolerances,
+                [&](unsigned int i, const PointAndValue<long int, 3> &match) {
+                    addPair(results, myDets[queryDets[i]].getIndex(), 
+                            match.getValue());
+                });
+        }
+        return;
+    }
+
+    for (unsigned int image = firstImage; image < endImage; image++) {
+
+        double curMJD = imageIndex.getImageMJD(image);
+        const KDTree<long int, 2> *curTree = &(myTrees[image]);
+
+        double maxDistance = (curMJD - queryMJD) * config.maxV;
+        double minDistance = (curMJD - queryMJD) * config.minV;
+
+        // the tree gives everything within maxDistance (by the
+        // haversine great-circle distance); keep those which are also
+        // at least minDistance away.
+        auto addIfFarEnough = [&](unsigned int i, 
+                                  const PointAndValue<long int, 2> &match) {
+            const PointAndValue<long int, 2>::PointType &resultPoint = 
+                match.getPoint();
+            double properDistance =  angularDistanceRADec_deg(queryPoints[2 * i], 
+                                                              queryPoints[2 * i + 1], 
+                                                              resultPoint[0],
+                                                              resultPoint[1]);
+            if ((properDistance <= maxDistance) && (properDistance >= minDistance)) {
+                addPair(results, myDets[queryDets[i]].getIndex(), 
+                        match.getValue());
+            }
+        };
+        // images are already searched in parallel, so one thread here.
+        curTree->RADecRangeSearchBatch(queryPoints, maxDistance,
+                                       otherDimsPt, otherDimsTolerances,
+                                       myGeos, addIfFarEnough, 1);
+    }
+}
+
+
+
+template <class TrackletContainer>
+void getTracklets(TrackletContainer &results,
+		  const std::vector<KDTree<long int, 2> > &myTrees,
+                  const std::vector<SkyIndex<long int> > &mySkyIndexes,
+                  const ImageIndex &imageIndex,
+                  const std::vector<MopsDetection> &myDets,
+                  const ImageGrouping &detsByImage,
+		  findTrackletsConfig config)
+{
+  time_t start = time(NULL);
+
+    if (config.nThreads <= 1) {
+        for (unsigned int queryImage = 0; queryImage < detsByImage.getNumImages(); queryImage++) {
+            getTrackletsForImage(results, queryImage, myTrees, mySkyIndexes,
+                                 imageIndex,
+                                 myDets, detsByImage, config);
+        }
+    }
+    else {
+        /* each image in a batch gets its own output, and once the
+         * whole batch is done these are appended to results in image
+         * order, so the output is just what a serial run gives.
+         * Batches are kept small so that few tracklets are held twice
+         * at once, and are held in the compact TrackletStore whatever
+         * the type of results. */
+        const unsigned int batchSize = 4 * config.nThreads;
+        std::vector<TrackletStore> imageResults(batchSize);
+        WorkStealingPool pool(config.nThreads);
+
+        for (unsigned int batchStart = 0; batchStart < detsByImage.getNumImages(); 
+             batchStart += batchSize) {
+            unsigned int batchEnd = std::min(batchStart + batchSize,
+                                             (unsigned int) detsByImage.getNumImages());
+            for (unsigned int queryImage = batchStart; queryImage < batchEnd; queryImage++) {
+                TrackletStore *myResults = &(imageResults[queryImage - batchStart]);
+                pool.submit([&, myResults, queryImage] {
+                        getTrackletsForImage(*myResults, queryImage, myTrees, 
+                                             mySkyIndexes, imageIndex, myDets,
+                                             detsByImage, config);
+                    });
+            }
+            pool.wait();
+            for (unsigned int i = 0; i < batchEnd - batchStart; i++) {
+                appendTracklets(results, imageResults[i]);
             }
         }
     }
@@ -0,0 +1,200 @@
+// -*- LSST-C++ -*-
+
+#include "lsst/mops/daymops/linkTracklets/FlatTrackletTree.h"
+#define uint unsigned int
+
+namespace lsst { namespace mops {
+
+
+
+FlatTrackletTree::FlatTrackletTree()
+{
+}
+
+
+
+FlatTrackletTree::FlatTrackletTree(const TrackletTree &source)
+{
+    TrackletTreeNode * root = source.getRootNode();
+    if (root == NULL) {
+        throw LSST_EXCEPT(BadParameterException,
+           "FlatTrackletTree: can't flatten a TrackletTree with no data.");
+    }
+    uint nNodes = source.size();
+    rightChild.reserve(nNodes);
+    firstTracklet.reserve(nNodes);
+    trackletCount.reserve(nNodes);
+    nodeIds.reserve(nNodes);
+    for (uint axis = 0; axis < 4; axis++) {
+        lBounds[axis].reserve(nNodes);
+        uBounds[axis].reserve(nNodes);
+    }
+    trackletIds.reserve(root->getNumTracklets());
+
+    addNode(root);
+
+    visits.reset(new std::atomic<unsigned int>[nodeIds.size()]);
+    for (uint i = 0; i < nodeIds.size(); i++) {
+        visits[i] = 0;
+    }
+}
+
+
+
+FlatTrackletTree::FlatTrackletTree(FlatTrackletTree &&other) :
+    rightChild(std::move(other.rightChild)),
+    firstTracklet(std::move(other.firstTracklet)),
+    trackletCount(std::move(other.trackletCount)),
+    nodeIds(std::move(other.nodeIds)),
+    visits(std::move(other.visits)),
+    trackletIds(std::move(other.trackletIds))
+{
+    for (uint axis = 0; axis < 4; axis++) {
+        lBounds[axis] = std::move(other.lBounds[axis]);
+        uBounds[axis] = std::move(other.uBounds[axis]);
+    }
+}
+
+
+
+static void writeArray(std::ostream &outFile, const std::vector<uint> &values)
+{
+    outFile.write((const char *) values.data(), values.size() * sizeof(uint));
+}
+
+static void writeArray(std::ostream &outFile, const std::vector<double> &values)
+{
+    outFile.write((const char *) values.data(), values.size() * sizeof(double));
+}
+
+template <class T>
+static void readArray(std::istream &inFile, std::vector<T> &values, uint n)
+{
+    values.resize(n);
+    if (!inFile.read((char *) values.data(), n * sizeof(T))) {
+        throw LSST_EXCEPT(InputFileFormatErrorException,
+                          "FlatTrackletTree: tree ended early.");
+    }
+}
+
+
+
+void FlatTrackletTree::write(std::ostream &outFile, uint firstTrackletId) const
+{
+    uint sizes[2] = { (uint) nodeIds.size(), (uint) trackletIds.size() };
+    outFile.write((const char *) sizes, sizeof(sizes));
+    writeArray(outFile, rightChild);
+    writeArray(outFile, firstTracklet);
+    writeArray(outFile, trackletCount);
+    writeArray(outFile, nodeIds);
+    for (uint axis = 0; axis < 4; axis++) {
+        writeArray(outFile, lBounds[axis]);
+        writeArray(outFile, uBounds[axis]);
+    }
+    std::vector<uint> localIds(trackletIds);
+    for (uint i = 0; i < localIds.size(); i++) {
+        localIds[i] -= firstTrackletId;
+    }
+    writeArray(outFile, localIds);
+}
+
+
+
+static void badTree(const std::string &why)
+{
+    throw LSST_EXCEPT(InputFileFormatErrorException,
+                      "FlatTrackletTree: " + why);
+}
+
+
+
+void FlatTrackletTree::read(std::istream &inFile, uint firstTrackletId)
+{
+    std::vector<uint> sizes;
+    readArray(inFile, sizes, 2);
+    uint nNodes = sizes[0];
+    if (nNodes == 0) {
+        badTree("tree has no nodes.");
+    }
+    // don't believe sizes which need more bytes than are left.
+    std::streampos start = inFile.tellg();
+    inFile.seekg(0, std::ios_base::end);
+    std::streampos end = inFile.tellg();
+    inFile.seekg(start);
+    uint64_t needed = (uint64_t) nNodes * (4 * sizeof(uint) + 8 * sizeof(double))
+        + (uint64_t) sizes[1] * sizeof(uint);
+    if ((start < 0) || (end < start) || (!inFile) ||
+        (needed > (uint64_t) (end - start))) {
+        badTree("tree sizes run past the end of the file.");
+    }
+    readArray(inFile, rightChild, nNodes);
+    readArray(inFile, firstTracklet, nNodes);
+    readArray(inFile, trackletCount, nNodes);
+    readArray(inFile, nodeIds, nNodes);
+    for (uint axis = 0; axis < 4; axis++) {
+        readArray(inFile, lBounds[axis], nNodes);
+        readArray(inFile, uBounds[axis], nNodes);
+    }
+    readArray(inFile, trackletIds, sizes[1]);
+    for (uint i = 0; i < trackletIds.size(); i++) {
+        trackletIds[i] += firstTrackletId;
+    }
+
+    // the walks trust these without checking, so check them here.
+    for (uint i = 0; i < nNodes; i++) {
+        if ((rightChild[i] != 0) &&
+            ((rightChild[i] <= i) || (rightChild[i] >= nNodes))) {
+            badTree("tree has a bad child index.");
+        }
+        if ((uint64_t) firstTracklet[i] + trackletCount[i] >
+            trackletIds.size()) {
+            badTree("tree has a bad tracklet range.");
+        }
+    }
+
+    visits.reset(new std::atomic<unsigned int>[nNodes]);
+    for (uint i = 0; i < nNodes; i++) {
+        visits[i] = 0;
+    }
+}
+
+
+
+/*
+ * append node, then (depth-first) its left and right subtrees.  A
+ * leaf's tracklets are appended to trackletIds when the leaf is
+ * added, so each subtree's tracklets end up contiguous.
+ */
+void FlatTrackletTree::addNode(TrackletTreeNode * node)
+{
+    uint myIndex = nodeIds.size();
+    rightChild.push_back(0);
+    firstTracklet.push_back(trackletIds.size());
+    trackletCount.push_back(0);
+    nodeIds.push_back(node->getId());
+    for (uint axis = 0; axis < 4; axis++) {
+        lBounds[axis].push_back(node->getLBounds()->at(axis));
+        uBounds[axis].push_back(node->getUBounds()->at(axis));
+    }
+
+    if (node->isLeaf()) {
+        const std::vector<PointAndValue <uint> > * data = node->getMyData();
+        for (uint i = 0; i < data->size(); i++) {
+            trackletIds.push_back(data->at(i).getValue());
+        }
+    }
+    else {
+        if (!(node->hasLeftChild() && node->hasRightChild())) {
+            throw LSST_EXCEPT(ProgrammerErrorException,
+       "FlatTrackletTree: expected every non-leaf node to have two children.");
+        }
+        addNode(node->getLeftChild());
+        rightChild[myIndex] = nodeIds.size();
+        addNode(node->getRightChild());
+    }
+    trackletCount[myIndex] = trackletIds.size() - firstTracklet[myIndex];
+}
+
+
+
+}} // close namespace lsst::mops
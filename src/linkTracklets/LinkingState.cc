@@ -0,0 +1,477 @@
+// -*- LSST-C++ -*-
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdint.h>
+#include <string.h>
+// for mkdir
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "lsst/mops/Exceptions.h"
+#include "lsst/mops/ImageIndex.h"
+#include "lsst/mops/daymops/linkTracklets/LinkingState.h"
+
+#define uint unsigned int
+
+namespace lsst {
+namespace mops {
+
+
+static const char IMAGE_MAGIC[8] = { 'M', 'O', 'P', 'S', 'L', 'I', 'N', 'K' };
+static const uint32_t IMAGE_VERSION = 1;
+static const char *INDEX_FILE_NAME = "images";
+static const char *INDEX_HEADER = "linkTrackletsState";
+static const uint INDEX_VERSION = 1;
+// per tracklet: RA, Dec and their velocities, and the time spanned.
+static const uint N_PARAMETERS = 5;
+
+
+
+template <class T>
+static void writeValues(std::ofstream &outFile, const T *values, uint64_t n)
+{
+    outFile.write((const char *) values, n * sizeof(T));
+}
+
+template <class T>
+static void readValues(std::ifstream &inFile, T *values, uint64_t n,
+                       const std::string &fileName)
+{
+    if (!inFile.read((char *) values, n * sizeof(T))) {
+        throw LSST_EXCEPT(InputFileFormatErrorException,
+                          "LinkingState: " + fileName + " ended early.\n");
+    }
+}
+
+
+
+LinkingState::LinkingState(double skyCenterRa, double skyCenterDec,
+                           double positionalError, uint leafSize)
+{
+    this->skyCenterRa = skyCenterRa;
+    this->skyCenterDec = skyCenterDec;
+    this->positionalError = positionalError;
+    this->leafSize = leafSize;
+}
+
+
+
+bool LinkingState::exists(const std::string &dirName)
+{
+    std::ifstream indexFile((dirName + "/" + INDEX_FILE_NAME).c_str());
+    return indexFile.is_open();
+}
+
+
+
+std::string LinkingState::getImageFileName(double mjd)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "image-%.8f", mjd);
+    return std::string(name);
+}
+
+
+
+uint LinkingState::getImageOfDetection(uint detIndex) const
+{
+    std::vector<Image>::const_iterator next =
+        std::upper_bound(images.begin(), images.end(), detIndex,
+                         [](uint d, const Image &image) {
+                             return d < image.firstDetection; });
+    return (next - images.begin()) - 1;
+}
+
+
+
+void LinkingState::read(const std::string &dirName, double windowStart)
+{
+    std::string indexFileName = dirName + "/" + INDEX_FILE_NAME;
+    std::ifstream indexFile(indexFileName.c_str());
+    if (!indexFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open linking state " + indexFileName
+                          + " - does this file exist?\n");
+    }
+    std::string header;
+    uint version, stateLeafSize, nImages;
+    double stateCenterRa, stateCenterDec, statePositionalError;
+    if (!(indexFile >> header >> version >> stateCenterRa >> stateCenterDec
+          >> statePositionalError >> stateLeafSize >> nImages) ||
+        (header != INDEX_HEADER) || (version != INDEX_VERSION)) {
+        throw LSST_EXCEPT(InputFileFormatErrorException,
+                          "LinkingState: " + indexFileName + " is not a linking state index.\n");
+    }
+    if ((stateCenterRa != skyCenterRa) || (stateCenterDec != skyCenterDec) ||
+        (statePositionalError != positionalError) || (stateLeafSize != leafSize)) {
+        throw LSST_EXCEPT(BadParameterException,
+            "LinkingState: the state in " + dirName + " was made with a different sky center, detection location error or leaf size.\n");
+    }
+
+    images.clear();
+    detections.clear();
+    tracklets.clear();
+    droppedFileNames.clear();
+    std::vector<uint> trackletSizes;
+    std::vector<uint> trackletRefs;
+    std::vector<unsigned char> trackletFlags;
+    std::vector<double> trackletParameters;
+    for (uint i = 0; i < nImages; i++) {
+        double mjd;
+        std::string fileName;
+        if (!(indexFile >> mjd >> fileName)) {
+            throw LSST_EXCEPT(InputFileFormatErrorException,
+                              "LinkingState: " + indexFileName + " ended early.\n");
+        }
+        if (mjd < windowStart) {
+            droppedFileNames.push_back(fileName);
+            continue;
+        }
+        readImage(dirName, fileName, trackletSizes, trackletRefs,
+                  trackletFlags, trackletParameters);
+    }
+
+    // now that every image's detections are in, the tracklets can
+    // find theirs.
+    std::vector<uint> indices;
+    uint t = 0;
+    const uint *ref = trackletRefs.data();
+    for (uint image = 0; image < images.size(); image++) {
+        for (uint i = 0; i < images[image].numTracklets; i++, t++) {
+            indices.clear();
+            for (uint j = 0; j < trackletSizes[t]; j++, ref += 2) {
+                uint detImage = image + ref[0];
+                if ((detImage >= images.size()) ||
+                    (ref[1] >= images[detImage].numDetections)) {
+                    throw LSST_EXCEPT(InputFileFormatErrorException,
+                        "LinkingState: a tracklet in " + dirName + " has a detection we don't.\n");
+                }
+                indices.push_back(images[detImage].firstDetection + ref[1]);
+            }
+            uint newIndex = tracklets.addTracklet(indices.data(),
+                                                  indices.data() + indices.size());
+            tracklets.setCollapsed(newIndex, trackletFlags[t]);
+            const double *params = &trackletParameters[N_PARAMETERS * t];
+            tracklets.setParameters(newIndex, params[0], params[1],
+                                    params[2], params[3], params[4]);
+        }
+    }
+}
+
+
+
+void LinkingState::readImage(const std::string &dirName,
+                             const std::string &fileName,
+                             std::vector<uint> &trackletSizes,
+                             std::vector<uint> &trackletRefs,
+                             std::vector<unsigned char> &trackletFlags,
+                             std::vector<double> &trackletParameters)
+{
+    std::string path = dirName + "/" + fileName;
+    std::ifstream inFile(path.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!inFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open linking state image " + path + "\n");
+    }
+    char magic[sizeof(IMAGE_MAGIC)];
+    uint32_t version;
+    readValues(inFile, magic, sizeof(magic), path);
+    readValues(inFile, &version, 1, path);
+    if ((memcmp(magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) ||
+        (version != IMAGE_VERSION)) {
+        throw LSST_EXCEPT(InputFileFormatErrorException,
+                          "LinkingState: " + path + " is not a linking state image.\n");
+    }
+    Image image;
+    // numbers of detections, tracklets, tracklet detections, trees.
+    uint32_t counts[4];
+    readValues(inFile, &image.mjd, 1, path);
+    readValues(inFile, counts, 4, path);
+    uint nDets = counts[0];
+    uint nTracklets = counts[1];
+    uint nRefs = counts[2];
+
+    std::vector<double> doubles(nDets);
+    std::vector<int64_t> longs(nDets);
+    std::vector<int32_t> ints(nDets);
+    image.firstDetection = detections.size();
+    image.numDetections = nDets;
+    detections.resize(detections.size() + nDets);
+    MopsDetection *dets = &detections[image.firstDetection];
+    for (uint i = 0; i < nDets; i++) {
+        dets[i].setEpochMJD(image.mjd);
+    }
+    // the columns, in the order writeImage writes them.
+    readValues(inFile, doubles.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setRA(doubles[i]); }
+    readValues(inFile, doubles.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setDec(doubles[i]); }
+    readValues(inFile, doubles.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setRaErr(doubles[i]); }
+    readValues(inFile, doubles.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setDecErr(doubles[i]); }
+    readValues(inFile, doubles.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setRaTopoCorr(doubles[i]); }
+    readValues(inFile, doubles.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setMag(doubles[i]); }
+    readValues(inFile, doubles.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setSNR(doubles[i]); }
+    readValues(inFile, longs.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setID(longs[i]); }
+    readValues(inFile, longs.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setImageID(longs[i]); }
+    readValues(inFile, ints.data(), nDets, path);
+    for (uint i = 0; i < nDets; i++) { dets[i].setSsmId(ints[i]); }
+
+    uint firstSize = trackletSizes.size();
+    trackletSizes.resize(firstSize + nTracklets);
+    readValues(inFile, &trackletSizes[firstSize], nTracklets, path);
+    uint64_t totalSize = 0;
+    for (uint i = firstSize; i < trackletSizes.size(); i++) {
+        totalSize += trackletSizes[i];
+    }
+    if (totalSize != nRefs) {
+        throw LSST_EXCEPT(InputFileFormatErrorException,
+                          "LinkingState: " + path + " has bad tracklet sizes.\n");
+    }
+    uint64_t firstRef = trackletRefs.size();
+    trackletRefs.resize(firstRef + 2 * (uint64_t) nRefs);
+    readValues(inFile, &trackletRefs[firstRef], 2 * (uint64_t) nRefs, path);
+    uint firstFlag = trackletFlags.size();
+    trackletFlags.resize(firstFlag + nTracklets);
+    readValues(inFile, &trackletFlags[firstFlag], nTracklets, path);
+    uint64_t firstParameter = trackletParameters.size();
+    trackletParameters.resize(firstParameter + N_PARAMETERS * (uint64_t) nTracklets);
+    readValues(inFile, &trackletParameters[firstParameter],
+               N_PARAMETERS * (uint64_t) nTracklets, path);
+
+    image.firstTracklet = firstSize;
+    image.numTracklets = nTracklets;
+    if (counts[3] > 0) {
+        image.tree.reset(new FlatTrackletTree());
+        image.tree->read(inFile, image.firstTracklet);
+        const std::vector<uint> &ids = image.tree->getTrackletIds();
+        for (uint i = 0; i < ids.size(); i++) {
+            // unsigned, so IDs below firstTracklet wrap and fail too.
+            if (ids[i] - image.firstTracklet >= image.numTracklets) {
+                throw LSST_EXCEPT(InputFileFormatErrorException,
+                                  "LinkingState: " + path +
+                                  " has a tree tracklet from another image.\n");
+            }
+        }
+    }
+    images.push_back(std::move(image));
+}
+
+
+
+uint LinkingState::addImages(const std::vector<MopsDetection> &newDetections,
+                             const TrackletStore &newTracklets)
+{
+    ImageIndex newImageIndex(newDetections);
+    uint nNewImages = newImageIndex.getNumImages();
+    uint firstNewImage = images.size();
+    uint firstNewTracklet = tracklets.size();
+    if ((nNewImages > 0) && (images.size() > 0) &&
+        (newImageIndex.getImageMJD(0) <= images.back().mjd)) {
+        throw LSST_EXCEPT(BadParameterException,
+            "LinkingState: new detections must be later than those we have.");
+    }
+
+    // detections, image by image.
+    ImageGrouping detsByImage(newImageIndex);
+    std::vector<uint> newDetIndices(newDetections.size());
+    detections.reserve(detections.size() + newDetections.size());
+    for (uint image = 0; image < nNewImages; image++) {
+        Image newImage;
+        newImage.mjd = newImageIndex.getImageMJD(image);
+        newImage.firstDetection = detections.size();
+        newImage.numDetections = detsByImage.getNumItems(image);
+        newImage.isNew = true;
+        for (const uint *det = detsByImage.itemsBegin(image);
+             det != detsByImage.itemsEnd(image); det++) {
+            newDetIndices[*det] = detections.size();
+            detections.push_back(newDetections[*det]);
+        }
+        images.push_back(std::move(newImage));
+    }
+
+    // and tracklets, by first image.
+    std::vector<uint> trackletFirstImages(newTracklets.size());
+    for (uint i = 0; i < newTracklets.size(); i++) {
+        uint firstImage = nNewImages;
+        for (const uint *det = newTracklets.indicesBegin(i);
+             det != newTracklets.indicesEnd(i); det++) {
+            firstImage = std::min(firstImage,
+                                  newImageIndex.getImageOfDetection(*det));
+        }
+        trackletFirstImages[i] = firstImage;
+    }
+    ImageGrouping trackletsByImage(trackletFirstImages, nNewImages);
+    std::vector<uint> indices;
+    for (uint image = 0; image < nNewImages; image++) {
+        Image &thisImage = images[firstNewImage + image];
+        thisImage.firstTracklet = tracklets.size();
+        thisImage.numTracklets = trackletsByImage.getNumItems(image);
+        for (const uint *t = trackletsByImage.itemsBegin(image);
+             t != trackletsByImage.itemsEnd(image); t++) {
+            indices.clear();
+            for (const uint *det = newTracklets.indicesBegin(*t);
+                 det != newTracklets.indicesEnd(*t); det++) {
+                indices.push_back(newDetIndices[*det]);
+            }
+            uint newIndex = tracklets.addTracklet(indices.data(),
+                                                  indices.data() + indices.size());
+            tracklets.setCollapsed(newIndex, newTracklets.isCollapsed(*t));
+        }
+    }
+    return firstNewTracklet;
+}
+
+
+
+void LinkingState::writeImage(const std::string &dirName, uint image) const
+{
+    const Image &thisImage = images[image];
+    std::string path = dirName + "/" + getImageFileName(thisImage.mjd);
+    std::ofstream outFile(path.c_str(),
+                          std::ios_base::out | std::ios_base::binary |
+                          std::ios_base::trunc);
+    if (!outFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open output file " + path
+                          + " - do you have permission?\n");
+    }
+
+    // each tracklet's detections, as (image after the tracklet's
+    // first, index in that image).
+    std::vector<uint> sizes;
+    std::vector<uint> refs;
+    std::vector<unsigned char> flags;
+    std::vector<double> parameters;
+    for (uint t = thisImage.firstTracklet;
+         t < thisImage.firstTracklet + thisImage.numTracklets; t++) {
+        sizes.push_back(tracklets.getNumIndices(t));
+        for (const uint *det = tracklets.indicesBegin(t);
+             det != tracklets.indicesEnd(t); det++) {
+            uint detImage = getImageOfDetection(*det);
+            refs.push_back(detImage - image);
+            refs.push_back(*det - images[detImage].firstDetection);
+        }
+        flags.push_back(tracklets.isCollapsed(t));
+        parameters.push_back(tracklets.getRa0(t));
+        parameters.push_back(tracklets.getDec0(t));
+        parameters.push_back(tracklets.getRaVelocity(t));
+        parameters.push_back(tracklets.getDecVelocity(t));
+        parameters.push_back(tracklets.getDeltaTime(t));
+    }
+
+    writeValues(outFile, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    writeValues(outFile, &IMAGE_VERSION, 1);
+    writeValues(outFile, &thisImage.mjd, 1);
+    uint32_t counts[4] = { thisImage.numDetections, thisImage.numTracklets,
+                           (uint32_t) (refs.size() / 2),
+                           thisImage.tree ? 1u : 0u };
+    writeValues(outFile, counts, 4);
+
+    uint n = thisImage.numDetections;
+    const MopsDetection *dets = &detections[thisImage.firstDetection];
+    std::vector<double> doubles(n);
+    std::vector<int64_t> longs(n);
+    std::vector<int32_t> ints(n);
+    for (uint i = 0; i < n; i++) { doubles[i] = dets[i].getRA(); }
+    writeValues(outFile, doubles.data(), n);
+    for (uint i = 0; i < n; i++) { doubles[i] = dets[i].getDec(); }
+    writeValues(outFile, doubles.data(), n);
+    for (uint i = 0; i < n; i++) { doubles[i] = dets[i].getRaErr(); }
+    writeValues(outFile, doubles.data(), n);
+    for (uint i = 0; i < n; i++) { doubles[i] = dets[i].getDecErr(); }
+    writeValues(outFile, doubles.data(), n);
+    for (uint i = 0; i < n; i++) { doubles[i] = dets[i].getRaTopoCorr(); }
+    writeValues(outFile, doubles.data(), n);
+    for (uint i = 0; i < n; i++) { doubles[i] = dets[i].getMag(); }
+    writeValues(outFile, doubles.data(), n);
+    for (uint i = 0; i < n; i++) { doubles[i] = dets[i].getSNR(); }
+    writeValues(outFile, doubles.data(), n);
+    for (uint i = 0; i < n; i++) { longs[i] = dets[i].getID(); }
+    writeValues(outFile, longs.data(), n);
+    for (uint i = 0; i < n; i++) { longs[i] = dets[i].getImageID(); }
+    writeValues(outFile, longs.data(), n);
+    for (uint i = 0; i < n; i++) { ints[i] = dets[i].getSsmId(); }
+    writeValues(outFile, ints.data(), n);
+
+    writeValues(outFile, sizes.data(), sizes.size());
+    writeValues(outFile, refs.data(), refs.size());
+    writeValues(outFile, flags.data(), flags.size());
+    writeValues(outFile, parameters.data(), parameters.size());
+    if (thisImage.tree) {
+        thisImage.tree->write(outFile, thisImage.firstTracklet);
+    }
+    outFile.close();
+    if (outFile.fail()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed writing linking state image " + path + "\n");
+    }
+}
+
+
+
+void LinkingState::writeNewImages(const std::string &dirName) const
+{
+    if ((mkdir(dirName.c_str(), 0777) != 0) && (errno != EEXIST)) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to make linking state directory " + dirName + "\n");
+    }
+    for (uint image = 0; image < images.size(); image++) {
+        if (!images[image].isNew) {
+            continue;
+        }
+        if (images[image].numTracklets > 0 && !images[image].tree) {
+            throw LSST_EXCEPT(ProgrammerErrorException,
+                              "LinkingState: a new image with tracklets has no tree.");
+        }
+        writeImage(dirName, image);
+    }
+}
+
+
+
+void LinkingState::writeIndex(const std::string &dirName) const
+{
+    // write a new index and then move it over the old, so that the
+    // state is never half-written.
+    std::string indexFileName = dirName + "/" + INDEX_FILE_NAME;
+    std::string tmpFileName = indexFileName + ".tmp";
+    std::ofstream indexFile(tmpFileName.c_str(),
+                            std::ios_base::out | std::ios_base::trunc);
+    if (!indexFile.is_open()) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed to open output file " + tmpFileName
+                          + " - do you have permission?\n");
+    }
+    indexFile << std::setprecision(17);
+    indexFile << INDEX_HEADER << " " << INDEX_VERSION << "\n";
+    indexFile << skyCenterRa << " " << skyCenterDec << " "
+              << positionalError << " " << leafSize << "\n";
+    indexFile << images.size() << "\n";
+    for (uint image = 0; image < images.size(); image++) {
+        indexFile << images[image].mjd << " "
+                  << getImageFileName(images[image].mjd) << "\n";
+    }
+    indexFile.close();
+    if (indexFile.fail() ||
+        (std::rename(tmpFileName.c_str(), indexFileName.c_str()) != 0)) {
+        throw LSST_EXCEPT(FileException,
+                          "Failed writing linking state index " + indexFileName + "\n");
+    }
+    for (uint i = 0; i < droppedFileNames.size(); i++) {
+        std::remove((dirName + "/" + droppedFileNames[i]).c_str());
+    }
+}
+
+
+
+}} // close namespace lsst::mops
@@ -33,6 +33,22 @@ TrackletTree::TrackletTree(const std::vector<MopsDetection> &allDetections,
 
 
 
+TrackletTree::TrackletTree(const TrackletStore &allTracklets,
+                           const unsigned int *firstIndex,
+                           const unsigned int *lastIndex,
+                           double positionalErrorRa, 
+                           double positionalErrorDec,
+                           unsigned int maxLeafSize)
+{
+    setUpEmptyTree();
+    std::vector<double> emptyVec;
+    buildFromData(allTracklets, firstIndex, lastIndex, positionalErrorRa,
+		  positionalErrorDec, maxLeafSize, emptyVec);
+
+}
+
+
+
 
 
 
@@ -43,16 +59,80 @@ void TrackletTree::buildFromData(
     double positionalErrorRa, double positionalErrorDec,
     unsigned int maxLeafSize, 
     const::std::vector<double> &perAxisWidths)
+{
+    // need to convert tracklets to a parameterized format:
+
+    // (RA_0, Dec_0, RAv, Dec_v) 
+        
+    // and make a PointAndValue vector.
+    std::vector<PointAndValue <unsigned int> > parameterizedTracklets;
+    for (uint i = 0; i < thisTreeTracklets.size(); i++) {
+        Tracklet myT = thisTreeTracklets.at(i);
+        PointAndValue<unsigned int> trackletPav;
+
+        std::vector<double> trackletPoint;
+        const std::vector<double> *raP0Vel = myT.getBestFitFunctionRa();
+        const std::vector<double> *decP0Vel = myT.getBestFitFunctionDec();
+        trackletPoint.push_back(raP0Vel->at(0));
+        trackletPoint.push_back(decP0Vel->at(0));
+        trackletPoint.push_back(raP0Vel->at(1));
+        trackletPoint.push_back(decP0Vel->at(1));
+        trackletPoint.push_back(myT.getDeltaTime(allDetections));
+
+        trackletPav.setPoint(trackletPoint);
+        trackletPav.setValue(myT.getId());
+
+        parameterizedTracklets.push_back(trackletPav);
+    }
+    buildFromParameterizedTracklets(parameterizedTracklets, 
+                                    positionalErrorRa, positionalErrorDec,
+                                    maxLeafSize, perAxisWidths);
+}
+
+
+
+void TrackletTree::buildFromData(
+    const TrackletStore &allTracklets,
+    const unsigned int *firstIndex,
+    const unsigned int *lastIndex,
+    double positionalErrorRa, double positionalErrorDec,
+    unsigned int maxLeafSize, 
+    const::std::vector<double> &perAxisWidths)
+{
+    std::vector<PointAndValue <unsigned int> > parameterizedTracklets(
+        lastIndex - firstIndex);
+    std::vector<double> trackletPoint(5);
+    for (uint i = 0; i < parameterizedTracklets.size(); i++) {
+        unsigned int t = firstIndex[i];
+        trackletPoint[0] = allTracklets.getRa0(t);
+        trackletPoint[1] = allTracklets.getDec0(t);
+        trackletPoint[2] = allTracklets.getRaVelocity(t);
+        trackletPoint[3] = allTracklets.getDecVelocity(t);
+        trackletPoint[4] = allTracklets.getDeltaTime(t);
+        parameterizedTracklets[i].setPoint(trackletPoint);
+        parameterizedTracklets[i].setValue(allTracklets.getId(t));
+    }
+    buildFromParameterizedTracklets(parameterizedTracklets, 
+                                    positionalErrorRa, positionalErrorDec,
+                                    maxLeafSize, perAxisWidths);
+}
+
+
+
+void TrackletTree::buildFromParameterizedTracklets(
+    const std::vector<PointAndValue <unsigned int> > &parameterizedTracklets,
+    double positionalErrorRa, double positionalErrorDec,
+    unsigned int maxLeafSize, 
+    const::std::vector<double> &perAxisWidths)
 {
     // need to set up fields used by KDTree just the way KDTree would; then 
     // create our set of child TrackletTreesNodes
     myK = 4;
 
 
-    if (thisTreeTracklets.size() > 0) 
+    if (parameterizedTracklets.size() > 0) 
     {
 
-        std::vector<PointAndValue <unsigned int> > parameterizedTracklets;
         std::vector<double> pointsUBounds, pointsLBounds;
 
         if (maxLeafSize < 1) {
@@ -60,36 +140,13 @@ void TrackletTree::buildFromData(
        "EE: KDTree: max leaf size must be strictly positive!\n");
         }
 
-
-        // need to convert tracklets to a parameterized format:
-
-        // (RA_0, Dec_0, RAv, Dec_v) 
-        
-        // and make a PointAndValue vector.
-
 	// ASSUME all data comes from the same <180 -degree region of sky in both RA and Dec.
 
-        for (uint i = 0; i < thisTreeTracklets.size(); i++) {
-            Tracklet myT = thisTreeTracklets.at(i);
-            MopsDetection firstDetection = 
-                myT.getFirstDetection(allDetections);
-            PointAndValue<unsigned int> trackletPav;
-
-            std::vector<double> trackletPoint;
-	    const std::vector<double> *raP0Vel = myT.getBestFitFunctionRa();
-	    const std::vector<double> *decP0Vel = myT.getBestFitFunctionDec();
-            trackletPoint.push_back(raP0Vel->at(0));
-            trackletPoint.push_back(decP0Vel->at(0));
-            trackletPoint.push_back(raP0Vel->at(1));
-            trackletPoint.push_back(decP0Vel->at(1));
-            trackletPoint.push_back(myT.getDeltaTime(allDetections));
-
-            trackletPav.setPoint(trackletPoint);
-            trackletPav.setValue(myT.getId());
-
-            parameterizedTracklets.push_back(trackletPav);
+        for (uint i = 0; i < parameterizedTracklets.size(); i++) {
+            const std::vector<double> &trackletPoint = 
+                parameterizedTracklets[i].getPoint();
 
-	    // calculate UBounds, LBounds                                                                                                                                                   
+	    // calculate UBounds, LBounds
 	    if (pointsUBounds.size() == 0) {		 
 		 pointsUBounds = trackletPoint;
 	    }
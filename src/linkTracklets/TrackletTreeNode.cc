@@ -1,6 +1,8 @@
 // -*- LSST-C++ -*-
 /* jmyers 2/10/11 */
 
+#include <algorithm>
+
 #include "lsst/mops/daymops/linkTracklets/TrackletTreeNode.h"
 #define uint unsigned int
 
@@ -22,29 +24,72 @@ TrackletTreeNode::TrackletTreeNode(
     unsigned int &lastId,
     bool useMedian,
     bool splitWidest)
+{
+    std::vector<unsigned int> order(tracklets.size());
+    for (uint i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    build(tracklets, order.data(), order.data() + order.size(),
+          positionalErrorRa, positionalErrorDec, maxLeafSize, 
+          myAxisToSplit, widths, lastId, useMedian, splitWidest);
+}
+
+
+
+TrackletTreeNode::TrackletTreeNode(
+    const std::vector<PointAndValue <unsigned int> > &allTracklets, 
+    unsigned int *first,
+    unsigned int *last,
+    double positionalErrorRa, 
+    double positionalErrorDec,
+    unsigned int maxLeafSize, 
+    unsigned int myAxisToSplit, 
+    const std::vector<double> &widths,
+    unsigned int &lastId,
+    bool useMedian,
+    bool splitWidest)
+{
+    build(allTracklets, first, last, 
+          positionalErrorRa, positionalErrorDec, maxLeafSize, 
+          myAxisToSplit, widths, lastId, useMedian, splitWidest);
+}
+
+
+
+void TrackletTreeNode::build(
+    const std::vector<PointAndValue <unsigned int> > &allTracklets, 
+    unsigned int *first,
+    unsigned int *last,
+    double positionalErrorRa, 
+    double positionalErrorDec,
+    unsigned int maxLeafSize, 
+    unsigned int myAxisToSplit, 
+    const std::vector<double> &widths,
+    unsigned int &lastId,
+    bool useMedian,
+    bool splitWidest)
 {
     myRefCount = 1;
     myK = 4; 
+    numVisits = 0;
+    numTracklets = last - first;
 
     lastId++;
     id = lastId;
 
-    std::vector<double> rightChildUBounds, rightChildLBounds,     
-        leftChildUBounds, leftChildLBounds;
-    std::vector<PointAndValue <uint> > leftPointsAndValues, rightPointsAndValues;
-
     
     myUBounds.resize(4);
     myLBounds.resize(4);
 
     // need to calculate initial UBounds, LBounds for our data.
-    for (uint i = 0; i < tracklets.size(); i++) {
-        if (tracklets.at(i).getPoint().size() != 5) {
+    for (uint i = 0; i < numTracklets; i++) {
+        const std::vector<double> &trackletPoint = allTracklets[first[i]].getPoint();
+        if (trackletPoint.size() != 5) {
             LSST_EXCEPT(ProgrammerErrorException, 
        "expected all tracklet points to be 5d: Ra, Dec, RaV, DecV, dt\n");
         }
         for (uint axis = 0; axis < 4; axis++) {
-            double val = tracklets.at(i).getPoint().at(axis);
+            double val = trackletPoint.at(axis);
             if ((i == 0) || (val > myUBounds[axis])) {
                 myUBounds[axis] = val;
             }
@@ -55,9 +100,12 @@ TrackletTreeNode::TrackletTreeNode(
     }
     
 
-    if (tracklets.size() <= maxLeafSize) {
+    if (numTracklets <= maxLeafSize) {
         // leaf case is easy.
-        myData = tracklets;
+        myData.reserve(numTracklets);
+        for (unsigned int *t = first; t != last; t++) {
+            myData.push_back(allTracklets[*t]);
+        }
     }
 
     else {
@@ -89,57 +137,54 @@ TrackletTreeNode::TrackletTreeNode(
         // split up data in our axis.
         if (useMedian) {
             // use the median.
-            pivot = getMedianByAxis(tracklets, myAxisToSplit);
+            std::vector<double> axisValues(numTracklets);
+            for (uint i = 0; i < numTracklets; i++) {
+                axisValues[i] = allTracklets[first[i]].getPoint()[myAxisToSplit];
+            }
+            pivot = fastMedian(axisValues);
         }
         else {
             // use average like C linkTracklets
             pivot = (myUBounds[myAxisToSplit] + myLBounds[myAxisToSplit]) / 2.0;
         }
 
-        // try to partition data
-        for (uint i = 0; i < tracklets.size(); i++) {
-            double val = tracklets[i].getPoint()[myAxisToSplit];
-            
-            if (val < pivot) {
-                leftPointsAndValues.push_back(tracklets[i]);
-            }
-            else {
-                rightPointsAndValues.push_back(tracklets[i]);
-            }
-        }
+        // try to partition data.  Our indices are in the order of
+        // allTracklets, and a stable partition keeps them that way
+        // for the children.
+        unsigned int *split = std::stable_partition(
+            first, last, 
+            [&](unsigned int t) {
+                return allTracklets[t].getPoint()[myAxisToSplit] < pivot;
+            });
         
         // like in C linkTracklets, partition up data and if it doesn't work well
         // just partition arbitrarily...
-        if ((leftPointsAndValues.size() == 0) || 
-            (rightPointsAndValues.size() == 0)) {
-            leftPointsAndValues.clear();
-            rightPointsAndValues.clear();
-
-            for (uint i = 0; i < tracklets.size(); i++) {
-                if (i % 2 == 0) {
-                    leftPointsAndValues.push_back(tracklets[i]);
-                }
-                else {
-                    rightPointsAndValues.push_back(tracklets[i]);
-                }
+        if ((split == first) || (split == last)) {
+            std::vector<unsigned int> evensThenOdds;
+            evensThenOdds.reserve(numTracklets);
+            for (uint i = 0; i < numTracklets; i += 2) {
+                evensThenOdds.push_back(first[i]);
+            }
+            for (uint i = 1; i < numTracklets; i += 2) {
+                evensThenOdds.push_back(first[i]);
             }
+            std::copy(evensThenOdds.begin(), evensThenOdds.end(), first);
+            split = first + (numTracklets + 1) / 2;
         }
 
         nextAxis = (myAxisToSplit + 1) % (myK);
         
-        TrackletTreeNode leftChild(leftPointsAndValues,
-                                   positionalErrorRa, positionalErrorDec,
-                                   maxLeafSize, nextAxis, widths, lastId, 
-                                   useMedian, splitWidest);
+        // build the children in place, so they are never copied.
+        myChildren.reserve(2);
+        myChildren.emplace_back(allTracklets, first, split,
+                                positionalErrorRa, positionalErrorDec,
+                                maxLeafSize, nextAxis, widths, lastId, 
+                                useMedian, splitWidest);
         
-        myChildren.push_back(leftChild);
-        
-        TrackletTreeNode rightChild(rightPointsAndValues, 
-                                    positionalErrorRa, positionalErrorDec,
-                                    maxLeafSize, nextAxis, widths, lastId, 
-                                    useMedian, splitWidest);
-
-        myChildren.push_back(rightChild);
+        myChildren.emplace_back(allTracklets, split, last,
+                                positionalErrorRa, positionalErrorDec,
+                                maxLeafSize, nextAxis, widths, lastId, 
+                                useMedian, splitWidest);
     }
 
 
@@ -149,16 +194,41 @@ TrackletTreeNode::TrackletTreeNode(
 }
         
 
+TrackletTreeNode::TrackletTreeNode(const TrackletTreeNode &other)
+    : BaseKDTreeNode<unsigned int, TrackletTreeNode>(other)
+{
+    numVisits = other.getNumVisits();
+    numTracklets = other.getNumTracklets();
+}
+
+
+
+TrackletTreeNode & TrackletTreeNode::operator=(const TrackletTreeNode &other)
+{
+    BaseKDTreeNode<unsigned int, TrackletTreeNode>::operator=(other);
+    numVisits = other.getNumVisits();
+    numTracklets = other.getNumTracklets();
+    return *this;
+}
+
+
+
 // these are to be used by linkTracklets.
 const unsigned int TrackletTreeNode::getNumVisits() const
 {
-    return numVisits;
+    return numVisits.load(std::memory_order_relaxed);
 }
 
 
 void TrackletTreeNode::addVisit() 
 {
-    numVisits++;
+    numVisits.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+unsigned int TrackletTreeNode::getNumTracklets() const
+{
+    return numTracklets;
 }
 
 
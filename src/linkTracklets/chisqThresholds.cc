@@ -0,0 +1,66 @@
+// -*- LSST-C++ -*-
+
+#include <limits>
+#include "gsl/gsl_cdf.h"
+
+#include "lsst/mops/daymops/linkTracklets/chisqThresholds.h"
+
+#define uint unsigned int
+
+namespace lsst { namespace mops {
+
+
+
+/*
+ * the inverse CDF can't take probabilities outside [0, 1]; those are
+ * the limits for which nothing or everything passes anyway.
+ */
+static double maxChisqForProb(double minProbChisq, uint dof)
+{
+    if (dof == 0) {
+        // a fit with no data passes nothing
+        return 0.;
+    }
+    if (minProbChisq <= 0.) {
+        return std::numeric_limits<double>::infinity();
+    }
+    if (minProbChisq >= 1.) {
+        return 0.;
+    }
+    return gsl_cdf_chisq_Qinv(minProbChisq, dof);
+}
+
+
+
+ChisqThresholds::ChisqThresholds(double minProbChisq, uint maxDof)
+{
+    this->minProbChisq = minProbChisq;
+    maxChisq.resize(maxDof + 1);
+    for (uint dof = 0; dof <= maxDof; dof++) {
+        maxChisq[dof] = maxChisqForProb(minProbChisq, dof);
+    }
+}
+
+
+
+double ChisqThresholds::getMaxChisq(uint dof) const
+{
+    if (dof < maxChisq.size()) {
+        return maxChisq[dof];
+    }
+    return maxChisqForProb(minProbChisq, dof);
+}
+
+
+
+bool ChisqThresholds::accepts(double chisq, uint dof) const
+{
+    if (dof < maxChisq.size()) {
+        return chisq < maxChisq[dof];
+    }
+    return gsl_cdf_chisq_Q(chisq, dof) > minProbChisq;
+}
+
+
+
+}} // close namespace lsst::mops
@@ -0,0 +1,294 @@
+// -*- LSST-C++ -*-
+
+#include <cmath>
+#include <set>
+
+#include "lsst/mops/daymops/linkTracklets/endpointPrecheck.h"
+
+#define uint unsigned int
+
+namespace lsst { namespace mops {
+
+
+// how far past a limit the pre-check's acceleration must be before we
+// trust it over the full fit: relative to the sizes involved, plus a
+// little (deg/day^2) for accelerations near zero.  Both are far larger
+// than the rounding error of either fit.
+static const double ACC_REL_MARGIN = 1e-6;
+static const double ACC_ABS_MARGIN = 1e-9;
+
+
+
+TrackletMoments::TrackletMoments()
+{
+    firstTime = 0;
+    lastTime = 0;
+    refTime = 0;
+    refRa = 0;
+    refDec = 0;
+    for (uint k = 0; k < 5; k++) {
+        raT[k] = 0;
+        decT[k] = 0;
+    }
+    for (uint k = 0; k < 3; k++) {
+        raTY[k] = 0;
+        decTY[k] = 0;
+    }
+}
+
+
+
+/*
+ * the moments of the detections with indices in [begin, end), which
+ * must not be empty.
+ */
+template <class IndexIter>
+static void fillMoments(const std::vector<MopsDetection> &allDetections,
+                        IndexIter begin, IndexIter end,
+                        TrackletMoments &m)
+{
+    IndexIter detIter;
+    const MopsDetection &firstDet = allDetections.at(*begin);
+    m.firstTime = firstDet.getEpochMJD();
+    m.lastTime = m.firstTime;
+    m.refRa = firstDet.getRA();
+    m.refDec = firstDet.getDec();
+    uint nDets = 0;
+    for (detIter = begin; detIter != end; detIter++) {
+        double t = allDetections.at(*detIter).getEpochMJD();
+        m.refTime += t;
+        if (t < m.firstTime) {
+            m.firstTime = t;
+        }
+        if (t > m.lastTime) {
+            m.lastTime = t;
+        }
+        nDets++;
+    }
+    m.refTime /= nDets;
+
+    for (detIter = begin; detIter != end; detIter++) {
+        const MopsDetection &det = allDetections.at(*detIter);
+        double s = det.getEpochMJD() - m.refTime;
+        double raW = 1. / (det.getRaErr() * det.getRaErr());
+        double decW = 1. / (det.getDecErr() * det.getDecErr());
+        double ra = det.getRA() - m.refRa;
+        double dec = det.getDec() - m.refDec;
+        double sPow = 1.;
+        for (uint k = 0; k < 5; k++) {
+            m.raT[k] += raW * sPow;
+            m.decT[k] += decW * sPow;
+            if (k < 3) {
+                m.raTY[k] += raW * sPow * ra;
+                m.decTY[k] += decW * sPow * dec;
+            }
+            sPow *= s;
+        }
+    }
+}
+
+
+
+TrackletMoments::TrackletMoments(const std::vector<MopsDetection> &allDetections,
+                                 const Tracklet &tracklet)
+{
+    *this = TrackletMoments();
+    if (tracklet.indices.size() == 0) {
+        return;
+    }
+    fillMoments(allDetections, tracklet.indices.begin(), 
+                tracklet.indices.end(), *this);
+}
+
+
+
+TrackletMoments::TrackletMoments(const std::vector<MopsDetection> &allDetections,
+                                 const unsigned int *firstDetIndex,
+                                 const unsigned int *lastDetIndex)
+{
+    *this = TrackletMoments();
+    if (firstDetIndex == lastDetIndex) {
+        return;
+    }
+    fillMoments(allDetections, firstDetIndex, lastDetIndex, *this);
+}
+
+
+
+void calculateTrackletMoments(const std::vector<MopsDetection> &allDetections,
+                              const std::vector<Tracklet> &allTracklets,
+                              std::vector<TrackletMoments> &moments)
+{
+    moments.resize(allTracklets.size());
+    for (uint i = 0; i < allTracklets.size(); i++) {
+        moments[i] = TrackletMoments(allDetections, allTracklets[i]);
+    }
+}
+
+
+
+void calculateTrackletMoments(const std::vector<MopsDetection> &allDetections,
+                              const TrackletStore &allTracklets,
+                              std::vector<TrackletMoments> &moments)
+{
+    moments.resize(allTracklets.size());
+    for (uint i = 0; i < allTracklets.size(); i++) {
+        moments[i] = TrackletMoments(allDetections, 
+                                     allTracklets.indicesBegin(i),
+                                     allTracklets.indicesEnd(i));
+    }
+}
+
+
+
+/*
+ * add to sumT and sumTY the moments T, TY, moved from times relative
+ * to some reference to times relative to a reference d days earlier
+ * (i.e. s -> s + d) and from positions relative to some reference to
+ * positions relative to one dy smaller (y -> y + dy).  The moments are
+ * also scaled by h: sumT[k] gets sum of w ((s + d)/h)^k.
+ */
+static void addShiftedMoments(const double T[5], const double TY[3],
+                              double d, double dy, double h,
+                              double sumT[5], double sumTY[3])
+{
+    static const double binomial[5][5] = { {1, 0, 0, 0, 0},
+                                           {1, 1, 0, 0, 0},
+                                           {1, 2, 1, 0, 0},
+                                           {1, 3, 3, 1, 0},
+                                           {1, 4, 6, 4, 1} };
+    double dPow[5];
+    dPow[0] = 1.;
+    for (uint k = 1; k < 5; k++) {
+        dPow[k] = dPow[k - 1] * d;
+    }
+    double hPow = 1.;
+    for (uint j = 0; j < 5; j++) {
+        double shiftedT = 0;
+        double shiftedTY = 0;
+        for (uint i = 0; i <= j; i++) {
+            shiftedT += binomial[j][i] * dPow[j - i] * T[i];
+            if (j < 3) {
+                shiftedTY += binomial[j][i] * dPow[j - i] * TY[i];
+            }
+        }
+        sumT[j] += shiftedT / hPow;
+        if (j < 3) {
+            sumTY[j] += (shiftedTY + dy * shiftedT) / hPow;
+        }
+        hPow *= h;
+    }
+}
+
+
+
+/*
+ * solve the (scaled) normal equations for the quadratic coefficient by
+ * Cramer's rule.  Returns false if the system is nearly singular.
+ */
+static bool solveQuadraticCoefficient(const double T[5], const double TY[3],
+                                      double &c2)
+{
+    double n00 = T[0], n01 = T[1], n02 = T[2];
+    double n11 = T[2], n12 = T[3], n22 = T[4];
+
+    double m00 = n11 * n22 - n12 * n12;
+    double m01 = n01 * n22 - n12 * n02;
+    double m02 = n01 * n12 - n11 * n02;
+    double det = n00 * m00 - n01 * m01 + n02 * m02;
+    if (!(std::fabs(det) > 1e-9 * n00 * n11 * n22)) {
+        return false;
+    }
+    // the determinant with the last column replaced by TY
+    double detC2 = n00 * (n11 * TY[2] - TY[1] * n12)
+        - n01 * (n01 * TY[2] - TY[1] * n02)
+        + TY[0] * (n01 * n12 - n11 * n02);
+    c2 = detC2 / det;
+    return true;
+}
+
+
+
+bool pairAccelerations(const TrackletMoments &first,
+                       const TrackletMoments &second,
+                       double &raAcc, double &decAcc)
+{
+    double refTime = (first.refTime + second.refTime) / 2.;
+    double dFirst = first.refTime - refTime;
+    double dSecond = second.refTime - refTime;
+    // scale times to about [-1, 1] to keep the solve well conditioned.
+    double h = std::fabs(dFirst);
+    if (std::fabs(dSecond) > h) {
+        h = std::fabs(dSecond);
+    }
+    if (!(h > 0)) {
+        return false;
+    }
+
+    double raSumT[5] = {0, 0, 0, 0, 0};
+    double raSumTY[3] = {0, 0, 0};
+    double decSumT[5] = {0, 0, 0, 0, 0};
+    double decSumTY[3] = {0, 0, 0};
+    addShiftedMoments(first.raT, first.raTY, dFirst, 0., h,
+                      raSumT, raSumTY);
+    addShiftedMoments(second.raT, second.raTY, dSecond,
+                      second.refRa - first.refRa, h,
+                      raSumT, raSumTY);
+    addShiftedMoments(first.decT, first.decTY, dFirst, 0., h,
+                      decSumT, decSumTY);
+    addShiftedMoments(second.decT, second.decTY, dSecond,
+                      second.refDec - first.refDec, h,
+                      decSumT, decSumTY);
+
+    double raC2, decC2;
+    if (!solveQuadraticCoefficient(raSumT, raSumTY, raC2) ||
+        !solveQuadraticCoefficient(decSumT, decSumTY, decC2)) {
+        return false;
+    }
+    raAcc = 2. * raC2 / (h * h);
+    decAcc = 2. * decC2 / (h * h);
+    return true;
+}
+
+
+
+static bool clearlyAbove(double acc, double maxAcc)
+{
+    double margin = ACC_REL_MARGIN * (std::fabs(acc) + std::fabs(maxAcc))
+        + ACC_ABS_MARGIN;
+    return acc > maxAcc + margin;
+}
+
+
+
+bool endpointPairCertainlyIncompatible(const TrackletMoments &first,
+                                       const TrackletMoments &second,
+                                       double maxRaAcc,
+                                       double maxDecAcc,
+                                       double minTimeSeparation)
+{
+    // the same comparison endpointTrackletsAreCompatible makes, on
+    // the same numbers, so no margin is needed.
+    double minTime = (first.firstTime < second.firstTime) ?
+        first.firstTime : second.firstTime;
+    double maxTime = (first.lastTime > second.lastTime) ?
+        first.lastTime : second.lastTime;
+    if (maxTime - minTime < minTimeSeparation) {
+        return true;
+    }
+
+    // if the tracklets overlap in time they might share detections,
+    // which the track would only count once; leave those to the full
+    // check.
+    if (first.lastTime >= second.firstTime) {
+        return false;
+    }
+    double raAcc, decAcc;
+    if (!pairAccelerations(first, second, raAcc, decAcc)) {
+        return false;
+    }
+    return clearlyAbove(raAcc, maxRaAcc) || clearlyAbove(decAcc, maxDecAcc);
+}
+
+
+}} // close namespace lsst::mops
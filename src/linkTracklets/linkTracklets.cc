@@ -7,13 +7,26 @@
 #include <map>
 #include <time.h>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
 
 
 #include "lsst/mops/rmsLineFit.h"
 #include "lsst/mops/daymops/linkTracklets/linkTracklets.h"
 #include "lsst/mops/Exceptions.h"
 #include "lsst/mops/KDTree.h"
+#include "lsst/mops/WorkStealingPool.h"
+#include "lsst/mops/ImageIndex.h"
 #include "lsst/mops/daymops/linkTracklets/TrackletTree.h"
+#include "lsst/mops/daymops/linkTracklets/FlatTrackletTree.h"
+#include "lsst/mops/daymops/linkTracklets/LinkingState.h"
+#include "lsst/mops/daymops/linkTracklets/supportCompatibility.h"
+#include "lsst/mops/daymops/linkTracklets/lruCache.h"
+#include "lsst/mops/daymops/linkTracklets/chisqThresholds.h"
+#include "lsst/mops/daymops/linkTracklets/endpointPrecheck.h"
 
 #undef DEBUG
 
@@ -55,8 +68,8 @@ namespace lsst {
 
 /*
  ImageTime is a class for improving readability as well as adding
- functionality. From now on we will be giving unique IDs to each image
- time.
+ functionality. Each image time carries its dense image and night
+ indices (see ImageIndex).
 
  This is important since we now support the use of a cache which takes
  a tree node ID and a time as a key, and you shouldn't use a
@@ -67,42 +80,51 @@ namespace lsst {
 class ImageTime {
 public:
     ImageTime() {
-        MJD = -1; imgId = 0;
+        MJD = -1; imgId = 0; nightId = 0;
     }
-    ImageTime(double newMJD, uint newImageId) {
+    ImageTime(double newMJD, uint newImageId, uint newNightId) {
         MJD = newMJD;
         imgId = newImageId;
+        nightId = newNightId;
     }
     ImageTime(const ImageTime &other) {
         MJD = other.getMJD();
         imgId = other.getImageId();
+        nightId = other.getNightId();
     }
-    const double getMJD() const {
+    double getMJD() const {
         return MJD;
     }
-    const uint getImageId() const {
+    uint getImageId() const {
         return imgId;
     }
+    uint getNightId() const {
+        return nightId;
+    }
     void setMJD(double m) {
         MJD = m;
     }
     void setImageId(uint i) {
         imgId = i;
     }
+    void setNightId(uint i) {
+        nightId = i;
+    }
     ImageTime & operator=(const ImageTime &rhs) {
         MJD = rhs.getMJD();
         imgId = rhs.getImageId();
+        nightId = rhs.getNightId();
         return *this;
     }
-    // NB: since IDs are assigned in order of image time, would it be
-    // faster if we did < based on imgId (int rather than double?)
+    // image IDs are assigned in order of image time.
     bool operator< (const ImageTime &other) const {
-        return MJD < other.getMJD();
+        return imgId < other.getImageId();
     }
 
 private:
     double MJD;
     uint imgId;
+    uint nightId;
 };
 
 
@@ -114,13 +136,65 @@ private:
 
 
 
+/*
+ * TrackletTreeNodeRef wraps a pointer to a TrackletTreeNode so that it
+ * offers the same calls as FlatTrackletTree::NodeRef.  The linking code
+ * below is written against that interface, with the node type as a
+ * template parameter, so it can run on either kind of tree (see
+ * linkTrackletsConfig::useFlatTrackletTrees).
+ */
+class TrackletTreeNodeRef {
+public:
+    TrackletTreeNodeRef() { node = NULL; }
+    TrackletTreeNodeRef(TrackletTreeNode * n) { node = n; }
+
+    bool isLeaf() const { return node->isLeaf(); }
+    bool hasLeftChild() const { return node->hasLeftChild(); }
+    bool hasRightChild() const { return node->hasRightChild(); }
+    TrackletTreeNodeRef getLeftChild() const {
+        return TrackletTreeNodeRef(node->getLeftChild());
+    }
+    TrackletTreeNodeRef getRightChild() const {
+        return TrackletTreeNodeRef(node->getRightChild());
+    }
+
+    double getLBound(uint axis) const { 
+        return node->getLBounds()->at(axis); 
+    }
+    double getUBound(uint axis) const { 
+        return node->getUBounds()->at(axis); 
+    }
+
+    unsigned int getNumTracklets() const { return node->getNumTracklets(); }
+    // leaves only: the ID of the k-th tracklet in this node.
+    unsigned int getTrackletId(uint k) const {
+        return node->getMyData()->at(k).getValue();
+    }
+
+    unsigned int getId() const { return node->getId(); }
+    unsigned int getNumVisits() const { return node->getNumVisits(); }
+    void addVisit() const { node->addVisit(); }
+
+private:
+    TrackletTreeNode * node;
+};
+
+
+
+
+
+
+
+
+
+template <class NodeRef>
 class TreeNodeAndTime {
 public:
-    TreeNodeAndTime(TrackletTreeNode * tree, ImageTime i) {
+    TreeNodeAndTime(NodeRef tree, ImageTime i) {
         myTree = tree;
         myTime = i;
     }
-    TrackletTreeNode * myTree;
+    NodeRef myTree;
     ImageTime myTime;
 
 };
@@ -134,6 +208,102 @@ public:
 
 
 
+/*
+ * the compatibility cache remembers, for a pair of tree nodes, the
+ * range of accelerations the pair allows (see AccWindow in
+ * supportCompatibility.h).  That range depends only on the two nodes,
+ * so as the endpoint recursion descends and keeps testing the same
+ * support nodes against the same endpoint nodes, we can look it up
+ * rather than redo the math.  A node is named by the ID of its image
+ * and its own ID within that image's tree.
+ */
+class NodePairKey {
+public:
+    NodePairKey(uint newImageA, uint newNodeA, uint newImageB, uint newNodeB) {
+        imageA = newImageA; nodeA = newNodeA;
+        imageB = newImageB; nodeB = newNodeB;
+    }
+    bool operator==(const NodePairKey &other) const {
+        return (nodeA == other.nodeA) && (nodeB == other.nodeB) &&
+            (imageA == other.imageA) && (imageB == other.imageB);
+    }
+    uint imageA, nodeA, imageB, nodeB;
+};
+
+
+
+class NodePairKeyHash {
+public:
+    size_t operator()(const NodePairKey &k) const {
+        unsigned long long h = ((unsigned long long) k.imageA << 32) | k.nodeA;
+        h ^= (((unsigned long long) k.imageB << 32) | k.nodeB) 
+            * 0x9e3779b97f4a7c15ULL;
+        // final mix (from MurmurHash3's fmix64)
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return (size_t) h;
+    }
+};
+
+
+
+typedef LRUCache<NodePairKey, AccWindow, NodePairKeyHash> CompatibilityCache;
+
+
+
+template <class NodeRef>
+NodePairKey makeNodePairKey(const TreeNodeAndTime<NodeRef> &A,
+                            const TreeNodeAndTime<NodeRef> &B)
+{
+    return NodePairKey(A.myTime.getImageId(), A.myTree.getId(),
+                       B.myTime.getImageId(), B.myTree.getId());
+}
+
+
+
+template <class NodeRef>
+void getNodeBounds(const TreeNodeAndTime<NodeRef> &node, 
+                   double lBounds[4], double uBounds[4])
+{
+    for (uint axis = 0; axis < 4; axis++) {
+        lBounds[axis] = node.myTree.getLBound(axis);
+        uBounds[axis] = node.myTree.getUBound(axis);
+    }
+}
+
+
+
+/*
+ * the acceleration window allowed by node A and the later node B;
+ * from cache if it's there, else computed (and added to cache).  cache
+ * may be NULL.
+ */
+template <class NodeRef>
+AccWindow getPairAccWindow(const TreeNodeAndTime<NodeRef> &A,
+                           const TreeNodeAndTime<NodeRef> &B,
+                           CompatibilityCache * cache)
+{
+    AccWindow w;
+    if ((cache != NULL) && cache->find(makeNodePairKey(A, B), w)) {
+        return w;
+    }
+    double aL[4], aU[4], bL[4], bU[4];
+    getNodeBounds(A, aL, aU);
+    getNodeBounds(B, bL, bU);
+    w = pairAccWindow(aL, aU, bL, bU, 
+                      B.myTime.getMJD() - A.myTime.getMJD());
+    if (cache != NULL) {
+        cache->insert(makeNodePairKey(A, B), w);
+    }
+    return w;
+}
+
+
+
+
+
+
 /* *****************************************************
 * These functions are for debugging/ diagnostics only.  
 ********************************************************/
@@ -154,34 +324,32 @@ std::set<uint> setUnion(const std::set<uint> &s1,
 }
 
 
-std::set<uint> allDetsInTreeNode(TrackletTreeNode &t,
+template <class NodeRef>
+std::set<uint> allDetsInTreeNode(const NodeRef &t,
                                  const std::vector<MopsDetection>&allDets,
-                                 const std::vector<Tracklet>&allTracklets) 
+                                 const TrackletStore &allTracklets) 
 {
     std::set<uint> toRet;
-    std::vector<PointAndValue<uint> >::const_iterator tIter;
 
     if(! t.isLeaf() ) {
         if (t.hasLeftChild()) {
-            std::set<uint> childDets = allDetsInTreeNode(*t.getLeftChild(), allDets, allTracklets);
+            std::set<uint> childDets = allDetsInTreeNode(t.getLeftChild(), allDets, allTracklets);
             toRet = setUnion(toRet, childDets);
         }
         if (t.hasRightChild()) {
-            std::set<uint> childDets = allDetsInTreeNode(*t.getRightChild(), allDets, allTracklets);
+            std::set<uint> childDets = allDetsInTreeNode(t.getRightChild(), allDets, allTracklets);
             toRet = setUnion(toRet, childDets);
         }
     }
     else 
     {
-        // t.getMyData() holds points and values. the "value" part is
-        // index into allTracklets.
-        for (tIter = t.getMyData()->begin();
-             tIter != t.getMyData()->end();
-             tIter++) {
+        // getTrackletId gives indices into allTracklets.
+        for (uint i = 0; i < t.getNumTracklets(); i++) {
             
-            std::set<uint>::const_iterator detIter;
-            for (detIter = allTracklets.at(tIter->getValue()).indices.begin();
-                 detIter != allTracklets.at(tIter->getValue()).indices.end();
+            uint trackletId = t.getTrackletId(i);
+            const uint *detIter;
+            for (detIter = allTracklets.indicesBegin(trackletId);
+                 detIter != allTracklets.indicesEnd(trackletId);
                  detIter++) {
                 
                 toRet.insert(allDets.at(*detIter).getID());
@@ -216,15 +384,16 @@ void printSet(const std::set<uint> s, std::string delimiter)
 
 
 
-void debugPrint(const TreeNodeAndTime &firstEndpoint, 
-                const TreeNodeAndTime &secondEndpoint, 
-                std::vector<TreeNodeAndTime> &supportNodes, 
+template <class NodeRef>
+void debugPrint(const TreeNodeAndTime<NodeRef> &firstEndpoint, 
+                const TreeNodeAndTime<NodeRef> &secondEndpoint, 
+                std::vector<TreeNodeAndTime<NodeRef> > &supportNodes, 
                 const std::vector<MopsDetection> &allDetections,
-                const std::vector<Tracklet> &allTracklets) 
+                const TrackletStore &allTracklets) 
 {
-    std::set<uint> leftEndpointDetIds = allDetsInTreeNode(*(firstEndpoint.myTree), 
+    std::set<uint> leftEndpointDetIds = allDetsInTreeNode(firstEndpoint.myTree, 
                                                           allDetections, allTracklets);
-    std::set<uint> rightEndpointDetIds = allDetsInTreeNode(*(secondEndpoint.myTree),
+    std::set<uint> rightEndpointDetIds = allDetsInTreeNode(secondEndpoint.myTree,
                                                            allDetections, allTracklets);
 
     std::cout << "in doLinkingRecurse,       first endpoint contains     " ;
@@ -236,7 +405,7 @@ void debugPrint(const TreeNodeAndTime &firstEndpoint,
 
     for(uint i = 0; i < supportNodes.size(); i++) {
         std::cout << " support node " << i << " contains                      ";
-        std::set <uint> supDetIds = allDetsInTreeNode(*(supportNodes.at(i).myTree), 
+        std::set <uint> supDetIds = allDetsInTreeNode(supportNodes.at(i).myTree, 
                                                       allDetections, allTracklets);
         printSet(supDetIds, " ");
         std::cout << '\n';
@@ -266,16 +435,17 @@ void debugPrint(const TreeNodeAndTime &firstEndpoint,
 
 
 
-void showNumVisits(TrackletTreeNode *tree, uint &totalNodes, uint &totalVisits) 
+template <class NodeRef>
+void showNumVisits(const NodeRef &tree, uint &totalNodes, uint &totalVisits) 
 {
     totalNodes++;
-    totalVisits += tree->getNumVisits();
-    std::cout << "Node " << tree->getId() << " had " << tree->getNumVisits() << " visits.\n";
-    if (tree->hasLeftChild()) {
-        showNumVisits(tree->getLeftChild(), totalNodes, totalVisits);
+    totalVisits += tree.getNumVisits();
+    std::cout << "Node " << tree.getId() << " had " << tree.getNumVisits() << " visits.\n";
+    if (tree.hasLeftChild()) {
+        showNumVisits(tree.getLeftChild(), totalNodes, totalVisits);
     }
-    if (tree->hasRightChild()) {
-        showNumVisits(tree->getRightChild(), totalNodes, totalVisits);
+    if (tree.hasRightChild()) {
+        showNumVisits(tree.getRightChild(), totalNodes, totalVisits);
     }
 }
 
@@ -304,18 +474,19 @@ void showNumVisits(TrackletTreeNode *tree, uint &totalNodes, uint &totalVisits)
 
 
 /* the final parameter is modified; it will hold Detections associated
-   with the tracklet t. */
+   with tracklet i of allTracklets. */
 
 void getAllDetectionsForTracklet(
     const std::vector<MopsDetection> & allDetections,
-    const Tracklet &t,
+    const TrackletStore &allTracklets,
+    uint i,
     std::vector<MopsDetection> &detectionsForTracklet) 
 {
     detectionsForTracklet.clear();
-    std::set<uint>::const_iterator trackletIndexIter;
+    const uint *trackletIndexIter;
 
-    for (trackletIndexIter = t.indices.begin();
-         trackletIndexIter != t.indices.end();
+    for (trackletIndexIter = allTracklets.indicesBegin(i);
+         trackletIndexIter != allTracklets.indicesEnd(i);
          trackletIndexIter++) {
         detectionsForTracklet.push_back(allDetections.at(
                                             *trackletIndexIter));
@@ -378,34 +549,40 @@ void recenterDetections(std::vector<MopsDetection> &allDetections,
 
 
 
+/*
+ * set the parameters of every tracklet (from firstTracklet on): RA,
+ * Dec and their rates of change at the time of its first detection,
+ * and the time between its first and last detections.
+ */
 void setTrackletVelocities(
     const std::vector<MopsDetection> &allDetections,
-    std::vector<Tracklet> &queryTracklets)
+    TrackletStore &queryTracklets,
+    uint firstTracklet=0)
     
 {
-    for (uint i = 0; i < queryTracklets.size(); i++) {
-        Tracklet *curTracklet = &queryTracklets.at(i);
-        std::vector <MopsDetection> trackletDets;
+    std::vector <MopsDetection> trackletDets;
+    for (uint i = firstTracklet; i < queryTracklets.size(); i++) {
         getAllDetectionsForTracklet(allDetections, 
-                                    *curTracklet, 
+                                    queryTracklets, i,
                                     trackletDets);
+        double firstTime = trackletDets.at(0).getEpochMJD();
+        double lastTime = firstTime;
+        for (uint j = 1; j < trackletDets.size(); j++) {
+            firstTime = std::min(firstTime, trackletDets[j].getEpochMJD());
+            lastTime = std::max(lastTime, trackletDets[j].getEpochMJD());
+        }
 
         std::vector<double> RASlopeAndOffset;
         std::vector<double> DecSlopeAndOffset;
         leastSquaresSolveForRADecLinear(&trackletDets,
                                         RASlopeAndOffset,
                                         DecSlopeAndOffset,
-                                        curTracklet->getStartTime(allDetections));
+                                        firstTime);
         // slope and offset is reverse of p0, vel form...
-        std::vector<double> raP0Vel(2);
-        raP0Vel[0] = RASlopeAndOffset[1];
-        raP0Vel[1] = RASlopeAndOffset[0];
-        std::vector<double> decP0Vel(2);
-        decP0Vel[0] = DecSlopeAndOffset[1];
-        decP0Vel[1] = DecSlopeAndOffset[0];
-        
-        curTracklet->setBestFitFunctionRa(raP0Vel);
-        curTracklet->setBestFitFunctionDec(decP0Vel);
+        queryTracklets.setParameters(i, 
+                                     RASlopeAndOffset[1], DecSlopeAndOffset[1],
+                                     RASlopeAndOffset[0], DecSlopeAndOffset[0],
+                                     lastTime - firstTime);
     }
 
 }
@@ -426,9 +603,14 @@ void modifyWithAcceleration(double &position, double &velocity,
     // modifyWithAccelerationTime += timeSince(start);
 }
 
+/*
+ * allDetections must already be labelled with their image and night
+ * indices by imageIndex (see ImageIndex::labelDetections).
+ */
 void makeTrackletTimeToTreeMap(
     const std::vector<MopsDetection> &allDetections,
-    std::vector<Tracklet> &queryTracklets,
+    const ImageIndex &imageIndex,
+    TrackletStore &queryTracklets,
     std::map<ImageTime, TrackletTree > &newMap,
     const linkTrackletsConfig &myConf)
 {
@@ -443,68 +625,58 @@ void makeTrackletTimeToTreeMap(
 
     newMap.clear();
 
-    //sort all tracklets by their first image time and assign them IDs.
-    // IDs are their indices into the queryTracklets[] vector.
-    
-    // we use a std::vector of tracklets rather than trackletvector
-    // because TrackletVectors are for large output sets, not for
-    // small dynamic stuff like this. Also they have no copy
-    // contructor, which is needed for map, because C++ STL doesn't
-    // let you copy streams.
-    std::map<double, std::vector<Tracklet> > allTrackletsByTime;
-
-    allTrackletsByTime.clear();
+    //group all tracklets by their first image and assign them IDs.
+    // IDs are their indices into queryTracklets.  The trees are
+    // built straight from the store, so all we need per image is
+    // the range of its tracklets.
+    std::vector<uint> trackletFirstImages(queryTracklets.size());
 
     for (uint i = 0; i < queryTracklets.size(); i++) {
 
-        double firstDetectionTime = 
-            queryTracklets.at(i).getStartTime(allDetections);
+        // images are numbered in order of time, so the first image
+        // of the tracklet is the one with the lowest number.
+        const uint *detIter = queryTracklets.indicesBegin(i);
+        long int firstImage = allDetections.at(*detIter).getImageIndex();
+        for (; detIter != queryTracklets.indicesEnd(i); detIter++) {
+            firstImage = std::min(firstImage, 
+                                  allDetections.at(*detIter).getImageIndex());
+        }
 
-        queryTracklets.at(i).setId(i);
-        allTrackletsByTime[firstDetectionTime].push_back(
-            queryTracklets.at(i));
+        queryTracklets.setId(i, i);
+        trackletFirstImages[i] = firstImage;
     }
+    ImageGrouping trackletsByImage(trackletFirstImages, 
+                                   imageIndex.getNumImages());
 
-    if (printDebug) 
-        std::cout << " got" << allTrackletsByTime.size()
-                  << " image times.\n";
-    
-    // iterate over each time/trackletVec pair and build a
-    // corresponding time/KDTree pair.  note that we iterate over a
-    // Map which uses MJD as key; Maps sort their data by their key,
-    // so we are iterating over all image times in order.
-    uint curImageId = 0;
-
-    std::map<double, std::vector<Tracklet> >::const_iterator 
-        timesIter;
-    
-    for (timesIter = allTrackletsByTime.begin(); 
-         timesIter != allTrackletsByTime.end(); 
-         timesIter++) {
-
+    // build a KDTree for every image which starts any tracklets.  We
+    // iterate over the images in order of time.
+    for (uint image = 0; image < trackletsByImage.getNumImages(); image++) {
+        if (trackletsByImage.getNumItems(image) == 0) {
+            continue;
+        }
 
-        TrackletTree curTree(allDetections, 
-                             timesIter->second,
+        TrackletTree curTree(queryTracklets, 
+                             trackletsByImage.itemsBegin(image),
+                             trackletsByImage.itemsEnd(image),
                              myConf.detectionLocationErrorThresh,
                              myConf.detectionLocationErrorThresh,
                              myConf.leafSize);
 
-        newMap[ImageTime(timesIter->first, curImageId)] = curTree;
+        newMap[ImageTime(imageIndex.getImageMJD(image), image, 
+                         imageIndex.getNightOfImage(image))] = curTree;
 
         if (printDebug) {
-            std::cout << " image time " << timesIter->first 
-                      << " (with Id = " << curImageId << ") had " 
-                      << timesIter->second.size() 
+            std::cout << " image time " << imageIndex.getImageMJD(image) 
+                      << " (with Id = " << image << ") had " 
+                      << trackletsByImage.getNumItems(image) 
                       << " tracklets, generating a tree of size " 
                       << curTree.size() << std::endl;
             std::cout << "    with leaf node size = " 
                       << myConf.leafSize 
                       << ", and an average leaf size of about " 
-                      << timesIter->second.size() * 2. / curTree.size() 
+                      << trackletsByImage.getNumItems(image) * 2. / curTree.size() 
                       << std::endl;
         }
-
-        curImageId++;
     }
 
 }
@@ -579,8 +751,8 @@ bool endpointTrackletsAreCompatible(
     if (allOK == true) {
         //check that time separation is good
         double minMJD, maxMJD;
-        std::set<uint> trackDets = newTrack.getComponentDetectionIndices();
-        std::set<uint>::const_iterator detIter;
+        const Track::IndexSet &trackDets = newTrack.getComponentDetectionIndices();
+        Track::IndexSet::const_iterator detIter;
         detIter = trackDets.begin();
 
         minMJD = allDetections.at(*detIter).getEpochMJD();
@@ -634,107 +806,217 @@ public:
     unsigned int parentTrackletId;
 };
 
+/*
+ * the detections of the support tracklets for one pair of endpoint
+ * leaves.  Every pair of endpoint tracklets from those leaves is
+ * checked against the same detections, so we gather them up once, into
+ * flat arrays, along with the distinct images they come from.  Kept
+ * per thread and reused; see addDetectionsCloseToPredictedPositions.
+ */
+class SupportDetections {
+public:
+    SupportDetections() {
+        generation = 0;
+        detections = NULL;
+    }
+
+    /* allDetections must be labelled with their image indices (see
+     * ImageIndex); there are nImages images in all. */
+    void fill(const std::vector<MopsDetection> &allDetections,
+              const TrackletStore &allTracklets,
+              const std::vector<uint> &candidateTrackletIds,
+              uint nImages) {
+        generation++;
+        detections = &allDetections;
+        if (slotStamps.size() < nImages) {
+            slotOfImage.resize(nImages);
+            slotStamps.resize(nImages, 0);
+        }
+        detIds.clear();
+        parentTrackletIds.clear();
+        imageSlots.clear();
+        ras.clear();
+        decs.clear();
+        imageMjds.clear();
+
+        // same order as we used to visit them, so ties between
+        // equally good candidates still go to the first one seen.
+        for (uint i = 0; i < candidateTrackletIds.size(); i++) {
+            uint trackletId = candidateTrackletIds[i];
+            const uint *detIter;
+            for (detIter = allTracklets.indicesBegin(trackletId);
+                 detIter != allTracklets.indicesEnd(trackletId);
+                 detIter++) {
+                const MopsDetection &curDet = allDetections.at(*detIter);
+                uint image = curDet.getImageIndex();
+                if (slotStamps[image] != generation) {
+                    slotStamps[image] = generation;
+                    slotOfImage[image] = imageMjds.size();
+                    imageMjds.push_back(curDet.getEpochMJD());
+                }
+                detIds.push_back(*detIter);
+                parentTrackletIds.push_back(candidateTrackletIds[i]);
+                imageSlots.push_back(slotOfImage[image]);
+                ras.push_back(curDet.getRA());
+                decs.push_back(curDet.getDec());
+            }
+        }
+
+        uint nSlots = imageMjds.size();
+        predRas.resize(nSlots);
+        predDecs.resize(nSlots);
+        cosPredDecs.resize(nSlots);
+        bestCandidates.resize(nSlots);
+        haveCandidate.resize(nSlots);
+        imageInTrack.resize(nSlots);
+    }
+
+    /* the slot of detection detId's image, or -1 if no support
+     * detection is from that image. */
+    int findImageSlot(uint detId) const {
+        uint image = detections->at(detId).getImageIndex();
+        if ((image < slotStamps.size()) && (slotStamps[image] == generation)) {
+            return slotOfImage[image];
+        }
+        return -1;
+    }
+
+    // one entry per support detection
+    std::vector<uint> detIds;
+    std::vector<uint> parentTrackletIds;
+    std::vector<uint> imageSlots;
+    std::vector<double> ras;
+    std::vector<double> decs;
+
+    // one entry ("slot") per distinct image among them
+    std::vector<double> imageMjds;
+    std::vector<double> predRas;
+    std::vector<double> predDecs;
+    std::vector<double> cosPredDecs;
+    std::vector<CandidateDetection> bestCandidates;
+    std::vector<unsigned char> haveCandidate;
+    std::vector<unsigned char> imageInTrack;
+
+private:
+    const std::vector<MopsDetection> * detections;
+    // slotOfImage[i] is only meaningful if slotStamps[i] == generation.
+    std::vector<uint> slotOfImage;
+    std::vector<unsigned long> slotStamps;
+    unsigned long generation;
+};
+
+
+
 /*
  * ASSUMES newTrack is prepared to call getBestFitQuadratic- this means
  * calculateBestFitQuadratic MUST have been called already.
  *
  * uses Track::predictLocationAtTime to find things within
- * searchConfig.trackAdditionThreshold of the predicted location.
+ * searchConfig.trackAdditionThreshold of the predicted location, and
+ * adds the closest such detection from each image which isn't already
+ * in the track.
+ *
+ * All the detections of an image share its MJD, so we predict once per
+ * image rather than once per detection.  Detections are first gated on
+ * Dec distance and then on a cheap lower bound of the angular distance
+ * (angularDistanceCertainlyAbove), so the exact great-circle distance
+ * is only worked out for detections which are nearly close enough.
  */
 void addDetectionsCloseToPredictedPositions(
     const std::vector<MopsDetection> &allDetections, 
-    const std::vector<Tracklet> &allTracklets, 
-    const std::vector<uint> &candidateTrackletIds,
+    SupportDetections &support,
     Track &newTrack, 
     const linkTrackletsConfig &searchConfig)
 {
-    /* the scoreToIDsMap will hold detection MJDs as the key, map from
-     * detection time to best-fitting candidate detection at that time
-     */
-    std::map<double, CandidateDetection > timeToCandidateMap;
-    
+    Constants c;
+    double threshold = searchConfig.trackAdditionThreshold;
+    double sinHalfThreshold = sin(c.deg_to_rad() * threshold / 2.);
+    double sinSqHalfThreshold = sinHalfThreshold * sinHalfThreshold;
+
+    uint nSlots = support.imageMjds.size();
+    for (uint slot = 0; slot < nSlots; slot++) {
+        support.haveCandidate[slot] = 0;
+        support.imageInTrack[slot] = 0;
+    }
+
+    /* don't add detections from image times already in the track, so
+     * don't bother looking at those images at all. */
+    const Track::IndexSet &trackDetIndicesSet = newTrack.getComponentDetectionIndices();
+    Track::IndexSet::const_iterator trackDetectionIndices;
+    for (trackDetectionIndices =  trackDetIndicesSet.begin();
+         trackDetectionIndices != trackDetIndicesSet.end();
+         trackDetectionIndices++) {
+        int slot = support.findImageSlot(*trackDetectionIndices);
+        if (slot >= 0) {
+            support.imageInTrack[slot] = 1;
+        }
+    }
+
+    for (uint slot = 0; slot < nSlots; slot++) {
+        if (!support.imageInTrack[slot]) {
+            newTrack.predictLocationAtTime(support.imageMjds[slot], 
+                                           support.predRas[slot], 
+                                           support.predDecs[slot]);
+            // filled in on first use; most images never need it.
+            support.cosPredDecs[slot] = 2.;
+        }
+    }
+
+    // find the best compatible detection at each image
+    uint nDets = support.detIds.size();
+    for (uint i = 0; i < nDets; i++) {
+        uint slot = support.imageSlots[i];
+        if (support.imageInTrack[slot]) {
+            continue;
+        }
+        double predRa = support.predRas[slot];
+        double predDec = support.predDecs[slot];
+        double detRa = support.ras[i];
+        double detDec = support.decs[i];
 
-    // find the best compatible detection at each unique image time
-    std::vector<unsigned int>::const_iterator trackletIDIter;
-    std::set<unsigned int>::const_iterator detectionIDIter;
-    for (trackletIDIter = candidateTrackletIds.begin();
-         trackletIDIter != candidateTrackletIds.end();
-         trackletIDIter++) {
-        const Tracklet * curTracklet = &allTracklets.at(*trackletIDIter);
-        for (detectionIDIter =  curTracklet->indices.begin();
-             detectionIDIter != curTracklet->indices.end();
-             detectionIDIter++) {
-            double detMjd = allDetections.at(*detectionIDIter).getEpochMJD();
-            double detRa  = allDetections.at(*detectionIDIter).getRA();
-            double detDec = allDetections.at(*detectionIDIter).getDec();
-
-            double predRa, predDec;
-            newTrack.predictLocationAtTime(detMjd, predRa, predDec);
-
-            double decDistance = fabs(detDec - predDec);
+        double decDistance = fabs(detDec - predDec);
 #ifdef DEBUG
-            std::cout << "dec dist:" << decDistance << " thresh: " << searchConfig.trackAdditionThreshold << '\n';
+        std::cout << "dec dist:" << decDistance << " thresh: " << threshold << '\n';
 #endif
-            if (decDistance < searchConfig.trackAdditionThreshold) {
+        if (decDistance >= threshold) {
+            continue;
+        }
+        if (support.cosPredDecs[slot] > 1.) {
+            support.cosPredDecs[slot] = cos(c.deg_to_rad() * predDec);
+        }
+        if (!angularDistanceCertainlyAbove(detRa, detDec, predRa, predDec,
+                                           support.cosPredDecs[slot],
+                                           sinSqHalfThreshold)) {
 
-                double distance = angularDistanceRADec_deg(detRa, detDec, predRa, predDec);
+            double distance = angularDistanceRADec_deg(detRa, detDec, predRa, predDec);
 #ifdef DEBUG
-                std::cout << "ang dist:" << distance << " thresh: " << searchConfig.trackAdditionThreshold << '\n';
+            std::cout << "ang dist:" << distance << " thresh: " << threshold << '\n';
 #endif
-                
-                // if the detection is compatible, consider whether
-                // it's the best at the image time
-                if (distance < searchConfig.trackAdditionThreshold) {
-                    std::map<double, CandidateDetection>::iterator candidateAtTime;
-                    candidateAtTime = timeToCandidateMap.find(detMjd);
-                    
-                    // more crazy C++-talk for "if we have no
-                    // candidate, or if this is a better candidate
-                    // than the one we have, then add this as the new
-                    // candidate at that time"
-                    if ((candidateAtTime == timeToCandidateMap.end()) 
-                        || (candidateAtTime->second.distance > distance)) {
-                        CandidateDetection newCandidate(distance, 
-                                                        *detectionIDIter, 
-                                                        *trackletIDIter);
-                        timeToCandidateMap[detMjd] = newCandidate;
-                    }
-                }
+            // if the detection is compatible, consider whether
+            // it's the best at the image time
+            if ((distance < threshold) &&
+                ((!support.haveCandidate[slot]) ||
+                 (support.bestCandidates[slot].distance > distance))) {
+                support.haveCandidate[slot] = 1;
+                support.bestCandidates[slot] = 
+                    CandidateDetection(distance, 
+                                       support.detIds[i],
+                                       support.parentTrackletIds[i]);
             }
         }
     }
-
-    /* initialize a list of image times present in the track already. */
-    std::set<double> trackMJDs;
-    std::set<uint> trackDetIndicesSet = newTrack.getComponentDetectionIndices();
-    std::set<unsigned int>::const_iterator trackDetectionIndices;
-    for (trackDetectionIndices =  trackDetIndicesSet.begin();
-         trackDetectionIndices != trackDetIndicesSet.end();
-         trackDetectionIndices++) {
-        trackMJDs.insert(allDetections.at(*trackDetectionIndices).getEpochMJD());        
-    }
     
-    /* add detections (and their parent tracklets) in order of 'score'
-     * (distance from best-fit line) without adding any detections
-     * from already-represented image times
-     */
-    std::map<double, CandidateDetection>::iterator candidatesIter;
-
-    for (candidatesIter = timeToCandidateMap.begin(); 
-         candidatesIter != timeToCandidateMap.end(); 
-         candidatesIter++) {
-
-        if (trackMJDs.find(candidatesIter->first) == trackMJDs.end()) {
-            /* add this detection and tracklet */
-            
-            trackMJDs.insert(candidatesIter->first);
-            newTrack.addDetection(candidatesIter->second.detId, 
+    /* add the best detection (and its parent tracklet) from each
+     * remaining image */
+    for (uint slot = 0; slot < nSlots; slot++) {
+        if (support.haveCandidate[slot]) {
+            newTrack.addDetection(support.bestCandidates[slot].detId, 
                                   allDetections);
 #ifdef DEBUG
-            std::cout << "inserted detection: " << candidatesIter->second.detId << '\n';
+            std::cout << "inserted detection: " << support.bestCandidates[slot].detId << '\n';
 #endif
             newTrack.componentTrackletIndices.insert(
-                candidatesIter->second.parentTrackletId);
+                support.bestCandidates[slot].parentTrackletId);
         }
     }
 }
@@ -746,7 +1028,8 @@ void addDetectionsCloseToPredictedPositions(
  * Return true iff the track has enough support points, and they fall
  * on enough unique nights.
  *
- * WARNING HACKISHNESS IN ACTION: see comments on how we count unique nights.
+ * allDetections must be labelled with their night indices (see
+ * ImageIndex).
  */ 
 bool trackHasSufficientSupport(const std::vector<MopsDetection> &allDetections,
                                const Track &newTrack, const linkTrackletsConfig &searchConfig)
@@ -755,36 +1038,15 @@ bool trackHasSufficientSupport(const std::vector<MopsDetection> &allDetections,
         searchConfig.minDetectionsPerTrack) {
         return false;
     }
-    /* count the number of NIGHTS of support.  Do this in a slightly
-     * hackish way: if two successive detections are > .5 days apart
-     * in time, then they must be from different nights.  So just
-     * order all the detection MJDs and then walk across them looking
-     * for unique nights.
-     */
-    const std::set<uint> trackDets = newTrack.getComponentDetectionIndices();
-    std::set<double> allMjds;
-    for (std::set<uint>::const_iterator detIter = trackDets.begin();
+    static thread_local DistinctIndexCounter nightsSeen;
+    nightsSeen.clear();
+    const Track::IndexSet &trackDets = newTrack.getComponentDetectionIndices();
+    for (Track::IndexSet::const_iterator detIter = trackDets.begin();
          detIter != trackDets.end(); detIter++) {
-        allMjds.insert(allDetections.at(*detIter).getEpochMJD());
-    }
-
-    uint uniqueNightsSeen = 1;
-    // this line could cause an exception if the program is run with
-    // minDetectionsPerTrack <= 0 but that'd be totally insane.
-    double lastDetTime = *(allMjds.begin());
-
-    // note: we start at the second item, because we already looked at
-    // the first. Ugly C++ syntax.
-    std::set<double>::const_iterator mjdIter = allMjds.begin();
-    for (++mjdIter; mjdIter != allMjds.end();  mjdIter++) {
-        
-        if (*mjdIter - lastDetTime > .5) {
-            uniqueNightsSeen++;
-        }
-        lastDetTime = *mjdIter;            
+        nightsSeen.add(allDetections.at(*detIter).getNightIndex());
     }
     
-    if (uniqueNightsSeen < searchConfig.minUniqueNights) {
+    if (nightsSeen.count() < searchConfig.minUniqueNights) {
         return false;
     }
     return true;
@@ -801,17 +1063,30 @@ bool trackHasSufficientSupport(const std::vector<MopsDetection> &allDetections,
  * and the requirement of a physical range fit from the topocentric corrections.
  * Due to the definition of the fit function, a physical range value here is
  * NEGATIVE.  If a range was not fit, it will be zero.
+ *
+ * if thresholds is non-NULL, the prob(chisq) cut is made using its
+ * precomputed chisq limits rather than by calculating prob(chisq).
  */
  
 bool trackRmsIsSufficientlyLow(
     const std::vector<MopsDetection> &allDetections,
     const Track &newTrack, 
-    const linkTrackletsConfig &searchConfig)
+    const linkTrackletsConfig &searchConfig,
+    const ChisqThresholds * thresholds)
 {
-
-    bool ok = newTrack.getProbChisqRa() > searchConfig.trackMinProbChisq &&
-        newTrack.getProbChisqDec() > searchConfig.trackMinProbChisq &&
-        newTrack.getFitRange() <= 0.0;
+    bool ok;
+    if (thresholds != NULL) {
+        ok = thresholds->accepts(newTrack.getChisqRa(), 
+                                 newTrack.getChisqDof()) &&
+            thresholds->accepts(newTrack.getChisqDec(), 
+                                newTrack.getChisqDof()) &&
+            newTrack.getFitRange() <= 0.0;
+    }
+    else {
+        ok = newTrack.getProbChisqRa() > searchConfig.trackMinProbChisq &&
+            newTrack.getProbChisqDec() > searchConfig.trackMinProbChisq &&
+            newTrack.getFitRange() <= 0.0;
+    }
 
     return ok;
 }
@@ -822,44 +1097,200 @@ bool trackRmsIsSufficientlyLow(
 
 
 
+/*
+ * state shared by all the image pairs searched in one call to
+ * doLinking.  pool is NULL when we are running serially.
+ */
+class LinkingTasks {
+public:
+    LinkingTasks(WorkStealingPool * newPool, 
+                 const linkTrackletsConfig &searchConfig,
+                 const ImageIndex &imageIndex,
+                 const std::vector<MopsDetection> &allDetections,
+                 const TrackletStore &allTracklets) {
+        pool = newPool;
+        nImages = imageIndex.getNumImages();
+        nNights = imageIndex.getNumNights();
+        taskSplitThreshold = searchConfig.taskSplitThreshold;
+        compatibilityCacheSize = searchConfig.compatibilityCacheSize;
+        // one per pool thread, plus one for any other thread.
+        compatibilityCaches.resize(std::max(searchConfig.nThreads, 1u) + 1);
+        if (searchConfig.useFastTrackFit) {
+            chisqThresholds.reset(
+                new ChisqThresholds(searchConfig.trackMinProbChisq));
+        }
+        if (searchConfig.useEndpointPrecheck) {
+            calculateTrackletMoments(allDetections, allTracklets, 
+                                     trackletMoments);
+        }
+        endpointPairsTried = 0;
+        endpointPairsPrechecked = 0;
+    }
+
+    /* the moments of every tracklet, for the endpoint pre-check, or
+     * NULL if useEndpointPrecheck is off. */
+    const std::vector<TrackletMoments> * getTrackletMoments() const {
+        return trackletMoments.empty() ? NULL : &trackletMoments;
+    }
+
+    /* precomputed limits for the trackMinProbChisq cut, or NULL if
+     * useFastTrackFit is off.  Read-only, so shared by all threads. */
+    const ChisqThresholds * getChisqThresholds() const {
+        return chisqThresholds.get();
+    }
+
+    /* the calling thread's compatibility cache, or NULL if caching is
+     * turned off.  Each cache is only ever touched by one thread. */
+    CompatibilityCache * getCompatibilityCache() {
+        if (compatibilityCacheSize == 0) {
+            return NULL;
+        }
+        uint i = (pool == NULL) ? 0 : pool->getThreadIndex();
+        if (!compatibilityCaches.at(i)) {
+            compatibilityCaches.at(i).reset(
+                new CompatibilityCache(compatibilityCacheSize));
+        }
+        return compatibilityCaches.at(i).get();
+    }
+
+    /* only call once no linking is going on. */
+    void getCacheStats(unsigned long &hits, unsigned long &misses) const {
+        hits = 0;
+        misses = 0;
+        for (uint i = 0; i < compatibilityCaches.size(); i++) {
+            if (compatibilityCaches[i]) {
+                hits += compatibilityCaches[i]->hits();
+                misses += compatibilityCaches[i]->misses();
+            }
+        }
+    }
+
+    WorkStealingPool * pool;
+    double taskSplitThreshold;
+    uint compatibilityCacheSize;
+    std::vector<std::unique_ptr<CompatibilityCache> > compatibilityCaches;
+    std::unique_ptr<ChisqThresholds> chisqThresholds;
+    std::vector<TrackletMoments> trackletMoments;
+    // pairs of endpoint tracklets looked at, and those thrown out by
+    // the pre-check.  Updated once per call to buildTracksAddToResults,
+    // and only if myVerbosity.printVisitCounts is set.
+    std::atomic<unsigned long> endpointPairsTried;
+    std::atomic<unsigned long> endpointPairsPrechecked;
+    // the number of distinct images and nights among the detections
+    // (see ImageIndex).
+    uint nImages;
+    uint nNights;
+    // guards outstandingTasks, finished and error of every ImagePairJob
+    std::mutex lock;
+    std::condition_variable jobFinished;
+};
+
+
+
+/*
+ * everything needed to search a single (first endpoint image, second
+ * endpoint image) pair, plus a private list of whatever that search
+ * finds.  Giving each pair its own results is what lets us search
+ * pairs in parallel without sharing a TrackSet between threads; see
+ * doLinking.  The list may hold duplicates; they are dropped when it
+ * is merged, on the merging thread, so the linking threads only
+ * append.
+ *
+ * a big pair may be split into several tasks (see doLinkingRecurse),
+ * so tracks must be added through addTrack, and the pair is only
+ * finished when its last task is done.
+ */
+template <class NodeRef>
+class ImagePairJob {
+public:
+    ImagePairJob(const TreeNodeAndTime<NodeRef> &first, 
+                 const TreeNodeAndTime<NodeRef> &second,
+                 LinkingTasks * newTasks) :
+        firstEndpoint(first), secondEndpoint(second) {
+        tasks = newTasks;
+        outstandingTasks = 0;
+        finished = false;
+    }
+
+    void addTrack(Track &&newTrack) {
+        std::lock_guard<std::mutex> guard(tracksLock);
+        tracks.push_back(std::move(newTrack));
+    }
+
+    void taskStarted() {
+        std::lock_guard<std::mutex> guard(tasks->lock);
+        outstandingTasks++;
+    }
+
+    void taskDone(std::exception_ptr err) {
+        std::lock_guard<std::mutex> guard(tasks->lock);
+        if (err && !error) {
+            error = err;
+        }
+        outstandingTasks--;
+        if (outstandingTasks == 0) {
+            finished = true;
+            tasks->jobFinished.notify_all();
+        }
+    }
+
+    TreeNodeAndTime<NodeRef> firstEndpoint;
+    TreeNodeAndTime<NodeRef> secondEndpoint;
+    std::vector<TreeNodeAndTime<NodeRef> > supportPoints;
+    LinkingTasks * tasks;
+    std::vector<Track> tracks;
+    std::mutex tracksLock;
+    unsigned int outstandingTasks;
+    bool finished;
+    std::exception_ptr error;
+};
+
+
+
 /*
  * this is called when all endpoint nodes (i.e. model nodes) and
  * support nodes are leaves.  model nodes and support nodes are
  * expected to be mutually compatible.
  */
+template <class NodeRef>
 void buildTracksAddToResults(
     const std::vector<MopsDetection> &allDetections,
-    const std::vector<Tracklet> &allTracklets,
+    const TrackletStore &allTracklets,
     const linkTrackletsConfig &searchConfig,
-    TreeNodeAndTime &firstEndpoint,
-    TreeNodeAndTime &secondEndpoint,
-    std::vector<TreeNodeAndTime> &supportNodes,
-    TrackSet & results)
+    TreeNodeAndTime<NodeRef> &firstEndpoint,
+    TreeNodeAndTime<NodeRef> &secondEndpoint,
+    std::vector<TreeNodeAndTime<NodeRef> > &supportNodes,
+    ImagePairJob<NodeRef> & job)
 {
 
-    if ((firstEndpoint.myTree->isLeaf() == false) ||
-        (secondEndpoint.myTree->isLeaf() == false)) {
+    if ((firstEndpoint.myTree.isLeaf() == false) ||
+        (secondEndpoint.myTree.isLeaf() == false)) {
         LSST_EXCEPT(ProgrammerErrorException, 
             "buildTracksAddToResults got non-leaf nodes, must be a bug!");
     }
     for (uint i = 0; i < supportNodes.size(); i++) {
-        if (supportNodes.at(i).myTree->isLeaf() == false) {
+        if (supportNodes.at(i).myTree.isLeaf() == false) {
             LSST_EXCEPT(ProgrammerErrorException, 
            "buildTracksAddToResults got non-leaf nodes, must be a bug!"); 
         }
     }
 
-    std::vector<PointAndValue<uint> >::const_iterator firstEndpointIter;
-    std::vector<PointAndValue<uint> >::const_iterator secondEndpointIter;
-    std::vector<TreeNodeAndTime>::const_iterator supportNodeIter;
-    std::vector<PointAndValue <uint> >::const_iterator supportPointIter;
-    for (firstEndpointIter = firstEndpoint.myTree->getMyData()->begin();
-         firstEndpointIter != firstEndpoint.myTree->getMyData()->end();
-         firstEndpointIter++) {
+    typename std::vector<TreeNodeAndTime<NodeRef> >::const_iterator supportNodeIter;
+
+    // the support detections are the same for every pair of endpoint
+    // tracklets, so gather them once, when first needed.
+    static thread_local SupportDetections support;
+    bool haveSupport = false;
+
+    const std::vector<TrackletMoments> * moments = 
+        job.tasks->getTrackletMoments();
+    unsigned long nPrechecked = 0;
+
+    uint nFirstEndpointTracklets = firstEndpoint.myTree.getNumTracklets();
+    uint nSecondEndpointTracklets = secondEndpoint.myTree.getNumTracklets();
+    for (uint firstI = 0; firstI < nFirstEndpointTracklets; firstI++) {
 
-        for (secondEndpointIter = secondEndpoint.myTree->getMyData()->begin();
-             secondEndpointIter != secondEndpoint.myTree->getMyData()->end();
-             secondEndpointIter++) {
+        for (uint secondI = 0; secondI < nSecondEndpointTracklets; secondI++) {
             
             /* figure out the rough quadratic track fitting the two
              * endpoints.  if error is too large, quit. Otherwise,
@@ -868,56 +1299,76 @@ void buildTracksAddToResults(
              * line.  If we get enough points, return a track.
             */
 
+            uint firstEndpointTrackletIndex = 
+                firstEndpoint.myTree.getTrackletId(firstI);
+            uint secondEndpointTrackletIndex = 
+                secondEndpoint.myTree.getTrackletId(secondI);
+
+            // most pairs can be thrown out without building a Track
+            if ((moments != NULL) && 
+                endpointPairCertainlyIncompatible(
+                    (*moments)[firstEndpointTrackletIndex],
+                    (*moments)[secondEndpointTrackletIndex],
+                    searchConfig.maxRAAccel, 
+                    searchConfig.maxDecAccel,
+                    searchConfig.minEndpointTimeSeparation)) {
+                nPrechecked++;
+                continue;
+            }
+
             // create a new track with these endpoints
             Track newTrack;
             
-            uint firstEndpointTrackletIndex = firstEndpointIter->getValue();
-            uint secondEndpointTrackletIndex = secondEndpointIter->getValue();
-            
-
-            
             newTrack.addTracklet(firstEndpointTrackletIndex, 
-                                 allTracklets.at(firstEndpointTrackletIndex),
+                                 allTracklets.indicesBegin(firstEndpointTrackletIndex),
+                                 allTracklets.indicesEnd(firstEndpointTrackletIndex),
                                  allDetections);
             
             newTrack.addTracklet(secondEndpointTrackletIndex, 
-                                 allTracklets.at(secondEndpointTrackletIndex),
+                                 allTracklets.indicesBegin(secondEndpointTrackletIndex),
+                                 allTracklets.indicesEnd(secondEndpointTrackletIndex),
                                  allDetections);
             // the 3 here says do NOT use the full form for ra and dec fit - use quadratic
-            newTrack.calculateBestFitQuadratic(allDetections, 3);
+            if (searchConfig.useFastTrackFit) {
+                newTrack.calculateBestFitQuadraticFast(allDetections, 3);
+            }
+            else {
+                newTrack.calculateBestFitQuadratic(allDetections, 3);
+            }
 
             if (endpointTrackletsAreCompatible(allDetections, 
                                                newTrack,
                                                searchConfig)) {
                 
-                std::vector<uint> candidateTrackletIds;
-                // put all support tracklet Ids in curSupportNodeData,
-                // then call addDetectionsCloseToPredictedPositions
-                for (supportNodeIter = supportNodes.begin(); 
-                     supportNodeIter != supportNodes.end();
-                     supportNodeIter++) {
-                    const std::vector<PointAndValue <uint> > * 
-                        curSupportNodeData;
-                    if (!supportNodeIter->myTree->isLeaf()) {
-                        throw LSST_EXCEPT(BadParameterException,
-                                          std::string(__FUNCTION__) + 
-                                          std::string(
-                         ": received non-leaf node as support node."));
-                    }
-                    curSupportNodeData = supportNodeIter->myTree->getMyData(); 
-                    for (supportPointIter  = curSupportNodeData->begin(); 
-                         supportPointIter != curSupportNodeData->end();
-                         supportPointIter++) {
+                if (!haveSupport) {
+                    std::vector<uint> candidateTrackletIds;
+                    // put all support tracklet Ids in candidateTrackletIds,
+                    // then gather up their detections
+                    for (supportNodeIter = supportNodes.begin(); 
+                         supportNodeIter != supportNodes.end();
+                         supportNodeIter++) {
+                        if (!supportNodeIter->myTree.isLeaf()) {
+                            throw LSST_EXCEPT(BadParameterException,
+                                              std::string(__FUNCTION__) + 
+                                              std::string(
+                             ": received non-leaf node as support node."));
+                        }
+                        const NodeRef &curSupportNode = supportNodeIter->myTree;
+                        for (uint i = 0; i < curSupportNode.getNumTracklets(); i++) {
 
-                        candidateTrackletIds.push_back(
-                            supportPointIter->getValue());
+                            candidateTrackletIds.push_back(
+                                curSupportNode.getTrackletId(i));
+                        }
                     }
+                    support.fill(allDetections, allTracklets, 
+                                 candidateTrackletIds,
+                                 job.tasks->nImages);
+                    haveSupport = true;
                 }
 
                 // Add support points if they are within thresholds.
                 addDetectionsCloseToPredictedPositions(allDetections, 
-                                                       allTracklets, 
-                                                       candidateTrackletIds,
+                                                       support,
                                                        newTrack, 
                                                        searchConfig);
 
@@ -933,14 +1384,21 @@ void buildTracksAddToResults(
                     // the 'true' here says DO use the full form for ra fit if there are enough
                     // points to do so
 
-                    newTrack.calculateBestFitQuadratic(allDetections, -1);
-                    if (trackRmsIsSufficientlyLow(allDetections, 
-                                                  newTrack, 
-                                                  searchConfig)) {
+                    if (searchConfig.useFastTrackFit) {
+                        newTrack.calculateBestFitQuadraticFast(allDetections, -1);
+                    }
+                    else {
+                        newTrack.calculateBestFitQuadratic(allDetections, -1);
+                    }
+                    if (trackRmsIsSufficientlyLow(
+                            allDetections, 
+                            newTrack, 
+                            searchConfig,
+                            job.tasks->getChisqThresholds())) {
 #ifdef DEBUG
                         std::cout << "track passed rms\n";
 #endif
-                        results.insert(newTrack);
+                        job.addTrack(std::move(newTrack));
                     } else {
 #ifdef DEBUG
                         std::cout << "track failed rms\n";
@@ -960,6 +1418,14 @@ void buildTracksAddToResults(
     }
 }
 
+    // these are shared by every thread, so don't touch them unless
+    // someone is going to look.
+    if (searchConfig.myVerbosity.printVisitCounts) {
+        job.tasks->endpointPairsTried += 
+            (unsigned long) nFirstEndpointTracklets * nSecondEndpointTracklets;
+        job.tasks->endpointPairsPrechecked += nPrechecked;
+    }
+
 
 }
 
@@ -981,8 +1447,9 @@ void buildTracksAddToResults(
  * feb 17, 2011: update acc bounds using formulas reverse-engineered
  * from Kubica.
  */
-bool updateAccBoundsReturnValidity(const TreeNodeAndTime &firstEndpoint, 
-                                   const TreeNodeAndTime &secondEndpoint,
+template <class NodeRef>
+bool updateAccBoundsReturnValidity(const TreeNodeAndTime<NodeRef> &firstEndpoint, 
+                                   const TreeNodeAndTime<NodeRef> &secondEndpoint,
                                    double &aMinRa, double &aMaxRa, 
                                    double &aMinDec, double &aMaxDec)
 {
@@ -992,8 +1459,8 @@ bool updateAccBoundsReturnValidity(const TreeNodeAndTime &firstEndpoint,
     double dt2 = 2./(dt*dt);
     double dti = 1./(dt);
 
-    TrackletTreeNode* A = firstEndpoint.myTree;
-    TrackletTreeNode* B = secondEndpoint.myTree;
+    const NodeRef &A = firstEndpoint.myTree;
+    const NodeRef &B = secondEndpoint.myTree;
 
     double AmaxVRa, AminVRa, AmaxPRa, AminPRa;
     double BmaxVRa, BminVRa, BmaxPRa, BminPRa;
@@ -1005,25 +1472,25 @@ bool updateAccBoundsReturnValidity(const TreeNodeAndTime &firstEndpoint,
         return false;
     }
 
-    AmaxPRa = A->getUBounds()->at(POINT_RA);
-    AminPRa = A->getLBounds()->at(POINT_RA);
-    AmaxVRa = A->getUBounds()->at(POINT_RA_VELOCITY);
-    AminVRa = A->getLBounds()->at(POINT_RA_VELOCITY);
+    AmaxPRa = A.getUBound(POINT_RA);
+    AminPRa = A.getLBound(POINT_RA);
+    AmaxVRa = A.getUBound(POINT_RA_VELOCITY);
+    AminVRa = A.getLBound(POINT_RA_VELOCITY);
     
-    BmaxPRa = B->getUBounds()->at(POINT_RA);
-    BminPRa = B->getLBounds()->at(POINT_RA);
-    BmaxVRa = B->getUBounds()->at(POINT_RA_VELOCITY);
-    BminVRa = B->getLBounds()->at(POINT_RA_VELOCITY);
-
-    AmaxPDec = A->getUBounds()->at(POINT_DEC);
-    AminPDec = A->getLBounds()->at(POINT_DEC);
-    AmaxVDec = A->getUBounds()->at(POINT_DEC_VELOCITY);
-    AminVDec = A->getLBounds()->at(POINT_DEC_VELOCITY);
+    BmaxPRa = B.getUBound(POINT_RA);
+    BminPRa = B.getLBound(POINT_RA);
+    BmaxVRa = B.getUBound(POINT_RA_VELOCITY);
+    BminVRa = B.getLBound(POINT_RA_VELOCITY);
+
+    AmaxPDec = A.getUBound(POINT_DEC);
+    AminPDec = A.getLBound(POINT_DEC);
+    AmaxVDec = A.getUBound(POINT_DEC_VELOCITY);
+    AminVDec = A.getLBound(POINT_DEC_VELOCITY);
     
-    BmaxPDec = B->getUBounds()->at(POINT_DEC);
-    BminPDec = B->getLBounds()->at(POINT_DEC);
-    BmaxVDec = B->getUBounds()->at(POINT_DEC_VELOCITY);
-    BminVDec = B->getLBounds()->at(POINT_DEC_VELOCITY);
+    BmaxPDec = B.getUBound(POINT_DEC);
+    BminPDec = B.getLBound(POINT_DEC);
+    BmaxVDec = B.getUBound(POINT_DEC_VELOCITY);
+    BminVDec = B.getLBound(POINT_DEC_VELOCITY);
 
     
     double tmpAcc;
@@ -1111,23 +1578,25 @@ bool updateAccBoundsReturnValidity(const TreeNodeAndTime &firstEndpoint,
  * acceleration limits; we assume that these are then potentially used
  * for splitting child nodes of the support node in question
  */
-bool areMutuallyCompatible(const TreeNodeAndTime &firstNode,
-                           const TreeNodeAndTime &secondNode,
-                           const TreeNodeAndTime &thirdNode,
+template <class NodeRef>
+bool areMutuallyCompatible(const TreeNodeAndTime<NodeRef> &firstNode,
+                           const TreeNodeAndTime<NodeRef> &secondNode,
+                           const TreeNodeAndTime<NodeRef> &thirdNode,
                            const linkTrackletsConfig &searchConfig,
                            double &aMinRa, double &aMaxRa,
-                           double &aMinDec, double &aMaxDec)
+                           double &aMinDec, double &aMaxDec,
+                           CompatibilityCache * cache)
 {
 
     bool firstPairCompat = 
-        updateAccBoundsReturnValidity(firstNode, secondNode, 
-                                      aMinRa, aMaxRa, aMinDec, aMaxDec);
+        getPairAccWindow(firstNode, secondNode, cache).applyTo(
+            aMinRa, aMaxRa, aMinDec, aMaxDec);
     if (!firstPairCompat) 
         return false;
 
     bool secondPairCompat = 
-        updateAccBoundsReturnValidity(secondNode, thirdNode, 
-                                      aMinRa, aMaxRa, aMinDec, aMaxDec);
+        getPairAccWindow(secondNode, thirdNode, cache).applyTo(
+            aMinRa, aMaxRa, aMinDec, aMaxDec);
     return secondPairCompat;
 }
 
@@ -1136,14 +1605,15 @@ bool areMutuallyCompatible(const TreeNodeAndTime &firstNode,
 
 
 
-bool areAllLeaves(const std::vector<TreeNodeAndTime> &nodeArray) {
+template <class NodeRef>
+bool areAllLeaves(const std::vector<TreeNodeAndTime<NodeRef> > &nodeArray) {
     bool allLeaves = true;
-    std::vector<TreeNodeAndTime>::const_iterator treeIter;
+    typename std::vector<TreeNodeAndTime<NodeRef> >::const_iterator treeIter;
     uint count = 0;
     for (treeIter = nodeArray.begin(); 
          (treeIter != nodeArray.end() && (allLeaves == true));
          treeIter++) {
-        if (treeIter->myTree->isLeaf() == false) {
+        if (treeIter->myTree.isLeaf() == false) {
             allLeaves = false;
         }
         count++;
@@ -1157,9 +1627,10 @@ bool areAllLeaves(const std::vector<TreeNodeAndTime> &nodeArray) {
 
 
 
-bool supportTooWide(const TreeNodeAndTime& firstEndpoint, 
-                    const TreeNodeAndTime& secondEndpoint,
-                    const TreeNodeAndTime& supportNode) 
+template <class NodeRef>
+bool supportTooWide(const TreeNodeAndTime<NodeRef>& firstEndpoint, 
+                    const TreeNodeAndTime<NodeRef>& secondEndpoint,
+                    const TreeNodeAndTime<NodeRef>& supportNode) 
 {
     /* odd-looking stuff with alpha based on test_and_add_support in
      * Kubica's linker.c.  the idea is to weight the expected size of a
@@ -1171,13 +1642,13 @@ bool supportTooWide(const TreeNodeAndTime& firstEndpoint,
     // check the width of the support node in all 4 axes; compare with
     // width of
     for (uint i = 0; i < 4; i++) {
-        double nodeWidth = supportNode.myTree->getUBounds()->at(i) - 
-            supportNode.myTree->getLBounds()->at(i);
+        double nodeWidth = supportNode.myTree.getUBound(i) - 
+            supportNode.myTree.getLBound(i);
         double maxWidth = (1.0 - alpha) * 
-            (firstEndpoint.myTree->getUBounds()->at(i) - 
-             firstEndpoint.myTree->getLBounds()->at(i)) + 
-            alpha * (secondEndpoint.myTree->getUBounds()->at(i) - 
-                     secondEndpoint.myTree->getLBounds()->at(i));
+            (firstEndpoint.myTree.getUBound(i) - 
+             firstEndpoint.myTree.getLBound(i)) + 
+            alpha * (secondEndpoint.myTree.getUBound(i) - 
+                     secondEndpoint.myTree.getLBound(i));
         
         // this constant 4 is taken from Kubica's linker.c
         // test_and_add_support.  Beware the magic number!
@@ -1195,35 +1666,82 @@ bool supportTooWide(const TreeNodeAndTime& firstEndpoint,
 
 
 
-void splitSupportRecursively(const TreeNodeAndTime& firstEndpoint, 
-                             const TreeNodeAndTime& secondEndpoint, 
+template <class NodeRef>
+void splitSupportRecursively(const TreeNodeAndTime<NodeRef>& firstEndpoint, 
+                             const TreeNodeAndTime<NodeRef>& secondEndpoint, 
                              bool requireLeaves,
-                             const TreeNodeAndTime &supportNode, 
+                             const TreeNodeAndTime<NodeRef> &supportNode, 
                              const linkTrackletsConfig &searchConfig, 
                              double accMinRa, double accMaxRa,
                              double accMinDec, double accMaxDec,
-                             std::vector<TreeNodeAndTime> &newSupportNodes)
-{
+                             std::vector<TreeNodeAndTime<NodeRef> > &newSupportNodes,
+                             CompatibilityCache * cache);
 
-    if ((firstEndpoint.myTime.getMJD() >= supportNode.myTime.getMJD()) || 
-        (supportNode.myTime.getMJD() > secondEndpoint.myTime.getMJD())) {
-        throw LSST_EXCEPT(BadParameterException, "splitSupportRecursively got impossibly-ordered endpoints/support");
-    }
 
-    
-    if (areMutuallyCompatible(firstEndpoint, supportNode,
-                              secondEndpoint, searchConfig, 
-                              accMinRa, accMaxRa,
-                              accMinDec, accMaxDec)) {
 
-        if (supportNode.myTree->isLeaf()) {
-            newSupportNodes.push_back(supportNode);
+/*
+ * supportNode has already been found compatible with the endpoints,
+ * and accMinRa etc. are the acceleration bounds as tightened by that
+ * test.  Add supportNode to newSupportNodes, or split it and recurse
+ * on its children.
+ */
+template <class NodeRef>
+void splitCompatibleSupport(const TreeNodeAndTime<NodeRef>& firstEndpoint, 
+                            const TreeNodeAndTime<NodeRef>& secondEndpoint, 
+                            bool requireLeaves,
+                            const TreeNodeAndTime<NodeRef> &supportNode, 
+                            const linkTrackletsConfig &searchConfig, 
+                            double accMinRa, double accMaxRa,
+                            double accMinDec, double accMaxDec,
+                            std::vector<TreeNodeAndTime<NodeRef> > &newSupportNodes,
+                            CompatibilityCache * cache)
+{
+    if (supportNode.myTree.isLeaf()) {
+        newSupportNodes.push_back(supportNode);
+    }
+
+    else if (requireLeaves) {
+        if (supportNode.myTree.hasLeftChild()) {
+            TreeNodeAndTime<NodeRef> leftTat(
+                supportNode.myTree.getLeftChild(), 
+                supportNode.myTime); 
+            splitSupportRecursively(firstEndpoint, 
+                                    secondEndpoint, 
+                                    requireLeaves, 
+                                    leftTat,
+                                    searchConfig, 
+                                    accMinRa, accMaxRa,
+                                    accMinDec, accMaxDec,
+                                    newSupportNodes, cache);
         }
+        if (supportNode.myTree.hasRightChild()) {
+            TreeNodeAndTime<NodeRef> rightTat(
+                supportNode.myTree.getRightChild(), 
+                supportNode.myTime);
+            splitSupportRecursively(firstEndpoint, 
+                                    secondEndpoint, 
+                                    requireLeaves, 
+                                    rightTat,
+                                    searchConfig, 
+                                    accMinRa, accMaxRa,
+                                    accMinDec, accMaxDec,
+                                    newSupportNodes, cache);
+        }
+    }
+    
+    else {
+        // we don't require leaves in output, but check to see if
+        // we *should* split this node.  if not, add it to
+        // output. Otherwise, recurse on its children.
 
-        else if (requireLeaves) {
-            if (supportNode.myTree->hasLeftChild()) {
-                TreeNodeAndTime leftTat(
-                    supportNode.myTree->getLeftChild(), 
+        bool tooWide = supportTooWide(firstEndpoint, 
+                                      secondEndpoint, 
+                                      supportNode);
+        
+        if (tooWide) {
+            if (supportNode.myTree.hasLeftChild()) {
+                TreeNodeAndTime<NodeRef> leftTat(
+                    supportNode.myTree.getLeftChild(), 
                     supportNode.myTime); 
                 splitSupportRecursively(firstEndpoint, 
                                         secondEndpoint, 
@@ -1232,11 +1750,11 @@ void splitSupportRecursively(const TreeNodeAndTime& firstEndpoint,
                                         searchConfig, 
                                         accMinRa, accMaxRa,
                                         accMinDec, accMaxDec,
-                                        newSupportNodes);
+                                        newSupportNodes, cache);
             }
-            if (supportNode.myTree->hasRightChild()) {
-                TreeNodeAndTime rightTat(
-                    supportNode.myTree->getRightChild(), 
+            if (supportNode.myTree.hasRightChild()) {
+                TreeNodeAndTime<NodeRef> rightTat(
+                    supportNode.myTree.getRightChild(), 
                     supportNode.myTime);
                 splitSupportRecursively(firstEndpoint, 
                                         secondEndpoint, 
@@ -1245,84 +1763,151 @@ void splitSupportRecursively(const TreeNodeAndTime& firstEndpoint,
                                         searchConfig, 
                                         accMinRa, accMaxRa,
                                         accMinDec, accMaxDec,
-                                        newSupportNodes);
+                                        newSupportNodes, cache);
             }
         }
-        
         else {
-            // we don't require leaves in output, but check to see if
-            // we *should* split this node.  if not, add it to
-            // output. Otherwise, recurse on its children.
-
-            bool tooWide = supportTooWide(firstEndpoint, 
-                                          secondEndpoint, 
-                                          supportNode);
-            
-            if (tooWide) {
-                if (supportNode.myTree->hasLeftChild()) {
-                    TreeNodeAndTime leftTat(
-                        supportNode.myTree->getLeftChild(), 
-                        supportNode.myTime); 
-                    splitSupportRecursively(firstEndpoint, 
-                                            secondEndpoint, 
-                                            requireLeaves, 
-                                            leftTat,
-                                            searchConfig, 
-                                            accMinRa, accMaxRa,
-                                            accMinDec, accMaxDec,
-                                            newSupportNodes);
-                }
-                if (supportNode.myTree->hasRightChild()) {
-                    TreeNodeAndTime rightTat(
-                        supportNode.myTree->getRightChild(), 
-                        supportNode.myTime);
-                    splitSupportRecursively(firstEndpoint, 
-                                            secondEndpoint, 
-                                            requireLeaves, 
-                                            rightTat,
-                                            searchConfig, 
-                                            accMinRa, accMaxRa,
-                                            accMinDec, accMaxDec,
-                                            newSupportNodes);
-                }
-            }
-            else {
-                newSupportNodes.push_back(supportNode);
-            }
+            newSupportNodes.push_back(supportNode);
         }
     }
 }
 
 
 
+template <class NodeRef>
+void splitSupportRecursively(const TreeNodeAndTime<NodeRef>& firstEndpoint, 
+                             const TreeNodeAndTime<NodeRef>& secondEndpoint, 
+                             bool requireLeaves,
+                             const TreeNodeAndTime<NodeRef> &supportNode, 
+                             const linkTrackletsConfig &searchConfig, 
+                             double accMinRa, double accMaxRa,
+                             double accMinDec, double accMaxDec,
+                             std::vector<TreeNodeAndTime<NodeRef> > &newSupportNodes,
+                             CompatibilityCache * cache)
+{
 
+    if ((firstEndpoint.myTime.getMJD() >= supportNode.myTime.getMJD()) || 
+        (supportNode.myTime.getMJD() > secondEndpoint.myTime.getMJD())) {
+        throw LSST_EXCEPT(BadParameterException, "splitSupportRecursively got impossibly-ordered endpoints/support");
+    }
 
+    
+    if (areMutuallyCompatible(firstEndpoint, supportNode,
+                              secondEndpoint, searchConfig, 
+                              accMinRa, accMaxRa,
+                              accMinDec, accMaxDec, cache)) {
+        splitCompatibleSupport(firstEndpoint, secondEndpoint, 
+                               requireLeaves, supportNode, searchConfig,
+                               accMinRa, accMaxRa, accMinDec, accMaxDec,
+                               newSupportNodes, cache);
+    }
+}
+
+
+
+template <class NodeRef>
 void filterAndSplitSupport(
-    const TreeNodeAndTime& firstEndpoint, 
-    const TreeNodeAndTime& secondEndpoint, 
-    const std::vector<TreeNodeAndTime> &supportNodes, 
+    const TreeNodeAndTime<NodeRef>& firstEndpoint, 
+    const TreeNodeAndTime<NodeRef>& secondEndpoint, 
+    const std::vector<TreeNodeAndTime<NodeRef> > &supportNodes, 
     const linkTrackletsConfig &searchConfig, 
     double accMinRa, double accMaxRa, 
     double accMinDec, double accMaxDec,
-    std::vector<TreeNodeAndTime> &newSupportNodes) 
+    std::vector<TreeNodeAndTime<NodeRef> > &newSupportNodes,
+    CompatibilityCache * cache) 
 {
 
     // if the endpoints are leaves, require that we get all leaves in
     // the support nodes.
     bool endpointsAreLeaves = 
-        firstEndpoint.myTree->isLeaf() && secondEndpoint.myTree->isLeaf();
-    
+        firstEndpoint.myTree.isLeaf() && secondEndpoint.myTree.isLeaf();
     
+    /* test all the support nodes against the endpoints in one batch
+     * (see supportCompatibility.h), then split the survivors.  Nodes
+     * whose windows with both endpoints are in the cache skip the
+     * batch.  These buffers are reused across calls to save
+     * allocations; each linking thread has its own, and we're done
+     * with them before recursing.
+     */
+    static thread_local SupportBatch batch;
+    // position of each support node in batch, or -1 if it was cached.
+    static thread_local std::vector<int> batchIndex;
+    static thread_local std::vector<AccWindow> cachedWindows;
+    batch.clear();
+    batchIndex.resize(supportNodes.size());
+    cachedWindows.resize(2 * supportNodes.size());
     for (uint i = 0; i < supportNodes.size(); i++) {
-        splitSupportRecursively(firstEndpoint, secondEndpoint, 
-                                endpointsAreLeaves, 
-                                supportNodes[i],
-                                searchConfig, 
-                                accMinRa, accMaxRa, accMinDec, accMaxDec,
-                                newSupportNodes);
+        const TreeNodeAndTime<NodeRef> &supportNode = supportNodes[i];
+        if ((firstEndpoint.myTime.getMJD() >= supportNode.myTime.getMJD()) || 
+            (supportNode.myTime.getMJD() > secondEndpoint.myTime.getMJD())) {
+            throw LSST_EXCEPT(BadParameterException, "filterAndSplitSupport got impossibly-ordered endpoints/support");
+        }
+        if ((cache != NULL) && 
+            cache->find(makeNodePairKey(firstEndpoint, supportNode), 
+                        cachedWindows[2*i]) &&
+            cache->find(makeNodePairKey(supportNode, secondEndpoint),
+                        cachedWindows[2*i + 1])) {
+            batchIndex[i] = -1;
+        }
+        else {
+            double lBounds[4];
+            double uBounds[4];
+            getNodeBounds(supportNode, lBounds, uBounds);
+            batchIndex[i] = batch.size();
+            batch.add(lBounds, uBounds, supportNode.myTime.getMJD());
+        }
+    }
+
+    if (batch.size() > 0) {
+        EndpointBounds firstBounds;
+        EndpointBounds secondBounds;
+        getNodeBounds(firstEndpoint, firstBounds.lBounds, firstBounds.uBounds);
+        firstBounds.mjd = firstEndpoint.myTime.getMJD();
+        getNodeBounds(secondEndpoint, secondBounds.lBounds, 
+                      secondBounds.uBounds);
+        secondBounds.mjd = secondEndpoint.myTime.getMJD();
+        findCompatibleSupport(firstBounds, secondBounds, 
+                              accMinRa, accMaxRa, accMinDec, accMaxDec,
+                              batch);
+    }
+
+    for (uint i = 0; i < supportNodes.size(); i++) {
+        const TreeNodeAndTime<NodeRef> &supportNode = supportNodes[i];
+        double supMinRa = accMinRa;
+        double supMaxRa = accMaxRa;
+        double supMinDec = accMinDec;
+        double supMaxDec = accMaxDec;
+        bool compatible;
+        if (batchIndex[i] < 0) {
+            compatible = 
+                cachedWindows[2*i].applyTo(supMinRa, supMaxRa, 
+                                           supMinDec, supMaxDec) &&
+                cachedWindows[2*i + 1].applyTo(supMinRa, supMaxRa, 
+                                               supMinDec, supMaxDec);
+        }
+        else {
+            uint j = batchIndex[i];
+            if (cache != NULL) {
+                cache->insert(makeNodePairKey(firstEndpoint, supportNode),
+                              batch.firstWindows[j]);
+                cache->insert(makeNodePairKey(supportNode, secondEndpoint),
+                              batch.secondWindows[j]);
+            }
+            compatible = batch.survivors[j];
+            supMinRa = batch.accMinRa[j];
+            supMaxRa = batch.accMaxRa[j];
+            supMinDec = batch.accMinDec[j];
+            supMaxDec = batch.accMaxDec[j];
+        }
+        if (compatible) {
+            splitCompatibleSupport(firstEndpoint, secondEndpoint, 
+                                   endpointsAreLeaves, 
+                                   supportNode,
+                                   searchConfig, 
+                                   supMinRa, supMaxRa, supMinDec, supMaxDec,
+                                   newSupportNodes, cache);
+        }
     }
-    
-    
 }
 
 
@@ -1331,11 +1916,12 @@ void filterAndSplitSupport(
 
 
 
-double nodeWidth(TrackletTreeNode *node)
+template <class NodeRef>
+double nodeWidth(const NodeRef &node)
 {
     double width = 1;
     for (uint i = 0; i < 4; i++) {
-        width *= node->getUBounds()->at(i) - node->getLBounds()->at(i);
+        width *= node.getUBound(i) - node.getLBound(i);
     }
     return width;    
 }
@@ -1348,14 +1934,102 @@ double nodeWidth(TrackletTreeNode *node)
 
 
 
-unsigned int countImageTimes(const std::vector<TreeNodeAndTime> &nodes)
+/*
+ * the number of distinct nights among the image times of nodes.
+ */
+template <class NodeRef>
+unsigned int countNights(const std::vector<TreeNodeAndTime<NodeRef> > &nodes)
 {
-    std::set<unsigned int> imageTimes;
-    std::vector<TreeNodeAndTime>::const_iterator nIter;
+    static thread_local DistinctIndexCounter nights;
+    nights.clear();
+    typename std::vector<TreeNodeAndTime<NodeRef> >::const_iterator nIter;
     for (nIter = nodes.begin(); nIter != nodes.end(); nIter++) {
-        imageTimes.insert(nIter->myTime.getImageId());
+        nights.add(nIter->myTime.getNightId());
     }
-    return imageTimes.size();
+    return nights.count();
+}
+
+
+
+template <class NodeRef>
+void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
+                      const TrackletStore &allTracklets,
+                      const linkTrackletsConfig &searchConfig,
+                      TreeNodeAndTime<NodeRef> &firstEndpoint,
+                      TreeNodeAndTime<NodeRef> &secondEndpoint,
+                      std::vector<TreeNodeAndTime<NodeRef> > &supportNodes,
+                      double accMinRa, double accMaxRa, 
+                      double accMinDec, double accMaxDec,
+                      ImagePairJob<NodeRef> & job,
+                      int iterationsTillSplit);
+
+
+
+/*
+ * decide whether the subtree of the search rooted at these endpoint
+ * nodes is big enough that, when we split an endpoint node, one of
+ * the two resulting recursions should be handed to the thread pool
+ * rather than run here.  Work is estimated as the number of endpoint
+ * tracklet pairs times the number of support nodes still in play.
+ */
+template <class NodeRef>
+bool worthSpawningChildTask(const ImagePairJob<NodeRef> &job,
+                            const TreeNodeAndTime<NodeRef> &firstEndpoint,
+                            const TreeNodeAndTime<NodeRef> &secondEndpoint,
+                            const std::vector<TreeNodeAndTime<NodeRef> > &supportNodes)
+{
+    if (job.tasks->pool == NULL) {
+        return false;
+    }
+    double work = (double) firstEndpoint.myTree.getNumTracklets() *
+        (double) secondEndpoint.myTree.getNumTracklets() *
+        (double) (supportNodes.size() + 1);
+    return (work >= job.tasks->taskSplitThreshold);
+}
+
+
+
+/*
+ * queue a call to doLinkingRecurse on the thread pool.  Everything
+ * which the recursion would normally get by reference from its
+ * caller's stack frame is copied, since the caller won't wait for
+ * it.
+ */
+template <class NodeRef>
+void spawnLinkingTask(const std::vector<MopsDetection> &allDetections,
+                      const TrackletStore &allTracklets,
+                      const linkTrackletsConfig &searchConfig,
+                      const TreeNodeAndTime<NodeRef> &firstEndpoint,
+                      const TreeNodeAndTime<NodeRef> &secondEndpoint,
+                      const std::vector<TreeNodeAndTime<NodeRef> > &supportNodes,
+                      double accMinRa, double accMaxRa, 
+                      double accMinDec, double accMaxDec,
+                      ImagePairJob<NodeRef> & job,
+                      int iterationsTillSplit)
+{
+    const std::vector<MopsDetection> * dets = &allDetections;
+    const TrackletStore * tracklets = &allTracklets;
+    const linkTrackletsConfig * config = &searchConfig;
+    ImagePairJob<NodeRef> * jobPtr = &job;
+    std::shared_ptr<std::vector<TreeNodeAndTime<NodeRef> > > support(
+        new std::vector<TreeNodeAndTime<NodeRef> >(supportNodes));
+    TreeNodeAndTime<NodeRef> first(firstEndpoint);
+    TreeNodeAndTime<NodeRef> second(secondEndpoint);
+
+    job.taskStarted();
+    job.tasks->pool->submit([=]() mutable {
+            std::exception_ptr err;
+            try {
+                doLinkingRecurse(*dets, *tracklets, *config,
+                                 first, second, *support,
+                                 accMinRa, accMaxRa, accMinDec, accMaxDec,
+                                 *jobPtr, iterationsTillSplit);
+            }
+            catch (...) {
+                err = std::current_exception();
+            }
+            jobPtr->taskDone(err);
+        });
 }
 
 
@@ -1376,20 +2050,26 @@ unsigned int countImageTimes(const std::vector<TreeNodeAndTime> &nodes)
  * this implementation is more like the one Kubica did in his code. at
  * every step, we check all support nodes for compatibility, splitting
  * each one. we then split one model node and recurse.
+ *
+ * when running with a thread pool, the recursion on the left child of
+ * a big split is queued as its own task (see worthSpawningChildTask)
+ * so that idle threads can steal it; the right child is always done
+ * here.
  */
+template <class NodeRef>
 void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
-                      const std::vector<Tracklet> &allTracklets,
+                      const TrackletStore &allTracklets,
                       const linkTrackletsConfig &searchConfig,
-                      TreeNodeAndTime &firstEndpoint,
-                      TreeNodeAndTime &secondEndpoint,
-                      std::vector<TreeNodeAndTime> &supportNodes,
+                      TreeNodeAndTime<NodeRef> &firstEndpoint,
+                      TreeNodeAndTime<NodeRef> &secondEndpoint,
+                      std::vector<TreeNodeAndTime<NodeRef> > &supportNodes,
                       double accMinRa, double accMaxRa, 
                       double accMinDec, double accMaxDec,
-                      TrackSet & results,
+                      ImagePairJob<NodeRef> & job,
                       int iterationsTillSplit)
 {
 
-    firstEndpoint.myTree->addVisit();
+    firstEndpoint.myTree.addVisit();
 
 
     bool isValid = updateAccBoundsReturnValidity(firstEndpoint, 
@@ -1400,40 +2080,40 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
     if (isValid)
     {
 
-        std::set<double> uniqueSupportMJDs;
-        std::vector<TreeNodeAndTime> newSupportNodes;
-        std::vector<TreeNodeAndTime>::iterator supportNodeIter;
+        std::vector<TreeNodeAndTime<NodeRef> > newSupportNodes;
+        typename std::vector<TreeNodeAndTime<NodeRef> >::iterator supportNodeIter;
         
         /* look through untested support nodes, find the ones that are
          * compatible with the model nodes, add their children to
          * newSupportNodes */
 
         if ((iterationsTillSplit <= 0) || 
-            (firstEndpoint.myTree->isLeaf() && secondEndpoint.myTree->isLeaf())) {
+            (firstEndpoint.myTree.isLeaf() && secondEndpoint.myTree.isLeaf())) {
             
             filterAndSplitSupport(firstEndpoint, secondEndpoint, 
                                   supportNodes, searchConfig, 
                                   accMinRa, accMaxRa, accMinDec, accMaxDec,
-                                  newSupportNodes);
+                                  newSupportNodes, 
+                                  job.tasks->getCompatibilityCache());
             iterationsTillSplit = ITERATIONS_PER_SPLIT;
         }
         else{
             newSupportNodes = supportNodes;
         }
         
-        unsigned int nUniqueMJDs = countImageTimes(newSupportNodes);
+        unsigned int nSupportNights = countNights(newSupportNodes);
 
-        // we get at least 2 unique nights from endpoints, and 4
+        // we get at most 2 unique nights from endpoints, and 4
         // unique detections from endpoints.  add those in and see if
-        // we have sufficient support.
-        if (nUniqueMJDs + 2 >= searchConfig.minUniqueNights)
+        // we could have sufficient support.
+        if (nSupportNights + 2 >= searchConfig.minUniqueNights)
         {
             // we have enough model nodes, and enough support nodes.
             // if they are all leaves, then start building tracks.  if
             // they are not leaves, split one of them and recurse.
 
-            if (firstEndpoint.myTree->isLeaf() && 
-                secondEndpoint.myTree->isLeaf()) {
+            if (firstEndpoint.myTree.isLeaf() && 
+                secondEndpoint.myTree.isLeaf()) {
                 
                 buildTracksAddToResults(allDetections, 
                                         allTracklets, 
@@ -1441,12 +2121,17 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
                                         firstEndpoint, 
                                         secondEndpoint, 
                                         newSupportNodes,
-                                        results);
+                                        job);
             }
             else {
                 
                 iterationsTillSplit -= 1;
                 
+                bool spawnLeft = worthSpawningChildTask(job, 
+                                                        firstEndpoint, 
+                                                        secondEndpoint, 
+                                                        newSupportNodes);
+
                 // find the "widest" node, where width is just the
                 // product of RA range, Dec range, RA velocity range,
                 // Dec velocity range.  we will split that node and
@@ -1458,10 +2143,10 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
                 // don't consider splitting endpoint nodes which are
                 // actually leaves! give them negative width to hack
                 // selection process.
-                if (firstEndpoint.myTree->isLeaf()) {
+                if (firstEndpoint.myTree.isLeaf()) {
                     firstEndpointWidth = -1;
                 }
-                if (secondEndpoint.myTree->isLeaf()) {
+                if (secondEndpoint.myTree.isLeaf()) {
                     secondEndpointWidth = -1;
                 }
  
@@ -1471,34 +2156,49 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
                     //"widest" node is first endpoint, recurse twice
                     // using its children in its place.
                     
-                    if ((! firstEndpoint.myTree->hasLeftChild()) 
-                        && (!firstEndpoint.myTree->hasRightChild())) {
+                    if ((! firstEndpoint.myTree.hasLeftChild()) 
+                        && (!firstEndpoint.myTree.hasRightChild())) {
                         throw LSST_EXCEPT(ProgrammerErrorException, 
      "Recursing in a leaf node (first endpoint), must be a bug!");
                     }
 
-                    if (firstEndpoint.myTree->hasLeftChild())
+                    if (firstEndpoint.myTree.hasLeftChild())
                     {
-                        TreeNodeAndTime newTAT(
-                            firstEndpoint.myTree->getLeftChild(), 
+                        TreeNodeAndTime<NodeRef> newTAT(
+                            firstEndpoint.myTree.getLeftChild(), 
                             firstEndpoint.myTime);
-                        doLinkingRecurse(allDetections, 
-                                         allTracklets, 
-                                         searchConfig,
-                                         newTAT,secondEndpoint,
-                                         newSupportNodes,
-                                         accMinRa,
-                                         accMaxRa,
-                                         accMinDec,
-                                         accMaxDec,
-                                         results, 
-                                         iterationsTillSplit); 
+                        if (spawnLeft) {
+                            spawnLinkingTask(allDetections, 
+                                             allTracklets, 
+                                             searchConfig,
+                                             newTAT,secondEndpoint,
+                                             newSupportNodes,
+                                             accMinRa,
+                                             accMaxRa,
+                                             accMinDec,
+                                             accMaxDec,
+                                             job, 
+                                             iterationsTillSplit); 
+                        }
+                        else {
+                            doLinkingRecurse(allDetections, 
+                                             allTracklets, 
+                                             searchConfig,
+                                             newTAT,secondEndpoint,
+                                             newSupportNodes,
+                                             accMinRa,
+                                             accMaxRa,
+                                             accMinDec,
+                                             accMaxDec,
+                                             job, 
+                                             iterationsTillSplit); 
+                        }
                     }
                     
-                    if (firstEndpoint.myTree->hasRightChild())
+                    if (firstEndpoint.myTree.hasRightChild())
                     {
-                        TreeNodeAndTime newTAT(
-                            firstEndpoint.myTree->getRightChild(), 
+                        TreeNodeAndTime<NodeRef> newTAT(
+                            firstEndpoint.myTree.getRightChild(), 
                             firstEndpoint.myTime);
                         doLinkingRecurse(allDetections, 
                                          allTracklets, 
@@ -1509,7 +2209,7 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
                                          accMaxRa,
                                          accMinDec,
                                          accMaxDec,
-                                         results, 
+                                         job, 
                                          iterationsTillSplit);  
                         //std::cout << "Returned from recursion on
                         //right child of first endpoint.\n";
@@ -1519,39 +2219,55 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
                     //"widest" node is second endpoint, recurse twice
                     // using its children in its place
                     
-                    if ((!secondEndpoint.myTree->hasLeftChild()) 
-                        && (!secondEndpoint.myTree->hasRightChild())) {
+                    if ((!secondEndpoint.myTree.hasLeftChild()) 
+                        && (!secondEndpoint.myTree.hasRightChild())) {
                         throw LSST_EXCEPT(ProgrammerErrorException, 
             "Recursing in a leaf node (second endpoint), must be a bug!");
                     }
 
-                    if (secondEndpoint.myTree->hasLeftChild())
+                    if (secondEndpoint.myTree.hasLeftChild())
                     {
-                        TreeNodeAndTime newTAT(
-                            secondEndpoint.myTree->getLeftChild(), 
+                        TreeNodeAndTime<NodeRef> newTAT(
+                            secondEndpoint.myTree.getLeftChild(), 
                             secondEndpoint.myTime);
                         //std::cout << "Recursing on left child of
                         //second endpoint.\n";
-                        doLinkingRecurse(allDetections, 
-                                         allTracklets, 
-                                         searchConfig,
-                                         firstEndpoint,
-                                         newTAT,
-                                         newSupportNodes,
-                                         accMinRa,
-                                         accMaxRa,
-                                         accMinDec,
-                                         accMaxDec,
-                                         results, 
-                                         iterationsTillSplit);
+                        if (spawnLeft) {
+                            spawnLinkingTask(allDetections, 
+                                             allTracklets, 
+                                             searchConfig,
+                                             firstEndpoint,
+                                             newTAT,
+                                             newSupportNodes,
+                                             accMinRa,
+                                             accMaxRa,
+                                             accMinDec,
+                                             accMaxDec,
+                                             job, 
+                                             iterationsTillSplit);
+                        }
+                        else {
+                            doLinkingRecurse(allDetections, 
+                                             allTracklets, 
+                                             searchConfig,
+                                             firstEndpoint,
+                                             newTAT,
+                                             newSupportNodes,
+                                             accMinRa,
+                                             accMaxRa,
+                                             accMinDec,
+                                             accMaxDec,
+                                             job, 
+                                             iterationsTillSplit);
+                        }
                         //std::cout << "Returned from recursion on
                         //left child of second endpoint.\n";
                     }
                     
-                    if (secondEndpoint.myTree->hasRightChild())
+                    if (secondEndpoint.myTree.hasRightChild())
                     {
-                        TreeNodeAndTime newTAT(
-                            secondEndpoint.myTree->getRightChild(), 
+                        TreeNodeAndTime<NodeRef> newTAT(
+                            secondEndpoint.myTree.getRightChild(), 
                             secondEndpoint.myTime);
                         //std::cout << "Recursing on right child of
                         //second endpoint.\n";
@@ -1565,7 +2281,7 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
                                          accMaxRa,
                                          accMinDec,
                                          accMaxDec,
-                                         results, 
+                                         job, 
                                          iterationsTillSplit);
                         //std::cout << "Returned from recursion on
                         //right child of second endpoint.\n";
@@ -1582,12 +2298,179 @@ void doLinkingRecurse(const std::vector<MopsDetection> &allDetections,
 
 
 
+/*
+ * set up the search between the trees at firstEndpointIter and
+ * secondEndpointIter.  note that std::maps are sorted by their key,
+ * which in this case is time.  ergo between firstEndpointIter and
+ * secondEndpointIter is *EVERY* tree (and ergo every tracklet) which
+ * happened between the first endpoint's tracklets and the second
+ * endpoint's tracklets; those are our support nodes.
+ */
+template <class NodeRef, class TreeMapIter>
+ImagePairJob<NodeRef> * makeImagePairJob(const linkTrackletsConfig &searchConfig,
+                                         TreeMapIter firstEndpointIter,
+                                         TreeMapIter secondEndpointIter,
+                                         LinkingTasks * tasks)
+{
+    TreeNodeAndTime<NodeRef> firstEndpoint(
+        NodeRef(firstEndpointIter->second.getRootNode()), 
+        firstEndpointIter->first);
+    TreeNodeAndTime<NodeRef> secondEndpoint(
+        NodeRef(secondEndpointIter->second.getRootNode()),
+        secondEndpointIter->first);
+    ImagePairJob<NodeRef> * job = new ImagePairJob<NodeRef>(firstEndpoint, 
+                                                            secondEndpoint, 
+                                                            tasks);
+
+    TreeMapIter supportPointIter = firstEndpointIter;
+    for (supportPointIter++;
+         supportPointIter != secondEndpointIter;
+         supportPointIter++) {
+                    
+        /* don't pass along second tracklets which
+           are 'too close' to the endpoints; see
+           linkTracklets.h for more comments */
+        double firstToSup = supportPointIter->first.getMJD() 
+            - firstEndpointIter->first.getMJD(); 
+        double supToSecond =  secondEndpointIter->first.getMJD() 
+            - supportPointIter->first.getMJD();
+        if ((firstToSup > 
+             searchConfig.minSupportToEndpointTimeSeparation) 
+            && 
+            (supToSecond > 
+             searchConfig.minSupportToEndpointTimeSeparation)) 
+        {
+            TreeNodeAndTime<NodeRef> tmpTAT(
+                NodeRef(supportPointIter->second.getRootNode()),
+                supportPointIter->first);
+            job->supportPoints.push_back(tmpTAT);
+        }
+    }
+    return job;
+}
+
+
+
+// serializes status printing from linking threads.
+static std::mutex statusPrintLock;
+
+
+
+/*
+ * call the recursive linker with the endpoint nodes and support point
+ * nodes of job.  Results go to job.tracks.  Safe to call for
+ * different jobs from different threads at once.  If job.tasks has a
+ * pool, parts of the search may still be running on other threads
+ * when this returns; job.finished says when they are all done.
+ */
+template <class NodeRef>
+void linkImagePair(const std::vector<MopsDetection> &allDetections,
+                   const TrackletStore &allTracklets,
+                   const linkTrackletsConfig &searchConfig,
+                   unsigned int numImages,
+                   ImagePairJob<NodeRef> &job)
+{
+    double iterationTime = std::clock();
+    if (searchConfig.myVerbosity.printStatus) {
+        std::lock_guard<std::mutex> guard(statusPrintLock);
+        std::cout << "Looking for tracks between images at times " 
+                  << std::setprecision(12) 
+                  << job.firstEndpoint.myTime.getMJD() 
+                  << " (image " << job.firstEndpoint.myTime.getImageId() 
+                  << " / " << numImages << ")"
+                  << " and " 
+                  << std::setprecision(12)
+                  << job.secondEndpoint.myTime.getMJD()
+                  << " (image " 
+                  << job.secondEndpoint.myTime.getImageId() 
+                  << " / " << numImages << ") "
+                  << " (with " 
+                  << job.supportPoints.size() << " support images).\n";
+        struct tm * timeinfo;
+        time_t rawtime;
+        time ( &rawtime );
+        timeinfo = localtime ( &rawtime );                    
+        
+        std::cout << " current wall-clock time is " 
+                  << asctime (timeinfo);
+    }
+
+    doLinkingRecurse(allDetections,
+                     allTracklets, 
+                     searchConfig,
+                     job.firstEndpoint, 
+                     job.secondEndpoint,
+                     job.supportPoints,  
+                     searchConfig.maxRAAccel*-1.,
+                     searchConfig.maxRAAccel,
+                     searchConfig.maxDecAccel*-1.,
+                     searchConfig.maxDecAccel,
+                     job, 
+                     ITERATIONS_PER_SPLIT);
+
+    if (searchConfig.myVerbosity.printStatus) {
+        // NB: std::clock is CPU time for the whole process, so with
+        // nThreads > 1 this overstates the time spent on this pair.
+        std::lock_guard<std::mutex> guard(statusPrintLock);
+        std::cout << "That iteration took " 
+                  << timeElapsed(iterationTime) << " seconds. "
+                  << std::endl;
+    }
+}
+
+
+
+/*
+ * move the tracks found for job into results.  Always called from the
+ * thread which owns results, in image pair order.
+ *
+ * With IDS_FILE_ASYNC output the writer drops duplicates itself, by
+ * hash.  Otherwise they are dropped here, and the rest inserted in
+ * order, just as they would come out of a std::set<Track> (the first
+ * of any duplicates found being kept), so that results (and when
+ * they are written) are as they were when each pair kept a TrackSet.
+ */
+template <class NodeRef>
+void mergeImagePairResults(ImagePairJob<NodeRef> &job,
+                           const linkTrackletsConfig &searchConfig,
+                           TrackSet &results)
+{
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+    std::vector<Track> &tracks = job.tracks;
+    if (searchConfig.outputMethod != trackOutputMethod::IDS_FILE_ASYNC) {
+        std::stable_sort(tracks.begin(), tracks.end());
+        tracks.erase(std::unique(tracks.begin(), tracks.end()), tracks.end());
+    }
+    for (uint i = 0; i < tracks.size(); i++) {
+        results.insert(std::move(tracks[i]));
+    }
+    std::vector<Track>().swap(tracks);
+
+    if (searchConfig.myVerbosity.printStatus) {
+        std::lock_guard<std::mutex> guard(statusPrintLock);
+        std::cout << " so far, we have found " << 
+            results.size() << " tracks.\n\n";
+    }
+}
+
+
+
+/*
+ * NodeRef is the node handle the linker will use (TrackletTreeNodeRef
+ * or FlatTrackletTree::NodeRef); TreeT is the matching tree type.
+ */
+template <class NodeRef, class TreeT>
 void doLinking(const std::vector<MopsDetection> &allDetections,
-               std::vector<Tracklet> &allTracklets,
+               const ImageIndex &imageIndex,
+               const TrackletStore &allTracklets,
                const linkTrackletsConfig &searchConfig,
-               std::map<ImageTime, TrackletTree > &trackletTimeToTreeMap,
+               std::map<ImageTime, TreeT > &trackletTimeToTreeMap,
                TrackSet &results)
 {
+    typedef typename std::map<ImageTime, TreeT>::const_iterator TreeMapIter;
+
     /* for every pair of trees, using the set of every intermediate
      * (temporally) tree as a set possible support nodes, call the
      * recursive linker.
@@ -1604,20 +2487,23 @@ void doLinking(const std::vector<MopsDetection> &allDetections,
      * doLinking, we start the searching with the head (i.e. root)
      * node of each tree.
      */
-    unsigned int imagePairs = 0;
-
     unsigned int numImages = trackletTimeToTreeMap.size();
 
-    std::map<ImageTime, TrackletTree >::const_iterator firstEndpointIter;
+    /* first just decide which image pairs to search; support nodes
+     * are gathered later, only for pairs which are about to be
+     * searched, since holding them for every pair at once could take
+     * a lot of memory.
+     */
+    std::vector<std::pair<TreeMapIter, TreeMapIter> > imagePairs;
+
+    TreeMapIter firstEndpointIter;
 
     for (firstEndpointIter = trackletTimeToTreeMap.begin(); 
          firstEndpointIter != trackletTimeToTreeMap.end(); 
          firstEndpointIter++)
     {
-        std::map<ImageTime, TrackletTree >::const_iterator 
-            secondEndpointIter;
-        std::map<ImageTime, TrackletTree >::const_iterator 
-            afterFirstIter = firstEndpointIter;
+        TreeMapIter secondEndpointIter;
+        TreeMapIter afterFirstIter = firstEndpointIter;
         afterFirstIter++;
 
 
@@ -1646,122 +2532,120 @@ void doLinking(const std::vector<MopsDetection> &allDetections,
                     if (secondEndpointIter->first.getMJD() 
                         - firstEndpointIter->first.getMJD() 
                         >= searchConfig.minEndpointTimeSeparation) {
+                        imagePairs.push_back(
+                            std::make_pair(firstEndpointIter, 
+                                           secondEndpointIter));
+                    }
+                }
+            }
+        }
+    }
 
-                        // get all intermediate points as support
-                        // nodes.
-                
-                        /* note that std::maps are sorted by their
-                         * key, which in this case is time.  ergo
-                         * between firstEndpointIter and
-                         * secondEndpointIter is *EVERY* tree (and
-                         * ergo every tracklet) which happened between
-                         * the first endpoint's tracklets and the
-                         * second endpoint's tracklets.
-                         */
-                
-                        std::vector<TreeNodeAndTime > supportPoints;
-                        std::map<ImageTime, TrackletTree >::const_iterator 
-                            supportPointIter;
-
-                        for (supportPointIter = afterFirstIter;
-                             supportPointIter != secondEndpointIter;
-                             supportPointIter++) {
-                    
-                            /* don't pass along second tracklets which
-                               are 'too close' to the endpoints; see
-                               linkTracklets.h for more comments */
-                            double firstToSup = supportPointIter->first.getMJD() 
-                                - firstEndpointIter->first.getMJD(); 
-                            double supToSecond =  secondEndpointIter->first.getMJD() 
-                                - supportPointIter->first.getMJD();
-                            if ((firstToSup > 
-                                 searchConfig.minSupportToEndpointTimeSeparation) 
-                                && 
-                                (supToSecond > 
-                                 searchConfig.minSupportToEndpointTimeSeparation)) 
-                            {
-                                
-                                TreeNodeAndTime tmpTAT(supportPointIter->second.getRootNode(),
-                                                       supportPointIter->first);
-                                supportPoints.push_back(tmpTAT);
-                            }
-                        }
-                
-
-                        TreeNodeAndTime firstEndpoint(firstEndpointIter->second.getRootNode(), 
-                                                      firstEndpointIter->first);
-                        TreeNodeAndTime secondEndpoint(secondEndpointIter->second.getRootNode(),
-                                                       secondEndpointIter->first);
-                
-                        //call the recursive linker with the endpoint
-                        //nodes and support point nodes.
-
-                        // use a cache to avoid doing math in
-                        // isCompatible!  we use a new cache for each
-                        // pair of endpoints, because isCompatible
-                        // projects the location of the endpoint
-                        // regions forward/backwards in time, so there
-                        // will be 0 reuse between pairs of endpoint
-                        // trees.
-
-                        double iterationTime = std::clock();
-                        if (searchConfig.myVerbosity.printStatus) {
-                            std::cout << "Looking for tracks between images at times " 
-                                      << std::setprecision(12) 
-                                      << firstEndpointIter->first.getMJD() 
-                                      << " (image " << firstEndpointIter->first.getImageId() 
-                                      << " / " << numImages << ")"
-                                      << " and " 
-                                      << std::setprecision(12)
-                                      << secondEndpointIter->first.getMJD()
-                                      << " (image " 
-                                      << secondEndpointIter->first.getImageId() 
-                                      << " / " << numImages << ") "
-                                      << " (with " 
-                                      << supportPoints.size() << " support images).\n";
-                            struct tm * timeinfo;
-                            time_t rawtime;
-                            time ( &rawtime );
-                            timeinfo = localtime ( &rawtime );                    
-                            
-                            std::cout << " current wall-clock time is " 
-                                      << asctime (timeinfo);
-
+    // the math in areMutuallyCompatible is cached (see
+    // CompatibilityCache) per thread rather than per pair of
+    // endpoint images; keys name the images, so entries from
+    // different pairs can share a cache without getting mixed up.
+    unsigned long cacheHits = 0;
+    unsigned long cacheMisses = 0;
+    unsigned long pairsTried = 0;
+    unsigned long pairsPrechecked = 0;
+
+    /* 
+     * every pair collects tracks in its own TrackSet, which is merged
+     * into results in the order the pairs were listed above.  This is
+     * done even when running serially, so that results (and the order
+     * in which they are written, for file output) are the same for
+     * any value of nThreads.
+     */
+    if (searchConfig.nThreads <= 1) {
+        LinkingTasks serialTasks(NULL, searchConfig, imageIndex, 
+                                 allDetections, allTracklets);
+        for (uint i = 0; i < imagePairs.size(); i++) {
+            std::unique_ptr<ImagePairJob<NodeRef> > job(
+                makeImagePairJob<NodeRef>(searchConfig, 
+                                 imagePairs[i].first, 
+                                 imagePairs[i].second,
+                                 &serialTasks));
+            linkImagePair(allDetections, allTracklets, searchConfig,
+                          numImages, *job);
+            mergeImagePairResults(*job, searchConfig, results);
+        }
+        serialTasks.getCacheStats(cacheHits, cacheMisses);
+        pairsTried = serialTasks.endpointPairsTried;
+        pairsPrechecked = serialTasks.endpointPairsPrechecked;
+    }
+    else {
+        /* pairs finish out of order, and finished pairs wait (holding
+         * their tracks) until every earlier pair has been merged.
+         * Don't let the pool run too far ahead of the oldest
+         * unfinished pair, or those waiting tracks could pile up.
+         */
+        const uint maxPairsInFlight = 4 * searchConfig.nThreads;
+        std::vector<std::unique_ptr<ImagePairJob<NodeRef> > > jobs(imagePairs.size());
+        LinkingTasks tasks(NULL, searchConfig, imageIndex, 
+                           allDetections, allTracklets);
+
+        // NB: the pool must be destroyed (which waits for its tasks)
+        // before jobs and tasks are.
+        WorkStealingPool pool(searchConfig.nThreads);
+        tasks.pool = &pool;
+        uint nSubmitted = 0;
+
+        for (uint nMerged = 0; nMerged < imagePairs.size(); nMerged++) {
+
+            while ((nSubmitted < imagePairs.size()) && 
+                   (nSubmitted < nMerged + maxPairsInFlight)) {
+                jobs[nSubmitted].reset(
+                    makeImagePairJob<NodeRef>(searchConfig, 
+                                     imagePairs[nSubmitted].first, 
+                                     imagePairs[nSubmitted].second,
+                                     &tasks));
+                ImagePairJob<NodeRef> * job = jobs[nSubmitted].get();
+                job->taskStarted();
+                pool.submit([&, job] {
+                        std::exception_ptr err;
+                        try {
+                            linkImagePair(allDetections, allTracklets, 
+                                          searchConfig, numImages, *job);
                         }
-                        imagePairs += 1;
-                        doLinkingRecurse(allDetections,
-                                         allTracklets, 
-                                         searchConfig,
-                                         firstEndpoint, 
-                                         secondEndpoint,
-                                         supportPoints,  
-                                         searchConfig.maxRAAccel*-1.,
-                                         searchConfig.maxRAAccel,
-                                         searchConfig.maxDecAccel*-1.,
-                                         searchConfig.maxDecAccel,
-                                         results, 
-                                         ITERATIONS_PER_SPLIT);
-
-                        if (searchConfig.myVerbosity.printStatus) {
-                            time_t rawtime;
-                            
-                            struct tm * timeinfo;
-                            std::cout << "That iteration took " 
-                                      << timeElapsed(iterationTime) << " seconds. "
-                                      << std::endl;
-                            std::cout << " so far, we have found " << 
-                                results.size() << " tracks.\n\n";
-                            time ( &rawtime );
-                            timeinfo = localtime ( &rawtime );                    
+                        catch (...) {
+                            err = std::current_exception();
                         }
-                    }
-                }
+                        job->taskDone(err);
+                    });
+                nSubmitted++;
             }
+
+            ImagePairJob<NodeRef> * oldest = jobs[nMerged].get();
+            {
+                std::unique_lock<std::mutex> guard(tasks.lock);
+                tasks.jobFinished.wait(guard, [oldest] { 
+                        return oldest->finished; });
+            }
+            mergeImagePairResults(*oldest, searchConfig, results);
+            jobs[nMerged].reset();
         }
+        pool.wait();
+        tasks.getCacheStats(cacheHits, cacheMisses);
+        pairsTried = tasks.endpointPairsTried;
+        pairsPrechecked = tasks.endpointPairsPrechecked;
     }
+
     if (searchConfig.myVerbosity.printVisitCounts) {
-        std::cout << "Found " << imagePairs << 
+        std::cout << "Found " << imagePairs.size() << 
             " valid start/end image pairs.\n";
+        if (searchConfig.compatibilityCacheSize > 0) {
+            unsigned long lookups = cacheHits + cacheMisses;
+            std::cout << "Compatibility cache: " << cacheHits << 
+                " hits in " << lookups << " lookups (hit rate " << 
+                (lookups > 0 ? 100. * cacheHits / lookups : 0.) << "%).\n";
+        }
+        if (searchConfig.useEndpointPrecheck) {
+            std::cout << "Endpoint pre-check: rejected " << pairsPrechecked <<
+                " of " << pairsTried << " endpoint tracklet pairs (" <<
+                (pairsTried > 0 ? 100. * pairsPrechecked / pairsTried : 0.) 
+                      << "%).\n";
+        }
     }
 }
 
@@ -1775,6 +2659,29 @@ void doLinking(const std::vector<MopsDetection> &allDetections,
 TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
                         std::vector<Tracklet> &queryTracklets,
                         const linkTrackletsConfig &searchConfig) {
+    TrackletStore store(queryTracklets);
+    TrackSet * toRet = linkTracklets(allDetections, store, searchConfig);
+    // pass the velocities and IDs back, as callers may expect.
+    for (uint i = 0; i < queryTracklets.size(); i++) {
+        std::vector<double> raP0Vel(2);
+        raP0Vel[0] = store.getRa0(i);
+        raP0Vel[1] = store.getRaVelocity(i);
+        std::vector<double> decP0Vel(2);
+        decP0Vel[0] = store.getDec0(i);
+        decP0Vel[1] = store.getDecVelocity(i);
+        queryTracklets[i].setBestFitFunctionRa(raP0Vel);
+        queryTracklets[i].setBestFitFunctionDec(decP0Vel);
+        queryTracklets[i].setId(store.getId(i));
+    }
+    return toRet;
+}
+
+
+
+/* an empty TrackSet, which keeps or writes tracks as
+ * searchConfig.outputMethod asks. */
+static TrackSet* makeOutputTrackSet(const linkTrackletsConfig &searchConfig)
+{
     TrackSet * toRet;
     if (searchConfig.outputMethod == trackOutputMethod::RETURN_TRACKS) {
         toRet = new TrackSet();
@@ -1789,12 +2696,26 @@ TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
                              true, 
                              searchConfig.outputBufferSize);
     }
+    else if (searchConfig.outputMethod == trackOutputMethod::IDS_FILE_ASYNC) {
+        toRet = new TrackSet(searchConfig.outputFile,
+                             false,
+                             searchConfig.outputBufferSize,
+                             true);
+    }
     else {
         throw LSST_EXCEPT(BadParameterException, 
       "linkTracklets: got unknown or unimplemented output method.");
     }
+    return toRet;
+}
+
 
 
+TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
+                        TrackletStore &queryTracklets,
+                        const linkTrackletsConfig &searchConfig) {
+    TrackSet * toRet = makeOutputTrackSet(searchConfig);
+
     /*create a sorted list of KDtrees, each tree holding tracklets
       with unique start times (times of first detection in the
       tracklet).
@@ -1803,6 +2724,18 @@ TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
       DecVelocity] and the returned keys are indices into
       queryTracklets.
     */
+    if (searchConfig.myVerbosity.printStatus) {
+        std::cout << "Numbering images and nights.\n";
+    }
+    ImageIndex imageIndex;
+    if (searchConfig.allImageMjds.empty()) {
+        imageIndex = ImageIndex(allDetections);
+    }
+    else {
+        imageIndex = ImageIndex(allDetections, searchConfig.allImageMjds);
+    }
+    imageIndex.labelDetections(allDetections);
+
     if (searchConfig.myVerbosity.printStatus) {
         std::cout << "Recentering all detections on (180, 0).\n";
     }
@@ -1818,6 +2751,7 @@ TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
     }
     std::map<ImageTime, TrackletTree > trackletTimeToTreeMap;    
     makeTrackletTimeToTreeMap(allDetections, 
+                              imageIndex,
                               queryTracklets, 
                               trackletTimeToTreeMap, 
                               searchConfig);
@@ -1827,11 +2761,37 @@ TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
 
     clock_t linkingStart = std::clock();
 
-    doLinking(allDetections, 
-              queryTracklets, 
-              searchConfig, 
-              trackletTimeToTreeMap, 
-              *toRet);
+    if (searchConfig.useFlatTrackletTrees) {
+        clock_t flattenStart = std::clock();
+        std::map<ImageTime, FlatTrackletTree> flatTreeMap;
+        std::map<ImageTime, TrackletTree >::iterator treeIter;
+        for (treeIter = trackletTimeToTreeMap.begin(); 
+             treeIter != trackletTimeToTreeMap.end();
+             treeIter++) {
+            flatTreeMap.emplace(treeIter->first, 
+                                FlatTrackletTree(treeIter->second));
+        }
+        // the pointer-based trees are no longer needed.
+        trackletTimeToTreeMap.clear();
+        if (searchConfig.myVerbosity.printStatus) {
+            std::cout << "Flattening trees took " 
+                      << timeElapsed(flattenStart) << " seconds.\n";
+        }
+        doLinking<FlatTrackletTree::NodeRef>(allDetections, 
+                                             imageIndex,
+                                             queryTracklets, 
+                                             searchConfig, 
+                                             flatTreeMap, 
+                                             *toRet);
+    }
+    else {
+        doLinking<TrackletTreeNodeRef>(allDetections, 
+                                       imageIndex,
+                                       queryTracklets, 
+                                       searchConfig, 
+                                       trackletTimeToTreeMap, 
+                                       *toRet);
+    }
     if (searchConfig.myVerbosity.printStatus) {
         std::cout << "Finished linking.\n";
     }
@@ -1844,6 +2804,132 @@ TrackSet* linkTracklets(std::vector<MopsDetection> &allDetections,
 }
 
 
+TrackSet* linkTrackletsIncremental(std::vector<MopsDetection> &newDetections,
+                                   TrackletStore &newTracklets,
+                                   const linkTrackletsConfig &searchConfig) {
+    if (searchConfig.incrementalStateDir.empty()) {
+        throw LSST_EXCEPT(BadParameterException,
+      "linkTrackletsIncremental: no incrementalStateDir was given.");
+    }
+    TrackSet * toRet = makeOutputTrackSet(searchConfig);
+    if (newDetections.empty()) {
+        return toRet;
+    }
+    std::unique_ptr<TrackSet> results(toRet);
+    const std::string &stateDir = searchConfig.incrementalStateDir;
+
+    double firstNewMjd = newDetections[0].getEpochMJD();
+    double lastNewMjd = firstNewMjd;
+    for (uint i = 1; i < newDetections.size(); i++) {
+        firstNewMjd = std::min(firstNewMjd, newDetections[i].getEpochMJD());
+        lastNewMjd = std::max(lastNewMjd, newDetections[i].getEpochMJD());
+    }
+    double windowStart = lastNewMjd - searchConfig.incrementalWindowDays;
+
+    LinkingState state(searchConfig.skyCenterRa, searchConfig.skyCenterDec,
+                       searchConfig.detectionLocationErrorThresh,
+                       searchConfig.leafSize);
+    if (LinkingState::exists(stateDir)) {
+        if (searchConfig.myVerbosity.printStatus) {
+            std::cout << "Reading the linking state in " << stateDir << ".\n";
+        }
+        state.read(stateDir, windowStart);
+    }
+    uint firstNewImage = state.images.size();
+
+    if (searchConfig.myVerbosity.printStatus) {
+        std::cout << "Recentering new detections on (180, 0).\n";
+    }
+    recenterDetections(newDetections, searchConfig);
+    uint firstNewTracklet = state.addImages(newDetections, newTracklets);
+
+    if (searchConfig.myVerbosity.printStatus) {
+        std::cout << "Setting new tracklet velocities and creating trees.\n";
+    }
+    setTrackletVelocities(state.detections, state.tracklets, firstNewTracklet);
+    for (uint image = firstNewImage; image < state.images.size(); image++) {
+        LinkingState::Image &thisImage = state.images[image];
+        if (thisImage.numTracklets == 0) {
+            continue;
+        }
+        std::vector<uint> trackletIndices(thisImage.numTracklets);
+        for (uint i = 0; i < thisImage.numTracklets; i++) {
+            trackletIndices[i] = thisImage.firstTracklet + i;
+        }
+        TrackletTree tree(state.tracklets,
+                          trackletIndices.data(),
+                          trackletIndices.data() + trackletIndices.size(),
+                          searchConfig.detectionLocationErrorThresh,
+                          searchConfig.detectionLocationErrorThresh,
+                          searchConfig.leafSize);
+        thisImage.tree.reset(new FlatTrackletTree(tree));
+    }
+    state.writeNewImages(stateDir);
+
+    // number the window's images and nights, and hand the trees over
+    // to the linker.
+    ImageIndex imageIndex;
+    if (searchConfig.allImageMjds.empty()) {
+        imageIndex = ImageIndex(state.detections);
+    }
+    else {
+        std::vector<double> windowImageMjds;
+        for (uint i = 0; i < searchConfig.allImageMjds.size(); i++) {
+            if (searchConfig.allImageMjds[i] >= windowStart) {
+                windowImageMjds.push_back(searchConfig.allImageMjds[i]);
+            }
+        }
+        imageIndex = ImageIndex(state.detections, windowImageMjds);
+    }
+    imageIndex.labelDetections(state.detections);
+    std::map<ImageTime, FlatTrackletTree> flatTreeMap;
+    for (uint image = 0; image < state.images.size(); image++) {
+        LinkingState::Image &thisImage = state.images[image];
+        if (!thisImage.tree) {
+            continue;
+        }
+        uint indexImage = imageIndex.getImageOfDetection(thisImage.firstDetection);
+        flatTreeMap.emplace(ImageTime(imageIndex.getImageMJD(indexImage),
+                                      indexImage,
+                                      imageIndex.getNightOfImage(indexImage)),
+                            std::move(*thisImage.tree));
+        thisImage.tree.reset();
+    }
+
+    // only look for tracks which end in a new image; the others were
+    // looked for in earlier runs.
+    linkTrackletsConfig incrementalConfig = searchConfig;
+    incrementalConfig.restrictTrackEndTimes = true;
+    if (!searchConfig.restrictTrackEndTimes ||
+        (searchConfig.earliestLastEndpointTime < firstNewMjd)) {
+        incrementalConfig.earliestLastEndpointTime = firstNewMjd;
+    }
+
+    if (searchConfig.myVerbosity.printStatus) {
+        std::cout << "Doing the linking, with " << state.images.size() 
+                  << " images in the window, " 
+                  << state.images.size() - firstNewImage << " of them new.\n";
+    }
+    clock_t linkingStart = std::clock();
+    doLinking<FlatTrackletTree::NodeRef>(state.detections,
+                                         imageIndex,
+                                         state.tracklets,
+                                         incrementalConfig,
+                                         flatTreeMap,
+                                         *results);
+    if (searchConfig.myVerbosity.printVisitCounts) {
+        double linkingTime = timeElapsed(linkingStart);
+        std::cout << "Linking took " << linkingTime << " seconds.\n";        
+    }
+
+    // only now is the run done, so only now are the new images part of
+    // the state.
+    state.writeIndex(stateDir);
+    return results.release();
+}
+
+
+
 void calculateTopoCorr(std::vector<MopsDetection> &allDetections,
                        const linkTrackletsConfig &searchConfig) {
 
@@ -0,0 +1,489 @@
+// -*- LSST-C++ -*-
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+// for fork and waitpid
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lsst/mops/Exceptions.h"
+#include "lsst/mops/ChunkedTextReader.h"
+#include "lsst/mops/TrackSet.h"
+#include "lsst/mops/daymops/linkTracklets/skyTiles.h"
+
+#define uint unsigned int
+
+namespace lsst {
+namespace mops {
+
+
+SkyTiling::SkyTiling(uint nRaTiles, uint nDecTiles,
+                     double raHalo, double decHalo)
+{
+    if ((nRaTiles < 1) || (nDecTiles < 1) || (raHalo < 0) || (decHalo < 0)) {
+        throw LSST_EXCEPT(BadParameterException,
+                          "SkyTiling: need at least one tile in RA and Dec, and halos >= 0.");
+    }
+    this->nRaTiles = nRaTiles;
+    this->nDecTiles = nDecTiles;
+    this->raHalo = raHalo;
+    this->decHalo = decHalo;
+}
+
+
+
+double SkyTiling::getRaMin(uint tile) const
+{
+    return (tile % nRaTiles) * getRaWidth();
+}
+
+
+
+double SkyTiling::getDecMin(uint tile) const
+{
+    return -90. + (tile / nRaTiles) * getDecWidth();
+}
+
+
+
+double SkyTiling::getCenterRa(uint tile) const
+{
+    return getRaMin(tile) + getRaWidth() / 2.;
+}
+
+
+
+double SkyTiling::getCenterDec(uint tile) const
+{
+    return getDecMin(tile) + getDecWidth() / 2.;
+}
+
+
+
+uint SkyTiling::getTileOfPoint(double RA, double Dec) const
+{
+    double wrappedRa = RA - 360. * floor(RA / 360.);
+    uint raIndex = std::min((uint) (wrappedRa / getRaWidth()), nRaTiles - 1);
+    double decPosition = floor((Dec + 90.) / getDecWidth());
+    uint decIndex = 0;
+    if (decPosition > 0) {
+        decIndex = std::min((uint) decPosition, nDecTiles - 1);
+    }
+    return decIndex * nRaTiles + raIndex;
+}
+
+
+
+bool SkyTiling::isInTileOrHalo(uint tile, double RA, double Dec) const
+{
+    double decMin = getDecMin(tile);
+    if ((Dec < decMin - decHalo) || (Dec > decMin + getDecWidth() + decHalo)) {
+        return false;
+    }
+    double maxRaOffset = getRaWidth() / 2. + raHalo;
+    if (maxRaOffset >= 180.) {
+        return true;
+    }
+    double raOffset = RA - getCenterRa(tile);
+    raOffset -= 360. * floor((raOffset + 180.) / 360.);
+    return fabs(raOffset) <= maxRaOffset;
+}
+
+
+
+/* the first and last detections of tracklet i, by time. */
+static void getTrackletEnds(const std::vector<MopsDetection> &allDetections,
+                            const TrackletStore &queryTracklets,
+                            uint i,
+                            const MopsDetection *&first,
+                            const MopsDetection *&last)
+{
+    first = &allDetections.at(*queryTracklets.indicesBegin(i));
+    last = first;
+    for (const uint *detIter = queryTracklets.indicesBegin(i);
+         detIter != queryTracklets.indicesEnd(i);
+         detIter++) {
+        const MopsDetection *det = &allDetections.at(*detIter);
+        if (det->getEpochMJD() < first->getEpochMJD()) {
+            first = det;
+        }
+        if (det->getEpochMJD() > last->getEpochMJD()) {
+            last = det;
+        }
+    }
+}
+
+
+
+void getSkyTileHalos(const std::vector<MopsDetection> &allDetections,
+                     const TrackletStore &queryTracklets,
+                     const linkTrackletsConfig &searchConfig,
+                     const skyTilesConfig &tilesConfig,
+                     double &raHalo, double &decHalo)
+{
+    double window = 0;
+    if (allDetections.size() > 0) {
+        double firstTime = allDetections[0].getEpochMJD();
+        double lastTime = firstTime;
+        for (uint i = 1; i < allDetections.size(); i++) {
+            firstTime = std::min(firstTime, allDetections[i].getEpochMJD());
+            lastTime = std::max(lastTime, allDetections[i].getEpochMJD());
+        }
+        window = lastTime - firstTime;
+    }
+
+    double maxRaVelocity = 0;
+    double maxDecVelocity = 0;
+    if (tilesConfig.maxVelocity > 0) {
+        maxRaVelocity = tilesConfig.maxVelocity;
+        maxDecVelocity = tilesConfig.maxVelocity;
+    }
+    else {
+        for (uint i = 0; i < queryTracklets.size(); i++) {
+            const MopsDetection *first;
+            const MopsDetection *last;
+            getTrackletEnds(allDetections, queryTracklets, i, first, last);
+            double dt = last->getEpochMJD() - first->getEpochMJD();
+            if (dt <= 0) {
+                continue;
+            }
+            double dRa = last->getRA() - first->getRA();
+            dRa -= 360. * floor((dRa + 180.) / 360.);
+            double dDec = last->getDec() - first->getDec();
+            maxRaVelocity = std::max(maxRaVelocity, fabs(dRa) / dt);
+            maxDecVelocity = std::max(maxDecVelocity, fabs(dDec) / dt);
+        }
+    }
+
+    double margin = searchConfig.trackAdditionThreshold + tilesConfig.haloPadding;
+    raHalo = maxRaVelocity * window
+        + .5 * searchConfig.maxRAAccel * window * window + margin;
+    decHalo = maxDecVelocity * window
+        + .5 * searchConfig.maxDecAccel * window * window + margin;
+}
+
+
+
+void getSkyTileInput(const std::vector<MopsDetection> &allDetections,
+                     const TrackletStore &queryTracklets,
+                     const SkyTiling &tiling,
+                     uint tile,
+                     std::vector<MopsDetection> &tileDetections,
+                     TrackletStore &tileTracklets,
+                     std::vector<bool> &startsInTile)
+{
+    // find the tracklets wholly inside the tile and halo, and mark
+    // their detections.
+    static const uint NOT_IN_TILE = (uint) -1;
+    std::vector<uint> newDetIndices(allDetections.size(), NOT_IN_TILE);
+    std::vector<uint> tileTrackletIndices;
+    for (uint i = 0; i < queryTracklets.size(); i++) {
+        bool inside = true;
+        for (const uint *detIter = queryTracklets.indicesBegin(i);
+             inside && (detIter != queryTracklets.indicesEnd(i));
+             detIter++) {
+            const MopsDetection &det = allDetections.at(*detIter);
+            inside = tiling.isInTileOrHalo(tile, det.getRA(), det.getDec());
+        }
+        if (inside) {
+            tileTrackletIndices.push_back(i);
+            for (const uint *detIter = queryTracklets.indicesBegin(i);
+                 detIter != queryTracklets.indicesEnd(i);
+                 detIter++) {
+                newDetIndices[*detIter] = 0;
+            }
+        }
+    }
+
+    tileDetections.clear();
+    startsInTile.clear();
+    for (uint i = 0; i < allDetections.size(); i++) {
+        if (newDetIndices[i] == NOT_IN_TILE) {
+            continue;
+        }
+        newDetIndices[i] = tileDetections.size();
+        tileDetections.push_back(allDetections[i]);
+        startsInTile.push_back(
+            tiling.getTileOfPoint(allDetections[i].getRA(),
+                                  allDetections[i].getDec()) == tile);
+    }
+
+    tileTracklets.clear();
+    std::vector<uint> indices;
+    for (uint t = 0; t < tileTrackletIndices.size(); t++) {
+        uint i = tileTrackletIndices[t];
+        indices.clear();
+        for (const uint *detIter = queryTracklets.indicesBegin(i);
+             detIter != queryTracklets.indicesEnd(i);
+             detIter++) {
+            indices.push_back(newDetIndices[*detIter]);
+        }
+        uint newIndex = tileTracklets.addTracklet(indices.data(),
+                                                  indices.data() + indices.size());
+        tileTracklets.setId(newIndex, queryTracklets.getId(i));
+        tileTracklets.setCollapsed(newIndex, queryTracklets.isCollapsed(i));
+    }
+}
+
+
+
+/* the times of all the detections, for linkTrackletsConfig::allImageMjds. */
+static void getAllImageMjds(const std::vector<MopsDetection> &allDetections,
+                            std::vector<double> &imageMjds)
+{
+    imageMjds.resize(allDetections.size());
+    for (uint i = 0; i < allDetections.size(); i++) {
+        imageMjds[i] = allDetections[i].getEpochMJD();
+    }
+    std::sort(imageMjds.begin(), imageMjds.end());
+    imageMjds.erase(std::unique(imageMjds.begin(), imageMjds.end()),
+                    imageMjds.end());
+}
+
+
+
+uint linkSkyTile(const std::vector<MopsDetection> &allDetections,
+                 const TrackletStore &queryTracklets,
+                 const linkTrackletsConfig &searchConfig,
+                 const SkyTiling &tiling,
+                 uint tile,
+                 const std::string &outFileName)
+{
+    if (tile >= tiling.getNumTiles()) {
+        throw LSST_EXCEPT(BadParameterException,
+                          "linkSkyTile: no such tile.");
+    }
+    std::vector<MopsDetection> tileDetections;
+    TrackletStore tileTracklets;
+    std::vector<bool> startsInTile;
+    getSkyTileInput(allDetections, queryTracklets, tiling, tile,
+                    tileDetections, tileTracklets, startsInTile);
+
+    linkTrackletsConfig tileConfig = searchConfig;
+    tileConfig.skyCenterRa = tiling.getCenterRa(tile);
+    tileConfig.skyCenterDec = tiling.getCenterDec(tile);
+    tileConfig.outputMethod = trackOutputMethod::RETURN_TRACKS;
+    tileConfig.outputFile = "";
+    if (tileConfig.allImageMjds.empty()) {
+        getAllImageMjds(allDetections, tileConfig.allImageMjds);
+    }
+    if (searchConfig.myVerbosity.printStatus) {
+        std::cout << "Linking sky tile " << tile << " (center "
+                  << tileConfig.skyCenterRa << ", " << tileConfig.skyCenterDec
+                  << "): " << tileTracklets.size() << " tracklets.\n";
+    }
+
+    // the TrackSet appends to its file.
+    std::remove(outFileName.c_str());
+    TrackSet outTracks(outFileName, false, 0);
+    uint nWritten = 0;
+    if (tileTracklets.size() == 0) {
+        return nWritten;
+    }
+    TrackSet *tileTracks = linkTracklets(tileDetections, tileTracklets, tileConfig);
+
+    // keep the tracks whose first detection is in this tile; any
+    // others belong to another.
+    std::set<Track>::const_iterator trackIter;
+    for (trackIter = tileTracks->componentTracks.begin();
+         trackIter != tileTracks->componentTracks.end();
+         trackIter++) {
+        const Track::IndexSet &detIndices = trackIter->getComponentDetectionIndices();
+        Track::IndexSet::const_iterator detIter = detIndices.begin();
+        uint firstDet = *detIter;
+        for (; detIter != detIndices.end(); detIter++) {
+            if (tileDetections[*detIter].getEpochMJD() <
+                tileDetections[firstDet].getEpochMJD()) {
+                firstDet = *detIter;
+            }
+        }
+        if (startsInTile[firstDet]) {
+            outTracks.insert(*trackIter);
+            nWritten++;
+        }
+    }
+    delete tileTracks;
+    return nWritten;
+}
+
+
+
+uint mergeTrackFiles(const std::vector<std::string> &inFileNames,
+                     const std::string &outFileName)
+{
+    std::ofstream outFile(outFileName.c_str(),
+                          std::ios_base::out | std::ios_base::trunc);
+    if (!outFile) {
+        throw LSST_EXCEPT(FileException,
+                          "mergeTrackFiles: failed to open " + outFileName + "\n");
+    }
+    std::set<std::vector<uint> > seenTracks;
+    std::vector<uint> ids;
+    uint nWritten = 0;
+    for (uint f = 0; f < inFileNames.size(); f++) {
+        std::ifstream inFile(inFileNames[f].c_str());
+        if (!inFile) {
+            throw LSST_EXCEPT(FileException,
+                              "mergeTrackFiles: failed to open " + inFileNames[f]
+                              + " - does this file exist?\n");
+        }
+        std::string line;
+        while (std::getline(inFile, line)) {
+            const char *pos = line.data();
+            const char *end = pos + line.size();
+            ids.clear();
+            uint id;
+            while (parseNextValue(pos, end, id)) {
+                ids.push_back(id);
+            }
+            if (!onlyBlanksLeft(pos, end)) {
+                throw LSST_EXCEPT(InputFileFormatErrorException,
+                                  "mergeTrackFiles: bad line in " + inFileNames[f] + "\n");
+            }
+            if (ids.empty()) {
+                continue;
+            }
+            std::sort(ids.begin(), ids.end());
+            if (!seenTracks.insert(ids).second) {
+                continue;
+            }
+            for (uint i = 0; i < ids.size(); i++) {
+                outFile << ids[i] << " ";
+            }
+            outFile << '\n';
+            nWritten++;
+        }
+    }
+    outFile.flush();
+    outFile.close();
+    return nWritten;
+}
+
+
+
+/* wait for the longest-running tile process, noting the tile if it
+ * failed. */
+static void waitForSkyTile(std::deque<std::pair<pid_t, uint> > &running,
+                           std::vector<uint> &failedTiles)
+{
+    int status;
+    pid_t pid = running.front().first;
+    while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR)) {
+    }
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+        failedTiles.push_back(running.front().second);
+    }
+    running.pop_front();
+}
+
+
+
+uint linkTrackletsInSkyTiles(const std::vector<MopsDetection> &allDetections,
+                             const TrackletStore &queryTracklets,
+                             const linkTrackletsConfig &searchConfig,
+                             const skyTilesConfig &tilesConfig)
+{
+    if (searchConfig.outputFile == "") {
+        throw LSST_EXCEPT(BadParameterException,
+                          "linkTrackletsInSkyTiles: need an outputFile.");
+    }
+    double raHalo, decHalo;
+    getSkyTileHalos(allDetections, queryTracklets, searchConfig, tilesConfig,
+                    raHalo, decHalo);
+    SkyTiling tiling(tilesConfig.nRaTiles, tilesConfig.nDecTiles,
+                     raHalo, decHalo);
+    if (searchConfig.myVerbosity.printStatus) {
+        std::cout << "Linking in " << tiling.getNumTiles()
+                  << " sky tiles with halos of " << raHalo << " deg (RA), "
+                  << decHalo << " deg (Dec).\n";
+    }
+
+    // number the nights once, for all tiles.
+    linkTrackletsConfig tileConfig = searchConfig;
+    if (tileConfig.allImageMjds.empty()) {
+        getAllImageMjds(allDetections, tileConfig.allImageMjds);
+    }
+
+    uint nProcesses = tilesConfig.nProcesses;
+    if (nProcesses == 0) {
+        nProcesses = std::thread::hardware_concurrency();
+    }
+    if (nProcesses == 0) {
+        nProcesses = 1;
+    }
+
+    std::vector<std::string> tileFileNames;
+    std::deque<std::pair<pid_t, uint> > running;
+    std::vector<uint> failedTiles;
+    for (uint tile = 0; tile < tiling.getNumTiles(); tile++) {
+        std::string tileFileName = searchConfig.outputFile + ".tile"
+            + std::to_string(tile);
+        tileFileNames.push_back(tileFileName);
+        if (running.size() >= nProcesses) {
+            waitForSkyTile(running, failedTiles);
+        }
+        // or the children would print whatever is buffered again.
+        std::cout.flush();
+        std::cerr.flush();
+        pid_t pid = fork();
+        if (pid < 0) {
+            while (!running.empty()) {
+                waitForSkyTile(running, failedTiles);
+            }
+            throw LSST_EXCEPT(MemoryException,
+                              "linkTrackletsInSkyTiles: could not start a process for a tile.");
+        }
+        if (pid == 0) {
+            int status = 0;
+            try {
+                linkSkyTile(allDetections, queryTracklets, tileConfig,
+                            tiling, tile, tileFileName);
+            }
+            catch (std::exception &e) {
+                std::cerr << "linkTrackletsInSkyTiles: tile " << tile
+                          << " failed: " << e.what() << "\n";
+                status = 1;
+            }
+            catch (...) {
+                status = 1;
+            }
+            std::cout.flush();
+            std::cerr.flush();
+            // skip the parent's exit handlers and destructors.
+            _exit(status);
+        }
+        running.push_back(std::make_pair(pid, tile));
+    }
+    while (!running.empty()) {
+        waitForSkyTile(running, failedTiles);
+    }
+    if (failedTiles.size() > 0) {
+        throw LSST_EXCEPT(ProgrammerErrorException,
+                          "linkTrackletsInSkyTiles: linking failed for sky tile "
+                          + std::to_string(failedTiles[0]) + "\n");
+    }
+
+    uint nTracks = mergeTrackFiles(tileFileNames, searchConfig.outputFile);
+    if (!tilesConfig.keepTileFiles) {
+        for (uint i = 0; i < tileFileNames.size(); i++) {
+            std::remove(tileFileNames[i].c_str());
+        }
+    }
+    if (searchConfig.myVerbosity.printStatus) {
+        std::cout << "Merged sky tiles: " << nTracks << " tracks.\n";
+    }
+    return nTracks;
+}
+
+
+
+}} // close namespace lsst::mops
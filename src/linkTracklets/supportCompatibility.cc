@@ -0,0 +1,340 @@
+// -*- LSST-C++ -*-
+
+#include <limits>
+
+#include "lsst/mops/daymops/linkTracklets/supportCompatibility.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MOPS_AVX2_SUPPORT_KERNEL 1
+#include <immintrin.h>
+#endif
+
+#define uint unsigned int
+
+namespace lsst { namespace mops {
+
+
+
+void SupportBatch::clear()
+{
+    for (uint axis = 0; axis < 4; axis++) {
+        lBounds[axis].clear();
+        uBounds[axis].clear();
+    }
+    mjd.clear();
+    firstWindows.clear();
+    secondWindows.clear();
+    survivors.clear();
+    accMinRa.clear();
+    accMaxRa.clear();
+    accMinDec.clear();
+    accMaxDec.clear();
+}
+
+
+
+void SupportBatch::add(const double newLBounds[4], const double newUBounds[4],
+                       double newMjd)
+{
+    for (uint axis = 0; axis < 4; axis++) {
+        lBounds[axis].push_back(newLBounds[axis]);
+        uBounds[axis].push_back(newUBounds[axis]);
+    }
+    mjd.push_back(newMjd);
+}
+
+
+
+/*
+ * tighten aMin, aMax (indexed 0 for RA, 1 for Dec) using the bounds of
+ * node A and the later node B, dt days apart.  Same formulas, in the
+ * same order, as updateAccBoundsReturnValidity.
+ */
+static void tightenAccBounds(const double Al[4], const double Au[4],
+                             const double Bl[4], const double Bu[4],
+                             double dt, double aMin[2], double aMax[2])
+{
+    double dt2 = 2./(dt*dt);
+    double dti = 1./(dt);
+    double tmpAcc;
+    for (uint d = 0; d < 2; d++) {
+        // d is the position axis, v the matching velocity axis.
+        uint v = d + 2;
+        // velocity test
+        tmpAcc = (Bu[v] - Al[v]) * dti;
+        if (tmpAcc < aMax[d]) {
+            aMax[d] = tmpAcc;
+        }
+        tmpAcc = (Bl[v] - Au[v]) * dti;
+        if (tmpAcc > aMin[d]) {
+            aMin[d] = tmpAcc;
+        }
+        // pos/vel test 1
+        tmpAcc = dt2 * (Au[d] - Bl[d] + Bu[v] * dt);
+        if (tmpAcc < aMax[d]) {
+            aMax[d] = tmpAcc;
+        }
+        tmpAcc = dt2 * (Bl[d] - Au[d] - Au[v] * dt);
+        if (tmpAcc > aMin[d]) {
+            aMin[d] = tmpAcc;
+        }
+        // pos/vel test 2
+        tmpAcc = dt2 * (Bu[d] - Al[d] - Al[v] * dt);
+        if (tmpAcc < aMax[d]) {
+            aMax[d] = tmpAcc;
+        }
+        tmpAcc = dt2 * (Al[d] - Bu[d] + Bl[v] * dt);
+        if (tmpAcc > aMin[d]) {
+            aMin[d] = tmpAcc;
+        }
+    }
+}
+
+
+
+AccWindow pairAccWindow(const double aLBounds[4], 
+                        const double aUBounds[4],
+                        const double bLBounds[4], 
+                        const double bUBounds[4],
+                        double dt)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    double aMin[2] = {-inf, -inf};
+    double aMax[2] = {inf, inf};
+    tightenAccBounds(aLBounds, aUBounds, bLBounds, bUBounds, dt, aMin, aMax);
+    AccWindow w;
+    w.minRa = aMin[0];
+    w.maxRa = aMax[0];
+    w.minDec = aMin[1];
+    w.maxDec = aMax[1];
+    return w;
+}
+
+
+
+/*
+ * the windows of node i of batch are in place; intersect them with the
+ * starting bounds and record the result.
+ *
+ * updateAccBoundsReturnValidity gives up as soon as the bounds are
+ * empty, but every step only ever raises aMin and lowers aMax, so
+ * checking once at the end gives the same answer.
+ */
+static bool applyWindows(SupportBatch &batch, uint i,
+                         double accMinRa, double accMaxRa,
+                         double accMinDec, double accMaxDec)
+{
+    batch.firstWindows[i].applyTo(accMinRa, accMaxRa, accMinDec, accMaxDec);
+    bool valid = batch.secondWindows[i].applyTo(accMinRa, accMaxRa, 
+                                                accMinDec, accMaxDec);
+    batch.survivors[i] = valid;
+    batch.accMinRa[i] = accMinRa;
+    batch.accMaxRa[i] = accMaxRa;
+    batch.accMinDec[i] = accMinDec;
+    batch.accMaxDec[i] = accMaxDec;
+    return valid;
+}
+
+
+
+/*
+ * test support nodes [start, end) of batch one at a time.
+ */
+static uint findCompatibleSupportScalar(const EndpointBounds &first,
+                                        const EndpointBounds &second,
+                                        double accMinRa, double accMaxRa,
+                                        double accMinDec, double accMaxDec,
+                                        SupportBatch &batch,
+                                        uint start, uint end)
+{
+    uint nSurvivors = 0;
+    for (uint i = start; i < end; i++) {
+        double supL[4];
+        double supU[4];
+        for (uint axis = 0; axis < 4; axis++) {
+            supL[axis] = batch.lBounds[axis][i];
+            supU[axis] = batch.uBounds[axis][i];
+        }
+        batch.firstWindows[i] = pairAccWindow(first.lBounds, first.uBounds, 
+                                              supL, supU,
+                                              batch.mjd[i] - first.mjd);
+        batch.secondWindows[i] = pairAccWindow(supL, supU, 
+                                               second.lBounds, second.uBounds,
+                                               second.mjd - batch.mjd[i]);
+        if (applyWindows(batch, i, accMinRa, accMaxRa, accMinDec, accMaxDec)) {
+            nSurvivors++;
+        }
+    }
+    return nSurvivors;
+}
+
+
+
+#ifdef MOPS_AVX2_SUPPORT_KERNEL
+
+/*
+ * tightenAccBounds for four (A, B) pairs at once.  Only AVX2 is
+ * enabled, not FMA, so the compiler can't fuse the multiply-adds and
+ * each lane rounds exactly as the scalar code does.  _mm256_min_pd(x, y)
+ * is (x < y ? x : y), which matches the scalar updates even for NaNs.
+ */
+static inline __attribute__((target("avx2"), always_inline))
+void tightenAccBoundsAvx2(const __m256d Al[4], const __m256d Au[4],
+                          const __m256d Bl[4], const __m256d Bu[4],
+                          __m256d dt, __m256d aMin[2], __m256d aMax[2])
+{
+    __m256d dt2 = _mm256_div_pd(_mm256_set1_pd(2.), _mm256_mul_pd(dt, dt));
+    __m256d dti = _mm256_div_pd(_mm256_set1_pd(1.), dt);
+    __m256d tmpAcc;
+    for (uint d = 0; d < 2; d++) {
+        uint v = d + 2;
+        // velocity test
+        tmpAcc = _mm256_mul_pd(_mm256_sub_pd(Bu[v], Al[v]), dti);
+        aMax[d] = _mm256_min_pd(tmpAcc, aMax[d]);
+        tmpAcc = _mm256_mul_pd(_mm256_sub_pd(Bl[v], Au[v]), dti);
+        aMin[d] = _mm256_max_pd(tmpAcc, aMin[d]);
+        // pos/vel test 1
+        tmpAcc = _mm256_mul_pd(dt2,
+                     _mm256_add_pd(_mm256_sub_pd(Au[d], Bl[d]),
+                                   _mm256_mul_pd(Bu[v], dt)));
+        aMax[d] = _mm256_min_pd(tmpAcc, aMax[d]);
+        tmpAcc = _mm256_mul_pd(dt2,
+                     _mm256_sub_pd(_mm256_sub_pd(Bl[d], Au[d]),
+                                   _mm256_mul_pd(Au[v], dt)));
+        aMin[d] = _mm256_max_pd(tmpAcc, aMin[d]);
+        // pos/vel test 2
+        tmpAcc = _mm256_mul_pd(dt2,
+                     _mm256_sub_pd(_mm256_sub_pd(Bu[d], Al[d]),
+                                   _mm256_mul_pd(Al[v], dt)));
+        aMax[d] = _mm256_min_pd(tmpAcc, aMax[d]);
+        tmpAcc = _mm256_mul_pd(dt2,
+                     _mm256_add_pd(_mm256_sub_pd(Al[d], Bu[d]),
+                                   _mm256_mul_pd(Bl[v], dt)));
+        aMin[d] = _mm256_max_pd(tmpAcc, aMin[d]);
+    }
+}
+
+
+
+/*
+ * store four lanes' worth of windows to windows[i] .. windows[i + 3].
+ */
+static inline __attribute__((target("avx2"), always_inline))
+void storeWindowsAvx2(const __m256d aMin[2], const __m256d aMax[2],
+                      std::vector<AccWindow> &windows, uint i)
+{
+    double minRa[4], maxRa[4], minDec[4], maxDec[4];
+    _mm256_storeu_pd(minRa, aMin[0]);
+    _mm256_storeu_pd(maxRa, aMax[0]);
+    _mm256_storeu_pd(minDec, aMin[1]);
+    _mm256_storeu_pd(maxDec, aMax[1]);
+    for (uint lane = 0; lane < 4; lane++) {
+        AccWindow &w = windows[i + lane];
+        w.minRa = minRa[lane];
+        w.maxRa = maxRa[lane];
+        w.minDec = minDec[lane];
+        w.maxDec = maxDec[lane];
+    }
+}
+
+
+
+/*
+ * work out the windows of support nodes [0, end) four at a time; end
+ * must be a multiple of four.  Intersecting them with the starting
+ * bounds is left to the scalar code, which does very little work.
+ */
+static __attribute__((target("avx2")))
+void findWindowsAvx2(const EndpointBounds &first,
+                     const EndpointBounds &second,
+                     SupportBatch &batch, uint end)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    __m256d firstL[4], firstU[4], secondL[4], secondU[4];
+    for (uint axis = 0; axis < 4; axis++) {
+        firstL[axis] = _mm256_set1_pd(first.lBounds[axis]);
+        firstU[axis] = _mm256_set1_pd(first.uBounds[axis]);
+        secondL[axis] = _mm256_set1_pd(second.lBounds[axis]);
+        secondU[axis] = _mm256_set1_pd(second.uBounds[axis]);
+    }
+    __m256d firstMjd = _mm256_set1_pd(first.mjd);
+    __m256d secondMjd = _mm256_set1_pd(second.mjd);
+
+    for (uint i = 0; i < end; i += 4) {
+        __m256d supL[4], supU[4];
+        for (uint axis = 0; axis < 4; axis++) {
+            supL[axis] = _mm256_loadu_pd(&batch.lBounds[axis][i]);
+            supU[axis] = _mm256_loadu_pd(&batch.uBounds[axis][i]);
+        }
+        __m256d supMjd = _mm256_loadu_pd(&batch.mjd[i]);
+
+        __m256d aMin[2] = {_mm256_set1_pd(-inf), _mm256_set1_pd(-inf)};
+        __m256d aMax[2] = {_mm256_set1_pd(inf), _mm256_set1_pd(inf)};
+        tightenAccBoundsAvx2(firstL, firstU, supL, supU,
+                             _mm256_sub_pd(supMjd, firstMjd), aMin, aMax);
+        storeWindowsAvx2(aMin, aMax, batch.firstWindows, i);
+
+        aMin[0] = aMin[1] = _mm256_set1_pd(-inf);
+        aMax[0] = aMax[1] = _mm256_set1_pd(inf);
+        tightenAccBoundsAvx2(supL, supU, secondL, secondU,
+                             _mm256_sub_pd(secondMjd, supMjd), aMin, aMax);
+        storeWindowsAvx2(aMin, aMax, batch.secondWindows, i);
+    }
+}
+
+#endif
+
+
+
+bool haveSimdSupportKernel()
+{
+#ifdef MOPS_AVX2_SUPPORT_KERNEL
+    static const bool haveAvx2 = __builtin_cpu_supports("avx2");
+    return haveAvx2;
+#else
+    return false;
+#endif
+}
+
+
+
+unsigned int findCompatibleSupport(const EndpointBounds &firstEndpoint,
+                                   const EndpointBounds &secondEndpoint,
+                                   double accMinRa, double accMaxRa,
+                                   double accMinDec, double accMaxDec,
+                                   SupportBatch &batch,
+                                   bool allowSimd)
+{
+    uint n = batch.size();
+    batch.firstWindows.resize(n);
+    batch.secondWindows.resize(n);
+    batch.survivors.resize(n);
+    batch.accMinRa.resize(n);
+    batch.accMaxRa.resize(n);
+    batch.accMinDec.resize(n);
+    batch.accMaxDec.resize(n);
+
+    uint nSurvivors = 0;
+    uint nDone = 0;
+#ifdef MOPS_AVX2_SUPPORT_KERNEL
+    if (allowSimd && haveSimdSupportKernel()) {
+        nDone = n - (n % 4);
+        findWindowsAvx2(firstEndpoint, secondEndpoint, batch, nDone);
+        for (uint i = 0; i < nDone; i++) {
+            if (applyWindows(batch, i, accMinRa, accMaxRa, 
+                             accMinDec, accMaxDec)) {
+                nSurvivors++;
+            }
+        }
+    }
+#endif
+    nSurvivors += findCompatibleSupportScalar(firstEndpoint, secondEndpoint,
+                                              accMinRa, accMaxRa,
+                                              accMinDec, accMaxDec,
+                                              batch, nDone, n);
+    return nSurvivors;
+}
+
+
+
+}} // close namespace lsst::mops
@@ -17,13 +17,13 @@ namespace lsst {
 
 // "internal" declarations
 
-KDTree<unsigned int> buildKDTree(const std::vector<Orbit>);
+KDTree<unsigned int, 6> buildKDTree(const std::vector<Orbit>);
 
 
 
 /* use const by reference to avoid copying lots of memory */
 std::vector<std::pair <unsigned int, unsigned int>  > 
-getResults(const KDTree<unsigned int>&,
+getResults(const KDTree<unsigned int, 6>&,
            const std::vector<Orbit>&,
            double, double, double,
            double, double, double);
@@ -48,7 +48,7 @@ orbitProximity(std::vector<Orbit> dataOrbits,
                double perihelionTimeTolerance)
 {
     //build KDTrees from Orbit vectors
-    KDTree<unsigned int> dataTree;
+    KDTree<unsigned int, 6> dataTree;
     dataTree = buildKDTree(dataOrbits);
     
     if (DEBUG) {
@@ -79,31 +79,32 @@ orbitProximity(std::vector<Orbit> dataOrbits,
 /**********************************************************************
  * Populate a KDTree 'tree' from the Orbits in vector 'orbits'
  ***********************************************************************/
-KDTree<unsigned int> buildKDTree(const std::vector<Orbit> orbits)
+KDTree<unsigned int, 6> buildKDTree(const std::vector<Orbit> orbits)
 {
     
-    std::vector<PointAndValue<unsigned int> > vecPV;
+    std::vector<PointAndValue<unsigned int, 6> > vecPV;
     
     const int orbitDimensions = 6;
     
     for(unsigned int i=0; i < orbits.size(); i++){
         
-	PointAndValue<unsigned int> tempPV;
-	std::vector<double> orbitDims;
-
-	orbitDims.push_back(orbits.at(i).getPerihelion());
-	orbitDims.push_back(orbits.at(i).getEccentricity());
-	orbitDims.push_back(orbits.at(i).getInclination());
-	orbitDims.push_back(orbits.at(i).getPerihelionArg());
-	orbitDims.push_back(orbits.at(i).getLongitude());
-	orbitDims.push_back(orbits.at(i).getPerihelionTime());
+	PointAndValue<unsigned int, 6> tempPV;
+	PointAndValue<unsigned int, 6>::PointType orbitDims;
+
+	orbitDims[0] = orbits.at(i).getPerihelion();
+	orbitDims[1] = orbits.at(i).getEccentricity();
+	orbitDims[2] = orbits.at(i).getInclination();
+	orbitDims[3] = orbits.at(i).getPerihelionArg();
+	orbitDims[4] = orbits.at(i).getLongitude();
+	orbitDims[5] = orbits.at(i).getPerihelionTime();
 	
 	tempPV.setPoint(orbitDims);
 	tempPV.setValue(i);
 	vecPV.push_back(tempPV);
     }
     
-    KDTree<unsigned int> toReturn(vecPV, orbitDimensions, 100);
+    // built before any searching, so use every core.
+    KDTree<unsigned int, 6> toReturn(vecPV, orbitDimensions, 100, 0);
     return toReturn;
 }
 
@@ -113,7 +114,7 @@ KDTree<unsigned int> buildKDTree(const std::vector<Orbit> orbits)
  *
  **************************************************/
 std::vector<std::pair<unsigned int, unsigned int> > 
-getResults(const KDTree<unsigned int> &searchTree,
+getResults(const KDTree<unsigned int, 6> &searchTree,
            const std::vector<Orbit> &queryPoints,
            double maxPerihelion,
            double maxEccentricity,
@@ -123,7 +124,7 @@ getResults(const KDTree<unsigned int> &searchTree,
            double maxPerihelionTime)
 {
     std::vector<std::pair<unsigned int, unsigned int> > results;
-    std::vector<PointAndValue<unsigned int> > queryResults;
+    std::vector<PointAndValue<unsigned int, 6> > queryResults;
     std::vector<double> queryPt;
 
     std::vector<GeometryType> myGeos;
@@ -4,7 +4,8 @@
 /* jonathan myers this is an attempt at doing removal of subset tracklets in a
  * much faster way than the naive algorithm.
  *
- * someday, it might make sense to template-ize this...
+ * the algorithms are templates, so they run on a vector of Tracklets
+ * or a TrackletStore alike.
 */
 
 
@@ -63,23 +64,86 @@ std::vector<unsigned int> intersect(const std::vector<unsigned int> &A,
 
 
 
-void getSupersetOrIdenticalTracks(const Tracklet* curTrack, 
+/* the algorithms below work on either a vector of Tracklets or a
+ * TrackletStore; these give them what they need from each. */
+static unsigned int numTracklets(const std::vector<Tracklet> &tracklets) 
+{
+    return tracklets.size();
+}
+
+static unsigned int numTracklets(const TrackletStore &tracklets) 
+{
+    return tracklets.size();
+}
+
+static unsigned int trackletLength(const std::vector<Tracklet> &tracklets, 
+                                   unsigned int i)
+{
+    return tracklets[i].indices.size();
+}
+
+static unsigned int trackletLength(const TrackletStore &tracklets, 
+                                   unsigned int i)
+{
+    return tracklets.getNumIndices(i);
+}
+
+static std::set<unsigned int>::const_iterator 
+indicesBegin(const std::vector<Tracklet> &tracklets, unsigned int i)
+{
+    return tracklets[i].indices.begin();
+}
+
+static std::set<unsigned int>::const_iterator 
+indicesEnd(const std::vector<Tracklet> &tracklets, unsigned int i)
+{
+    return tracklets[i].indices.end();
+}
+
+static const unsigned int * indicesBegin(const TrackletStore &tracklets, 
+                                         unsigned int i)
+{
+    return tracklets.indicesBegin(i);
+}
+
+static const unsigned int * indicesEnd(const TrackletStore &tracklets, 
+                                       unsigned int i)
+{
+    return tracklets.indicesEnd(i);
+}
+
+static void copyTracklet(const std::vector<Tracklet> &tracklets, unsigned int i,
+                         std::vector<Tracklet> &out)
+{
+    out.push_back(tracklets[i]);
+}
+
+static void copyTracklet(const TrackletStore &tracklets, unsigned int i,
+                         TrackletStore &out)
+{
+    out.addTracklet(tracklets, i);
+}
+
+
+
+template <class IndexIter>
+void getSupersetOrIdenticalTracks(IndexIter firstIndex, IndexIter lastIndex, 
                                   std::map<unsigned int, std::vector<unsigned int> > & reverseMap,
                                   bool shortCircuit,
                                   bool sortBeforeIntersect,
                                   std::vector<unsigned int> & results)
 {
-    std::set<unsigned int>::const_iterator indexIter;
+    IndexIter indexIter;
     bool quitNow = false;
     if (!sortBeforeIntersect) 
     {
         // initialize results set
-        results = reverseMap[*(curTrack->indices.begin())]; 
+        results = reverseMap[*firstIndex]; 
 
         // if not sorting, read elements from reverse-map as needed;
         // if we short-circuit we can avoid some memory accesses.
-        for (indexIter = (curTrack->indices.begin())++; 
-             indexIter != curTrack->indices.end() && (quitNow == false);
+        for (indexIter = firstIndex; 
+             indexIter != lastIndex && (quitNow == false);
              indexIter++) {
             std::vector<unsigned int> tmpResults;
             const std::vector<unsigned int> * detIDSet = &(reverseMap[*indexIter]);
@@ -102,8 +166,8 @@ void getSupersetOrIdenticalTracks(const Tracklet* curTrack,
          * elements from the reverse map, sort them by size and THEN
          * do the intersection */
         std::multimap<unsigned int, const std::vector<unsigned int>* > reverseMapEntries;
-        for (indexIter = (curTrack->indices.begin()); 
-             indexIter != curTrack->indices.end();
+        for (indexIter = firstIndex; 
+             indexIter != lastIndex;
              indexIter++) {
             const std::vector<unsigned int>* detIDSet = &(reverseMap[*indexIter]);
             std::pair<unsigned int, const std::vector<unsigned int> * > toInsert(detIDSet->size(), detIDSet);
@@ -121,7 +185,7 @@ void getSupersetOrIdenticalTracks(const Tracklet* curTrack,
              entryIter++) {
             
             std::vector<unsigned int> tmpResults;
-            const std::vector<unsigned int> * detIDSet = &(reverseMap[*indexIter]);
+            const std::vector<unsigned int> * detIDSet = entryIter->second;
             tmpResults = intersect(*detIDSet, results);
             results = tmpResults;
 
@@ -143,22 +207,21 @@ void getSupersetOrIdenticalTracks(const Tracklet* curTrack,
 
 
 
-void SubsetRemover::removeSubsetsPopulateOutputVector(const std::vector<Tracklet> *tracksVector, 
-                                                      std::vector<Tracklet> &outVector,
-                                                      bool shortCircuit, 
-                                                      bool sortBeforeIntersect) {
+template <class Tracklets>
+void removeSubsetsPopulateOutput(const Tracklets *tracksVector, 
+                                 Tracklets &outVector,
+                                 bool shortCircuit, 
+                                 bool sortBeforeIntersect) {
     /* build a map which maps each detection to each tracklet which uses it. */
     
     std::map<unsigned int, std::vector<unsigned int> > reverseMap;
-    std::set<unsigned int>::iterator indicesIter;
+    unsigned int nTracks = numTracklets(*tracksVector);
     
     std::cout << "Building detection-to-track map, starting at " << curTime() << std::endl;
-    for (unsigned int curTrackIndex = 0; curTrackIndex < tracksVector->size(); curTrackIndex++) {
-        
-        const Tracklet *curTrack = &(*tracksVector)[curTrackIndex];
+    for (unsigned int curTrackIndex = 0; curTrackIndex < nTracks; curTrackIndex++) {
         
-        for (indicesIter = curTrack->indices.begin(); 
-             indicesIter != curTrack->indices.end();
+        for (auto indicesIter = indicesBegin(*tracksVector, curTrackIndex); 
+             indicesIter != indicesEnd(*tracksVector, curTrackIndex);
              indicesIter++) {
             /* indicesIter now points to an index into the detections file (i.e. detection ID) */
             reverseMap[*indicesIter].push_back(curTrackIndex);
@@ -173,20 +236,19 @@ void SubsetRemover::removeSubsetsPopulateOutputVector(const std::vector<Tracklet
         
     std::cout << "Finished detection-to-track map, filtering tracks starting at " << curTime() << std::endl;
 
-    std::vector<bool> trackHasBeenWritten(tracksVector->size(), false); 
+    std::vector<bool> trackHasBeenWritten(nTracks, false); 
 
     /* for each tracklet: see if any other tracklet uses all the same
      * detections as this one.  If it does, it is either a superset or an
      * identical tracklet. */
 
-    for (unsigned int curTrackIndex = 0; curTrackIndex < tracksVector->size(); curTrackIndex++)  {
+    for (unsigned int curTrackIndex = 0; curTrackIndex < nTracks; curTrackIndex++)  {
  
         if ((curTrackIndex > 0) && (curTrackIndex % 10000 == 0)) {
-            std::cout << "Processing element " << curTrackIndex << " of " << tracksVector->size() << " (" 
-                      << 100. * (curTrackIndex*1.0) / (tracksVector->size() * 1.0) << "%)" << std::endl;
+            std::cout << "Processing element " << curTrackIndex << " of " << nTracks << " (" 
+                      << 100. * (curTrackIndex*1.0) / (nTracks * 1.0) << "%)" << std::endl;
         }
 
-        const Tracklet * curTrack =  &(*tracksVector)[curTrackIndex];
         /* iteratively calculate the intersect of the various sets of tracks
          * which use the detections in this track.  Start with the first set
          * - the one associated with the first detection in this
@@ -196,7 +258,8 @@ void SubsetRemover::removeSubsetsPopulateOutputVector(const std::vector<Tracklet
          * detection, of course */
 
         std::vector<unsigned int> indicesIntersect;  
-        getSupersetOrIdenticalTracks(curTrack, 
+        getSupersetOrIdenticalTracks(indicesBegin(*tracksVector, curTrackIndex), 
+                                     indicesEnd(*tracksVector, curTrackIndex), 
                                      reverseMap,
                                      shortCircuit,
                                      sortBeforeIntersect, 
@@ -210,23 +273,23 @@ void SubsetRemover::removeSubsetsPopulateOutputVector(const std::vector<Tracklet
         if (indicesIntersect.size() == 1) {
             /* we are the only tracklet with these detections. */
             trackHasBeenWritten[curTrackIndex] = true;
-            outVector.push_back(*curTrack);                
+            copyTracklet(*tracksVector, curTrackIndex, outVector);
         }
         else if (indicesIntersect.size() > 1) {
             /* we got other tracklet(s) which may be supersets or identical.  Check for supersets.*/
             bool writeThisTracklet = true;
-            unsigned int mySize = curTrack->indices.size();
+            unsigned int mySize = trackletLength(*tracksVector, curTrackIndex);
             std::vector<unsigned int>::iterator otherTrackletIter;
 
             for (otherTrackletIter = indicesIntersect.begin(); 
                  otherTrackletIter != indicesIntersect.end();
                  otherTrackletIter++) {
 
-                if ((*tracksVector)[*otherTrackletIter].indices.size() > mySize) {
+                if (trackletLength(*tracksVector, *otherTrackletIter) > mySize) {
                     writeThisTracklet = false;
                 }
 
-                else if (((*tracksVector)[*otherTrackletIter].indices.size() == mySize) && 
+                else if ((trackletLength(*tracksVector, *otherTrackletIter) == mySize) && 
                          (trackHasBeenWritten[*otherTrackletIter] == true)) {
                     writeThisTracklet = false;
                 }
@@ -237,7 +300,7 @@ void SubsetRemover::removeSubsetsPopulateOutputVector(const std::vector<Tracklet
                  * out - so write ourselves, and mark ourselves as
                  * written */                    
                 trackHasBeenWritten[curTrackIndex] = true;
-                outVector.push_back(*curTrack);                
+                copyTracklet(*tracksVector, curTrackIndex, outVector);
             }
 
         }
@@ -254,29 +317,53 @@ void SubsetRemover::removeSubsetsPopulateOutputVector(const std::vector<Tracklet
 
 
 
-void putLongestPerDetInOutputVector(const std::vector<Tracklet> *pairsVector, 
-                                    std::vector<Tracklet> &outputVector) {
+void SubsetRemover::removeSubsetsPopulateOutputVector(const std::vector<Tracklet> *tracksVector, 
+                                                      std::vector<Tracklet> &outVector,
+                                                      bool shortCircuit, 
+                                                      bool sortBeforeIntersect) {
+    removeSubsetsPopulateOutput(tracksVector, outVector, shortCircuit,
+                                sortBeforeIntersect);
+}
+
+
+
+void SubsetRemover::removeSubsetsPopulateOutputVector(const TrackletStore *tracksVector, 
+                                                      TrackletStore &outVector,
+                                                      bool shortCircuit, 
+                                                      bool sortBeforeIntersect) {
+    removeSubsetsPopulateOutput(tracksVector, outVector, shortCircuit,
+                                sortBeforeIntersect);
+}
+
+
+
+    
+
+
+
+template <class Tracklets>
+void putLongestPerDetInOutput(const Tracklets *pairsVector, 
+                              Tracklets &outputVector) {
     
     std::map<unsigned int, std::set<unsigned int> > detectionIndexToPairsVectorIndexSet;
     std::set<unsigned int>::iterator indicesIter;
     
     /* make a mapping from each detID to the tracklet IDs which contain that det */
     
-    for (unsigned int curPairIndex = 0; curPairIndex < pairsVector->size(); curPairIndex++) {
+    unsigned int nPairs = numTracklets(*pairsVector);
+    for (unsigned int curPairIndex = 0; curPairIndex < nPairs; curPairIndex++) {
         
-        const Tracklet *curPair = &(*pairsVector)[curPairIndex];
-        
-        for (indicesIter = curPair->indices.begin(); 
-             indicesIter != curPair->indices.end();
-             indicesIter++) {
-            /* indicesIter now points to an index into the detections file (i.e. detection ID) */
-            detectionIndexToPairsVectorIndexSet[*indicesIter].insert(curPairIndex);
+        for (auto pairIndicesIter = indicesBegin(*pairsVector, curPairIndex); 
+             pairIndicesIter != indicesEnd(*pairsVector, curPairIndex);
+             pairIndicesIter++) {
+            /* pairIndicesIter now points to an index into the detections file (i.e. detection ID) */
+            detectionIndexToPairsVectorIndexSet[*pairIndicesIter].insert(curPairIndex);
         }
     }
     /* now for each det, find the longest associated tracklet.  Add that one
      * to outputVector. (if not already added). */
     
-    std::vector<bool> writeThisIndex(pairsVector->size(), false);
+    std::vector<bool> writeThisIndex(nPairs, false);
     
     /* for each detection... */
     std::map<unsigned int, std::set<unsigned int> >::iterator detIter;
@@ -290,7 +377,7 @@ void putLongestPerDetInOutputVector(const std::vector<Tracklet> *pairsVector,
              indicesIter != detIter->second.end();
              indicesIter++) {
             /*indicesiter points at an int which is an index into pairsVector. */
-            unsigned int curTrackletLen = (*pairsVector)[*indicesIter].indices.size();
+            unsigned int curTrackletLen = trackletLength(*pairsVector, *indicesIter);
             if ( curTrackletLen > maxLen) {
                 maxLen = curTrackletLen;
                 longestTrackletIndex = *indicesIter;
@@ -304,13 +391,27 @@ void putLongestPerDetInOutputVector(const std::vector<Tracklet> *pairsVector,
     /* now write out chosen tracklet to output vector */
     for (unsigned int i = 0; i < writeThisIndex.size(); i++) {
         if (writeThisIndex[i] == true) {
-            outputVector.push_back((*pairsVector)[i]);
+            copyTracklet(*pairsVector, i, outputVector);
         }
     }
 }
 
 
 
+void putLongestPerDetInOutputVector(const std::vector<Tracklet> *pairsVector, 
+                                    std::vector<Tracklet> &outputVector) {
+    putLongestPerDetInOutput(pairsVector, outputVector);
+}
+
+
+
+void putLongestPerDetInOutputVector(const TrackletStore *pairsVector, 
+                                    TrackletStore &outputVector) {
+    putLongestPerDetInOutput(pairsVector, outputVector);
+}
+
+
+
 
 
 
@@ -7,8 +7,12 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
 
 
 
@@ -61,8 +65,8 @@ void debugPrintTrackSet(const TrackSet &tracks, const std::vector<MopsDetection>
          trackIter != tracks.componentTracks.end();
          trackIter++) {
         std::cout << " track " << trackCount << ":\n";
-        std::set<unsigned int>::const_iterator detIdIter;
-        std::set<unsigned int> componentDetectionIndices = trackIter->getComponentDetectionIndices();
+        Track::IndexSet::const_iterator detIdIter;
+        const Track::IndexSet &componentDetectionIndices = trackIter->getComponentDetectionIndices();
         for (detIdIter = componentDetectionIndices.begin();
              detIdIter != componentDetectionIndices.end();
              detIdIter++) {
@@ -257,16 +261,17 @@ BOOST_AUTO_TEST_CASE (trackSet_3) {
 
 
 
-template <typename T>
-bool setsEqual(const std::set<T> s1, const std::set<T> s2)
+// works for any pair of sorted containers, e.g. std::set and Track::IndexSet
+template <typename S1, typename S2>
+bool setsEqual(const S1 &s1, const S2 &s2)
 {
     if (s1.size() != s2.size()) {
         return false;
     }
 
     // take advantage of the fact that sets are ordered
-    typename std::set<T>::const_iterator sIter1;
-    typename std::set<T>::const_iterator sIter2;
+    typename S1::const_iterator sIter1;
+    typename S2::const_iterator sIter2;
     sIter1 = s1.begin();
     sIter2 = s2.begin();
 
@@ -470,4 +475,283 @@ BOOST_AUTO_TEST_CASE( big_quadFit_test0)
 
 
 
+bool relEq(double a, double b, double epsilon)
+{
+    return fabs(a - b) <= epsilon * std::max(1., std::max(fabs(a), fabs(b)));
+}
+
+
+
+BOOST_AUTO_TEST_CASE( track_fastQuadraticFit_matchesSvd ) 
+{
+    // the fixed-size fitter must reproduce the SVD fit: same model
+    // order (after any backing off), same predictions and
+    // uncertainties, same chisq and prob(chisq).
+    MopsDetection::setObservatoryLocation(-30.169, -70.804);
+    srand(42);
+    double astromErr = 0.2 / 3600.;
+
+    for (unsigned int i = 0; i < 300; i++) {
+        std::vector<MopsDetection> allDets;
+        double ra0 = 10. + 300. * rand() / RAND_MAX;
+        double dec0 = -60. + 80. * rand() / RAND_MAX;
+        double raV = (rand() / (double) RAND_MAX - .5) * .5;
+        double decV = (rand() / (double) RAND_MAX - .5) * .5;
+        double raAcc = (rand() / (double) RAND_MAX - .5) * .004;
+        double decAcc = (rand() / (double) RAND_MAX - .5) * .004;
+        // 2 to 6 nights with a pair of detections each
+        unsigned int nNights = 2 + i % 5;
+        Track svdTrack;
+        for (unsigned int night = 0; night < nNights; night++) {
+            double nightTime = 55000. + night * 3. + 
+                rand() / (double) RAND_MAX;
+            for (unsigned int j = 0; j < 2; j++) {
+                double t = nightTime + j * .03;
+                double dt = t - 55000.;
+                double noiseRa = (rand() / (double) RAND_MAX - .5) * astromErr;
+                double noiseDec = (rand() / (double) RAND_MAX - .5) * astromErr;
+                MopsDetection det(allDets.size(), t, 
+                                  projectLoc(dt, ra0, raV, raAcc) + noiseRa,
+                                  projectLoc(dt, dec0, decV, decAcc) + noiseDec,
+                                  astromErr, astromErr);
+                det.calculateTopoCorr();
+                allDets.push_back(det);
+                svdTrack.addDetection(allDets.size() - 1, allDets);
+            }
+        }
+        Track fastTrack(svdTrack);
+
+        int forceOrder = (i % 2 == 0) ? -1 : 3;
+        svdTrack.calculateBestFitQuadratic(allDets, forceOrder);
+        fastTrack.calculateBestFitQuadraticFast(allDets, forceOrder);
+
+        BOOST_CHECK(svdTrack.getChisqDof() == fastTrack.getChisqDof());
+        BOOST_CHECK(relEq(svdTrack.getChisqRa(), fastTrack.getChisqRa(), 1e-5));
+        BOOST_CHECK(relEq(svdTrack.getChisqDec(), fastTrack.getChisqDec(), 1e-5));
+        BOOST_CHECK(relEq(svdTrack.getProbChisqRa(), 
+                          fastTrack.getProbChisqRa(), 1e-6));
+        BOOST_CHECK(relEq(svdTrack.getProbChisqDec(), 
+                          fastTrack.getProbChisqDec(), 1e-6));
+        // only a 5-term RA model has a range term.
+        BOOST_CHECK((svdTrack.getFitRange() == 0) == 
+                    (fastTrack.getFitRange() == 0));
+
+        // predictions (including one past the last night) should agree
+        // to well within the astrometric error.
+        for (unsigned int night = 0; night <= nNights; night++) {
+            double t = 55000. + night * 3.;
+            double svdRa, svdDec, fastRa, fastDec;
+            svdTrack.predictLocationAtTime(t, svdRa, svdDec);
+            fastTrack.predictLocationAtTime(t, fastRa, fastDec);
+            BOOST_CHECK(fabs(svdRa - fastRa) < 1e-3 * astromErr);
+            BOOST_CHECK(fabs(svdDec - fastDec) < 1e-3 * astromErr);
+
+            double svdRaUnc, svdDecUnc, fastRaUnc, fastDecUnc;
+            svdTrack.predictLocationUncertaintyAtTime(t, svdRaUnc, svdDecUnc);
+            fastTrack.predictLocationUncertaintyAtTime(t, fastRaUnc, fastDecUnc);
+            BOOST_CHECK(relEq(svdRaUnc, fastRaUnc, 1e-6));
+            BOOST_CHECK(relEq(svdDecUnc, fastDecUnc, 1e-6));
+        }
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE( track_fastQuadraticFit_degenerate ) 
+{
+    // three parameters can't be fit to two distinct times; the fast
+    // fitter must notice and hand the problem to the SVD rather than
+    // return garbage.
+    std::vector<MopsDetection> allDets;
+    double astromErr = 0.2 / 3600.;
+    for (unsigned int i = 0; i < 4; i++) {
+        MopsDetection det(i, 55000. + (i / 2) * 3., 
+                          10. + (i / 2) * .1 + i * 1e-5, 
+                          -10. + (i / 2) * .1,
+                          astromErr, astromErr);
+        det.calculateTopoCorr();
+        allDets.push_back(det);
+    }
+    Track svdTrack;
+    for (unsigned int i = 0; i < allDets.size(); i++) {
+        svdTrack.addDetection(i, allDets);
+    }
+    Track fastTrack(svdTrack);
+    svdTrack.calculateBestFitQuadratic(allDets, 3);
+    fastTrack.calculateBestFitQuadraticFast(allDets, 3);
+
+    double svdRa, svdDec, fastRa, fastDec;
+    svdTrack.predictLocationAtTime(55004., svdRa, svdDec);
+    fastTrack.predictLocationAtTime(55004., fastRa, fastDec);
+    BOOST_CHECK(Eq(svdRa, fastRa));
+    BOOST_CHECK(Eq(svdDec, fastDec));
+    BOOST_CHECK(Eq(svdTrack.getChisqRa(), fastTrack.getChisqRa()));
+    BOOST_CHECK(Eq(svdTrack.getChisqDec(), fastTrack.getChisqDec()));
+}
+
+
+
+
+BOOST_AUTO_TEST_CASE( smallSortedSet_1 ) 
+{
+    // must behave like a std::set, whether it holds few enough values
+    // to keep them inline or has spilled onto the heap.
+    srand(3);
+    for (unsigned int nValues = 0; nValues < 40; nValues += 3) {
+        SmallSortedSet<unsigned int, 8> s;
+        std::set<unsigned int> expected;
+        for (unsigned int i = 0; i < nValues; i++) {
+            unsigned int v = rand() % 50;
+            BOOST_CHECK(s.insert(v) == expected.insert(v).second);
+        }
+        BOOST_CHECK(setsEqual(s, expected));
+        for (unsigned int v = 0; v < 50; v++) {
+            BOOST_CHECK(s.count(v) == expected.count(v));
+            BOOST_CHECK((s.find(v) != s.end()) == 
+                        (expected.find(v) != expected.end()));
+        }
+
+        SmallSortedSet<unsigned int, 8> copied(s);
+        BOOST_CHECK(copied == s);
+        SmallSortedSet<unsigned int, 8> moved(std::move(copied));
+        BOOST_CHECK(moved == s);
+        BOOST_CHECK(copied.empty());
+        copied = moved;
+        BOOST_CHECK(copied == s);
+        moved = SmallSortedSet<unsigned int, 8>();
+        BOOST_CHECK(moved.empty());
+        moved = std::move(copied);
+        BOOST_CHECK(moved == s);
+        moved.clear();
+        BOOST_CHECK(moved.empty());
+    }
+
+    // < orders like std::set's <.
+    std::set<unsigned int> a, b;
+    SmallSortedSet<unsigned int, 2> sa, sb;
+    for (unsigned int i = 0; i < 200; i++) {
+        unsigned int v = rand() % 6;
+        if (rand() % 2) { 
+            a.insert(v); sa.insert(v); 
+        }
+        else { 
+            b.insert(v); sb.insert(v); 
+        }
+        BOOST_CHECK((sa < sb) == (a < b));
+        BOOST_CHECK((sb < sa) == (b < a));
+        BOOST_CHECK((sa == sb) == (a == b));
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE( track_copyAndMove ) 
+{
+    // copies and moves keep the fit as well as the detections.
+    MopsDetection::setObservatoryLocation(-30.169, -70.804);
+    std::vector<MopsDetection> allDets;
+    double astromErr = 0.2 / 3600.;
+    Track orig;
+    for (unsigned int i = 0; i < 20; i++) {
+        double t = 55000. + (i / 2) * 2. + (i % 2) * .03;
+        MopsDetection det(i, t, 10. + .1 * (t - 55000.) + ((i * 7) % 5) * 1e-5,
+                          -10. + .05 * (t - 55000.) + ((i * 3) % 5) * 1e-5,
+                          astromErr, astromErr);
+        det.calculateTopoCorr();
+        allDets.push_back(det);
+        orig.addDetection(i, allDets);
+        orig.componentTrackletIndices.insert(i / 2);
+    }
+    orig.calculateBestFitQuadratic(allDets);
+
+    Track assigned;
+    assigned = orig;
+    Track moveSource(orig);
+    Track moved(std::move(moveSource));
+    Track * tracks[2] = {&assigned, &moved};
+    for (unsigned int i = 0; i < 2; i++) {
+        Track &t = *tracks[i];
+        BOOST_CHECK(t == orig);
+        BOOST_CHECK(setsEqual(t.componentTrackletIndices, 
+                              orig.componentTrackletIndices));
+        BOOST_CHECK(setsEqual(t.getComponentDetectionIndices(), 
+                              orig.getComponentDetectionIndices()));
+        BOOST_CHECK(t.getChisqRa() == orig.getChisqRa());
+        BOOST_CHECK(t.getChisqDec() == orig.getChisqDec());
+        BOOST_CHECK(t.getProbChisqRa() == orig.getProbChisqRa());
+        BOOST_CHECK(t.getProbChisqDec() == orig.getProbChisqDec());
+        double raUnc, decUnc, origRaUnc, origDecUnc;
+        t.predictLocationUncertaintyAtTime(55021., raUnc, decUnc);
+        orig.predictLocationUncertaintyAtTime(55021., origRaUnc, origDecUnc);
+        BOOST_CHECK(raUnc == origRaUnc);
+        BOOST_CHECK(decUnc == origDecUnc);
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE( trackSet_asyncWrite ) 
+{
+    // every distinct track is written exactly once, however often it
+    // is inserted, and the lines are those the plain file output
+    // would write.
+    std::string outFileName = "trackSet_asyncWrite.tmp";
+    std::remove(outFileName.c_str());
+
+    std::vector<MopsDetection> allDetections;
+    for (unsigned int i = 0; i < 12; i++) {
+        addDetectionAt(5000. + i, 350. + .05 * i, 4. + .01 * i, allDetections);
+    }
+    TrackSet plain;
+    // small batches, so that many of them go to the writer.
+    TrackSet * async = new TrackSet(outFileName, false, 3, true);
+    for (unsigned int pass = 0; pass < 2; pass++) {
+        for (unsigned int i = 0; i < allDetections.size(); i++) {
+            for (unsigned int j = i + 1; j < allDetections.size(); j++) {
+                Track t;
+                t.addDetection(i, allDetections);
+                t.addDetection(j, allDetections);
+                if (j % 3 == 0) {
+                    t.addDetection(0, allDetections);
+                }
+                plain.insert(t);
+                async->insert(t);
+            }
+        }
+    }
+    BOOST_CHECK(async->size() == plain.size());
+    BOOST_CHECK(async->componentTracks.size() == 0);
+    delete async;
+
+    std::set<std::string> expectedLines;
+    std::set<Track>::const_iterator tIter;
+    for (tIter = plain.componentTracks.begin(); 
+         tIter != plain.componentTracks.end();
+         tIter++) {
+        std::ostringstream line;
+        const Track::IndexSet &diaIds = tIter->getComponentDetectionDiaIds();
+        Track::IndexSet::const_iterator idIter;
+        for (idIter = diaIds.begin(); idIter != diaIds.end(); idIter++) {
+            line << *idIter << " ";
+        }
+        expectedLines.insert(line.str());
+    }
+
+    std::ifstream inFile(outFileName.c_str());
+    std::set<std::string> foundLines;
+    unsigned int nLines = 0;
+    std::string line;
+    while (std::getline(inFile, line)) {
+        foundLines.insert(line);
+        nLines++;
+    }
+    inFile.close();
+    std::remove(outFileName.c_str());
+
+    BOOST_CHECK(nLines == plain.size());
+    BOOST_CHECK(foundLines == expectedLines);
+}
+
+
+
 }} // close lsst::mops
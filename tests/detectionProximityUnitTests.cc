@@ -8,6 +8,7 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <set>
 
 
 #include "lsst/mops/Exceptions.h"
@@ -433,3 +434,37 @@ BOOST_AUTO_TEST_CASE( detectionProximity14 )
   BOOST_CHECK(containsPair(0,1,queryResult));
   
 }
+
+
+
+BOOST_AUTO_TEST_CASE( detectionProximity_skyIndex_1 ) 
+{
+  // searching unit vectors must find the same pairs as the KDTree,
+  // across RA 0 and near the pole.
+  std::vector<MopsDetection> dataDets;
+  std::vector<MopsDetection> queryDets;
+  srand(17);
+  for (unsigned int i = 0; i < 2000; i++) {
+      double ra = convertToStandardDegrees(-2. + 4. * rand() / RAND_MAX);
+      double dec = (i % 2 == 0) ? -2. + 4. * rand() / RAND_MAX 
+                                : 86. + 3. * rand() / RAND_MAX;
+      double mjd = 53736 + .5 * rand() / RAND_MAX;
+      if (i % 4 < 2) {
+          dataDets.push_back(MopsDetection(i, mjd, ra, dec));
+      }
+      else {
+          queryDets.push_back(MopsDetection(i, mjd, ra, dec));
+      }
+  }
+  std::vector<std::pair <unsigned int, unsigned int> > treePairs =
+      detectionProximity(queryDets, dataDets, .3, 0.1);
+  std::vector<std::pair <unsigned int, unsigned int> > skyIndexPairs =
+      detectionProximity(queryDets, dataDets, .3, 0.1, true);
+  BOOST_CHECK(treePairs.size() > 100);
+  std::set<std::pair <unsigned int, unsigned int> > 
+      expected(treePairs.begin(), treePairs.end());
+  std::set<std::pair <unsigned int, unsigned int> > 
+      found(skyIndexPairs.begin(), skyIndexPairs.end());
+  BOOST_CHECK(skyIndexPairs.size() == treePairs.size());
+  BOOST_CHECK(found == expected);
+}
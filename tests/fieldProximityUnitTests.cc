@@ -155,6 +155,78 @@ BOOST_AUTO_TEST_CASE ( fieldProximity2 )
 
 
 
+BOOST_AUTO_TEST_CASE ( fieldProximity_skyIndex_1 ) 
+{
+     // as fieldProximity2, but searching a SkyIndex.  Track 33 is
+     // outside the KDTree's RA, Dec box around the field (RA 50 +/-
+     // 1.75), but at Dec 50 that is only ~1.37 degrees of sky, so the
+     // SkyIndex finds that it does pass through the field.
+     std::vector<Field> queryFields;
+     std::vector<FieldProximityTrack> allTracks;
+
+     Field tmpField;
+     tmpField.setFieldID(1);
+     tmpField.setEpochMJD(300);
+     tmpField.setRA(50);
+     tmpField.setDec(50);
+     tmpField.setRadius(1.75);
+     queryFields.push_back(tmpField);
+     
+     FieldProximityTrack tmpTrack;
+     tmpTrack.setID(42);
+     FieldProximityPoint tmpPoint;
+     tmpPoint.setRA(50);
+     tmpPoint.setDec(50);
+     tmpPoint.setEpochMJD(299.5);
+     tmpTrack.addPoint(tmpPoint);
+
+     tmpPoint.setRA(51);
+     tmpPoint.setDec(49);
+     tmpPoint.setEpochMJD(300.5);
+     tmpTrack.addPoint(tmpPoint);
+     allTracks.push_back(tmpTrack);
+     
+     FieldProximityTrack tmpTrack2;
+     tmpTrack2.setID(33);
+     tmpPoint.setRA(51.76);
+     tmpPoint.setDec(50);
+     tmpPoint.setEpochMJD(299.5);
+     tmpTrack2.addPoint(tmpPoint);
+
+     tmpPoint.setRA(52.5);
+     tmpPoint.setDec(50);
+     tmpPoint.setEpochMJD(300.5);
+     tmpTrack2.addPoint(tmpPoint);
+     allTracks.push_back(tmpTrack2);     
+
+     // and one which passes nowhere near.
+     FieldProximityTrack tmpTrack3;
+     tmpTrack3.setID(7);
+     tmpPoint.setRA(56);
+     tmpPoint.setDec(50);
+     tmpPoint.setEpochMJD(299.5);
+     tmpTrack3.addPoint(tmpPoint);
+
+     tmpPoint.setRA(57);
+     tmpPoint.setDec(50);
+     tmpPoint.setEpochMJD(300.5);
+     tmpTrack3.addPoint(tmpPoint);
+     allTracks.push_back(tmpTrack3);     
+
+     std::vector<std::pair <unsigned int, unsigned int> > pairs;
+     fieldProximity(allTracks, queryFields, pairs, 0, true);
+     
+     BOOST_CHECK(pairs.size() == 2);
+     BOOST_CHECK(containsPair(1,42,pairs));
+     BOOST_CHECK(containsPair(1,33,pairs));
+     
+}
+
+
+
+
+
+
 BOOST_AUTO_TEST_CASE ( fieldProximity4 ) 
 {
      //try to cause trouble - give no tracks.
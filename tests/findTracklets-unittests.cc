@@ -9,6 +9,9 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <set>
+#include <sstream>
+#include <cstdio>
 
 
 
@@ -902,3 +905,188 @@ BOOST_AUTO_TEST_CASE( findTracklets_blackbox_using_minv_8 )
   delete pairs;
 
 }
+
+
+
+// several threads must give exactly what one thread does, in the same order.
+BOOST_AUTO_TEST_CASE( findTracklets_nThreads_1 )
+{
+  std::vector<MopsDetection> myDets;
+  srand(42);
+  for (unsigned int image = 0; image < 30; image++) {
+      double mjd = 53736.0 + image * .01;
+      for (unsigned int i = 0; i < 40; i++) {
+          addDetectionAt(mjd, 100.0 + 2.0 * rand() / RAND_MAX, 
+                         10.0 + 2.0 * rand() / RAND_MAX, myDets);
+      }
+  }
+
+  findTrackletsConfig config;
+  config.maxV = 1.0;
+  config.maxDt = .2;
+  std::vector<Tracklet> *serialPairs = findTracklets(myDets, config);
+  TrackletStore serialStore;
+  findTracklets(myDets, config, serialStore);
+
+  config.nThreads = 4;
+  std::vector<Tracklet> *threadedPairs = findTracklets(myDets, config);
+  TrackletStore threadedStore;
+  findTracklets(myDets, config, threadedStore);
+
+  BOOST_CHECK(serialPairs->size() > 100);
+  BOOST_CHECK(threadedPairs->size() == serialPairs->size());
+  BOOST_CHECK(threadedStore.size() == serialPairs->size());
+  BOOST_CHECK(serialStore.size() == serialPairs->size());
+  for (unsigned int i = 0; i < serialPairs->size(); i++) {
+      BOOST_CHECK(threadedPairs->at(i).indices == serialPairs->at(i).indices);
+      BOOST_CHECK(threadedStore.getTracklet(i).indices == serialPairs->at(i).indices);
+      BOOST_CHECK(threadedStore.getId(i) == serialStore.getId(i));
+  }
+  delete serialPairs;
+  delete threadedPairs;
+}
+
+
+
+// searching pairs of trees together must find the same tracklets.
+BOOST_AUTO_TEST_CASE( findTracklets_dualTreeSearch_1 )
+{
+  std::vector<MopsDetection> myDets;
+  srand(43);
+  for (unsigned int image = 0; image < 12; image++) {
+      double mjd = 53736.0 + image * .015;
+      for (unsigned int i = 0; i < 200; i++) {
+          // straddle RA 0 and Dec 0.
+          addDetectionAt(mjd, convertToStandardDegrees(-1.0 + 2.0 * rand() / RAND_MAX), 
+                         -1.0 + 2.0 * rand() / RAND_MAX, myDets);
+      }
+  }
+
+  findTrackletsConfig config;
+  config.maxV = 1.0;
+  config.minV = .1;
+  config.maxDt = .1;
+  std::vector<Tracklet> *pairs = findTracklets(myDets, config);
+  config.dualTreeSearch = true;
+  std::vector<Tracklet> *dualTreePairs = findTracklets(myDets, config);
+
+  BOOST_CHECK(pairs->size() > 100);
+  BOOST_CHECK(dualTreePairs->size() == pairs->size());
+  std::set<std::set<unsigned int> > expected, found;
+  for (unsigned int i = 0; i < pairs->size(); i++) {
+      expected.insert(pairs->at(i).indices);
+      found.insert(dualTreePairs->at(i).indices);
+  }
+  BOOST_CHECK(found == expected);
+  delete pairs;
+  delete dualTreePairs;
+}
+
+
+
+// searching unit vectors must find the same tracklets, in the same
+// order of images.
+BOOST_AUTO_TEST_CASE( findTracklets_unitVectorSearch_1 )
+{
+  std::vector<MopsDetection> myDets;
+  srand(45);
+  for (unsigned int image = 0; image < 12; image++) {
+      double mjd = 53736.0 + image * .015;
+      for (unsigned int i = 0; i < 200; i++) {
+          // straddle RA 0, and some near the pole.
+          double dec = (i % 2 == 0) ? -1.0 + 2.0 * rand() / RAND_MAX
+                                    : 88.5 + 1.0 * rand() / RAND_MAX;
+          addDetectionAt(mjd, convertToStandardDegrees(-1.0 + 2.0 * rand() / RAND_MAX), 
+                         dec, myDets);
+      }
+  }
+
+  findTrackletsConfig config;
+  config.maxV = 1.0;
+  config.minV = .1;
+  config.maxDt = .1;
+  std::vector<Tracklet> *pairs = findTracklets(myDets, config);
+  config.unitVectorSearch = true;
+  std::vector<Tracklet> *unitVectorPairs = findTracklets(myDets, config);
+  config.nThreads = 4;
+  TrackletStore threadedStore;
+  findTracklets(myDets, config, threadedStore);
+
+  BOOST_CHECK(pairs->size() > 100);
+  BOOST_REQUIRE(unitVectorPairs->size() == pairs->size());
+  BOOST_REQUIRE(threadedStore.size() == pairs->size());
+  // each query detection's partners may come in another order, but
+  // the detections and images are taken in the same order.
+  std::set<std::set<unsigned int> > expected, found;
+  for (unsigned int i = 0; i < pairs->size(); i++) {
+      if ((i > 0) && 
+          (*(pairs->at(i).indices.begin()) != *(pairs->at(i - 1).indices.begin()))) {
+          BOOST_CHECK(found == expected);
+          expected.clear();
+          found.clear();
+      }
+      expected.insert(pairs->at(i).indices);
+      found.insert(unitVectorPairs->at(i).indices);
+      BOOST_CHECK(threadedStore.getTracklet(i).indices == unitVectorPairs->at(i).indices);
+  }
+  BOOST_CHECK(found == expected);
+
+  config.dualTreeSearch = true;
+  BOOST_CHECK_THROW(findTracklets(myDets, config), BadParameterException);
+  delete pairs;
+  delete unitVectorPairs;
+}
+
+
+
+// the file output methods must write just the tracklets which would
+// have been returned, in the same order.
+BOOST_AUTO_TEST_CASE( findTracklets_fileOutput_1 )
+{
+  std::vector<MopsDetection> myDets;
+  srand(44);
+  for (unsigned int image = 0; image < 20; image++) {
+      double mjd = 53736.0 + image * .01;
+      for (unsigned int i = 0; i < 40; i++) {
+          addDetectionAt(mjd, 100.0 + 2.0 * rand() / RAND_MAX, 
+                         10.0 + 2.0 * rand() / RAND_MAX, myDets);
+      }
+  }
+  findTrackletsConfig config;
+  config.maxV = 1.0;
+  config.maxDt = .2;
+  std::vector<Tracklet> *pairs = findTracklets(myDets, config);
+  BOOST_CHECK(pairs->size() > 100);
+  std::ostringstream expected;
+  for (unsigned int i = 0; i < pairs->size(); i++) {
+      std::set<unsigned int>::const_iterator index;
+      for (index = pairs->at(i).indices.begin(); 
+           index != pairs->at(i).indices.end(); index++) {
+          expected << *index << " ";
+      }
+      expected << "\n";
+  }
+  delete pairs;
+
+  std::string outFileName = "findTracklets_fileOutput_1.tmp";
+  for (unsigned int run = 0; run < 3; run++) {
+      remove(outFileName.c_str());
+      config.outputFile = outFileName;
+      config.outputMethod = trackletOutputMethod::IDS_FILE_WITH_CACHE;
+      // a cache much smaller than the output, so the writer is busy.
+      config.outputBufferSize = 7;
+      config.nThreads = 1;
+      if (run == 1) {
+          config.outputMethod = trackletOutputMethod::IDS_FILE;
+      }
+      if (run == 2) {
+          config.nThreads = 3;
+      }
+      BOOST_CHECK(findTracklets(myDets, config) == NULL);
+      std::ifstream outFile(outFileName.c_str());
+      std::ostringstream written;
+      written << outFile.rdbuf();
+      BOOST_CHECK(written.str() == expected.str());
+  }
+  remove(outFileName.c_str());
+}
@@ -7,14 +7,23 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <stdint.h>
 
 
 #include "lsst/mops/MopsDetection.h"
+#include "lsst/mops/ImageIndex.h"
+#include "lsst/mops/DetectionStore.h"
+#include "lsst/mops/ChunkedTextReader.h"
+#include "lsst/mops/fileUtils.h"
 #include "lsst/mops/Exceptions.h"
 #include "lsst/mops/Tracklet.h"
 #include "lsst/mops/PointAndValue.h"
 #include "lsst/mops/common.h"
 #include "lsst/mops/KDTree.h"
+#include "lsst/mops/SkyIndex.h"
 #include "lsst/mops/rmsLineFit.h"
 #include "lsst/mops/removeSubsets.h"
 
@@ -380,6 +389,372 @@ BOOST_AUTO_TEST_CASE( angularDistance_3 )
 
 
 
+BOOST_AUTO_TEST_CASE( angularDistanceCertainlyAbove_1 )
+{
+     // must never claim a point is too far when it isn't, and should
+     // catch nearly every point which is clearly too far.
+     srand(11);
+     unsigned int nFar = 0;
+     unsigned int nCaught = 0;
+     for (unsigned int i = 0; i < 100000; i++) {
+	  double maxDist = .0001 + .1 * rand() / RAND_MAX;
+	  double ra1 = 360. * rand() / RAND_MAX;
+	  double dec1 = -89. + 178. * rand() / RAND_MAX;
+	  double ra0 = ra1 + (rand() / (double) RAND_MAX - .5) * 
+	       4. * arcToRA(dec1, maxDist);
+	  double dec0 = dec1 + (rand() / (double) RAND_MAX - .5) * 4. * maxDist;
+	  double cosDec1 = cos(dec1 * M_PI / 180.);
+	  double sinHalfMaxDist = sin(maxDist * M_PI / 360.);
+	  bool above = angularDistanceCertainlyAbove(
+	       ra0, dec0, ra1, dec1, cosDec1, sinHalfMaxDist * sinHalfMaxDist);
+	  double dist = angularDistanceRADec_deg(ra0, dec0, ra1, dec1);
+	  if (above) {
+	       BOOST_CHECK(dist > maxDist);
+	  }
+	  if (dist > 1.01 * maxDist) {
+	       nFar++;
+	       if (above) {
+		    nCaught++;
+	       }
+	  }
+     }
+     BOOST_CHECK(nFar > 0);
+     BOOST_CHECK(nCaught > .99 * nFar);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( angularDistanceBoundsRADecBoxes_1 )
+{
+     // every pair of points drawn from two boxes must lie within the
+     // bounds, including boxes across RA 0 and Dec 0 (Dec as standard
+     // degrees, so such a box runs from e.g. 2 up to 355).
+     srand(12);
+     for (unsigned int box = 0; box < 2000; box++) {
+	  double ra[4], dec[4];
+	  for (unsigned int i = 0; i < 4; i++) {
+	       ra[i] = 360. * rand() / (RAND_MAX + 1.);
+	       double realDec = -90. + 180. * rand() / RAND_MAX;
+	       if (box % 2 == 0) {
+		    // mostly small boxes, near each other.
+		    ra[i] = convertToStandardDegrees(ra[0] + 10. * rand() / RAND_MAX - 5.);
+		    realDec = -5. + 10. * rand() / RAND_MAX;
+	       }
+	       dec[i] = convertToStandardDegrees(realDec);
+	  }
+	  double raLo0 = minOfTwo(ra[0], ra[1]), raHi0 = maxOfTwo(ra[0], ra[1]);
+	  double decLo0 = minOfTwo(dec[0], dec[1]), decHi0 = maxOfTwo(dec[0], dec[1]);
+	  double raLo1 = minOfTwo(ra[2], ra[3]), raHi1 = maxOfTwo(ra[2], ra[3]);
+	  double decLo1 = minOfTwo(dec[2], dec[3]), decHi1 = maxOfTwo(dec[2], dec[3]);
+	  double minDist, maxDist;
+	  angularDistanceBoundsRADecBoxes_deg(raLo0, raHi0, decLo0, decHi0,
+					      raLo1, raHi1, decLo1, decHi1,
+					      minDist, maxDist);
+	  BOOST_CHECK(minDist <= maxDist);
+	  for (unsigned int i = 0; i < 20; i++) {
+	       double ra0 = raLo0 + (raHi0 - raLo0) * rand() / RAND_MAX;
+	       double ra1 = raLo1 + (raHi1 - raLo1) * rand() / RAND_MAX;
+	       double dec0 = decLo0 + (decHi0 - decLo0) * rand() / RAND_MAX;
+	       double dec1 = decLo1 + (decHi1 - decLo1) * rand() / RAND_MAX;
+	       // only real Decs can hold data.
+	       if (((dec0 > 90.) && (dec0 < 270.)) || 
+		   ((dec1 > 90.) && (dec1 < 270.))) {
+		    continue;
+	       }
+	       double dist = angularDistanceRADec_deg(ra0, dec0, ra1, dec1);
+	       BOOST_CHECK(dist >= minDist - 1e-9);
+	       BOOST_CHECK(dist <= maxDist + 1e-9);
+	  }
+     }
+     // two points: the bounds are the distance.
+     double minDist, maxDist;
+     angularDistanceBoundsRADecBoxes_deg(359., 359., 1., 1., 1., 1., 359., 359.,
+					 minDist, maxDist);
+     BOOST_CHECK(fabs(minDist - angularDistanceRADec_deg(359., 1., 1., 359.)) < 1e-9);
+     BOOST_CHECK(fabs(maxDist - minDist) < 1e-9);
+}
+
+
+
+
+BOOST_AUTO_TEST_CASE( imageIndex_1 )
+{
+     // two nights, three images, detections given out of time order.
+     std::vector<MopsDetection> dets;
+     dets.push_back(MopsDetection(0, 5301.03, 10., 10.));
+     dets.push_back(MopsDetection(1, 5300.0, 10., 10.));
+     dets.push_back(MopsDetection(2, 5301.0, 10., 10.));
+     dets.push_back(MopsDetection(3, 5300.0, 10., 10.));
+     dets.push_back(MopsDetection(4, 5301.03, 10., 10.));
+
+     ImageIndex index(dets);
+     BOOST_CHECK(index.getNumImages() == 3);
+     BOOST_CHECK(index.getNumNights() == 2);
+     BOOST_CHECK(index.getImageOfDetection(0) == 2);
+     BOOST_CHECK(index.getImageOfDetection(1) == 0);
+     BOOST_CHECK(index.getImageOfDetection(2) == 1);
+     BOOST_CHECK(index.getImageOfDetection(3) == 0);
+     BOOST_CHECK(index.getImageOfDetection(4) == 2);
+     BOOST_CHECK(index.getImageMJD(1) == 5301.0);
+     BOOST_CHECK(index.getNightOfImage(0) == 0);
+     BOOST_CHECK(index.getNightOfImage(1) == 1);
+     BOOST_CHECK(index.getNightOfImage(2) == 1);
+
+     BOOST_CHECK(dets[0].getImageIndex() == -1);
+     index.labelDetections(dets);
+     BOOST_CHECK(dets[0].getImageIndex() == 2);
+     BOOST_CHECK(dets[0].getNightIndex() == 1);
+     BOOST_CHECK(dets[3].getImageIndex() == 0);
+     BOOST_CHECK(dets[3].getNightIndex() == 0);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( imageIndex_laterImagesInRange_1 )
+{
+     std::vector<MopsDetection> dets;
+     dets.push_back(MopsDetection(0, 5300.0, 10., 10.));
+     dets.push_back(MopsDetection(1, 5300.01, 10., 10.));
+     dets.push_back(MopsDetection(2, 5300.02, 10., 10.));
+     dets.push_back(MopsDetection(3, 5300.05, 10., 10.));
+     dets.push_back(MopsDetection(4, 5301.0, 10., 10.));
+
+     ImageIndex index(dets);
+     unsigned int first, end;
+     index.getLaterImagesInRange(0, .01, .0625, first, end);
+     BOOST_CHECK(first == 1);
+     BOOST_CHECK(end == 4);
+     index.getLaterImagesInRange(0, .015, .03, first, end);
+     BOOST_CHECK(first == 2);
+     BOOST_CHECK(end == 3);
+     // never the image itself or earlier ones.
+     index.getLaterImagesInRange(2, -1., .001, first, end);
+     BOOST_CHECK(first == 3);
+     BOOST_CHECK(end == 3);
+     index.getLaterImagesInRange(4, 0., 10., first, end);
+     BOOST_CHECK(first == 5);
+     BOOST_CHECK(end == 5);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( imageGrouping_1 )
+{
+     std::vector<MopsDetection> dets;
+     dets.push_back(MopsDetection(0, 5300.02, 10., 10.));
+     dets.push_back(MopsDetection(1, 5300.0, 10., 10.));
+     dets.push_back(MopsDetection(2, 5300.02, 10., 10.));
+     dets.push_back(MopsDetection(3, 5300.0, 10., 10.));
+     dets.push_back(MopsDetection(4, 5300.02, 10., 10.));
+
+     ImageIndex index(dets);
+     ImageGrouping grouping(index);
+     BOOST_CHECK(grouping.getNumImages() == 2);
+     BOOST_CHECK(grouping.getNumItems(0) == 2);
+     BOOST_CHECK(grouping.getNumItems(1) == 3);
+     // each image keeps its items in their original order.
+     const unsigned int *item = grouping.itemsBegin(0);
+     BOOST_CHECK(item[0] == 1);
+     BOOST_CHECK(item[1] == 3);
+     BOOST_CHECK(grouping.itemsEnd(0) == grouping.itemsBegin(1));
+     item = grouping.itemsBegin(1);
+     BOOST_CHECK(item[0] == 0);
+     BOOST_CHECK(item[1] == 2);
+     BOOST_CHECK(item[2] == 4);
+
+     std::vector<unsigned int> itemImages;
+     itemImages.push_back(2);
+     itemImages.push_back(0);
+     itemImages.push_back(2);
+     ImageGrouping grouping2(itemImages, 4);
+     BOOST_CHECK(grouping2.getNumImages() == 4);
+     BOOST_CHECK(grouping2.getNumItems(1) == 0);
+     BOOST_CHECK(grouping2.getNumItems(3) == 0);
+     BOOST_CHECK(*grouping2.itemsBegin(0) == 1);
+     BOOST_CHECK(grouping2.itemsBegin(2)[0] == 0);
+     BOOST_CHECK(grouping2.itemsBegin(2)[1] == 2);
+
+     itemImages.push_back(4);
+     BOOST_CHECK_THROW(ImageGrouping(itemImages, 4), BadParameterException);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( distinctIndexCounter_1 )
+{
+     DistinctIndexCounter counter;
+     counter.resize(10);
+     BOOST_CHECK(counter.count() == 0);
+     BOOST_CHECK(counter.add(3));
+     BOOST_CHECK(!counter.add(3));
+     BOOST_CHECK(counter.add(9));
+     // grows past what we asked for
+     BOOST_CHECK(counter.add(200));
+     BOOST_CHECK(!counter.add(200));
+     BOOST_CHECK(counter.count() == 3);
+     counter.clear();
+     BOOST_CHECK(counter.count() == 0);
+     BOOST_CHECK(counter.add(200));
+     BOOST_CHECK(counter.add(3));
+     BOOST_CHECK(counter.count() == 2);
+}
+
+
+
+
+BOOST_AUTO_TEST_CASE( detectionStore_1 )
+{
+     // a store converted from a text file reads back as the same
+     // detections.
+     std::string textFileName = "detectionStore_1.txt.tmp";
+     std::string storeFileName = "detectionStore_1.store.tmp";
+     std::ofstream textFile(textFileName.c_str());
+     //  diaId obsHistId ssmId RA Dec MJD mag SNR
+     textFile << "0 85000 17 10.5 -20.25 53000.01 21.5 5.5\n";
+     textFile << "1 85000 -1 10.6 -20.125 53000.01 22.75 7.25\n";
+     textFile << "7 85001 17 10.625 -20.0625 53000.04 21.25 10.5\n";
+     textFile.close();
+
+     double astromErr = 0.2 / 3600.;
+     convertDetectionFileToStore(textFileName, storeFileName, astromErr);
+     BOOST_CHECK(DetectionStore::isDetectionStore(storeFileName));
+     BOOST_CHECK(!DetectionStore::isDetectionStore(textFileName));
+
+     std::vector<MopsDetection> fromText;
+     populateDetVectorFromFile(textFileName, fromText, astromErr);
+     std::vector<MopsDetection> fromStore;
+     populateDetVectorFromFile(storeFileName, fromStore, astromErr);
+     BOOST_CHECK(fromText.size() == 3);
+     BOOST_CHECK(fromStore.size() == fromText.size());
+     for (unsigned int i = 0; i < fromText.size(); i++) {
+          const MopsDetection &a = fromText[i];
+          const MopsDetection &b = fromStore[i];
+          BOOST_CHECK(a.getID() == b.getID());
+          BOOST_CHECK(a.getImageID() == b.getImageID());
+          BOOST_CHECK(a.getSsmId() == b.getSsmId());
+          BOOST_CHECK(a.getRA() == b.getRA());
+          BOOST_CHECK(a.getDec() == b.getDec());
+          BOOST_CHECK(a.getEpochMJD() == b.getEpochMJD());
+          BOOST_CHECK(a.getMag() == b.getMag());
+          BOOST_CHECK(a.getSNR() == b.getSNR());
+          BOOST_CHECK(a.getRaErr() == b.getRaErr());
+          BOOST_CHECK(a.getDecErr() == b.getDecErr());
+     }
+     // without an astromErr, the stored errors are used.
+     std::vector<MopsDetection> storedErrs;
+     populateDetVectorFromFile(storeFileName, storedErrs);
+     BOOST_CHECK(storedErrs.size() == 3);
+     BOOST_CHECK(storedErrs[1].getRaErr() == astromErr);
+     BOOST_CHECK(storedErrs[1].getDecErr() == astromErr);
+
+     {
+          DetectionStore store(storeFileName);
+          BOOST_CHECK(store.size() == 3);
+          BOOST_CHECK(store.getIDs()[2] == 7);
+          BOOST_CHECK(store.getSsmIds()[1] == -1);
+          BOOST_CHECK(store.getMJDs()[2] == 53000.04);
+          BOOST_CHECK(store.getRaErrs()[0] == astromErr);
+          BOOST_CHECK(((uintptr_t) store.getDecs()) % 64 == 0);
+          BOOST_CHECK(((uintptr_t) store.getSsmIds()) % 64 == 0);
+     }
+
+     // an empty store is fine too.
+     writeDetectionStore(std::vector<MopsDetection>(), storeFileName);
+     DetectionStore emptyStore(storeFileName);
+     BOOST_CHECK(emptyStore.size() == 0);
+
+     std::remove(textFileName.c_str());
+     std::remove(storeFileName.c_str());
+}
+
+
+
+
+BOOST_AUTO_TEST_CASE( chunkedTextReader_1 )
+{
+     // the parallel readers give just what the line-by-line ones do,
+     // in the same order.  Make the files big enough to be split.
+     std::string detsFileName = "chunkedTextReader_1.dets.tmp";
+     std::string pairsFileName = "chunkedTextReader_1.pairs.tmp";
+     std::ofstream detsOut(detsFileName.c_str());
+     std::ofstream pairsOut(pairsFileName.c_str());
+     detsOut << std::setprecision(12);
+     srand(42);
+     for (unsigned int i = 0; i < 100000; i++) {
+          detsOut << i << " " << 85000 + i / 1000 << " " << (int) (i % 7) - 1 
+                  << " " << 360. * rand() / RAND_MAX 
+                  << "\t" << 180. * rand() / RAND_MAX - 90.
+                  << " " << 53000. + i * 1e-4 << " " << 20 + i % 5 
+                  << " +" << 5.5 << "\n";
+          // indices out of order, repeated, extra blanks, no final
+          // newline.  (The old reader wants a blank after the last
+          // index, as writeTrackletsToOutFile writes.)
+          pairsOut << 1000 + (i * 3) % 1000 << " " << i % 1000 << " " << i % 1000 << " ";
+          if (i % 3 == 0) {
+               pairsOut << (i * 7) % 1000 << "  ";
+          }
+          if (i + 1 < 100000) {
+               pairsOut << "\n";
+          }
+     }
+     detsOut.close();
+     pairsOut.close();
+
+     std::vector<MopsDetection> oldDets, newDets;
+     std::ifstream detsIn(detsFileName.c_str());
+     populateDetVectorFromFile(detsIn, oldDets, .001);
+     populateDetVectorFromFile(detsFileName, newDets, .001);
+     BOOST_CHECK(oldDets.size() == 100000);
+     BOOST_CHECK(newDets.size() == oldDets.size());
+     bool allSame = true;
+     for (unsigned int i = 0; i < oldDets.size() && i < newDets.size(); i++) {
+          const MopsDetection &a = oldDets[i];
+          const MopsDetection &b = newDets[i];
+          allSame = allSame && (a.getID() == b.getID()) &&
+               (a.getImageID() == b.getImageID()) &&
+               (a.getSsmId() == b.getSsmId()) &&
+               (a.getRA() == b.getRA()) && (a.getDec() == b.getDec()) &&
+               (a.getEpochMJD() == b.getEpochMJD()) &&
+               (a.getMag() == b.getMag()) && (a.getSNR() == b.getSNR()) &&
+               (a.getRaErr() == b.getRaErr()) && 
+               (a.getDecErr() == b.getDecErr());
+     }
+     BOOST_CHECK(allSame);
+
+     // make sure the file really is split, and lines are numbered
+     // across chunks.
+     ChunkedTextReader reader(detsFileName, "dets");
+     std::vector<unsigned long> lineNumbers;
+     reader.parseLines([](const char *, const char *,
+                          unsigned long lineNumber,
+                          std::vector<unsigned long> &numbers) {
+                            numbers.push_back(lineNumber);
+                       }, lineNumbers, 4);
+     BOOST_CHECK(lineNumbers.size() == 100000);
+     allSame = true;
+     for (unsigned int i = 0; i < lineNumbers.size(); i++) {
+          allSame = allSame && (lineNumbers[i] == i);
+     }
+     BOOST_CHECK(allSame);
+
+     std::vector<Tracklet> oldPairs, newPairs;
+     std::ifstream pairsIn(pairsFileName.c_str());
+     populatePairsVectorFromFile(pairsIn, oldPairs);
+     populatePairsVectorFromFile(pairsFileName, newPairs);
+     BOOST_CHECK(oldPairs.size() == 100000);
+     BOOST_CHECK(newPairs.size() == oldPairs.size());
+     allSame = true;
+     for (unsigned int i = 0; i < oldPairs.size() && i < newPairs.size(); i++) {
+          allSame = allSame && (oldPairs[i].indices == newPairs[i].indices);
+     }
+     BOOST_CHECK(allSame);
+
+     std::remove(detsFileName.c_str());
+     std::remove(pairsFileName.c_str());
+}
+
+
+
 
 ///////////////////////////////////////////////////////////////////////
 //    KDTREE TESTS
@@ -745,6 +1120,271 @@ BOOST_AUTO_TEST_CASE ( KDTree_john_dailey_bug_unit_test  )
 
 
 
+BOOST_AUTO_TEST_CASE ( KDTree_nThreads_1 )
+{
+     // the tree must be the same however many threads build it.
+     // Points are on a coarse grid so many share values along each
+     // axis.
+     srand(17);
+     std::vector<PointAndValue <int> > pav;
+     int count = 0;
+     for (unsigned int i = 0; i < 40000; i++) {
+	  std::vector<double> tmpPt;
+	  tmpPt.push_back((rand() % 200) * .01);
+	  tmpPt.push_back((rand() % 50) * .01);
+	  tmpPt.push_back(rand() % 10);
+	  insertPoint(tmpPt, count, pav);
+     }
+     KDTree<int> serialTree(pav, 3, 8, 1);
+     KDTree<int> threadedTree(pav, 3, 8, 4);
+     BOOST_CHECK(serialTree.size() == threadedTree.size());
+
+     std::vector<double> queryPt;
+     queryPt.push_back(1.);
+     queryPt.push_back(.25);
+     std::vector<double> otherDimsPt;
+     otherDimsPt.push_back(5);
+     std::vector<double> otherDimsTolerances;
+     otherDimsTolerances.push_back(2);
+     std::vector<GeometryType> spaceTypes;
+     spaceTypes.push_back(RA_DEGREES);
+     spaceTypes.push_back(DEC_DEGREES);
+     spaceTypes.push_back(EUCLIDEAN);
+     std::vector<PointAndValue <int> > serialResults = 
+	  serialTree.RADecRangeSearch(queryPt, .2, otherDimsPt, 
+				      otherDimsTolerances, spaceTypes);
+     std::vector<PointAndValue <int> > threadedResults = 
+	  threadedTree.RADecRangeSearch(queryPt, .2, otherDimsPt, 
+					otherDimsTolerances, spaceTypes);
+     BOOST_CHECK(serialResults.size() > 100);
+     BOOST_REQUIRE(serialResults.size() == threadedResults.size());
+     for (unsigned int i = 0; i < serialResults.size(); i++) {
+	  BOOST_CHECK(serialResults[i].getValue() == threadedResults[i].getValue());
+     }
+}
+
+
+
+BOOST_AUTO_TEST_CASE ( KDTree_fixedDimension_1 )
+{
+     // a KDTree<T, K> must find just what a KDTree<T> of the same
+     // points does.
+     srand(19);
+     std::vector<PointAndValue <int> > pav;
+     std::vector<PointAndValue <int, 3> > fixedPav;
+     for (unsigned int i = 0; i < 3000; i++) {
+	  PointAndValue<int, 3>::PointType fixedPt;
+	  fixedPt[0] = 359.5 + rand() % 100 * .01;
+	  fixedPt[0] = convertToStandardDegrees(fixedPt[0]);
+	  fixedPt[1] = rand() % 100 * .01;
+	  fixedPt[2] = rand() % 10;
+	  PointAndValue<int, 3> fixedTmp;
+	  fixedTmp.setPoint(fixedPt);
+	  fixedTmp.setValue(i);
+	  fixedPav.push_back(fixedTmp);
+
+	  std::vector<double> tmpPt(fixedPt.begin(), fixedPt.end());
+	  PointAndValue<int> tmp;
+	  tmp.setPoint(tmpPt);
+	  tmp.setValue(i);
+	  pav.push_back(tmp);
+     }
+     KDTree<int> tree(pav, 3, 4);
+     KDTree<int, 3> fixedTree(fixedPav, 3, 4);
+     BOOST_CHECK(tree.size() == fixedTree.size());
+
+     std::vector<double> queryPt;
+     queryPt.push_back(0.);
+     queryPt.push_back(.5);
+     std::vector<double> otherDimsPt;
+     otherDimsPt.push_back(5);
+     std::vector<double> otherDimsTolerances;
+     otherDimsTolerances.push_back(2);
+     std::vector<GeometryType> spaceTypes;
+     spaceTypes.push_back(RA_DEGREES);
+     spaceTypes.push_back(DEC_DEGREES);
+     spaceTypes.push_back(EUCLIDEAN);
+     std::vector<PointAndValue <int> > results = 
+	  tree.RADecRangeSearch(queryPt, .3, otherDimsPt, 
+				otherDimsTolerances, spaceTypes);
+     std::vector<PointAndValue <int, 3> > fixedResults = 
+	  fixedTree.RADecRangeSearch(queryPt, .3, otherDimsPt, 
+				     otherDimsTolerances, spaceTypes);
+     BOOST_CHECK(results.size() > 50);
+     BOOST_REQUIRE(results.size() == fixedResults.size());
+     for (unsigned int i = 0; i < results.size(); i++) {
+	  BOOST_CHECK(results[i].getValue() == fixedResults[i].getValue());
+	  BOOST_CHECK(results[i].getPoint()[2] == fixedResults[i].getPoint()[2]);
+     }
+}
+
+
+
+BOOST_AUTO_TEST_CASE ( KDTree_visitAndBatch_1 )
+{
+     // searching with a visitor, or many points at once, must find just
+     // what the vector-returning searches do, in the same order.
+     srand(23);
+     std::vector<PointAndValue <int, 3> > pav;
+     for (unsigned int i = 0; i < 3000; i++) {
+	  PointAndValue<int, 3>::PointType pt;
+	  pt[0] = convertToStandardDegrees(359.5 + rand() % 100 * .01);
+	  pt[1] = rand() % 100 * .01;
+	  pt[2] = rand() % 10;
+	  PointAndValue<int, 3> tmp;
+	  tmp.setPoint(pt);
+	  tmp.setValue(i);
+	  pav.push_back(tmp);
+     }
+     KDTree<int, 3> tree(pav, 3, 4);
+
+     std::vector<double> otherDimsTolerances;
+     otherDimsTolerances.push_back(2);
+     std::vector<GeometryType> spaceTypes;
+     spaceTypes.push_back(RA_DEGREES);
+     spaceTypes.push_back(DEC_DEGREES);
+     spaceTypes.push_back(EUCLIDEAN);
+
+     std::vector<double> queryPts;
+     std::vector<double> otherDimsPts;
+     std::vector<std::pair<unsigned int, int> > expected;
+     for (unsigned int q = 0; q < 600; q++) {
+	  std::vector<double> queryPt;
+	  queryPt.push_back(convertToStandardDegrees(359.5 + rand() % 100 * .01));
+	  queryPt.push_back(rand() % 100 * .01);
+	  std::vector<double> otherDimsPt;
+	  otherDimsPt.push_back(rand() % 10);
+	  queryPts.insert(queryPts.end(), queryPt.begin(), queryPt.end());
+	  otherDimsPts.push_back(otherDimsPt[0]);
+
+	  std::vector<PointAndValue <int, 3> > results = 
+	       tree.RADecRangeSearch(queryPt, .1, otherDimsPt, 
+				     otherDimsTolerances, spaceTypes);
+	  std::vector<int> visited;
+	  tree.RADecRangeSearch(queryPt, .1, otherDimsPt, 
+				otherDimsTolerances, spaceTypes,
+				[&visited](const PointAndValue<int, 3> &match) {
+				     visited.push_back(match.getValue());
+				});
+	  BOOST_REQUIRE(results.size() == visited.size());
+	  for (unsigned int i = 0; i < results.size(); i++) {
+	       BOOST_CHECK(results[i].getValue() == visited[i]);
+	       expected.push_back(std::make_pair(q, results[i].getValue()));
+	  }
+     }
+     BOOST_CHECK(expected.size() > 1000);
+
+     for (unsigned int nThreads = 1; nThreads <= 4; nThreads += 3) {
+	  std::vector<std::pair<unsigned int, int> > batchResults;
+	  tree.RADecRangeSearchBatch(queryPts, .1, otherDimsPts, 
+				     otherDimsTolerances, spaceTypes,
+				     [&batchResults](unsigned int q,
+						     const PointAndValue<int, 3> &match) {
+					  batchResults.push_back(std::make_pair(q, match.getValue()));
+				     },
+				     nThreads);
+	  BOOST_CHECK(batchResults == expected);
+     }
+
+     std::vector<double> rectQueryPt(pav[0].getPoint().begin(), 
+				     pav[0].getPoint().end());
+     std::vector<double> rectTolerances(3, .2);
+     std::vector<GeometryType> rectTypes(3, EUCLIDEAN);
+     rectTypes[0] = CIRCULAR_DEGREES;
+     std::vector<PointAndValue <int, 3> > rectResults = 
+	  tree.hyperRectangleSearch(rectQueryPt, rectTolerances, rectTypes);
+     std::vector<int> rectVisited;
+     tree.hyperRectangleSearch(rectQueryPt, rectTolerances, rectTypes,
+			       [&rectVisited](const PointAndValue<int, 3> &match) {
+				    rectVisited.push_back(match.getValue());
+			       });
+     BOOST_CHECK(rectResults.size() > 0);
+     BOOST_REQUIRE(rectResults.size() == rectVisited.size());
+     for (unsigned int i = 0; i < rectResults.size(); i++) {
+	  BOOST_CHECK(rectResults[i].getValue() == rectVisited[i]);
+     }
+}
+
+
+
+BOOST_AUTO_TEST_CASE ( SkyIndex_1 )
+{
+     // a SkyIndex must find just the points a brute-force search by
+     // great-circle distance does, across RA 0 and over the pole.
+     srand(29);
+     std::vector<double> RADecs;
+     std::vector<double> times;
+     std::vector<unsigned int> values;
+     for (unsigned int i = 0; i < 4000; i++) {
+	  RADecs.push_back(convertToStandardDegrees(-3. + 6. * rand() / RAND_MAX));
+	  if (i % 2 == 0) {
+	       RADecs.push_back(-3. + 6. * rand() / RAND_MAX);
+	  }
+	  else {
+	       RADecs.push_back(85. + 5. * rand() / RAND_MAX);
+	  }
+	  times.push_back(rand() % 10);
+	  values.push_back(i);
+     }
+     std::vector<double> noOtherDims;
+     SkyIndex<unsigned int> index(RADecs, noOtherDims, values, 8);
+     SkyIndex<unsigned int, 1> timeIndex(RADecs, times, values, 8);
+     BOOST_CHECK(index.size() == values.size());
+
+     std::vector<double> timeTolerance(1, 1.);
+     std::vector<double> queryRADecs;
+     std::vector<double> queryTimes;
+     std::vector<std::pair<unsigned int, unsigned int> > expectedBatch;
+     unsigned int nFound = 0;
+     for (unsigned int q = 0; q < 100; q++) {
+	  double ra = RADecs[2 * q];
+	  double dec = RADecs[2 * q + 1] - .5;
+	  queryRADecs.push_back(ra);
+	  queryRADecs.push_back(dec);
+	  queryTimes.push_back(times[q]);
+	  std::set<unsigned int> expected, expectedInTime;
+	  for (unsigned int i = 0; i < values.size(); i++) {
+	       double d = angularDistanceRADec_deg(ra, dec, RADecs[2 * i], 
+						   RADecs[2 * i + 1]);
+	       if ((d >= .2) && (d < .6)) {
+		    expected.insert(i);
+		    if (fabs(times[i] - times[q]) <= 1.) {
+			 expectedInTime.insert(i);
+		    }
+	       }
+	  }
+	  std::set<unsigned int> found, foundInTime;
+	  index.radiusSearch(ra, dec, .2, .6, noOtherDims, noOtherDims,
+			     [&found](const PointAndValue<unsigned int, 3> &match) {
+				  found.insert(match.getValue());
+			     });
+	  std::vector<double> queryTime(1, times[q]);
+	  timeIndex.radiusSearch(ra, dec, .2, .6, queryTime, timeTolerance,
+				 [&](const PointAndValue<unsigned int, 4> &match) {
+				      foundInTime.insert(match.getValue());
+				      expectedBatch.push_back(std::make_pair(q, match.getValue()));
+				 });
+	  BOOST_CHECK(found == expected);
+	  BOOST_CHECK(foundInTime == expectedInTime);
+	  nFound += found.size();
+     }
+     BOOST_CHECK(nFound > 1000);
+
+     std::vector<std::pair<unsigned int, unsigned int> > batch;
+     timeIndex.radiusSearchBatch(queryRADecs, .2, .6, queryTimes, timeTolerance,
+				 [&batch](unsigned int q, 
+					  const PointAndValue<unsigned int, 4> &match) {
+				      batch.push_back(std::make_pair(q, match.getValue()));
+				 });
+     BOOST_CHECK(batch == expectedBatch);
+
+     BOOST_CHECK_THROW(index.radiusSearch(0, 0, .2, .6, timeTolerance, timeTolerance,
+					  [](const PointAndValue<unsigned int, 3> &) {}),
+		       BadParameterException);
+}
+
+
+
 BOOST_AUTO_TEST_CASE ( KDTree_RADecRangeSearch_1 )
 {
      // test our ability to deal with pole crossers in RADec searches.
@@ -1025,6 +1665,58 @@ BOOST_AUTO_TEST_CASE ( KDTree_RADecRangeSearch_6 )
 
 
 
+BOOST_AUTO_TEST_CASE ( KDTree_RADecPairSearch_1 )
+{
+     // must find just what a brute-force search does, around RA 0 and
+     // Dec 0 where the tree's boxes wrap.
+     srand(13);
+     std::vector<PointAndValue <int> > pav0, pav1;
+     std::vector<double> ra0, dec0, ra1, dec1;
+     int count0 = 0, count1 = 0;
+     for (unsigned int i = 0; i < 1500; i++) {
+	  std::vector<double> tmpPt;
+	  tmpPt.push_back(convertToStandardDegrees(-1. + 2. * rand() / RAND_MAX));
+	  tmpPt.push_back(convertToStandardDegrees(-1. + 2. * rand() / RAND_MAX));
+	  if (i % 2 == 0) {
+	       ra0.push_back(tmpPt[0]);
+	       dec0.push_back(tmpPt[1]);
+	       insertPoint(tmpPt, count0, pav0);
+	  }
+	  else {
+	       ra1.push_back(tmpPt[0]);
+	       dec1.push_back(tmpPt[1]);
+	       insertPoint(tmpPt, count1, pav1);
+	  }
+     }
+     KDTree<int> tree0(pav0, 2, 4);
+     KDTree<int> tree1(pav1, 2, 4);
+     double minDistance = .02;
+     double maxDistance = .1;
+     std::vector<std::pair<int, int> > found;
+     tree0.RADecPairSearch(tree1, minDistance, maxDistance, found);
+     std::sort(found.begin(), found.end());
+
+     std::vector<std::pair<int, int> > expected;
+     for (unsigned int i = 0; i < ra0.size(); i++) {
+	  for (unsigned int j = 0; j < ra1.size(); j++) {
+	       double d = angularDistanceRADec_deg(ra0[i], dec0[i], ra1[j], dec1[j]);
+	       if ((d >= minDistance) && (d < maxDistance)) {
+		    expected.push_back(std::make_pair((int) i, (int) j));
+	       }
+	  }
+     }
+     BOOST_CHECK(expected.size() > 100);
+     BOOST_CHECK(found == expected);
+
+     // an empty tree has no pairs.
+     KDTree<int> emptyTree;
+     found.clear();
+     tree0.RADecPairSearch(emptyTree, 0, 1., found);
+     BOOST_CHECK(found.size() == 0);
+}
+
+
+
 
 
 
@@ -1291,6 +1983,109 @@ BOOST_AUTO_TEST_CASE( putLongestOnlyInOutputVector_blackbox_2 )
 
 
 
+
+BOOST_AUTO_TEST_CASE( trackletStore_1 )
+{
+    TrackletStore store;
+    BOOST_CHECK(store.size() == 0);
+    // out of order, with a repeat.
+    unsigned int indices[4] = {7, 3, 7, 5};
+    BOOST_CHECK(store.addTracklet(indices, indices + 4) == 0);
+    BOOST_CHECK(store.addTracklet(indices + 1, indices + 2) == 1);
+    BOOST_REQUIRE(store.size() == 2);
+    BOOST_CHECK(store.getNumAllIndices() == 4);
+    BOOST_REQUIRE(store.getNumIndices(0) == 3);
+    BOOST_CHECK(store.indicesBegin(0)[0] == 3);
+    BOOST_CHECK(store.indicesBegin(0)[1] == 5);
+    BOOST_CHECK(store.indicesBegin(0)[2] == 7);
+    BOOST_CHECK(store.indicesEnd(0) == store.indicesBegin(1));
+    BOOST_CHECK(store.contains(0, 5));
+    BOOST_CHECK(!store.contains(1, 5));
+    BOOST_CHECK(store.getId(1) == 1);
+    BOOST_CHECK(!store.isCollapsed(0));
+
+    BOOST_CHECK(!store.hasParameters());
+    store.setParameters(1, 1., 2., 3., 4., 5.);
+    BOOST_CHECK(store.hasParameters());
+    BOOST_CHECK(store.getRa0(0) == 0.);
+    BOOST_CHECK(store.getDeltaTime(1) == 5.);
+    Tracklet t = store.getTracklet(1);
+    BOOST_REQUIRE(t.getBestFitFunctionDec()->size() == 2);
+    BOOST_CHECK(t.getBestFitFunctionDec()->at(0) == 2.);
+    BOOST_CHECK(t.getBestFitFunctionDec()->at(1) == 4.);
+
+    // to and from vectors of Tracklets.
+    std::vector<Tracklet> trackletVec;
+    store.appendToVector(trackletVec);
+    BOOST_REQUIRE(trackletVec.size() == 2);
+    std::set<unsigned int> expected;
+    expected.insert(3);
+    expected.insert(5);
+    expected.insert(7);
+    BOOST_CHECK(trackletVec[0].indices == expected);
+    trackletVec[1].setId(12);
+    trackletVec[1].isCollapsed = true;
+    TrackletStore copy(trackletVec);
+    BOOST_REQUIRE(copy.size() == 2);
+    BOOST_CHECK(copy.getId(1) == 12);
+    BOOST_CHECK(copy.isCollapsed(1));
+    BOOST_CHECK(copy.getTracklet(0).indices == expected);
+
+    // removeSubsets and putLongest give the same on either.
+    std::vector<Tracklet> pairsVec;
+    for (unsigned int i = 0; i < 300; i++) {
+        Tracklet tmp;
+        tmp.indices.insert(i % 40);
+        tmp.indices.insert(40 + (i * 7) % 50);
+        if (i % 4 == 0) {
+            tmp.indices.insert(100 + i % 13);
+        }
+        pairsVec.push_back(tmp);
+    }
+    TrackletStore pairsStore(pairsVec);
+    SubsetRemover mySR;
+    std::vector<Tracklet> vecOut;
+    TrackletStore storeOut;
+    mySR.removeSubsetsPopulateOutputVector(&pairsVec, vecOut);
+    mySR.removeSubsetsPopulateOutputVector(&pairsStore, storeOut);
+    BOOST_REQUIRE(vecOut.size() == storeOut.size());
+    bool allSame = true;
+    for (unsigned int i = 0; i < vecOut.size(); i++) {
+        allSame = allSame && (vecOut[i].indices == storeOut.getTracklet(i).indices);
+    }
+    BOOST_CHECK(allSame);
+
+    vecOut.clear();
+    storeOut.clear();
+    putLongestPerDetInOutputVector(&pairsVec, vecOut);
+    putLongestPerDetInOutputVector(&pairsStore, storeOut);
+    BOOST_REQUIRE(vecOut.size() == storeOut.size());
+    allSame = true;
+    for (unsigned int i = 0; i < vecOut.size(); i++) {
+        allSame = allSame && (vecOut[i].indices == storeOut.getTracklet(i).indices);
+    }
+    BOOST_CHECK(allSame);
+
+    // and the file readers and writers agree.
+    std::string fileName = "trackletStore_1.tmp";
+    writeTrackletsToOutFile(&pairsStore, fileName);
+    std::vector<Tracklet> readVec;
+    TrackletStore readStore;
+    populatePairsVectorFromFile(fileName, readVec);
+    populateTrackletStoreFromFile(fileName, readStore);
+    std::remove(fileName.c_str());
+    BOOST_REQUIRE(readVec.size() == pairsVec.size());
+    BOOST_REQUIRE(readStore.size() == pairsVec.size());
+    allSame = true;
+    for (unsigned int i = 0; i < pairsVec.size(); i++) {
+        allSame = allSame && (readVec[i].indices == pairsVec[i].indices) &&
+            (readStore.getTracklet(i).indices == pairsVec[i].indices);
+    }
+    BOOST_CHECK(allSame);
+}
+
+
+
 // TBD: removeSubsetsMain.  This will also require some external files.  Probably 
 // better accomplished with some shell scripts...
 
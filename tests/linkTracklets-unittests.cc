@@ -7,13 +7,17 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <set>
+#include <sstream>
 #include <string>
 #include <cmath>
 
 // for rand()
 #include <cstdlib> 
+#include <cstdio>
 // for printing timing info
 #include <time.h>
+#include <dirent.h>
 
 
 
@@ -24,6 +28,13 @@
 #include "lsst/mops/daymops/linkTracklets/linkTracklets.h"
 #include "lsst/mops/Exceptions.h"
 #include "lsst/mops/daymops/linkTracklets/TrackletTree.h"
+#include "lsst/mops/daymops/linkTracklets/supportCompatibility.h"
+#include "lsst/mops/daymops/linkTracklets/lruCache.h"
+#include "lsst/mops/daymops/linkTracklets/chisqThresholds.h"
+#include "lsst/mops/daymops/linkTracklets/endpointPrecheck.h"
+#include "lsst/mops/daymops/linkTracklets/skyTiles.h"
+#include "lsst/mops/daymops/linkTracklets/LinkingState.h"
+#include "gsl/gsl_cdf.h"
 
 namespace lsst {
     namespace mops {
@@ -71,8 +82,8 @@ void debugPrintTrackSet(const TrackSet &tracks, const std::vector<MopsDetection>
          trackIter != tracks.componentTracks.end();
          trackIter++) {
         std::cout << " track " << trackCount << ":\n";
-        std::set<unsigned int>::const_iterator detIdIter;
-        std::set<unsigned int> componentDetectionIndices = trackIter->getComponentDetectionIndices();
+        Track::IndexSet::const_iterator detIdIter;
+        const Track::IndexSet &componentDetectionIndices = trackIter->getComponentDetectionIndices();
         for (detIdIter = componentDetectionIndices.begin();
              detIdIter != componentDetectionIndices.end();
              detIdIter++) {
@@ -1531,6 +1542,1281 @@ BOOST_AUTO_TEST_CASE( linkTracklets_5_5 )
 
 
 
+BOOST_AUTO_TEST_CASE( linkTracklets_nThreads )
+{
+    // many image pairs; running them on several threads must give
+    // exactly the same tracks as running them serially.
+    TrackSet expectedTracks;
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(5);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5302);
+    imgTimes.at(1).push_back(5302.03);
+    imgTimes.at(2).push_back(5305);
+    imgTimes.at(2).push_back(5305.03);
+    imgTimes.at(3).push_back(5308);
+    imgTimes.at(3).push_back(5308.03);
+    imgTimes.at(4).push_back(5312);
+    imgTimes.at(4).push_back(5312.03);
+
+    srand(11);
+
+    for (unsigned int i = 0; i < 200; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 6; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        expectedTracks.insert(generateTrack(20. + someRands[0] * 2., 
+                                            20. + someRands[1] * 2., 
+                                            (someRands[2] - .5) * .2, 
+                                            (someRands[3] - .5) * .2, 
+                                            (someRands[4]) * .0019, 
+                                            (someRands[5]) * .0019, 
+                                            imgTimes, 
+                                            allDets, allTracklets, 
+                                            firstDetId, firstTrackletId));
+    }
+
+    linkTrackletsConfig serialConfig;
+    std::vector<MopsDetection> serialDets(allDets);
+    std::vector<Tracklet> serialTracklets(allTracklets);
+    TrackSet * serialTracks = linkTracklets(serialDets, serialTracklets, 
+                                            serialConfig);
+
+    linkTrackletsConfig threadedConfig;
+    threadedConfig.nThreads = 4;
+    std::vector<MopsDetection> threadedDets(allDets);
+    std::vector<Tracklet> threadedTracklets(allTracklets);
+    TrackSet * threadedTracks = linkTracklets(threadedDets, threadedTracklets, 
+                                              threadedConfig);
+
+    // also split every image pair into as many tasks as possible.
+    linkTrackletsConfig splitConfig;
+    splitConfig.nThreads = 4;
+    splitConfig.taskSplitThreshold = 1;
+    std::vector<MopsDetection> splitDets(allDets);
+    std::vector<Tracklet> splitTracklets(allTracklets);
+    TrackSet * splitTracks = linkTracklets(splitDets, splitTracklets, 
+                                           splitConfig);
+
+    BOOST_CHECK(expectedTracks.isSubsetOf(*serialTracks));
+    BOOST_CHECK(*serialTracks == *threadedTracks);
+    BOOST_CHECK(*serialTracks == *splitTracks);
+    delete serialTracks;
+    delete threadedTracks;
+    delete splitTracks;
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_flatTrees )
+{
+    // linking on FlatTrackletTrees must find exactly the tracks found
+    // on the usual pointer-based TrackletTrees.
+    TrackSet expectedTracks;
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(4);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5303);
+    imgTimes.at(1).push_back(5303.03);
+    imgTimes.at(2).push_back(5306);
+    imgTimes.at(2).push_back(5306.03);
+    imgTimes.at(3).push_back(5310);
+    imgTimes.at(3).push_back(5310.03);
+
+    srand(12);
+
+    for (unsigned int i = 0; i < 200; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 6; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        expectedTracks.insert(generateTrack(20. + someRands[0] * 2., 
+                                            20. + someRands[1] * 2., 
+                                            (someRands[2] - .5) * .2, 
+                                            (someRands[3] - .5) * .2, 
+                                            (someRands[4]) * .0019, 
+                                            (someRands[5]) * .0019, 
+                                            imgTimes, 
+                                            allDets, allTracklets, 
+                                            firstDetId, firstTrackletId));
+    }
+
+    linkTrackletsConfig pointerConfig;
+    std::vector<MopsDetection> pointerDets(allDets);
+    std::vector<Tracklet> pointerTracklets(allTracklets);
+    TrackSet * pointerTracks = linkTracklets(pointerDets, pointerTracklets, 
+                                             pointerConfig);
+
+    linkTrackletsConfig flatConfig;
+    flatConfig.useFlatTrackletTrees = true;
+    std::vector<MopsDetection> flatDets(allDets);
+    std::vector<Tracklet> flatTracklets(allTracklets);
+    TrackSet * flatTracks = linkTracklets(flatDets, flatTracklets, 
+                                          flatConfig);
+
+    linkTrackletsConfig flatThreadedConfig;
+    flatThreadedConfig.useFlatTrackletTrees = true;
+    flatThreadedConfig.nThreads = 4;
+    flatThreadedConfig.taskSplitThreshold = 1;
+    std::vector<MopsDetection> flatThreadedDets(allDets);
+    std::vector<Tracklet> flatThreadedTracklets(allTracklets);
+    TrackSet * flatThreadedTracks = linkTracklets(flatThreadedDets, 
+                                                  flatThreadedTracklets, 
+                                                  flatThreadedConfig);
+
+    BOOST_CHECK(expectedTracks.isSubsetOf(*pointerTracks));
+    BOOST_CHECK(*pointerTracks == *flatTracks);
+    BOOST_CHECK(*pointerTracks == *flatThreadedTracks);
+    delete pointerTracks;
+    delete flatTracks;
+    delete flatThreadedTracks;
+}
+
+
+
+BOOST_AUTO_TEST_CASE( supportCompatibility_1 )
+{
+    // a support node on the path of a slow, unaccelerated object is
+    // compatible with endpoints on that path; one far away is not.
+    EndpointBounds first;
+    EndpointBounds second;
+    double firstL[4] = {10., 10., .01, .01};
+    double firstU[4] = {10.01, 10.01, .02, .02};
+    double secondL[4] = {10.1, 10.1, .01, .01};
+    double secondU[4] = {10.11, 10.11, .02, .02};
+    for (unsigned int i = 0; i < 4; i++) {
+        first.lBounds[i] = firstL[i];
+        first.uBounds[i] = firstU[i];
+        second.lBounds[i] = secondL[i];
+        second.uBounds[i] = secondU[i];
+    }
+    first.mjd = 5300.;
+    second.mjd = 5310.;
+
+    SupportBatch batch;
+    double onPathL[4] = {10.05, 10.05, .01, .01};
+    double onPathU[4] = {10.06, 10.06, .02, .02};
+    double farL[4] = {12., 12., .01, .01};
+    double farU[4] = {12.01, 12.01, .02, .02};
+    batch.add(onPathL, onPathU, 5305.);
+    batch.add(farL, farU, 5305.);
+
+    unsigned int nSurvivors = findCompatibleSupport(first, second, 
+                                                    -.02, .02, -.02, .02,
+                                                    batch);
+    BOOST_CHECK(nSurvivors == 1);
+    BOOST_CHECK(batch.survivors.at(0));
+    BOOST_CHECK(!batch.survivors.at(1));
+    BOOST_CHECK(batch.accMinRa.at(0) >= -.02);
+    BOOST_CHECK(batch.accMaxRa.at(0) <= .02);
+    BOOST_CHECK(batch.accMinRa.at(0) <= batch.accMaxRa.at(0));
+}
+
+
+
+BOOST_AUTO_TEST_CASE( supportCompatibility_simdMatchesScalar )
+{
+    // whatever kernel this machine uses must agree exactly with the
+    // scalar code, including for batch sizes which aren't a multiple
+    // of the SIMD width.  Nodes are scattered around a straight-line
+    // path so that some survive and some don't.
+    srand(13);
+    unsigned int totalSurvivors = 0;
+    unsigned int totalNodes = 0;
+    for (unsigned int trial = 0; trial < 50; trial++) {
+        EndpointBounds first;
+        EndpointBounds second;
+        double p0[2];
+        double v[2];
+        first.mjd = 5300.;
+        second.mjd = 5301. + 9. * (double) rand() / RAND_MAX;
+        for (unsigned int d = 0; d < 2; d++) {
+            p0[d] = (double) rand() / RAND_MAX;
+            v[d] = ((double) rand() / RAND_MAX - .5) * .1;
+            double secondPos = p0[d] + v[d] * (second.mjd - first.mjd);
+            double w = .01 * (double) rand() / RAND_MAX;
+            first.lBounds[d] = p0[d] - w;
+            first.uBounds[d] = p0[d] + w;
+            w = .01 * (double) rand() / RAND_MAX;
+            second.lBounds[d] = secondPos - w;
+            second.uBounds[d] = secondPos + w;
+            w = .005 * (double) rand() / RAND_MAX;
+            first.lBounds[d + 2] = v[d] - w;
+            first.uBounds[d + 2] = v[d] + w;
+            w = .005 * (double) rand() / RAND_MAX;
+            second.lBounds[d + 2] = v[d] - w;
+            second.uBounds[d + 2] = v[d] + w;
+        }
+
+        SupportBatch simdBatch;
+        SupportBatch scalarBatch;
+        unsigned int batchSize = trial + 1;
+        for (unsigned int i = 0; i < batchSize; i++) {
+            double lBounds[4];
+            double uBounds[4];
+            double mjd = first.mjd + (second.mjd - first.mjd) * 
+                (.01 + .98 * (double) rand() / RAND_MAX);
+            for (unsigned int d = 0; d < 2; d++) {
+                double pos = p0[d] + v[d] * (mjd - first.mjd) + 
+                    ((double) rand() / RAND_MAX - .5) * .02;
+                double vel = v[d] + ((double) rand() / RAND_MAX - .5) * .005;
+                double w = .01 * (double) rand() / RAND_MAX;
+                lBounds[d] = pos - w;
+                uBounds[d] = pos + w;
+                w = .005 * (double) rand() / RAND_MAX;
+                lBounds[d + 2] = vel - w;
+                uBounds[d + 2] = vel + w;
+            }
+            simdBatch.add(lBounds, uBounds, mjd);
+            scalarBatch.add(lBounds, uBounds, mjd);
+        }
+
+        unsigned int simdSurvivors = 
+            findCompatibleSupport(first, second, -.02, .02, -.02, .02, 
+                                  simdBatch, true);
+        unsigned int scalarSurvivors = 
+            findCompatibleSupport(first, second, -.02, .02, -.02, .02, 
+                                  scalarBatch, false);
+        BOOST_CHECK(simdSurvivors == scalarSurvivors);
+        totalSurvivors += scalarSurvivors;
+        totalNodes += batchSize;
+        BOOST_CHECK(simdBatch.survivors == scalarBatch.survivors);
+        for (unsigned int i = 0; i < batchSize; i++) {
+            if (scalarBatch.survivors[i]) {
+                BOOST_CHECK(simdBatch.accMinRa[i] == scalarBatch.accMinRa[i]);
+                BOOST_CHECK(simdBatch.accMaxRa[i] == scalarBatch.accMaxRa[i]);
+                BOOST_CHECK(simdBatch.accMinDec[i] == scalarBatch.accMinDec[i]);
+                BOOST_CHECK(simdBatch.accMaxDec[i] == scalarBatch.accMaxDec[i]);
+            }
+        }
+    }
+    BOOST_CHECK(totalSurvivors > 0);
+    BOOST_CHECK(totalSurvivors < totalNodes);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( lruCache_1 )
+{
+    LRUCache<unsigned int, double> cache(3);
+    double v;
+    cache.insert(1, 1.);
+    cache.insert(2, 2.);
+    cache.insert(3, 3.);
+    BOOST_CHECK(cache.size() == 3);
+
+    // touch 1, so 2 is now the least recently used.
+    BOOST_CHECK(cache.find(1, v));
+    BOOST_CHECK(v == 1.);
+    cache.insert(4, 4.);
+    BOOST_CHECK(cache.size() == 3);
+    BOOST_CHECK(!cache.find(2, v));
+    BOOST_CHECK(cache.find(3, v));
+    BOOST_CHECK(cache.find(4, v));
+    BOOST_CHECK(v == 4.);
+
+    // updating an entry doesn't grow the cache.
+    cache.insert(3, 30.);
+    BOOST_CHECK(cache.size() == 3);
+    BOOST_CHECK(cache.find(3, v));
+    BOOST_CHECK(v == 30.);
+
+    // 1 is now the oldest; removing it frees a slot for 5.
+    cache.remove(1);
+    BOOST_CHECK(cache.size() == 2);
+    cache.insert(5, 5.);
+    BOOST_CHECK(cache.find(3, v));
+    BOOST_CHECK(cache.find(4, v));
+    BOOST_CHECK(cache.find(5, v));
+    BOOST_CHECK(cache.size() == 3);
+
+    BOOST_CHECK(cache.hits() == 7);
+    BOOST_CHECK(cache.misses() == 1);
+
+    cache.set_max_size(1);
+    BOOST_CHECK(cache.size() == 1);
+    BOOST_CHECK(cache.find(5, v));
+
+    LRUCache<unsigned int, double> noCache(0);
+    noCache.insert(1, 1.);
+    BOOST_CHECK(noCache.empty());
+    BOOST_CHECK(!noCache.find(1, v));
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_compatibilityCache )
+{
+    // caching must not change the tracks we find, whether the cache is
+    // big or small enough to be evicting all the time.
+    TrackSet expectedTracks;
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(4);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5302);
+    imgTimes.at(1).push_back(5302.03);
+    imgTimes.at(2).push_back(5305);
+    imgTimes.at(2).push_back(5305.03);
+    imgTimes.at(3).push_back(5309);
+    imgTimes.at(3).push_back(5309.03);
+
+    srand(14);
+
+    for (unsigned int i = 0; i < 200; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 6; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        expectedTracks.insert(generateTrack(20. + someRands[0] * 2., 
+                                            20. + someRands[1] * 2., 
+                                            (someRands[2] - .5) * .2, 
+                                            (someRands[3] - .5) * .2, 
+                                            (someRands[4]) * .0019, 
+                                            (someRands[5]) * .0019, 
+                                            imgTimes, 
+                                            allDets, allTracklets, 
+                                            firstDetId, firstTrackletId));
+    }
+
+    linkTrackletsConfig noCacheConfig;
+    noCacheConfig.compatibilityCacheSize = 0;
+    std::vector<MopsDetection> noCacheDets(allDets);
+    std::vector<Tracklet> noCacheTracklets(allTracklets);
+    TrackSet * noCacheTracks = linkTracklets(noCacheDets, noCacheTracklets, 
+                                             noCacheConfig);
+
+    linkTrackletsConfig cacheConfig;
+    cacheConfig.compatibilityCacheSize = 1 << 16;
+    std::vector<MopsDetection> cacheDets(allDets);
+    std::vector<Tracklet> cacheTracklets(allTracklets);
+    TrackSet * cacheTracks = linkTracklets(cacheDets, cacheTracklets, 
+                                           cacheConfig);
+
+    linkTrackletsConfig smallCacheConfig;
+    smallCacheConfig.compatibilityCacheSize = 16;
+    smallCacheConfig.nThreads = 4;
+    smallCacheConfig.taskSplitThreshold = 1;
+    std::vector<MopsDetection> smallCacheDets(allDets);
+    std::vector<Tracklet> smallCacheTracklets(allTracklets);
+    TrackSet * smallCacheTracks = linkTracklets(smallCacheDets, 
+                                                smallCacheTracklets, 
+                                                smallCacheConfig);
+
+    BOOST_CHECK(expectedTracks.isSubsetOf(*noCacheTracks));
+    BOOST_CHECK(*noCacheTracks == *cacheTracks);
+    BOOST_CHECK(*noCacheTracks == *smallCacheTracks);
+    delete noCacheTracks;
+    delete cacheTracks;
+    delete smallCacheTracks;
+}
+
+
+
+BOOST_AUTO_TEST_CASE( chisqThresholds_1 )
+{
+    // the precomputed limits must make the same call as evaluating
+    // prob(chisq), both inside the table and past its end.
+    double minProbs[] = {.5, .9, .98, .999};
+    srand(7);
+    for (unsigned int p = 0; p < 4; p++) {
+        ChisqThresholds thresholds(minProbs[p], 40);
+        for (unsigned int dof = 1; dof < 60; dof++) {
+            double limit = thresholds.getMaxChisq(dof);
+            BOOST_CHECK(fabs(gsl_cdf_chisq_Q(limit, dof) - minProbs[p]) 
+                        < 1e-9);
+            BOOST_CHECK(thresholds.accepts(limit * (1 - 1e-6), dof));
+            BOOST_CHECK(!thresholds.accepts(limit * (1 + 1e-6), dof));
+            for (unsigned int i = 0; i < 20; i++) {
+                double chisq = 3. * dof * rand() / RAND_MAX;
+                if (fabs(chisq - limit) < 1e-6 * limit) {
+                    continue;
+                }
+                BOOST_CHECK(thresholds.accepts(chisq, dof) ==
+                            (gsl_cdf_chisq_Q(chisq, dof) > minProbs[p]));
+            }
+        }
+    }
+
+    // nothing passes a cut of 1 and everything passes a cut of 0.
+    ChisqThresholds none(1.);
+    ChisqThresholds all(0.);
+    BOOST_CHECK(!none.accepts(0., 4));
+    BOOST_CHECK(all.accepts(1e6, 4));
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_fastTrackFit )
+{
+    // the fixed-size fitter and precomputed chisq cut must find the
+    // same tracks as the SVD fit and prob(chisq).
+    TrackSet expectedTracks;
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(5);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5303);
+    imgTimes.at(1).push_back(5303.03);
+    imgTimes.at(2).push_back(5306);
+    imgTimes.at(2).push_back(5306.03);
+    imgTimes.at(3).push_back(5308);
+    imgTimes.at(3).push_back(5308.03);
+    imgTimes.at(4).push_back(5310);
+    imgTimes.at(4).push_back(5310.03);
+
+    srand(14);
+
+    for (unsigned int i = 0; i < 200; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 6; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        expectedTracks.insert(generateTrack(20. + someRands[0] * 2., 
+                                            20. + someRands[1] * 2., 
+                                            (someRands[2] - .5) * .2, 
+                                            (someRands[3] - .5) * .2, 
+                                            (someRands[4]) * .0019, 
+                                            (someRands[5]) * .0019, 
+                                            imgTimes, 
+                                            allDets, allTracklets, 
+                                            firstDetId, firstTrackletId));
+    }
+
+    linkTrackletsConfig svdConfig;
+    std::vector<MopsDetection> svdDets(allDets);
+    std::vector<Tracklet> svdTracklets(allTracklets);
+    TrackSet * svdTracks = linkTracklets(svdDets, svdTracklets, svdConfig);
+
+    linkTrackletsConfig fastConfig;
+    fastConfig.useFastTrackFit = true;
+    std::vector<MopsDetection> fastDets(allDets);
+    std::vector<Tracklet> fastTracklets(allTracklets);
+    TrackSet * fastTracks = linkTracklets(fastDets, fastTracklets, fastConfig);
+
+    BOOST_CHECK(expectedTracks.isSubsetOf(*svdTracks));
+    BOOST_CHECK(*svdTracks == *fastTracks);
+    delete svdTracks;
+    delete fastTracks;
+}
+
+
+
+BOOST_AUTO_TEST_CASE( endpointPrecheck_matchesTrackFit )
+{
+    // the pre-check's accelerations must be those of the full fit, and
+    // it must never reject a pair which the full check would keep.
+    srand(21);
+    unsigned int nRejected = 0;
+    for (unsigned int i = 0; i < 2000; i++) {
+        std::vector<MopsDetection> dets;
+        std::vector<Tracklet> tracklets(2);
+        double ra0 = 360. * rand() / RAND_MAX;
+        double dec0 = -60. + 120. * rand() / RAND_MAX;
+        double raV = (rand() / (double) RAND_MAX - .5) * .5;
+        double decV = (rand() / (double) RAND_MAX - .5) * .5;
+        double raAcc = (rand() / (double) RAND_MAX - .5) * .1;
+        double decAcc = (rand() / (double) RAND_MAX - .5) * .1;
+        double t0 = 53000. + 10. * rand() / RAND_MAX;
+        double dt = .2 + 15. * rand() / RAND_MAX;
+        for (unsigned int k = 0; k < 2; k++) {
+            // 2 to 4 detections per tracklet, with differing errors.
+            unsigned int nDets = 2 + rand() % 3;
+            for (unsigned int d = 0; d < nDets; d++) {
+                double t = k * dt + d * .015;
+                double err = 1e-5 * (1. + 3. * rand() / RAND_MAX);
+                double noise = (rand() / (double) RAND_MAX - .5) * 2. * err;
+                tracklets[k].indices.insert(dets.size());
+                dets.push_back(MopsDetection(dets.size(), t0 + t,
+                                             ra0 + raV * t + .5 * raAcc * t * t + noise,
+                                             dec0 + decV * t + .5 * decAcc * t * t - noise,
+                                             err, 2. * err));
+            }
+        }
+
+        Track track;
+        track.addTracklet(0, tracklets[0], dets);
+        track.addTracklet(1, tracklets[1], dets);
+        track.calculateBestFitQuadratic(dets, 3);
+        double epoch, fitRa0, fitRaV, fitRaAcc, fitDec0, fitDecV, fitDecAcc;
+        track.getBestFitQuadratic(epoch, fitRa0, fitRaV, fitRaAcc, 
+                                  fitDec0, fitDecV, fitDecAcc);
+
+        std::vector<TrackletMoments> moments;
+        calculateTrackletMoments(dets, tracklets, moments);
+        double preRaAcc, preDecAcc;
+        BOOST_REQUIRE(pairAccelerations(moments[0], moments[1], 
+                                        preRaAcc, preDecAcc));
+        BOOST_CHECK(fabs(preRaAcc - fitRaAcc) < 1e-9 + 1e-9 * fabs(fitRaAcc));
+        BOOST_CHECK(fabs(preDecAcc - fitDecAcc) < 1e-9 + 1e-9 * fabs(fitDecAcc));
+
+        double maxAcc = .02;
+        double minSeparation = 1.;
+        double span = dets.back().getEpochMJD() - dets.front().getEpochMJD();
+        bool fullCheckRejects = (fitRaAcc > maxAcc) || (fitDecAcc > maxAcc) ||
+            (span < minSeparation);
+        if (endpointPairCertainlyIncompatible(moments[0], moments[1], 
+                                              maxAcc, maxAcc, minSeparation)) {
+            BOOST_CHECK(fullCheckRejects);
+            nRejected++;
+        }
+    }
+    // and it should catch a good share of them.
+    BOOST_CHECK(nRejected > 500);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_endpointPrecheck )
+{
+    // the same tracks must be found with and without the pre-check,
+    // including when many objects are accelerating too fast.
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(5);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5303);
+    imgTimes.at(1).push_back(5303.03);
+    imgTimes.at(2).push_back(5306);
+    imgTimes.at(2).push_back(5306.03);
+    imgTimes.at(3).push_back(5308);
+    imgTimes.at(3).push_back(5308.03);
+    imgTimes.at(4).push_back(5310);
+    imgTimes.at(4).push_back(5310.03);
+
+    srand(15);
+
+    for (unsigned int i = 0; i < 200; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 6; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        generateTrack(20. + someRands[0] * 2., 
+                      20. + someRands[1] * 2., 
+                      (someRands[2] - .5) * .2, 
+                      (someRands[3] - .5) * .2, 
+                      (someRands[4] - .5) * .06, 
+                      (someRands[5] - .5) * .06, 
+                      imgTimes, 
+                      allDets, allTracklets, 
+                      firstDetId, firstTrackletId);
+    }
+
+    linkTrackletsConfig plainConfig;
+    plainConfig.useEndpointPrecheck = false;
+    std::vector<MopsDetection> plainDets(allDets);
+    std::vector<Tracklet> plainTracklets(allTracklets);
+    TrackSet * plainTracks = linkTracklets(plainDets, plainTracklets, plainConfig);
+
+    linkTrackletsConfig precheckConfig;
+    precheckConfig.useEndpointPrecheck = true;
+    std::vector<MopsDetection> precheckDets(allDets);
+    std::vector<Tracklet> precheckTracklets(allTracklets);
+    TrackSet * precheckTracks = linkTracklets(precheckDets, precheckTracklets, 
+                                              precheckConfig);
+
+    BOOST_CHECK(plainTracks->size() > 0);
+    BOOST_CHECK(*plainTracks == *precheckTracks);
+    delete plainTracks;
+    delete precheckTracks;
+}
+
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_asyncOutput )
+{
+    // IDS_FILE_ASYNC writes (in some order) just the tracks
+    // RETURN_TRACKS returns.
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(4);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5303);
+    imgTimes.at(1).push_back(5303.03);
+    imgTimes.at(2).push_back(5306);
+    imgTimes.at(2).push_back(5306.03);
+    imgTimes.at(3).push_back(5308);
+    imgTimes.at(3).push_back(5308.03);
+
+    srand(16);
+
+    for (unsigned int i = 0; i < 100; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 4; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        generateTrack(20. + someRands[0] * 2., 
+                      20. + someRands[1] * 2., 
+                      (someRands[2] - .5) * .2, 
+                      (someRands[3] - .5) * .2, 
+                      0., 0., 
+                      imgTimes, 
+                      allDets, allTracklets, 
+                      firstDetId, firstTrackletId);
+    }
+
+    linkTrackletsConfig plainConfig;
+    std::vector<MopsDetection> plainDets(allDets);
+    std::vector<Tracklet> plainTracklets(allTracklets);
+    TrackSet * plainTracks = linkTracklets(plainDets, plainTracklets, plainConfig);
+
+    std::string outFileName = "linkTracklets_asyncOutput.tmp";
+    std::remove(outFileName.c_str());
+    linkTrackletsConfig asyncConfig;
+    asyncConfig.outputMethod = trackOutputMethod::IDS_FILE_ASYNC;
+    asyncConfig.outputFile = outFileName;
+    asyncConfig.outputBufferSize = 10;
+    std::vector<MopsDetection> asyncDets(allDets);
+    std::vector<Tracklet> asyncTracklets(allTracklets);
+    TrackSet * asyncTracks = linkTracklets(asyncDets, asyncTracklets, asyncConfig);
+    BOOST_CHECK(asyncTracks->size() == plainTracks->size());
+    delete asyncTracks;
+
+    std::set<std::string> expectedLines;
+    std::set<Track>::const_iterator tIter;
+    for (tIter = plainTracks->componentTracks.begin(); 
+         tIter != plainTracks->componentTracks.end();
+         tIter++) {
+        std::ostringstream line;
+        const Track::IndexSet &diaIds = tIter->getComponentDetectionDiaIds();
+        Track::IndexSet::const_iterator idIter;
+        for (idIter = diaIds.begin(); idIter != diaIds.end(); idIter++) {
+            line << *idIter << " ";
+        }
+        expectedLines.insert(line.str());
+    }
+
+    std::ifstream inFile(outFileName.c_str());
+    std::set<std::string> foundLines;
+    unsigned int nLines = 0;
+    std::string line;
+    while (std::getline(inFile, line)) {
+        foundLines.insert(line);
+        nLines++;
+    }
+    inFile.close();
+    std::remove(outFileName.c_str());
+
+    BOOST_CHECK(plainTracks->size() > 0);
+    BOOST_CHECK(nLines == plainTracks->size());
+    BOOST_CHECK(foundLines == expectedLines);
+    delete plainTracks;
+}
+
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_trackletStore )
+{
+    // linking tracklets in a TrackletStore finds just the tracks
+    // linking the same tracklets in a vector does.
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(3);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5303);
+    imgTimes.at(1).push_back(5303.03);
+    imgTimes.at(2).push_back(5306);
+    imgTimes.at(2).push_back(5306.03);
+
+    srand(23);
+
+    for (unsigned int i = 0; i < 100; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 4; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        generateTrack(20. + someRands[0] * 2., 
+                      20. + someRands[1] * 2., 
+                      (someRands[2] - .5) * .2, 
+                      (someRands[3] - .5) * .2, 
+                      0., 0., 
+                      imgTimes, 
+                      allDets, allTracklets, 
+                      firstDetId, firstTrackletId);
+    }
+
+    linkTrackletsConfig myConfig;
+    std::vector<MopsDetection> vecDets(allDets);
+    std::vector<Tracklet> vecTracklets(allTracklets);
+    TrackSet * vecTracks = linkTracklets(vecDets, vecTracklets, myConfig);
+
+    std::vector<MopsDetection> storeDets(allDets);
+    TrackletStore storeTracklets(allTracklets);
+    TrackSet * storeTracks = linkTracklets(storeDets, storeTracklets, myConfig);
+
+    BOOST_CHECK(vecTracks->size() > 0);
+    BOOST_CHECK(*vecTracks == *storeTracks);
+
+    // the vector's tracklets get the parameters the store's do.
+    BOOST_REQUIRE(storeTracklets.hasParameters());
+    bool allSame = true;
+    for (unsigned int i = 0; i < vecTracklets.size(); i++) {
+        allSame = allSame && 
+            (vecTracklets[i].getId() == i) &&
+            (storeTracklets.getId(i) == i) &&
+            (vecTracklets[i].getBestFitFunctionRa()->at(0) == storeTracklets.getRa0(i)) &&
+            (vecTracklets[i].getBestFitFunctionDec()->at(1) == storeTracklets.getDecVelocity(i));
+    }
+    BOOST_CHECK(allSame);
+    delete vecTracks;
+    delete storeTracks;
+}
+
+
+
+BOOST_AUTO_TEST_CASE( skyTiling_1 )
+{
+    SkyTiling tiling(4, 2, 1., 2.);
+    BOOST_CHECK(tiling.getNumTiles() == 8);
+    BOOST_CHECK(tiling.getTileOfPoint(10., -10.) == 0);
+    BOOST_CHECK(tiling.getTileOfPoint(100., -10.) == 1);
+    BOOST_CHECK(tiling.getTileOfPoint(350., 10.) == 7);
+    BOOST_CHECK(tiling.getTileOfPoint(-10., 10.) == 7);
+    BOOST_CHECK(tiling.getTileOfPoint(370., 90.) == 4);
+    BOOST_CHECK(tiling.getTileOfPoint(0., -90.) == 0);
+    BOOST_CHECK(Eq(tiling.getCenterRa(5), 135.));
+    BOOST_CHECK(Eq(tiling.getCenterDec(5), 45.));
+
+    BOOST_CHECK(tiling.isInTileOrHalo(0, 45., -45.));
+    BOOST_CHECK(tiling.isInTileOrHalo(0, 90.5, -45.));
+    BOOST_CHECK(!tiling.isInTileOrHalo(0, 91.5, -45.));
+    // the halo wraps around RA 0.
+    BOOST_CHECK(tiling.isInTileOrHalo(0, 359.5, -45.));
+    BOOST_CHECK(!tiling.isInTileOrHalo(0, 358.5, -45.));
+    BOOST_CHECK(tiling.isInTileOrHalo(0, 45., 1.5));
+    BOOST_CHECK(!tiling.isInTileOrHalo(0, 45., 2.5));
+
+    // a halo this wide takes in all RAs.
+    SkyTiling wideTiling(4, 2, 140., 2.);
+    BOOST_CHECK(wideTiling.isInTileOrHalo(0, 225., -45.));
+
+    BOOST_CHECK_THROW(SkyTiling(0, 2, 1., 1.), BadParameterException);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( mergeTrackFiles_1 )
+{
+    // tracks with the same detection IDs are written once, however
+    // they're ordered.
+    std::string inFileName0 = "mergeTrackFiles_1.0.tmp";
+    std::string inFileName1 = "mergeTrackFiles_1.1.tmp";
+    std::string outFileName = "mergeTrackFiles_1.tmp";
+    std::ofstream inFile0(inFileName0.c_str());
+    inFile0 << "1 2 3 4 \n5 6 7 8 \n";
+    inFile0.close();
+    std::ofstream inFile1(inFileName1.c_str());
+    inFile1 << "8 7 6 5\n\n9 10 11 12 \n1 2 3 \n";
+    inFile1.close();
+
+    std::vector<std::string> inFileNames;
+    inFileNames.push_back(inFileName0);
+    inFileNames.push_back(inFileName1);
+    BOOST_CHECK(mergeTrackFiles(inFileNames, outFileName) == 4);
+
+    std::ifstream outFile(outFileName.c_str());
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(outFile, line)) {
+        lines.push_back(line);
+    }
+    outFile.close();
+    BOOST_REQUIRE(lines.size() == 4);
+    BOOST_CHECK(lines[0] == "1 2 3 4 ");
+    BOOST_CHECK(lines[1] == "5 6 7 8 ");
+    BOOST_CHECK(lines[2] == "9 10 11 12 ");
+    BOOST_CHECK(lines[3] == "1 2 3 ");
+
+    inFileNames.push_back("mergeTrackFiles_1.missing.tmp");
+    BOOST_CHECK_THROW(mergeTrackFiles(inFileNames, outFileName), FileException);
+    std::remove(inFileName0.c_str());
+    std::remove(inFileName1.c_str());
+    std::remove(outFileName.c_str());
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_skyTiles )
+{
+    // linking in sky tiles, in several processes, finds just the
+    // tracks linking the whole sky at once does.
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+
+    std::vector<std::vector<double> > imgTimes(4);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5302);
+    imgTimes.at(1).push_back(5302.03);
+    imgTimes.at(2).push_back(5305);
+    imgTimes.at(2).push_back(5305.03);
+    imgTimes.at(3).push_back(5308);
+    imgTimes.at(3).push_back(5308.03);
+
+    srand(31);
+
+    unsigned int nObjects = 0;
+    while (nObjects < 200) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 6; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        double ra0 = someRands[0] * 360.;
+        // linking the whole sky at once splits it opposite
+        // skyCenterRa, and misses tracks there.
+        if (fabs(ra0 - 160.) < 10.) {
+            continue;
+        }
+        generateTrack(ra0, 
+                      (someRands[1] - .5) * 120., 
+                      (someRands[2] - .5) * .2, 
+                      (someRands[3] - .5) * .2, 
+                      (someRands[4] - .5) * .0019, 
+                      (someRands[5] - .5) * .0019, 
+                      imgTimes, 
+                      allDets, allTracklets, 
+                      firstDetId, firstTrackletId);
+        nObjects++;
+    }
+    // and some which cross the edges of tiles.
+    generateTrack(89.9, 10., .1, 0., 0., 0., imgTimes, 
+                  allDets, allTracklets, firstDetId, firstTrackletId);
+    generateTrack(359.9, -20., .1, .01, 0., 0., imgTimes, 
+                  allDets, allTracklets, firstDetId, firstTrackletId);
+    generateTrack(200., -.1, 0., .08, 0., 0., imgTimes, 
+                  allDets, allTracklets, firstDetId, firstTrackletId);
+    generateTrack(270.05, .05, -.05, -.05, 0., 0., imgTimes, 
+                  allDets, allTracklets, firstDetId, firstTrackletId);
+
+    linkTrackletsConfig myConfig;
+    std::vector<MopsDetection> plainDets(allDets);
+    TrackletStore plainTracklets(allTracklets);
+    TrackSet * plainTracks = linkTracklets(plainDets, plainTracklets, myConfig);
+    std::set<std::string> expectedLines;
+    std::set<Track>::const_iterator tIter;
+    for (tIter = plainTracks->componentTracks.begin(); 
+         tIter != plainTracks->componentTracks.end();
+         tIter++) {
+        std::ostringstream line;
+        const Track::IndexSet &diaIds = tIter->getComponentDetectionDiaIds();
+        Track::IndexSet::const_iterator idIter;
+        for (idIter = diaIds.begin(); idIter != diaIds.end(); idIter++) {
+            line << *idIter << " ";
+        }
+        expectedLines.insert(line.str());
+    }
+    BOOST_CHECK(plainTracks->size() >= 204);
+    delete plainTracks;
+
+    std::string outFileName = "linkTracklets_skyTiles.tmp";
+    linkTrackletsConfig tiledConfig;
+    tiledConfig.outputFile = outFileName;
+    skyTilesConfig tilesConfig;
+    tilesConfig.nRaTiles = 4;
+    tilesConfig.nDecTiles = 2;
+    tilesConfig.nProcesses = 3;
+    TrackletStore tiledTracklets(allTracklets);
+    unsigned int nTiledTracks = linkTrackletsInSkyTiles(allDets, tiledTracklets, 
+                                                        tiledConfig, tilesConfig);
+
+    std::ifstream inFile(outFileName.c_str());
+    std::set<std::string> foundLines;
+    unsigned int nLines = 0;
+    std::string line;
+    while (std::getline(inFile, line)) {
+        foundLines.insert(line);
+        nLines++;
+    }
+    inFile.close();
+    std::remove(outFileName.c_str());
+
+    BOOST_CHECK(nTiledTracks == nLines);
+    BOOST_CHECK(nLines == expectedLines.size());
+    BOOST_CHECK(foundLines == expectedLines);
+    // the tile files are gone.
+    std::ifstream tileFile((outFileName + ".tile0").c_str());
+    BOOST_CHECK(!tileFile.good());
+}
+
+
+
+/* the detection IDs of each track, one line per track, as IDS_FILE
+ * output writes them. */
+std::set<std::string> getTrackIdLines(const TrackSet &tracks)
+{
+    std::set<std::string> lines;
+    std::set<Track>::const_iterator tIter;
+    for (tIter = tracks.componentTracks.begin(); 
+         tIter != tracks.componentTracks.end();
+         tIter++) {
+        std::ostringstream line;
+        const Track::IndexSet &diaIds = tIter->getComponentDetectionDiaIds();
+        Track::IndexSet::const_iterator idIter;
+        for (idIter = diaIds.begin(); idIter != diaIds.end(); idIter++) {
+            line << *idIter << " ";
+        }
+        lines.insert(line.str());
+    }
+    return lines;
+}
+
+
+
+/* the detections from startMjd up to endMjd, and the tracklets all
+ * of whose detections they are, with indices into nightDets. */
+void getDetectionsBetween(const std::vector<MopsDetection> &allDets,
+                          const std::vector<Tracklet> &allTracklets,
+                          double startMjd, double endMjd,
+                          std::vector<MopsDetection> &nightDets,
+                          TrackletStore &nightTracklets)
+{
+    std::vector<int> newIndices(allDets.size(), -1);
+    for (unsigned int i = 0; i < allDets.size(); i++) {
+        if ((allDets[i].getEpochMJD() >= startMjd) && 
+            (allDets[i].getEpochMJD() < endMjd)) {
+            newIndices[i] = nightDets.size();
+            nightDets.push_back(allDets[i]);
+        }
+    }
+    for (unsigned int i = 0; i < allTracklets.size(); i++) {
+        std::vector<unsigned int> indices;
+        std::set<unsigned int>::const_iterator det;
+        for (det = allTracklets[i].indices.begin(); 
+             det != allTracklets[i].indices.end(); det++) {
+            if (newIndices[*det] >= 0) {
+                indices.push_back(newIndices[*det]);
+            }
+        }
+        if (indices.size() == allTracklets[i].indices.size()) {
+            nightTracklets.addTracklet(indices.data(), 
+                                       indices.data() + indices.size());
+        }
+    }
+}
+
+
+
+/* the names of the files in dirName. */
+std::set<std::string> getFileNames(const std::string &dirName)
+{
+    std::set<std::string> names;
+    DIR *dir = opendir(dirName.c_str());
+    if (dir == NULL) {
+        return names;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name(entry->d_name);
+        if ((name != ".") && (name != "..")) {
+            names.insert(name);
+        }
+    }
+    closedir(dir);
+    return names;
+}
+
+
+
+void removeStateDir(const std::string &dirName)
+{
+    std::set<std::string> names = getFileNames(dirName);
+    std::set<std::string>::const_iterator name;
+    for (name = names.begin(); name != names.end(); name++) {
+        std::remove((dirName + "/" + *name).c_str());
+    }
+    std::remove(dirName.c_str());
+}
+
+
+
+void generateIncrementalTracks(std::vector<std::vector<double> > &imgTimes,
+                               std::vector<MopsDetection> &allDets,
+                               std::vector<Tracklet> &allTracklets)
+{
+    unsigned int firstDetId = -1;
+    unsigned int firstTrackletId = -1;
+    imgTimes.resize(5);
+    imgTimes.at(0).push_back(5300);
+    imgTimes.at(0).push_back(5300.03);
+    imgTimes.at(1).push_back(5302);
+    imgTimes.at(1).push_back(5302.03);
+    imgTimes.at(2).push_back(5305);
+    imgTimes.at(2).push_back(5305.03);
+    imgTimes.at(3).push_back(5308);
+    imgTimes.at(3).push_back(5308.03);
+    imgTimes.at(4).push_back(5311);
+    imgTimes.at(4).push_back(5311.03);
+
+    srand(47);
+
+    for (unsigned int i = 0; i < 60; i++) {
+        std::vector<double> someRands;         
+        for (unsigned int j = 0; j < 6; j++) {
+            someRands.push_back( (double) rand() / RAND_MAX );
+        }
+        generateTrack(330. + someRands[0] * 2., 
+                      -15. + someRands[1] * 2., 
+                      (someRands[2] - .5) * .1, 
+                      (someRands[3] - .5) * .1, 
+                      (someRands[4] - .5) * .0019, 
+                      (someRands[5] - .5) * .0019, 
+                      imgTimes, 
+                      allDets, allTracklets, 
+                      firstDetId, firstTrackletId);
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_incremental )
+{
+    // linking a night at a time finds, over all the nights, just the
+    // tracks linking all the nights at once does, each once.
+    std::vector<std::vector<double> > imgTimes;
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    generateIncrementalTracks(imgTimes, allDets, allTracklets);
+
+    linkTrackletsConfig myConfig;
+    myConfig.useFlatTrackletTrees = true;
+    std::vector<MopsDetection> plainDets(allDets);
+    TrackletStore plainTracklets(allTracklets);
+    TrackSet * plainTracks = linkTracklets(plainDets, plainTracklets, myConfig);
+    std::set<std::string> expectedLines = getTrackIdLines(*plainTracks);
+    BOOST_CHECK(plainTracks->size() >= 60);
+    delete plainTracks;
+
+    std::string stateDir = "linkTracklets_incremental.state";
+    removeStateDir(stateDir);
+    linkTrackletsConfig incrementalConfig;
+    incrementalConfig.incrementalStateDir = stateDir;
+    incrementalConfig.incrementalWindowDays = 100.;
+    std::set<std::string> foundLines;
+    unsigned int nFound = 0;
+    for (unsigned int night = 0; night < imgTimes.size(); night++) {
+        std::vector<MopsDetection> nightDets;
+        TrackletStore nightTracklets;
+        getDetectionsBetween(allDets, allTracklets, 
+                             imgTimes[night][0], imgTimes[night][0] + .5,
+                             nightDets, nightTracklets);
+        TrackSet * nightTracks = linkTrackletsIncremental(nightDets, nightTracklets,
+                                                          incrementalConfig);
+        std::set<std::string> nightLines = getTrackIdLines(*nightTracks);
+        foundLines.insert(nightLines.begin(), nightLines.end());
+        nFound += nightTracks->size();
+        delete nightTracks;
+    }
+    BOOST_CHECK(nFound == expectedLines.size());
+    BOOST_CHECK(foundLines == expectedLines);
+    // the images file and one for each image.
+    BOOST_CHECK(getFileNames(stateDir).size() == 11);
+
+    // a night we've already had can't be added again.
+    std::vector<MopsDetection> oldDets;
+    TrackletStore oldTracklets;
+    getDetectionsBetween(allDets, allTracklets, 5305., 5305.5, 
+                         oldDets, oldTracklets);
+    BOOST_CHECK_THROW(linkTrackletsIncremental(oldDets, oldTracklets, 
+                                               incrementalConfig),
+                      BadParameterException);
+    // nor can the state be used with other settings.
+    std::vector<MopsDetection> newDets;
+    TrackletStore newTracklets;
+    getDetectionsBetween(allDets, allTracklets, 5311., 5311.5, 
+                         newDets, newTracklets);
+    for (unsigned int i = 0; i < newDets.size(); i++) {
+        newDets[i].setEpochMJD(newDets[i].getEpochMJD() + 3.);
+    }
+    incrementalConfig.leafSize++;
+    BOOST_CHECK_THROW(linkTrackletsIncremental(newDets, newTracklets, 
+                                               incrementalConfig),
+                      BadParameterException);
+    removeStateDir(stateDir);
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_incrementalWindow )
+{
+    // images which leave the window are dropped, and tracks starting
+    // in them aren't found.
+    std::vector<std::vector<double> > imgTimes;
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    generateIncrementalTracks(imgTimes, allDets, allTracklets);
+
+    // the window of the last night holds the last three nights.
+    linkTrackletsConfig myConfig;
+    myConfig.restrictTrackEndTimes = true;
+    myConfig.earliestLastEndpointTime = 5311.;
+    std::vector<MopsDetection> windowDets;
+    TrackletStore windowTracklets;
+    getDetectionsBetween(allDets, allTracklets, 5305., 5312., 
+                         windowDets, windowTracklets);
+    TrackSet * windowTracks = linkTracklets(windowDets, windowTracklets, myConfig);
+    std::set<std::string> expectedLines = getTrackIdLines(*windowTracks);
+    BOOST_CHECK(windowTracks->size() >= 60);
+    delete windowTracks;
+
+    std::string stateDir = "linkTracklets_incrementalWindow.state";
+    removeStateDir(stateDir);
+    linkTrackletsConfig incrementalConfig;
+    incrementalConfig.incrementalStateDir = stateDir;
+    incrementalConfig.incrementalWindowDays = 7.;
+    std::set<std::string> foundLines;
+    for (unsigned int night = 0; night < imgTimes.size(); night++) {
+        std::vector<MopsDetection> nightDets;
+        TrackletStore nightTracklets;
+        getDetectionsBetween(allDets, allTracklets, 
+                             imgTimes[night][0], imgTimes[night][0] + .5,
+                             nightDets, nightTracklets);
+        TrackSet * nightTracks = linkTrackletsIncremental(nightDets, nightTracklets,
+                                                          incrementalConfig);
+        foundLines = getTrackIdLines(*nightTracks);
+        delete nightTracks;
+    }
+    BOOST_CHECK(foundLines == expectedLines);
+    // only the last three nights' images are left.
+    BOOST_CHECK(getFileNames(stateDir).size() == 7);
+    removeStateDir(stateDir);
+}
+
+
+
+/* a FlatTrackletTree file (see FlatTrackletTree::write) of a root and
+ * two leaves holding one tracklet each, with the given changes. */
+std::string makeFlatTreeFile(unsigned int rootRightChild,
+                             unsigned int rootCount,
+                             unsigned int nTrackletIds)
+{
+    unsigned int sizes[2] = { 3, nTrackletIds };
+    unsigned int rightChild[3] = { rootRightChild, 0, 0 };
+    unsigned int firstTracklet[3] = { 0, 0, 1 };
+    unsigned int trackletCount[3] = { rootCount, 1, 1 };
+    unsigned int nodeIds[3] = { 0, 1, 2 };
+    double bounds[3] = { 0., 0., 0. };
+    unsigned int trackletIds[2] = { 0, 1 };
+    std::string file;
+    file.append((const char *) sizes, sizeof(sizes));
+    file.append((const char *) rightChild, sizeof(rightChild));
+    file.append((const char *) firstTracklet, sizeof(firstTracklet));
+    file.append((const char *) trackletCount, sizeof(trackletCount));
+    file.append((const char *) nodeIds, sizeof(nodeIds));
+    for (unsigned int i = 0; i < 8; i++) {
+        file.append((const char *) bounds, sizeof(bounds));
+    }
+    file.append((const char *) trackletIds, sizeof(trackletIds));
+    return file;
+}
+
+
+
+BOOST_AUTO_TEST_CASE( flatTrackletTree_read )
+{
+    // a good tree reads back; a bad one throws rather than handing
+    // out-of-range indices to the walks.
+    FlatTrackletTree good;
+    std::istringstream goodFile(makeFlatTreeFile(2, 2, 2));
+    good.read(goodFile, 10);
+    BOOST_CHECK(good.size() == 3);
+    BOOST_CHECK(good.getRootNode().getRightChild().getTrackletId(0) == 11);
+
+    std::vector<std::string> badFiles;
+    badFiles.push_back(makeFlatTreeFile(3, 2, 2));
+    badFiles.push_back(makeFlatTreeFile(2, 3, 2));
+    badFiles.push_back(makeFlatTreeFile(2, 2, 1000000));
+    badFiles.push_back(makeFlatTreeFile(2, 2, 2).substr(0, 100));
+    for (unsigned int i = 0; i < badFiles.size(); i++) {
+        FlatTrackletTree bad;
+        std::istringstream badFile(badFiles[i]);
+        BOOST_CHECK_THROW(bad.read(badFile, 10), 
+                          InputFileFormatErrorException);
+    }
+}
+
+
+
+BOOST_AUTO_TEST_CASE( linkTracklets_incrementalBadTree )
+{
+    // a state image whose tree holds tracklets of no image isn't used.
+    std::vector<std::vector<double> > imgTimes;
+    std::vector<MopsDetection> allDets;
+    std::vector<Tracklet> allTracklets;
+    generateIncrementalTracks(imgTimes, allDets, allTracklets);
+
+    std::string stateDir = "linkTracklets_incrementalBadTree.state";
+    removeStateDir(stateDir);
+    linkTrackletsConfig incrementalConfig;
+    incrementalConfig.incrementalStateDir = stateDir;
+    incrementalConfig.incrementalWindowDays = 100.;
+    std::vector<MopsDetection> nightDets;
+    TrackletStore nightTracklets;
+    getDetectionsBetween(allDets, allTracklets, 
+                         imgTimes[0][0], imgTimes[0][0] + .5,
+                         nightDets, nightTracklets);
+    delete linkTrackletsIncremental(nightDets, nightTracklets, 
+                                    incrementalConfig);
+
+    // the night's tracklets start in its first image, and the last
+    // thing in that image's file is its last tree tracklet ID.
+    std::string imageName = stateDir + "/image-5300.00000000";
+    BOOST_REQUIRE(getFileNames(stateDir).count("image-5300.00000000") == 1);
+    std::fstream imageFile(imageName.c_str(), 
+                           std::ios_base::in | std::ios_base::out | 
+                           std::ios_base::binary);
+    unsigned int badId = 1000000;
+    imageFile.seekp(-(int) sizeof(badId), std::ios_base::end);
+    imageFile.write((const char *) &badId, sizeof(badId));
+    imageFile.close();
+
+    std::vector<MopsDetection> newDets;
+    TrackletStore newTracklets;
+    getDetectionsBetween(allDets, allTracklets, 
+                         imgTimes[1][0], imgTimes[1][0] + .5,
+                         newDets, newTracklets);
+    BOOST_CHECK_THROW(linkTrackletsIncremental(newDets, newTracklets, 
+                                               incrementalConfig),
+                      InputFileFormatErrorException);
+    removeStateDir(stateDir);
+}
+
+
+
 // TBD: check that tracks with too-high acceleration are correctly rejected, etc.
 
 